@@ -0,0 +1,598 @@
+#include "medley_capi.h"
+
+#include <JuceHeader.h>
+#include "Medley.h"
+#include "StationHost.h"
+#include "MpscQueue.h"
+
+using namespace juce;
+
+namespace {
+
+thread_local std::string lastError;
+
+// Events waiting for the host callback, and how often the dispatcher delivers them
+constexpr int kEventQueueSize = 1024;
+constexpr int kDispatchInterval = 10;
+
+medley_result_t fail(medley_result_t code, const std::string& message) {
+    lastError = message;
+    return code;
+}
+
+// Runs an engine call, turning whatever it throws into an error code
+template <typename Function>
+medley_result_t guard(Function&& function, medley_result_t code = MEDLEY_ERROR_ENGINE) {
+    try {
+        function();
+        return MEDLEY_OK;
+    }
+    catch (std::exception& e) {
+        return fail(code, e.what());
+    }
+    catch (...) {
+        return fail(code, "Unknown engine error");
+    }
+}
+
+struct PendingEvent {
+    medley_event_t event = MEDLEY_EVENT_DECK_LOADED;
+    int deck = -1;
+    double position = 0.0;
+};
+
+class MessageThread : public Thread {
+public:
+    MessageThread() : Thread("Medley Message Thread") {}
+
+    void run() override {
+        MessageManager::getInstance();
+        started.signal();
+
+        JUCE_TRY
+        {
+            MessageManager::getInstance()->runDispatchLoop();
+        }
+        JUCE_CATCH_EXCEPTION
+    }
+
+    void shutdown() {
+        if (auto mm = MessageManager::getInstanceWithoutCreating()) {
+            mm->stopDispatchLoop();
+        }
+
+        stopThread(1000);
+    }
+
+    WaitableEvent started;
+};
+
+CriticalSection messageThreadLock;
+MessageThread* messageThread = nullptr;
+int engineCount = 0;
+
+}
+
+struct medley_track : public medley::ITrack {
+    medley_track(const String& path, float pregain)
+        : file(path), pregain(pregain), path(path.toStdString())
+    {
+
+    }
+
+    File getFile() override { return file; }
+
+    float getPreGain() const override { return pregain; }
+
+    File file;
+    float pregain;
+    std::string path;
+};
+
+struct medley_queue : public medley::IQueue {
+    medley_queue(const medley_queue_interface_t& iface, void* userData)
+        : iface(iface), userData(userData)
+    {
+
+    }
+
+    size_t count() const override {
+        return iface.count(userData);
+    }
+
+    medley::ITrack::Ptr fetchNextTrack() override {
+        auto track = iface.fetch_next_track(userData);
+        if (track == nullptr) {
+            return nullptr;
+        }
+
+        // Adopt the reference handed over by the host
+        medley::ITrack::Ptr ptr(track);
+        track->decReferenceCount();
+        return ptr;
+    }
+
+    medley_queue_interface_t iface;
+    void* userData;
+};
+
+struct medley_engine : public medley::Medley::Callback, private Thread {
+    medley_engine(medley_queue& queue, bool useAudioDevice)
+        : Thread("Medley Event Dispatcher"), events(kEventQueueSize), engine(new medley::Medley(queue, useAudioDevice))
+    {
+        engine->addListener(this);
+        startThread();
+    }
+
+    ~medley_engine() {
+        engine->removeListener(this);
+        stopThread(2000);
+        engine = nullptr;
+    }
+
+    // Any engine thread, the audio thread included: only queued, the host callback runs on the dispatcher
+    void emit(medley_event_t event, medley::Deck* deck, double position = 0.0) {
+        PendingEvent pending;
+        pending.event = event;
+        pending.position = position;
+
+        if (deck != nullptr) {
+            pending.deck = (deck == &engine->getDeck1()) ? 0 : 1;
+        }
+
+        events.push(pending);
+    }
+
+    void run() override {
+        while (!threadShouldExit()) {
+            dispatch();
+            wait(kDispatchInterval);
+        }
+    }
+
+    void dispatch() {
+        const ScopedLock sl(callbackLock);
+
+        PendingEvent pending;
+
+        while (events.pop(pending)) {
+            if (callback != nullptr) {
+                callback(pending.event, pending.deck, pending.position, callbackUserData);
+            }
+        }
+    }
+
+    void deckTrackScanning(medley::Deck& sender) override { emit(MEDLEY_EVENT_DECK_SCANNING, &sender); }
+
+    void deckTrackScanned(medley::Deck& sender) override { emit(MEDLEY_EVENT_DECK_SCANNED, &sender); }
+
+    void deckPosition(medley::Deck& sender, double position) override { emit(MEDLEY_EVENT_DECK_POSITION, &sender, position); }
+
+    void deckStarted(medley::Deck& sender) override { emit(MEDLEY_EVENT_DECK_STARTED, &sender); }
+
+    void deckFinished(medley::Deck& sender) override { emit(MEDLEY_EVENT_DECK_FINISHED, &sender); }
+
+    void deckLoaded(medley::Deck& sender) override { emit(MEDLEY_EVENT_DECK_LOADED, &sender); }
+
+    void deckUnloaded(medley::Deck& sender) override { emit(MEDLEY_EVENT_DECK_UNLOADED, &sender); }
+
+    void audioDeviceChanged() override { emit(MEDLEY_EVENT_AUDIO_DEVICE_CHANGED, nullptr); }
+
+    void preCueNext() override { emit(MEDLEY_EVENT_PRE_CUE_NEXT, nullptr); }
+
+    medley::MpscQueue<PendingEvent> events;
+    std::unique_ptr<medley::Medley> engine;
+
+    // Held by the dispatcher while calling back
+    CriticalSection callbackLock;
+    medley_event_callback callback = nullptr;
+    void* callbackUserData = nullptr;
+
+    int maxBlockSize = 0;
+    int numChannels = 0;
+};
+
+struct medley_host {
+    medley_host(int numWorkers)
+        : host(numWorkers)
+    {
+
+    }
+
+    ~medley_host() {
+        host.closeDevice();
+
+        for (auto engine : engines) {
+            host.removeStation(*engine->engine);
+        }
+    }
+
+    medley::StationHost host;
+    Array<medley_engine*> engines;
+};
+
+#define MEDLEY_CHECK_ENGINE(e) \
+    if ((e) == nullptr) return fail(MEDLEY_ERROR_INVALID_ARGUMENT, "engine is null")
+
+#define MEDLEY_CHECK_OUTPUT(p) \
+    if ((p) == nullptr) return fail(MEDLEY_ERROR_INVALID_ARGUMENT, #p " is null")
+
+int medley_api_version(void) {
+    return MEDLEY_API_VERSION;
+}
+
+const char* medley_last_error(void) {
+    return lastError.c_str();
+}
+
+medley_result_t medley_initialize(void) {
+    const ScopedLock sl(messageThreadLock);
+
+    if (messageThread == nullptr) {
+        messageThread = new MessageThread();
+        messageThread->startThread();
+
+        if (!messageThread->started.wait(5000)) {
+            return fail(MEDLEY_ERROR_ENGINE, "Timed out starting message thread");
+        }
+    }
+
+    return MEDLEY_OK;
+}
+
+void medley_shutdown(void) {
+    const ScopedLock sl(messageThreadLock);
+
+    if (messageThread == nullptr || engineCount > 0) {
+        return;
+    }
+
+    messageThread->shutdown();
+    delete messageThread;
+    messageThread = nullptr;
+
+    DeletedAtShutdown::deleteAll();
+    MessageManager::deleteInstance();
+}
+
+medley_track_t* medley_track_create(const char* path, float pregain) {
+    if (path == nullptr) {
+        fail(MEDLEY_ERROR_INVALID_ARGUMENT, "path is null");
+        return nullptr;
+    }
+
+    auto track = new medley_track(String::fromUTF8(path), pregain);
+    track->incReferenceCount();
+    return track;
+}
+
+void medley_track_retain(medley_track_t* track) {
+    if (track != nullptr) {
+        track->incReferenceCount();
+    }
+}
+
+void medley_track_release(medley_track_t* track) {
+    if (track != nullptr) {
+        track->decReferenceCount();
+    }
+}
+
+const char* medley_track_get_path(const medley_track_t* track) {
+    return track != nullptr ? track->path.c_str() : nullptr;
+}
+
+float medley_track_get_pregain(const medley_track_t* track) {
+    return track != nullptr ? track->pregain : 1.0f;
+}
+
+medley_queue_t* medley_queue_create(const medley_queue_interface_t* iface, void* user_data) {
+    if (iface == nullptr || iface->count == nullptr || iface->fetch_next_track == nullptr) {
+        fail(MEDLEY_ERROR_INVALID_ARGUMENT, "Incomplete queue interface");
+        return nullptr;
+    }
+
+    return new medley_queue(*iface, user_data);
+}
+
+void medley_queue_destroy(medley_queue_t* queue) {
+    delete queue;
+}
+
+medley_engine_t* medley_engine_create(medley_queue_t* queue, int use_audio_device) {
+    if (queue == nullptr) {
+        fail(MEDLEY_ERROR_INVALID_ARGUMENT, "queue is null");
+        return nullptr;
+    }
+
+    if (medley_initialize() != MEDLEY_OK) {
+        return nullptr;
+    }
+
+    try {
+        auto engine = new medley_engine(*queue, use_audio_device != 0);
+
+        const ScopedLock sl(messageThreadLock);
+        engineCount++;
+
+        return engine;
+    }
+    catch (std::exception& e) {
+        fail(MEDLEY_ERROR_ENGINE, e.what());
+    }
+    catch (...) {
+        fail(MEDLEY_ERROR_ENGINE, "Unknown Error while initializing engine.");
+    }
+
+    return nullptr;
+}
+
+void medley_engine_destroy(medley_engine_t* engine) {
+    if (engine == nullptr) {
+        return;
+    }
+
+    delete engine;
+
+    const ScopedLock sl(messageThreadLock);
+    engineCount--;
+}
+
+medley_result_t medley_engine_set_event_callback(medley_engine_t* engine, medley_event_callback callback, void* user_data) {
+    MEDLEY_CHECK_ENGINE(engine);
+
+    const ScopedLock sl(engine->callbackLock);
+    engine->callback = callback;
+    engine->callbackUserData = user_data;
+    return MEDLEY_OK;
+}
+
+medley_result_t medley_engine_play(medley_engine_t* engine) {
+    MEDLEY_CHECK_ENGINE(engine);
+    return guard([&] { engine->engine->play(); });
+}
+
+medley_result_t medley_engine_stop(medley_engine_t* engine) {
+    MEDLEY_CHECK_ENGINE(engine);
+    return guard([&] { engine->engine->stop(); });
+}
+
+medley_result_t medley_engine_toggle_pause(medley_engine_t* engine, int* paused) {
+    MEDLEY_CHECK_ENGINE(engine);
+
+    return guard([&] {
+        const auto result = engine->engine->togglePause() ? 1 : 0;
+
+        if (paused != nullptr) {
+            *paused = result;
+        }
+    });
+}
+
+medley_result_t medley_engine_is_paused(const medley_engine_t* engine, int* paused) {
+    MEDLEY_CHECK_ENGINE(engine);
+    MEDLEY_CHECK_OUTPUT(paused);
+    return guard([&] { *paused = engine->engine->isPaused() ? 1 : 0; });
+}
+
+medley_result_t medley_engine_is_playing(const medley_engine_t* engine, int* playing) {
+    MEDLEY_CHECK_ENGINE(engine);
+    MEDLEY_CHECK_OUTPUT(playing);
+    return guard([&] { *playing = engine->engine->isPlaying() ? 1 : 0; });
+}
+
+medley_result_t medley_engine_fade_out(medley_engine_t* engine) {
+    MEDLEY_CHECK_ENGINE(engine);
+    return guard([&] { engine->engine->fadeOutMainDeck(); });
+}
+
+medley_result_t medley_engine_seek(medley_engine_t* engine, double seconds) {
+    MEDLEY_CHECK_ENGINE(engine);
+    return guard([&] { engine->engine->setPositionInSeconds(seconds); });
+}
+
+medley_result_t medley_engine_seek_fractional(medley_engine_t* engine, double fraction) {
+    MEDLEY_CHECK_ENGINE(engine);
+    return guard([&] { engine->engine->setPositionFractional(fraction); });
+}
+
+medley_result_t medley_engine_get_position(const medley_engine_t* engine, double* seconds) {
+    MEDLEY_CHECK_ENGINE(engine);
+    MEDLEY_CHECK_OUTPUT(seconds);
+    return guard([&] { *seconds = engine->engine->getPositionInSeconds(); });
+}
+
+medley_result_t medley_engine_get_duration(const medley_engine_t* engine, double* seconds) {
+    MEDLEY_CHECK_ENGINE(engine);
+    MEDLEY_CHECK_OUTPUT(seconds);
+    return guard([&] { *seconds = engine->engine->getDuration(); });
+}
+
+medley_result_t medley_engine_get_gain(const medley_engine_t* engine, float* gain) {
+    MEDLEY_CHECK_ENGINE(engine);
+    MEDLEY_CHECK_OUTPUT(gain);
+    return guard([&] { *gain = engine->engine->getGain(); });
+}
+
+medley_result_t medley_engine_set_gain(medley_engine_t* engine, float gain) {
+    MEDLEY_CHECK_ENGINE(engine);
+    return guard([&] { engine->engine->setGain(gain); });
+}
+
+medley_result_t medley_engine_get_fading_curve(const medley_engine_t* engine, double* curve) {
+    MEDLEY_CHECK_ENGINE(engine);
+    MEDLEY_CHECK_OUTPUT(curve);
+    return guard([&] { *curve = engine->engine->getFadingCurve(); });
+}
+
+medley_result_t medley_engine_set_fading_curve(medley_engine_t* engine, double curve) {
+    MEDLEY_CHECK_ENGINE(engine);
+    return guard([&] { engine->engine->setFadingCurve(curve); });
+}
+
+medley_result_t medley_engine_get_max_transition_time(const medley_engine_t* engine, double* seconds) {
+    MEDLEY_CHECK_ENGINE(engine);
+    MEDLEY_CHECK_OUTPUT(seconds);
+    return guard([&] { *seconds = engine->engine->getMaxTransitionTime(); });
+}
+
+medley_result_t medley_engine_set_max_transition_time(medley_engine_t* engine, double seconds) {
+    MEDLEY_CHECK_ENGINE(engine);
+    return guard([&] { engine->engine->setMaxTransitionTime(seconds); });
+}
+
+medley_result_t medley_engine_get_max_leading_duration(const medley_engine_t* engine, double* seconds) {
+    MEDLEY_CHECK_ENGINE(engine);
+    MEDLEY_CHECK_OUTPUT(seconds);
+    return guard([&] { *seconds = engine->engine->getMaxLeadingDuration(); });
+}
+
+medley_result_t medley_engine_set_max_leading_duration(medley_engine_t* engine, double seconds) {
+    MEDLEY_CHECK_ENGINE(engine);
+    return guard([&] { engine->engine->setMaxLeadingDuration(seconds); });
+}
+
+medley_result_t medley_engine_get_level(const medley_engine_t* engine, int channel, double* level, double* peak) {
+    MEDLEY_CHECK_ENGINE(engine);
+
+    int numChannels = 0;
+
+    if (auto result = guard([&] { numChannels = engine->engine->getNumOutputChannels(); })) {
+        return result;
+    }
+
+    if (channel < 0 || channel >= numChannels) {
+        if (level != nullptr) {
+            *level = 0.0;
+        }
+
+        if (peak != nullptr) {
+            *peak = 0.0;
+        }
+
+        return fail(MEDLEY_ERROR_INVALID_ARGUMENT, "Invalid channel");
+    }
+
+    return guard([&] {
+        if (level != nullptr) {
+            *level = engine->engine->getLevel(channel);
+        }
+
+        if (peak != nullptr) {
+            *peak = engine->engine->getPeakLevel(channel);
+        }
+    });
+}
+
+medley_result_t medley_engine_prepare_render(medley_engine_t* engine, double sample_rate, int max_block_size, int num_channels) {
+    MEDLEY_CHECK_ENGINE(engine);
+
+    if (sample_rate <= 0.0 || max_block_size <= 0 || num_channels <= 0) {
+        return fail(MEDLEY_ERROR_INVALID_ARGUMENT, "Invalid render configuration");
+    }
+
+    if (auto result = guard([&] { engine->engine->prepareToRender(sample_rate, max_block_size, num_channels); }, MEDLEY_ERROR_INVALID_STATE)) {
+        return result;
+    }
+
+    engine->maxBlockSize = max_block_size;
+    engine->numChannels = num_channels;
+    return MEDLEY_OK;
+}
+
+medley_result_t medley_engine_render(medley_engine_t* engine, float* const* channels, int num_channels, int num_samples) {
+    MEDLEY_CHECK_ENGINE(engine);
+
+    if (!engine->engine->isRenderingOffline()) {
+        return fail(MEDLEY_ERROR_INVALID_STATE, "medley_engine_prepare_render() has not been called");
+    }
+
+    if (channels == nullptr || num_channels != engine->numChannels || num_samples < 0 || num_samples > engine->maxBlockSize) {
+        return fail(MEDLEY_ERROR_INVALID_ARGUMENT, "Invalid render buffer");
+    }
+
+    // Refers to the caller's memory, nothing is allocated or copied
+    AudioBuffer<float> buffer(channels, num_channels, num_samples);
+    buffer.clear();
+
+    return guard([&] { engine->engine->renderNextBlock(buffer, 0, num_samples); });
+}
+
+medley_host_t* medley_host_create(int num_workers) {
+    if (medley_initialize() != MEDLEY_OK) {
+        return nullptr;
+    }
+
+    medley_host* host = nullptr;
+
+    if (guard([&] { host = new medley_host(num_workers); }) != MEDLEY_OK) {
+        return nullptr;
+    }
+
+    const ScopedLock sl(messageThreadLock);
+    engineCount++;
+
+    return host;
+}
+
+void medley_host_destroy(medley_host_t* host) {
+    if (host == nullptr) {
+        return;
+    }
+
+    delete host;
+
+    const ScopedLock sl(messageThreadLock);
+    engineCount--;
+}
+
+medley_result_t medley_host_open_device(medley_host_t* host, int num_output_channels, const char* device_name) {
+    if (host == nullptr || num_output_channels <= 0) {
+        return fail(MEDLEY_ERROR_INVALID_ARGUMENT, "Invalid host or channel count");
+    }
+
+    return guard([&] { host->host.openDevice(num_output_channels, device_name != nullptr ? String::fromUTF8(device_name) : String()); });
+}
+
+medley_result_t medley_host_add_engine(medley_host_t* host, medley_engine_t* engine, int first_channel, int num_channels) {
+    MEDLEY_CHECK_ENGINE(engine);
+
+    if (host == nullptr || first_channel < 0 || num_channels <= 0) {
+        return fail(MEDLEY_ERROR_INVALID_ARGUMENT, "Invalid host or channel range");
+    }
+
+    if (auto result = guard([&] { host->host.addStation(*engine->engine, first_channel, num_channels); }, MEDLEY_ERROR_INVALID_STATE)) {
+        return result;
+    }
+
+    host->engines.add(engine);
+    return MEDLEY_OK;
+}
+
+medley_result_t medley_host_remove_engine(medley_host_t* host, medley_engine_t* engine) {
+    MEDLEY_CHECK_ENGINE(engine);
+
+    if (host == nullptr) {
+        return fail(MEDLEY_ERROR_INVALID_ARGUMENT, "host is null");
+    }
+
+    const auto removed = host->host.removeStation(*engine->engine);
+    host->engines.removeFirstMatchingValue(engine);
+
+    if (!removed) {
+        return fail(MEDLEY_ERROR_INVALID_STATE, "Engine is still rendering, it must not be destroyed yet");
+    }
+
+    return MEDLEY_OK;
+}
+
+medley_result_t medley_host_get_late_renders(medley_host_t* host, int64_t* count) {
+    if (host == nullptr) {
+        return fail(MEDLEY_ERROR_INVALID_ARGUMENT, "host is null");
+    }
+
+    MEDLEY_CHECK_OUTPUT(count);
+
+    *count = host->host.getStatsAndReset().numLateRenders;
+    return MEDLEY_OK;
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+/*
+ * C interface to the Medley engine, for hosts that cannot link against the C++ classes directly.
+ *
+ * All handles are opaque. Strings are UTF-8. Unless noted otherwise, functions returning
+ * medley_result_t report failures through a negative code, and medley_last_error() describes
+ * the most recent failure on the calling thread. Values are returned through out-parameters,
+ * which are left untouched on failure. No C++ exception crosses this interface.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+  #if defined(MEDLEY_CAPI_EXPORTS)
+    #define MEDLEY_API __declspec(dllexport)
+  #else
+    #define MEDLEY_API __declspec(dllimport)
+  #endif
+#else
+  #define MEDLEY_API __attribute__((visibility("default")))
+#endif
+
+#define MEDLEY_API_VERSION 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct medley_engine medley_engine_t;
+typedef struct medley_queue medley_queue_t;
+typedef struct medley_track medley_track_t;
+typedef struct medley_host medley_host_t;
+
+typedef enum medley_result {
+    MEDLEY_OK = 0,
+    MEDLEY_ERROR_INVALID_ARGUMENT = -1,
+    MEDLEY_ERROR_INVALID_STATE = -2,
+    MEDLEY_ERROR_ENGINE = -3
+} medley_result_t;
+
+typedef enum medley_event {
+    MEDLEY_EVENT_DECK_LOADED = 0,
+    MEDLEY_EVENT_DECK_UNLOADED,
+    MEDLEY_EVENT_DECK_STARTED,
+    MEDLEY_EVENT_DECK_FINISHED,
+    MEDLEY_EVENT_DECK_SCANNING,
+    MEDLEY_EVENT_DECK_SCANNED,
+    MEDLEY_EVENT_DECK_POSITION,
+    MEDLEY_EVENT_AUDIO_DEVICE_CHANGED,
+    MEDLEY_EVENT_PRE_CUE_NEXT
+} medley_event_t;
+
+/*
+ * Called in order on a dispatcher thread owned by the engine, never from the audio callback nor other engine threads.
+ * Events are queued without locking wherever they happen, and delivered every few milliseconds. Newer events are
+ * dropped while more than 1024 are waiting for a slow callback.
+ * deck is 0 or 1 for deck events and -1 otherwise, position is only meaningful for MEDLEY_EVENT_DECK_POSITION.
+ */
+typedef void (*medley_event_callback)(medley_event_t event, int deck, double position, void* user_data);
+
+/*
+ * Queue implemented by the host. fetch_next_track transfers one reference of the returned track
+ * to the engine, return NULL when the queue is empty.
+ */
+typedef struct medley_queue_interface {
+    size_t (*count)(void* user_data);
+    medley_track_t* (*fetch_next_track)(void* user_data);
+} medley_queue_interface_t;
+
+MEDLEY_API int medley_api_version(void);
+
+MEDLEY_API const char* medley_last_error(void);
+
+/* Starts the shared message thread, called implicitly by medley_engine_create() */
+MEDLEY_API medley_result_t medley_initialize(void);
+
+/* Stops the message thread once all engines have been destroyed */
+MEDLEY_API void medley_shutdown(void);
+
+/* Tracks are reference counted, a new track holds one reference */
+MEDLEY_API medley_track_t* medley_track_create(const char* path, float pregain);
+
+MEDLEY_API void medley_track_retain(medley_track_t* track);
+
+MEDLEY_API void medley_track_release(medley_track_t* track);
+
+/* The returned string is owned by the track */
+MEDLEY_API const char* medley_track_get_path(const medley_track_t* track);
+
+MEDLEY_API float medley_track_get_pregain(const medley_track_t* track);
+
+/* The interface is copied, user_data must outlive the queue */
+MEDLEY_API medley_queue_t* medley_queue_create(const medley_queue_interface_t* iface, void* user_data);
+
+MEDLEY_API void medley_queue_destroy(medley_queue_t* queue);
+
+/*
+ * Create an engine pulling tracks from queue, which must outlive the engine.
+ * When use_audio_device is zero, no device is opened and audio must be pulled with medley_engine_render().
+ */
+MEDLEY_API medley_engine_t* medley_engine_create(medley_queue_t* queue, int use_audio_device);
+
+MEDLEY_API void medley_engine_destroy(medley_engine_t* engine);
+
+MEDLEY_API medley_result_t medley_engine_set_event_callback(medley_engine_t* engine, medley_event_callback callback, void* user_data);
+
+MEDLEY_API medley_result_t medley_engine_play(medley_engine_t* engine);
+
+MEDLEY_API medley_result_t medley_engine_stop(medley_engine_t* engine);
+
+/* paused is set to 1 when paused after toggling and 0 otherwise, it may be NULL */
+MEDLEY_API medley_result_t medley_engine_toggle_pause(medley_engine_t* engine, int* paused);
+
+MEDLEY_API medley_result_t medley_engine_is_paused(const medley_engine_t* engine, int* paused);
+
+MEDLEY_API medley_result_t medley_engine_is_playing(const medley_engine_t* engine, int* playing);
+
+MEDLEY_API medley_result_t medley_engine_fade_out(medley_engine_t* engine);
+
+MEDLEY_API medley_result_t medley_engine_seek(medley_engine_t* engine, double seconds);
+
+MEDLEY_API medley_result_t medley_engine_seek_fractional(medley_engine_t* engine, double fraction);
+
+MEDLEY_API medley_result_t medley_engine_get_position(const medley_engine_t* engine, double* seconds);
+
+MEDLEY_API medley_result_t medley_engine_get_duration(const medley_engine_t* engine, double* seconds);
+
+MEDLEY_API medley_result_t medley_engine_get_gain(const medley_engine_t* engine, float* gain);
+
+MEDLEY_API medley_result_t medley_engine_set_gain(medley_engine_t* engine, float gain);
+
+MEDLEY_API medley_result_t medley_engine_get_fading_curve(const medley_engine_t* engine, double* curve);
+
+MEDLEY_API medley_result_t medley_engine_set_fading_curve(medley_engine_t* engine, double curve);
+
+MEDLEY_API medley_result_t medley_engine_get_max_transition_time(const medley_engine_t* engine, double* seconds);
+
+MEDLEY_API medley_result_t medley_engine_set_max_transition_time(medley_engine_t* engine, double seconds);
+
+MEDLEY_API medley_result_t medley_engine_get_max_leading_duration(const medley_engine_t* engine, double* seconds);
+
+MEDLEY_API medley_result_t medley_engine_set_max_leading_duration(medley_engine_t* engine, double seconds);
+
+/* Output level and peak in linear gain. Out of range channels fail with MEDLEY_ERROR_INVALID_ARGUMENT and give 0 */
+MEDLEY_API medley_result_t medley_engine_get_level(const medley_engine_t* engine, int channel, double* level, double* peak);
+
+/*
+ * Offline or externally clocked output, only for engines created without an audio device.
+ * medley_engine_prepare_render() must be called once before rendering.
+ */
+MEDLEY_API medley_result_t medley_engine_prepare_render(medley_engine_t* engine, double sample_rate, int max_block_size, int num_channels);
+
+/*
+ * Render num_samples directly into the caller's planar channel buffers, no intermediate copy is made.
+ * num_samples must not exceed the max_block_size given to medley_engine_prepare_render().
+ */
+MEDLEY_API medley_result_t medley_engine_render(medley_engine_t* engine, float* const* channels, int num_channels, int num_samples);
+
+/*
+ * A host drives several engines from one multichannel audio device, each engine owning a range of output channels.
+ * Engines are rendered in parallel on num_workers threads, a negative value uses one per CPU.
+ */
+MEDLEY_API medley_host_t* medley_host_create(int num_workers);
+
+/* Engines still attached are detached, but not destroyed */
+MEDLEY_API void medley_host_destroy(medley_host_t* host);
+
+/* device_name may be NULL for the default device */
+MEDLEY_API medley_result_t medley_host_open_device(medley_host_t* host, int num_output_channels, const char* device_name);
+
+/* The engine must have been created without an audio device, and must stay alive until it is removed */
+MEDLEY_API medley_result_t medley_host_add_engine(medley_host_t* host, medley_engine_t* engine, int first_channel, int num_channels);
+
+/* Fails with MEDLEY_ERROR_INVALID_STATE when a block is still rendering after 2 seconds, the engine must then be kept alive */
+MEDLEY_API medley_result_t medley_host_remove_engine(medley_host_t* host, medley_engine_t* engine);
+
+/* Number of engine blocks replaced with silence because they missed the callback deadline, since the last call */
+MEDLEY_API medley_result_t medley_host_get_late_renders(medley_host_t* host, int64_t* count);
+
+#ifdef __cplusplus
+}
+#endif
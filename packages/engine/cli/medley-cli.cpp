@@ -0,0 +1,718 @@
+#include <iostream>
+#include <csignal>
+#include <JuceHeader.h>
+
+#include "Medley.h"
+#include "SessionReplayer.h"
+
+using namespace juce;
+using namespace medley;
+
+namespace {
+
+std::atomic<bool> quitRequested{ false };
+
+void signalHandler(int) {
+    quitRequested = true;
+}
+
+void printUsage() {
+    std::cout
+        << "Usage: medley-cli <playlist> [options]" << std::endl
+        << "       medley-cli --replay <session log> [options]" << std::endl
+        << "       medley-cli --run-tests   Run the engine self tests, MP3 checks read $MEDLEY_TEST_MEDIA" << std::endl
+        << std::endl
+        << "  -o, --output <target>    default, null or a .wav file (default: default)" << std::endl
+        << "  -i, --interval <sec>     Statistics interval in seconds (default: 1)" << std::endl
+        << "  -r, --sample-rate <hz>   Sample rate for null/file output (default: 44100)" << std::endl
+        << "  -b, --block-size <n>     Block size for null/file output (default: 512)" << std::endl
+        << "      --realtime           Pace null/file output in real time" << std::endl
+        << "      --rt-priority <n>    SCHED_FIFO priority for the audio thread, read-ahead runs one below" << std::endl
+        << "      --cpus <list>        Pin the audio and read-ahead threads to CPUs, e.g. 2,3" << std::endl
+        << "      --isolated-cores     Pin the audio and read-ahead threads to isolated CPUs" << std::endl
+        << "      --memory-limit <mb>  Memory budget for read-ahead buffers and decoders" << std::endl
+        << "      --no-wait            Do not wait for read-ahead when rendering to null/file, underruns play as silence" << std::endl
+        << "      --inject-faults <spec>" << std::endl
+        << "                           Slow down or break track reads for null/file output, a comma separated list of:" << std::endl
+        << "                             files=<wildcard>   files affected (default: *)" << std::endl
+        << "                             latency=<ms>       added to every read" << std::endl
+        << "                             jitter=<ms>        latency spread" << std::endl
+        << "                             dist=<name>        constant, uniform, normal or exponential (default: constant)" << std::endl
+        << "                             stall=<p>:<ms>     chance per read of hanging for a while" << std::endl
+        << "                             short=<p>          chance per read of a short read" << std::endl
+        << "                             error=<p>          chance per read of a failed read, seen as the end of the file" << std::endl
+        << "                             fail-from=<bytes>  every read from this offset on fails" << std::endl
+        << "                             seed=<n>           for reproducible runs (default: 0)" << std::endl
+        << "      --record <file>      Record a session log, for replaying later" << std::endl
+        << "      --media-dir <dir>    When replaying, where to find tracks missing at their recorded path" << std::endl;
+}
+
+int runSelfTests() {
+#if MEDLEY_SELF_TESTS
+    UnitTestRunner runner;
+    runner.setAssertOnFailure(false);
+    runner.runTestsInCategory("Medley");
+
+    int failures = 0;
+
+    for (int i = 0; i < runner.getNumResults(); i++) {
+        failures += runner.getResult(i)->failures;
+    }
+
+    return failures > 0 ? 1 : 0;
+#else
+    std::cerr << "Built without self tests, MEDLEY_SELF_TESTS=1 enables them" << std::endl;
+    return 1;
+#endif
+}
+
+juce::uint64 parseCpuList(const String& list) {
+    juce::uint64 mask = 0;
+
+    for (auto& cpu : StringArray::fromTokens(list, ",", "")) {
+        auto index = cpu.trim().getIntValue();
+
+        if (index >= 0 && index < 64) {
+            mask |= (1ULL << index);
+        }
+    }
+
+    return mask;
+}
+
+// Throws on anything not understood, a typo should not silently run without faults
+void parseFaultSpec(const String& spec, FaultInjector::Rule& rule, int64& seed) {
+    for (auto& item : StringArray::fromTokens(spec, ",", "")) {
+        auto key = item.upToFirstOccurrenceOf("=", false, false).trim();
+        auto value = item.fromFirstOccurrenceOf("=", false, false).trim();
+
+        if (key == "files") {
+            rule.pattern = value;
+        }
+        else if (key == "latency") {
+            rule.latencyMean = jmax(0.0, value.getDoubleValue());
+        }
+        else if (key == "jitter") {
+            rule.latencySpread = jmax(0.0, value.getDoubleValue());
+        }
+        else if (key == "dist") {
+            if (value == "constant") {
+                rule.latency = FaultInjector::Distribution::Constant;
+            }
+            else if (value == "uniform") {
+                rule.latency = FaultInjector::Distribution::Uniform;
+            }
+            else if (value == "normal") {
+                rule.latency = FaultInjector::Distribution::Normal;
+            }
+            else if (value == "exponential") {
+                rule.latency = FaultInjector::Distribution::Exponential;
+            }
+            else {
+                throw std::runtime_error(("Unknown latency distribution: " + value).toStdString());
+            }
+        }
+        else if (key == "stall") {
+            rule.stallProbability = jlimit(0.0, 1.0, value.upToFirstOccurrenceOf(":", false, false).getDoubleValue());
+            rule.stallDuration = jmax(0.0, value.fromFirstOccurrenceOf(":", false, false).getDoubleValue());
+        }
+        else if (key == "short") {
+            rule.shortReadProbability = jlimit(0.0, 1.0, value.getDoubleValue());
+        }
+        else if (key == "error") {
+            rule.errorProbability = jlimit(0.0, 1.0, value.getDoubleValue());
+        }
+        else if (key == "fail-from") {
+            rule.failFromOffset = jmax((int64)0, value.getLargeIntValue());
+        }
+        else if (key == "seed") {
+            seed = value.getLargeIntValue();
+        }
+        else {
+            throw std::runtime_error(("Unknown fault: " + item).toStdString());
+        }
+    }
+}
+
+AudioFormatWriter* createWavWriter(const File& file, double sampleRate, int numChannels) {
+    file.deleteFile();
+
+    if (auto stream = file.createOutputStream()) {
+        WavAudioFormat wav;
+
+        if (auto writer = wav.createWriterFor(stream.get(), sampleRate, numChannels, 16, {}, 0)) {
+            stream.release();
+            return writer;
+        }
+    }
+
+    throw std::runtime_error("Could not create output file");
+}
+
+String formatDecibels(double gain) {
+    return String(Decibels::gainToDecibels(gain), 1) + "dB";
+}
+
+String formatMegabytes(int64 bytes) {
+    return String(bytes / (1024.0 * 1024.0), 1) + "MB";
+}
+
+}
+
+class Track : public medley::ITrack {
+public:
+    Track(const File& file)
+        :
+        file(file)
+    {
+
+    }
+
+    File getFile() override {
+        return file;
+    }
+
+private:
+    JUCE_LEAK_DETECTOR(Track)
+
+    File file;
+};
+
+class Queue : public medley::IQueue {
+public:
+    size_t count() const override {
+        const ScopedLock sl(lock);
+        return tracks.size();
+    }
+
+    medley::ITrack::Ptr fetchNextTrack() override {
+        const ScopedLock sl(lock);
+
+        if (tracks.empty()) {
+            return nullptr;
+        }
+
+        auto track = tracks.front();
+        tracks.erase(tracks.begin());
+        return track;
+    }
+
+    // Plain text or M3U, relative paths are resolved against the playlist location
+    int loadPlaylist(const File& playlist) {
+        const ScopedLock sl(lock);
+
+        StringArray lines;
+        playlist.readLines(lines);
+
+        int added = 0;
+        for (auto& line : lines) {
+            auto path = line.trim();
+
+            if (path.isEmpty() || path.startsWithChar('#')) {
+                continue;
+            }
+
+            auto file = playlist.getParentDirectory().getChildFile(path);
+            if (!file.existsAsFile()) {
+                std::cerr << "Skipping missing file: " << file.getFullPathName() << std::endl;
+                continue;
+            }
+
+            tracks.push_back(new Track(file));
+            added++;
+        }
+
+        return added;
+    }
+
+private:
+    mutable CriticalSection lock;
+    std::list<Track::Ptr> tracks;
+};
+
+class Host : public Thread, public medley::Medley::Callback {
+public:
+    enum class Output {
+        Device,
+        Null,
+        File
+    };
+
+    struct Options {
+        Output output = Output::Device;
+        File outputFile;
+        double statsInterval = 1.0;
+        double sampleRate = 44100.0;
+        int blockSize = 512;
+        bool blockSizeGiven = false;
+        bool realtime = false;
+        int rtPriority = 0;
+        juce::uint64 cpus = 0;
+        bool isolatedCores = false;
+        bool waitForBuffering = true;
+        bool injectFaults = false;
+        FaultInjector::Rule faultRule;
+        int64 faultSeed = 0;
+        File recordFile;
+        File mediaDirectory;
+    };
+
+    Host(Queue& queue, const Options& options)
+        :
+        Thread("Host"),
+        options(options),
+        queue(queue),
+        engine(queue, options.output == Output::Device)
+    {
+        engine.addListener(this);
+
+        // Reads would sleep on the audio device's deadline otherwise
+        if (options.injectFaults && options.output != Output::Device) {
+            faultInjector = std::make_unique<FaultInjector>(options.faultSeed);
+            faultInjector->addRule(options.faultRule);
+            engine.setFaultInjector(faultInjector.get());
+        }
+        else if (options.injectFaults) {
+            std::cerr << "Warning: --inject-faults is ignored with device output, use -o null or a .wav file" << std::endl;
+        }
+
+        if (options.rtPriority > 0 || options.cpus != 0 || options.isolatedCores) {
+            ThreadPolicy policy;
+            policy.scheduling = options.rtPriority > 0 ? ThreadPolicy::Scheduling::Fifo : ThreadPolicy::Scheduling::Default;
+            policy.priority = options.rtPriority;
+            policy.affinityMask = options.cpus;
+            policy.isolatedCores = options.isolatedCores;
+
+            engine.setThreadPolicy(Medley::EngineThread::Audio, policy);
+
+            policy.priority = jmax(1, options.rtPriority - 1);
+            engine.setThreadPolicy(Medley::EngineThread::ReadAhead, policy);
+
+            threadPoliciesRequested = true;
+        }
+
+        if (options.output != Output::Device) {
+            engine.prepareToRender(options.sampleRate, options.blockSize, kNumChannels, options.waitForBuffering);
+        }
+
+        if (options.output == Output::File) {
+            writer.reset(createWavWriter(options.outputFile, options.sampleRate, kNumChannels));
+        }
+
+        // Last, so the log starts with the settings in effect
+        if (options.recordFile != File()) {
+            engine.startRecording(options.recordFile);
+        }
+    }
+
+    ~Host() override {
+        stopThread(1000);
+        engine.removeListener(this);
+    }
+
+    void run() override {
+        engine.play();
+        printStartup();
+
+        AudioBuffer<float> buffer(kNumChannels, options.blockSize);
+
+        auto renderDuration = options.blockSize / options.sampleRate * 1000.0;
+        auto nextRenderTime = Time::getMillisecondCounterHiRes();
+        auto nextStatsTime = nextRenderTime + options.statsInterval * 1000.0;
+
+        while (!threadShouldExit() && !quitRequested && !isFinished()) {
+            auto now = Time::getMillisecondCounterHiRes();
+
+            if (options.output == Output::Device) {
+                wait(10);
+            }
+            else if (!options.realtime || now >= nextRenderTime) {
+                buffer.clear();
+                engine.renderNextBlock(buffer, 0, options.blockSize);
+                renderedSamples += options.blockSize;
+
+                if (writer) {
+                    writer->writeFromAudioSampleBuffer(buffer, 0, options.blockSize);
+                }
+
+                nextRenderTime += renderDuration;
+            }
+            else {
+                wait(jmax(1, (int)(nextRenderTime - now)));
+            }
+
+            if (now >= nextStatsTime) {
+                if (threadPoliciesRequested) {
+                    printThreadStatus();
+                    threadPoliciesRequested = false;
+                }
+
+                printStats();
+                nextStatsTime = now + options.statsInterval * 1000.0;
+            }
+        }
+
+        engine.stop();
+        engine.stopRecording();
+        writer = nullptr;
+
+        printStats();
+
+        MessageManager::getInstance()->stopDispatchLoop();
+    }
+
+    void deckTrackScanning(Deck& sender) override {
+
+    }
+
+    void deckTrackScanned(Deck& sender) override {
+        std::cout << "[" << sender.getName() << "] scanned in " << String(sender.getLastScanningTime(), 2) << "ms" << std::endl;
+    }
+
+    void deckPosition(Deck& sender, double position) override {
+
+    }
+
+    void deckStarted(Deck& sender) override {
+        started = true;
+
+        if (auto track = sender.getTrack()) {
+            std::cout << "[" << sender.getName() << "] started: " << track->getFile().getFileName() << std::endl;
+        }
+    }
+
+    void deckFinished(Deck& sender) override {
+
+    }
+
+    void deckLoaded(Deck& sender) override {
+        std::cout << "[" << sender.getName() << "] loaded in " << String(sender.getLastLoadingTime(), 2) << "ms" << std::endl;
+    }
+
+    void deckUnloaded(Deck& sender) override {
+
+    }
+
+    void audioDeviceChanged() override {
+
+    }
+
+    void preCueNext() override {
+
+    }
+
+private:
+    static constexpr int kNumChannels = 2;
+
+    bool isFinished() {
+        return started && queue.count() == 0 && !engine.isDeckPlaying() && engine.getMainDeck() == nullptr;
+    }
+
+    void printThreadStatus() {
+        std::cout << "audio thread: " << ThreadPolicy::describe(engine.getThreadStatus(Medley::EngineThread::Audio)) << std::endl;
+        std::cout << "read-ahead thread: " << ThreadPolicy::describe(engine.getThreadStatus(Medley::EngineThread::ReadAhead)) << std::endl;
+    }
+
+    // Deferred parts are done by now, play() opens the device and starts the threads
+    void printStartup() {
+        auto& times = engine.getStartupTimes();
+
+        String line;
+        line << "startup: construction=" << String(times.construction, 2) << "ms"
+            << " formats=" << String(times.formats, 2) << "ms"
+            << " decks=" << String(times.decks, 2) << "ms"
+            << " threads=" << String(times.threads, 2) << "ms"
+            << " device=" << String(times.device, 2) << "ms"
+            << " | rss constructed=" << formatMegabytes(times.constructionMemory)
+            << " started=" << formatMegabytes(times.startedMemory);
+
+        std::cout << line << std::endl;
+    }
+
+    void printStats() {
+        auto stats = engine.getCallbackStats();
+
+        String line;
+        line << "callbacks=" << stats.numCallbacks
+            << " avg=" << String(stats.averageTime, 3) << "ms"
+            << " max=" << String(stats.maxTime, 3) << "ms"
+            << " load=" << String(stats.load * 100.0, 1) << "%";
+
+        for (auto deck : { &engine.getDeck1(), &engine.getDeck2() }) {
+            if (deck->isTrackLoaded()) {
+                line << " | " << deck->getName()
+                    << " pos=" << String(deck->getPositionInSeconds(), 2)
+                    << " buffer=" << String(deck->getBufferFill() * 100.0, 0) << "%"
+                    << " underruns=" << deck->getNumUnderruns();
+            }
+        }
+
+        if (faultInjector) {
+            auto faults = faultInjector->getStats();
+            line << " | reads=" << faults.numReads
+                << " stalls=" << faults.numStalls
+                << " short=" << faults.numShortReads
+                << " errors=" << faults.numErrors
+                << " delay=" << String(faults.totalDelay, 0) << "ms";
+        }
+
+        auto memory = engine.getMemoryAccount().getUsage();
+        line << " | mem=" << formatMegabytes(memory.current) << " peak=" << formatMegabytes(memory.peak);
+
+        line << " | level=" << formatDecibels(engine.getLevel(0)) << "/" << formatDecibels(engine.getLevel(1))
+            << " peak=" << formatDecibels(engine.getPeakLevel(0)) << "/" << formatDecibels(engine.getPeakLevel(1));
+
+        if (options.output != Output::Device) {
+            line << " | rendered=" << String(renderedSamples / options.sampleRate, 1) << "s";
+        }
+
+        std::cout << line << std::endl;
+    }
+
+    Options options;
+    Queue& queue;
+    // Before the engine, whose decks read through it until they are gone
+    std::unique_ptr<FaultInjector> faultInjector;
+    medley::Medley engine;
+    std::unique_ptr<AudioFormatWriter> writer;
+
+    std::atomic<bool> started{ false };
+    bool threadPoliciesRequested = false;
+    int64 renderedSamples = 0;
+};
+
+// Re-drives an offline engine from a session log, as fast as it renders
+class Replay : public Thread {
+public:
+    Replay(const File& log, const Host::Options& options)
+        :
+        Thread("Replay"),
+        options(options),
+        replayer(log, getReplayOptions(options))
+    {
+        if (options.injectFaults) {
+            faultInjector = std::make_unique<FaultInjector>(options.faultSeed);
+            faultInjector->addRule(options.faultRule);
+            replayer.getEngine().setFaultInjector(faultInjector.get());
+        }
+
+        auto& header = replayer.getHeader();
+
+        if (options.output == Host::Output::File) {
+            writer.reset(createWavWriter(options.outputFile, header.sampleRate, header.numChannels));
+        }
+    }
+
+    ~Replay() override {
+        stopThread(1000);
+    }
+
+    void run() override {
+        auto& header = replayer.getHeader();
+        auto& engine = replayer.getEngine();
+
+        std::cout << "Replaying " << String(replayer.getLength() / header.sampleRate, 1) << "s recorded "
+            << Time(header.startTime).toString(true, true) << " at " << header.sampleRate << "Hz" << std::endl;
+
+        auto nextStatsTime = Time::getMillisecondCounterHiRes() + options.statsInterval * 1000.0;
+
+        auto result = replayer.run([&](const AudioBuffer<float>& buffer, int numSamples) {
+            if (writer) {
+                writer->writeFromAudioSampleBuffer(buffer, 0, numSamples);
+            }
+
+            if (quitRequested || threadShouldExit()) {
+                replayer.cancel();
+            }
+
+            auto now = Time::getMillisecondCounterHiRes();
+
+            if (now >= nextStatsTime) {
+                std::cout << "replayed=" << String(engine.getSamplePosition() / header.sampleRate, 1) << "s"
+                    << " underruns=" << engine.getNumUnderruns() << std::endl;
+
+                nextStatsTime = now + options.statsInterval * 1000.0;
+            }
+        });
+
+        writer = nullptr;
+
+        std::cout << "inputs=" << result.numInputs
+            << " events=" << result.numMatched << "/" << result.numEvents
+            << " drift=" << String(result.maxDrift / header.sampleRate * 1000.0, 1) << "ms"
+            << " underruns=" << result.numUnderruns
+            << " rendered=" << String(result.renderedSamples / header.sampleRate, 1) << "s" << std::endl;
+
+        for (auto& divergence : result.divergences) {
+            std::cout << "  " << divergence << std::endl;
+        }
+
+        exitCode = result.divergences.isEmpty() ? 0 : 2;
+
+        MessageManager::getInstance()->stopDispatchLoop();
+    }
+
+    // 2 when the replay diverged from the recording
+    int getExitCode() const { return exitCode; }
+
+private:
+    static SessionReplayer::Options getReplayOptions(const Host::Options& options) {
+        SessionReplayer::Options result;
+        result.mediaDirectory = options.mediaDirectory;
+        // Recorded sizes unless asked otherwise
+        result.blockSize = options.blockSizeGiven ? options.blockSize : 0;
+        return result;
+    }
+
+    Host::Options options;
+    // Before the replayer, whose engine reads through it
+    std::unique_ptr<FaultInjector> faultInjector;
+    SessionReplayer replayer;
+    std::unique_ptr<AudioFormatWriter> writer;
+    std::atomic<int> exitCode{ 1 };
+};
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        printUsage();
+        return 1;
+    }
+
+    if (String(argv[1]) == "--run-tests") {
+        return runSelfTests();
+    }
+
+    const auto replaying = String(argv[1]) == "--replay";
+
+    if (replaying && argc < 3) {
+        printUsage();
+        return 1;
+    }
+
+    Host::Options options;
+    File input = File::getCurrentWorkingDirectory().getChildFile(argv[replaying ? 2 : 1]);
+
+    for (int i = replaying ? 3 : 2; i < argc; i++) {
+        String arg(argv[i]);
+        String value = (i + 1 < argc) ? String(argv[i + 1]) : String();
+
+        if (arg == "-o" || arg == "--output") {
+            if (value == "null") {
+                options.output = Host::Output::Null;
+            }
+            else if (value != "default") {
+                options.output = Host::Output::File;
+                options.outputFile = File::getCurrentWorkingDirectory().getChildFile(value);
+            }
+            i++;
+        }
+        else if (arg == "-i" || arg == "--interval") {
+            options.statsInterval = jmax(0.1, value.getDoubleValue());
+            i++;
+        }
+        else if (arg == "-r" || arg == "--sample-rate") {
+            options.sampleRate = jmax(8000.0, value.getDoubleValue());
+            i++;
+        }
+        else if (arg == "-b" || arg == "--block-size") {
+            options.blockSize = jmax(16, value.getIntValue());
+            options.blockSizeGiven = true;
+            i++;
+        }
+        else if (arg == "--realtime") {
+            options.realtime = true;
+        }
+        else if (arg == "--rt-priority") {
+            options.rtPriority = jlimit(1, 99, value.getIntValue());
+            i++;
+        }
+        else if (arg == "--cpus") {
+            options.cpus = parseCpuList(value);
+            i++;
+        }
+        else if (arg == "--isolated-cores") {
+            options.isolatedCores = true;
+        }
+        else if (arg == "--memory-limit") {
+            MemoryBudget::getGlobal().setLimit((int64)(value.getDoubleValue() * 1024 * 1024));
+            i++;
+        }
+        else if (arg == "--no-wait") {
+            options.waitForBuffering = false;
+        }
+        else if (arg == "--inject-faults") {
+            try {
+                parseFaultSpec(value, options.faultRule, options.faultSeed);
+            }
+            catch (std::exception& e) {
+                std::cerr << e.what() << std::endl;
+                return 1;
+            }
+
+            options.injectFaults = true;
+            i++;
+        }
+        else if (arg == "--record") {
+            options.recordFile = File::getCurrentWorkingDirectory().getChildFile(value);
+            i++;
+        }
+        else if (arg == "--media-dir") {
+            options.mediaDirectory = File::getCurrentWorkingDirectory().getChildFile(value);
+            i++;
+        }
+        else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    std::signal(SIGINT, signalHandler);
+    std::signal(SIGTERM, signalHandler);
+
+    // The calling thread becomes the message thread
+    MessageManager::getInstance();
+
+    int exitCode = 0;
+
+    if (replaying) {
+        try {
+            Replay replay(input, options);
+            replay.startThread();
+
+            MessageManager::getInstance()->runDispatchLoop();
+            exitCode = replay.getExitCode();
+        }
+        catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            exitCode = 1;
+        }
+
+        DeletedAtShutdown::deleteAll();
+        MessageManager::deleteInstance();
+
+        return exitCode;
+    }
+
+    Queue queue;
+    if (queue.loadPlaylist(input) <= 0) {
+        std::cerr << "No playable tracks in " << input.getFullPathName() << std::endl;
+        return 1;
+    }
+
+    try {
+        Host host(queue, options);
+        host.startThread();
+
+        MessageManager::getInstance()->runDispatchLoop();
+    }
+    catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        exitCode = 1;
+    }
+
+    DeletedAtShutdown::deleteAll();
+    MessageManager::deleteInstance();
+
+    return exitCode;
+}
@@ -16,15 +16,34 @@
 #include <juce_audio_basics/juce_audio_basics.h>
 #include <juce_audio_devices/juce_audio_devices.h>
 #include <juce_audio_formats/juce_audio_formats.h>
-#include <juce_audio_processors/juce_audio_processors.h>
-#include <juce_audio_utils/juce_audio_utils.h>
 #include <juce_core/juce_core.h>
-#include <juce_data_structures/juce_data_structures.h>
 #include <juce_dsp/juce_dsp.h>
 #include <juce_events/juce_events.h>
+
+// Optional modules, a headless build (MEDLEY_HEADLESS) does not compile these
+#if JUCE_MODULE_AVAILABLE_juce_audio_processors
+#include <juce_audio_processors/juce_audio_processors.h>
+#endif
+
+#if JUCE_MODULE_AVAILABLE_juce_audio_utils
+#include <juce_audio_utils/juce_audio_utils.h>
+#endif
+
+#if JUCE_MODULE_AVAILABLE_juce_data_structures
+#include <juce_data_structures/juce_data_structures.h>
+#endif
+
+#if JUCE_MODULE_AVAILABLE_juce_graphics
 #include <juce_graphics/juce_graphics.h>
+#endif
+
+#if JUCE_MODULE_AVAILABLE_juce_gui_basics
 #include <juce_gui_basics/juce_gui_basics.h>
+#endif
+
+#if JUCE_MODULE_AVAILABLE_juce_gui_extra
 #include <juce_gui_extra/juce_gui_extra.h>
+#endif
 
 
 #if defined (JUCE_PROJUCER_VERSION) && JUCE_PROJUCER_VERSION < JUCE_VERSION
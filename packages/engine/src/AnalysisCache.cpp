@@ -0,0 +1,119 @@
+#include "AnalysisCache.h"
+
+namespace medley {
+
+namespace {
+    // Roughly what a node of std::map costs on top of its value
+    constexpr int64 kMapNodeOverhead = 4 * sizeof(void*);
+}
+
+AnalysisCache& AnalysisCache::getShared()
+{
+    static AnalysisCache instance;
+    return instance;
+}
+
+bool AnalysisCache::find(const File& file, double maxTransitionTime, TrackAnalysis& result) const
+{
+    const ScopedLock sl(lock);
+
+    auto it = entries.find(file.getFullPathName());
+    if (it == entries.end()) {
+        return false;
+    }
+
+    auto& entry = it->second;
+
+    if (entry.fileSize != file.getSize() || entry.modificationTime != file.getLastModificationTime()) {
+        erase(it);
+        return false;
+    }
+
+    if (!entry.analysis.tailAnalyzed || entry.analysis.maxTransitionTime != maxTransitionTime) {
+        return false;
+    }
+
+    entry.lastUsed = ++useCounter;
+    result = entry.analysis;
+    return true;
+}
+
+void AnalysisCache::store(const File& file, const TrackAnalysis& analysis)
+{
+    const ScopedLock sl(lock);
+
+    const auto path = file.getFullPathName();
+
+    // A replaced entry gives its charge back before negotiating again
+    auto existing = entries.find(path);
+    if (existing != entries.end()) {
+        erase(existing);
+    }
+
+    const auto desired = getEntrySize(path);
+    auto granted = memoryAccount.negotiate(MemoryBudget::Component::Analysis, desired, 0);
+
+    while (granted < desired || (int)entries.size() >= kMaxEntries) {
+        memoryAccount.release(MemoryBudget::Component::Analysis, granted);
+
+        if (!evictLeastRecentlyUsed()) {
+            // Nothing left to make room with, the analysis is simply not cached
+            return;
+        }
+
+        granted = memoryAccount.negotiate(MemoryBudget::Component::Analysis, desired, 0);
+    }
+
+    auto& entry = entries[path];
+    entry.fileSize = file.getSize();
+    entry.modificationTime = file.getLastModificationTime();
+    entry.analysis = analysis;
+    entry.lastUsed = ++useCounter;
+    entry.charge = granted;
+}
+
+void AnalysisCache::clear()
+{
+    const ScopedLock sl(lock);
+
+    while (!entries.empty()) {
+        erase(entries.begin());
+    }
+}
+
+int AnalysisCache::size() const
+{
+    const ScopedLock sl(lock);
+    return (int)entries.size();
+}
+
+int64 AnalysisCache::getEntrySize(const String& path)
+{
+    return (int64)sizeof(Entries::value_type) + kMapNodeOverhead + (int64)path.getNumBytesAsUTF8() + 1;
+}
+
+bool AnalysisCache::evictLeastRecentlyUsed()
+{
+    if (entries.empty()) {
+        return false;
+    }
+
+    auto oldest = entries.begin();
+
+    for (auto it = entries.begin(); it != entries.end(); it++) {
+        if (it->second.lastUsed < oldest->second.lastUsed) {
+            oldest = it;
+        }
+    }
+
+    erase(oldest);
+    return true;
+}
+
+void AnalysisCache::erase(Entries::iterator it) const
+{
+    memoryAccount.release(MemoryBudget::Component::Analysis, it->second.charge);
+    entries.erase(it);
+}
+
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "TrackAnalyzer.h"
+#include "MemoryBudget.h"
+#include <map>
+
+using namespace juce;
+
+namespace medley {
+
+/**
+ * Process-wide cache of track analysis, shared by every engine and the analyzer.
+ *
+ * Entries are keyed by the file path and invalidated when the file size or modification time changes.
+ * They are charged to the global budget as Analysis, least recently used entries are evicted whenever
+ * the budget grants less than a new entry needs.
+ */
+class AnalysisCache {
+public:
+    static constexpr int kMaxEntries = 4096;
+
+    static AnalysisCache& getShared();
+
+    // Only complete analysis made with the same maxTransitionTime is returned
+    bool find(const File& file, double maxTransitionTime, TrackAnalysis& result) const;
+
+    void store(const File& file, const TrackAnalysis& analysis);
+
+    void clear();
+
+    int size() const;
+
+    const MemoryBudget::Account& getMemoryAccount() const { return memoryAccount; }
+
+private:
+    struct Entry {
+        int64 fileSize = 0;
+        Time modificationTime;
+        TrackAnalysis analysis;
+        uint64 lastUsed = 0;
+        // Bytes charged to the account
+        int64 charge = 0;
+    };
+
+    using Entries = std::map<String, Entry>;
+
+    static int64 getEntrySize(const String& path);
+
+    // Returns false when the cache is already empty
+    bool evictLeastRecentlyUsed();
+
+    void erase(Entries::iterator it) const;
+
+    mutable MemoryBudget::Account memoryAccount{ "Analysis cache", MemoryBudget::getGlobal() };
+
+    CriticalSection lock;
+    mutable Entries entries;
+    mutable uint64 useCounter = 0;
+};
+
+}
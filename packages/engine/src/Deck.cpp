@@ -1,35 +1,88 @@
 #include "Deck.h"
+#include "MiniMP3AudioFormatReader.h"
+#include "AnalysisCache.h"
+#include "FormatSniffer.h"
 #include <inttypes.h>
 
 namespace {
-    static const auto kSilenceThreshold = Decibels::decibelsToGain(-60.0f);
-    static const auto kEndingSilenceThreshold = Decibels::decibelsToGain(-45.0f);
-    static const auto kFadingSilenceThreshold = Decibels::decibelsToGain(-23.0f);
+    constexpr int kBufferingTimeout = 1000;
 
-    constexpr float kFirstSoundDuration = 0.001f;
-    constexpr float kLastSoundDuration = 1.25f;
-    constexpr auto kLeadingScanningDuration = 10.0;
-    constexpr float kLastSoundScanningDurartion = 20.0f;
+    // Below this many seconds of playback before the results may be needed, tail scanning no longer gives way to loads
+    constexpr double kUrgentScanningSlack = 30.0;
+
+    constexpr double kReadAheadDuration = 2.0;
+    constexpr double kMinReadAheadDuration = 0.5;
+
+    int64 getReaderMemoryUsage(AudioFormatReader* reader) {
+        if (auto mp3 = dynamic_cast<MiniMP3AudioFormatReader*>(reader)) {
+            return mp3->getMemoryUsage();
+        }
+
+        // Other readers do not tell, their buffers are small compared to the read-ahead anyway
+        return 0;
+    }
+
+    constexpr float kMinus3dB = 0.7071f;
+
+    /**
+     * Left and right gains of a source channel folded down to stereo, ITU-R BS.775 style without the LFE.
+     * Channels are in the WAVE/FLAC/Vorbis default order for their count, the usual order for 3 to 8 channel files.
+     */
+    std::pair<float, float> getStereoDownmixGains(int numChannels, int channel) {
+        enum Position { L, R, C, LFE, LS, RS, CS, Other };
+
+        static const Position layouts[][8] = {
+            { L, R, C },                          // 3.0
+            { L, R, LS, RS },                     // Quad
+            { L, R, C, LS, RS },                  // 5.0
+            { L, R, C, LFE, LS, RS },             // 5.1
+            { L, R, C, LFE, CS, LS, RS },         // 6.1
+            { L, R, C, LFE, LS, RS, LS, RS }      // 7.1, back and side pairs fold the same way
+        };
+
+        auto position = numChannels >= 3 && numChannels <= 8 && channel < numChannels ? layouts[numChannels - 3][channel] : Other;
+
+        switch (position) {
+        case L: return { 1.0f, 0.0f };
+        case R: return { 0.0f, 1.0f };
+        case C: return { kMinus3dB, kMinus3dB };
+        case LFE: return { 0.0f, 0.0f };
+        case LS: return { kMinus3dB, 0.0f };
+        case RS: return { 0.0f, kMinus3dB };
+        default: return { 0.5f, 0.5f };
+        }
+    }
 }
 
 namespace medley {
 
-Deck::Deck(const String& name, AudioFormatManager& formatMgr, TimeSliceThread& loadingThread, TimeSliceThread& readAheadThread)
+Deck::Deck(const String& name, AudioFormatManager& formatMgr, TimeSliceThread& loadingThread, TimeSliceThread& readAheadThread, DecodePool& decodePool, MemoryBudget::Account* parentAccount, ScanCoordinator* scanCoordinator)
     :
+    memoryAccount(name, parentAccount),
     formatMgr(formatMgr),
     loadingThread(loadingThread),
     readAheadThread(readAheadThread),
+    decodePool(decodePool),
     name(name),
     loader(*this),
     scanningScheduler(*this),
+    scanCoordinator(scanCoordinator),
     playhead(*this)
 {
+    if (scanCoordinator != nullptr) {
+        scanCoordinator->addDeck(this);
+    }
+
     loadingThread.addTimeSliceClient(&loader);
     loadingThread.addTimeSliceClient(&scanningScheduler);
     readAheadThread.addTimeSliceClient(&playhead);
 }
 
 Deck::~Deck() {
+    if (scanCoordinator != nullptr) {
+        scanCoordinator->removeDeck(this);
+    }
+
     releaseChainedResources();
     unloadTrackInternal();
 }
@@ -57,7 +110,18 @@ bool Deck::loadTrack(const ITrack::Ptr track, bool play)
     }
 
 
-    auto format = formatMgr.findFormatForFileExtension(track->getFile().getFileExtension());
+    auto file = track->getFile();
+    auto format = formatMgr.findFormatForFileExtension(file.getFileExtension());
+
+    // Mislabeled files are still given a chance, from their content. Sniffed once, the loader is handed the result
+    AudioFormat* sniffedFormat = nullptr;
+
+    if (!format) {
+        if (auto stream = file.createInputStream()) {
+            format = sniffedFormat = FormatSniffer::sniff(formatMgr, *stream);
+        }
+    }
+
     if (!format) {
         Logger::writeToLog("Could not find appropriate format reader for " + track->getFile().getFullPathName());
         return false;
@@ -71,7 +135,8 @@ bool Deck::loadTrack(const ITrack::Ptr track, bool play)
     }
 
     playAfterLoading = play;
-    loader.load(track);
+    loadRequestedTime = Time::getMillisecondCounterHiRes();
+    loader.load(track, sniffedFormat);
 
     isTrackLoading = true;
     return true;
@@ -83,7 +148,18 @@ void Deck::unloadTrack()
     unloadTrackInternal();
 }
 
-void Deck::loadTrackInternal(const ITrack::Ptr track)
+std::unique_ptr<InputStream> Deck::openInputStream(const File& file)
+{
+    auto stream = file.createInputStream().release();
+
+    if (auto injector = faultInjector.load()) {
+        stream = injector->wrap(file, stream);
+    }
+
+    return std::unique_ptr<InputStream>(stream);
+}
+
+void Deck::loadTrackInternal(const ITrack::Ptr track, AudioFormat* sniffedFormat)
 {
     auto file = track->getFile();
     if (!file.existsAsFile()) {
@@ -91,7 +167,11 @@ void Deck::loadTrackInternal(const ITrack::Ptr track)
         return;
     }
 
-    auto newReader = formatMgr.createReaderFor(file);
+    // One stream, parsed by the format its header tells, unless loadTrack() already had to sniff it
+    AudioFormat* newFormat = sniffedFormat;
+    auto newReader = sniffedFormat != nullptr
+        ? FormatSniffer::createReaderFor(sniffedFormat, openInputStream(file))
+        : FormatSniffer::createReaderFor(formatMgr, openInputStream(file), &newFormat);
 
     if (!newReader) {
         Logger::writeToLog("Could not create format reader");
@@ -100,61 +180,51 @@ void Deck::loadTrackInternal(const ITrack::Ptr track)
 
     unloadTrackInternal();
     reader = newReader;
+    readerFormat = newFormat;
+
+    decoderCharge = getReaderMemoryUsage(reader);
+    memoryAccount.charge(MemoryBudget::Component::Decoder, decoderCharge);
 
-    auto mid = reader->lengthInSamples / 2;
-    firstAudibleSamplePosition = jmax(0LL, reader->searchForLevel(0, mid, kSilenceThreshold, 1.0, (int)(reader->sampleRate * kFirstSoundDuration)));
+    // Tracks analyzed before, by any engine or the analyzer, need no searching at all
+    TrackAnalysis analysis;
+    const auto analyzed = AnalysisCache::getShared().find(file, maxTransitionTime, analysis);
+
+    if (!analyzed) {
+        TrackAnalyzer::analyzeHead(*reader, maxTransitionTime, analysis);
+    }
+
+    firstAudibleSamplePosition = analysis.firstAudibleSamplePosition;
     totalSamplesToPlay = reader->lengthInSamples;
     lastAudibleSamplePosition = totalSamplesToPlay;
-    leadingSamplePosition = -1;
+    leadingSamplePosition = analysis.leadingSamplePosition;
+    leadingDuration = analysis.leadingDuration;
+    leadingDecibel = analysis.leadingDecibel;
+    introEndPosition = analysis.introEndPosition;
     trailingPosition = -1;
     trailingDuration = 0;
+    tailAnalyzed = false;
 
-    auto playDuration = getEndPosition();
-
-    if (playDuration >= 3) {
-        Range<float> maxLevels[2]{};
-        reader->readMaxLevels(firstAudibleSamplePosition, (int)(reader->sampleRate * jmax(maxTransitionTime, kLeadingScanningDuration)), maxLevels, 2);
-
-        auto leadingDecibel = Decibels::gainToDecibels((maxLevels[0].getEnd() + maxLevels[1].getEnd()) / 2.0f);
-        auto leadingLevel = jlimit(0.0f, 0.9f, Decibels::decibelsToGain(leadingDecibel - 6.0f));
-
-        leadingSamplePosition = reader->searchForLevel(
-            firstAudibleSamplePosition,
-            (int)(reader->sampleRate * kLeadingScanningDuration),
-            leadingLevel, 1.0,
-            (int)(reader->sampleRate * kFirstSoundDuration / 10)
-        );
-
-
-        if (leadingSamplePosition > -1) {
-            auto lead2 = reader->searchForLevel(
-                jmax(0LL, leadingSamplePosition - (int)(reader->sampleRate * 2.0)),
-                (int)(reader->sampleRate * 2.0),
-                leadingLevel * 0.33, 1.0,
-                0
-            );
-
-            if ((lead2 > firstAudibleSamplePosition) && (lead2 < leadingSamplePosition)) {
-                leadingSamplePosition = lead2;
-            }
-        }
-    }
-
-    leadingDuration = (leadingSamplePosition > -1) ? (leadingSamplePosition - firstAudibleSamplePosition) / reader->sampleRate : 0;
+    auto playDuration = totalSamplesToPlay / reader->sampleRate;
 
     Logger::writeToLog(String::formatted("[%s] Leading: duration=%.2f, position=%d", name.toWideCharPointer(), leadingDuration, leadingSamplePosition));
 
+    // Must be set before the source, so the state published from there refers to this track
+    this->track = track;
+
     setSource(new AudioFormatReaderSource(reader, false));
 
-    if (playDuration >= 3) {
+    if (analyzed) {
+        applyTail(analysis);
+    }
+    else if (playDuration >= 3) {
         scanningScheduler.scan(track);
     }
     else {
         calculateTransition();
     }
 
-    this->track = track;
     isTrackLoading = false;
+    lastLoadingTime = Time::getMillisecondCounterHiRes() - loadRequestedTime;
 
     listeners.call([this](Callback& cb) {
         cb.deckLoaded(*this);
@@ -184,10 +254,18 @@ void Deck::unloadTrackInternal()
             deckUnloaded = true;
         }
 
+        if (stretcher) {
+            delete stretcher;
+            stretcher = nullptr;
+        }
+
         if (bufferingSource) {
             delete bufferingSource;
             bufferingSource = nullptr;
             deckUnloaded = true;
+
+            memoryAccount.release(MemoryBudget::Component::ReadAhead, readAheadCharge);
+            readAheadCharge = 0;
         }
 
         if (source) {
@@ -199,7 +277,11 @@ void Deck::unloadTrackInternal()
         if (reader) {
             delete reader;
             reader = nullptr;
+            readerFormat = nullptr;
             deckUnloaded = true;
+
+            memoryAccount.release(MemoryBudget::Component::Decoder, decoderCharge);
+            decoderCharge = 0;
         }
     }
 
@@ -213,6 +295,10 @@ void Deck::unloadTrackInternal()
     pregain = 1.0f;
     volume = 1.0f;
     updateGain();
+
+    readPosition = 0;
+    bufferFill = 0.0;
+    publishState();
 }
 
 void Deck::scanTrackInternal(ITrack::Ptr trackToScan)
@@ -227,85 +313,144 @@ void Deck::scanTrackInternal(ITrack::Ptr trackToScan)
         cb.deckTrackScanning(*this);
     });
 
-    auto scanningReader = formatMgr.createReaderFor(file);
-
-    auto middlePosition = scanningReader->lengthInSamples / 2;
-    auto tailPosition = jmax(
-        firstAudibleSamplePosition,
-        middlePosition,
-        (int64)(scanningReader->lengthInSamples - scanningReader->sampleRate * kLastSoundScanningDurartion)
-    );
+    auto scanningStartTime = Time::getMillisecondCounterHiRes();
 
-    auto silencePosition = scanningReader->searchForLevel(
-        tailPosition,
-        scanningReader->lengthInSamples - tailPosition,
-        0, kSilenceThreshold,
-        (int)(scanningReader->sampleRate * kLastSoundDuration)
-    );
+    // Known from loading, no need to sniff again
+    AudioFormatReader* scanningReader = nullptr;
 
-    if (silencePosition < 0) {
-        silencePosition = 0;
+    if (readerFormat != nullptr) {
+        scanningReader = FormatSniffer::createReaderFor(readerFormat, openInputStream(file));
     }
 
-    if (silencePosition > firstAudibleSamplePosition) {
-        lastAudibleSamplePosition = silencePosition;
+    if (scanningReader == nullptr) {
+        scanningReader = FormatSniffer::createReaderFor(formatMgr, openInputStream(file));
     }
 
-    auto endPosition = scanningReader->searchForLevel(
-        silencePosition,
-        scanningReader->lengthInSamples - silencePosition,
-        0, kSilenceThreshold,
-        (int)(scanningReader->sampleRate * 0.004)
-    );
-
-    if (endPosition > lastAudibleSamplePosition) {
-        totalSamplesToPlay = endPosition;
+    if (scanningReader == nullptr) {
+        Logger::writeToLog("Cancel track scanning, could not create format reader: " + file.getFullPathName());
+        return;
     }
 
-    trailingPosition = scanningReader->searchForLevel(
-        tailPosition,
-        totalSamplesToPlay - tailPosition,
-        0, kFadingSilenceThreshold,
-        (int)(scanningReader->sampleRate * 0.8)
-    );
+    auto scanningCharge = getReaderMemoryUsage(scanningReader);
+    memoryAccount.charge(MemoryBudget::Component::Analysis, scanningCharge);
 
-    trailingDuration = (trailingPosition > -1) ? (lastAudibleSamplePosition - trailingPosition) / scanningReader->sampleRate : 0;
+    auto analysis = getAnalysis();
+    TrackAnalyzer::analyzeTail(*scanningReader, analysis);
 
     delete scanningReader;
+    memoryAccount.release(MemoryBudget::Component::Analysis, scanningCharge);
 
-    calculateTransition();
+    lastScanningTime = Time::getMillisecondCounterHiRes() - scanningStartTime;
+
+    applyTail(analysis);
+
+    AnalysisCache::getShared().store(file, getAnalysis());
 
     listeners.call([this](Callback& cb) {
         cb.deckTrackScanned(*this);
     });
 }
 
+double Deck::getScanningSlack() const
+{
+    auto currentState = getState();
+
+    if (currentState->sourceSampleRate <= 0.0) {
+        return 0.0;
+    }
+
+    // The earliest cue the scanning could come up with, the trailing search starts this far from the end
+    auto duration = currentState->totalSourceLength / currentState->sourceSampleRate;
+    auto earliestCue = duration - TrackAnalyzer::kTailScanningDuration - jmax(TrackAnalyzer::kLeadingScanningDuration, maxTransitionTime);
+
+    // A stopped deck may be started at any time, so the clock is assumed to be running
+    return earliestCue - readPosition / currentState->sourceSampleRate;
+}
+
 void Deck::calculateTransition()
 {
-    transitionStartPosition = lastAudibleSamplePosition / sourceSampleRate;
-    transitionEndPosition = transitionStartPosition;
+    auto analysis = getAnalysis();
+    analysis.calculateTransition();
 
-    if (trailingDuration > 0.0 && maxTransitionTime > 0.0)
-    {
+    transitionPreCuePosition = analysis.transitionPreCuePosition;
+    transitionCuePosition = analysis.transitionCuePosition;
+    transitionStartPosition = analysis.transitionStartPosition;
+    transitionEndPosition = analysis.transitionEndPosition;
 
-        if (trailingDuration >= maxTransitionTime) {
-            transitionStartPosition = trailingPosition / sourceSampleRate;
-            transitionEndPosition = transitionStartPosition + maxTransitionTime;
-        }
-        else {
-            transitionStartPosition = jmax(2.0, transitionEndPosition - trailingDuration);
-        }
-    }
+    publishState();
+}
+
+TrackAnalysis Deck::getAnalysis() const
+{
+    TrackAnalysis analysis;
+
+    analysis.sampleRate = sourceSampleRate;
+    analysis.lengthInSamples = sourceLength;
+    analysis.maxTransitionTime = maxTransitionTime;
+    analysis.firstAudibleSamplePosition = firstAudibleSamplePosition;
+    analysis.lastAudibleSamplePosition = lastAudibleSamplePosition;
+    analysis.totalSamplesToPlay = totalSamplesToPlay;
+    analysis.leadingSamplePosition = leadingSamplePosition;
+    analysis.leadingDuration = leadingDuration;
+    analysis.leadingDecibel = leadingDecibel;
+    analysis.introEndPosition = introEndPosition;
+    analysis.trailingPosition = trailingPosition;
+    analysis.trailingDuration = trailingDuration;
+    analysis.transitionPreCuePosition = transitionPreCuePosition;
+    analysis.transitionCuePosition = transitionCuePosition;
+    analysis.transitionStartPosition = transitionStartPosition;
+    analysis.transitionEndPosition = transitionEndPosition;
+    analysis.tailAnalyzed = tailAnalyzed;
+
+    return analysis;
+}
+
+void Deck::applyTail(const TrackAnalysis& analysis)
+{
+    lastAudibleSamplePosition = analysis.lastAudibleSamplePosition;
+    totalSamplesToPlay = analysis.totalSamplesToPlay;
+    trailingPosition = analysis.trailingPosition;
+    trailingDuration = analysis.trailingDuration;
+    tailAnalyzed = true;
+
+    calculateTransition();
+}
+
+void Deck::publishState()
+{
+    auto newState = std::make_shared<State>();
 
-    transitionCuePosition = jmax(0.0, transitionStartPosition - jmax(kLeadingScanningDuration, maxTransitionTime));
-    if (transitionCuePosition == 0.0) {
-        transitionCuePosition = jmax(0.0, transitionStartPosition - jmax(kLeadingScanningDuration, maxTransitionTime) / 2.0);
+    newState->track = track;
+    newState->totalSourceLength = sourceLength;
+    newState->sourceSampleRate = sourceSampleRate;
+    newState->looping = sourceLooping;
+    newState->firstAudibleSamplePosition = firstAudibleSamplePosition;
+    newState->totalSamplesToPlay = totalSamplesToPlay;
+    newState->leadingSamplePosition = leadingSamplePosition;
+    newState->leadingDuration = leadingDuration;
+    newState->introEndPosition = introEndPosition;
+    newState->trailingPosition = trailingPosition;
+    newState->trailingDuration = trailingDuration;
+    newState->transitionPreCuePosition = transitionPreCuePosition;
+    newState->transitionCuePosition = transitionCuePosition;
+    newState->transitionStartPosition = transitionStartPosition;
+    newState->transitionEndPosition = transitionEndPosition;
+
+    std::atomic_store(&state, StatePtr(std::move(newState)));
+}
+
+void Deck::publishPosition()
+{
+    if (bufferingSource == nullptr || source == nullptr) {
+        return;
     }
 
-    transitionPreCuePosition = jmax(0.0, transitionCuePosition - 1.0);
+    auto position = bufferingSource->getNextReadPosition();
+    readPosition = stretcher != nullptr ? stretcher->getNextReadPosition() : position;
 
-    if (transitionPreCuePosition == transitionCuePosition) {
-        transitionCuePosition = jmin(transitionPreCuePosition + 1, transitionEndPosition);
+    // Decoding is always ahead of playback by the amount of samples buffered
+    if (bufferingSize > 0) {
+        bufferFill = jlimit(0.0, 1.0, (double)(bufferingSource->getDecodedPosition() - position) / bufferingSize);
     }
 }
 
@@ -334,7 +479,27 @@ void Deck::getNextAudioBlock(const AudioSourceChannelInfo& info)
 
     if (resamplerSource != nullptr && !stopped)
     {
-        resamplerSource->getNextAudioBlock(info);
+        updatePlaybackSpeed(info.numSamples);
+
+        if (waitsForBuffering) {
+            const double ratio = getResamplingRatio();
+            // A few more samples for the resampler's interpolation
+            AudioSourceChannelInfo sourceInfo(info.buffer, info.startSample, (int)std::ceil(info.numSamples * ratio) + 4);
+
+            // Returns right away when not stretching, the buffering source may be needed for the rest of the block
+            stretcher->waitForNextAudioBlockReady(sourceInfo.numSamples, kBufferingTimeout);
+            bufferingSource->waitForNextAudioBlockReady(sourceInfo, kBufferingTimeout);
+        }
+
+        renderSource(info);
+
+        const auto currentUnderruns = bufferingSource->getNumUnderruns() + stretcher->getNumUnderruns();
+
+        if (currentUnderruns > sourceUnderruns) {
+            numUnderruns += currentUnderruns - sourceUnderruns;
+        }
+
+        sourceUnderruns = currentUnderruns;
 
         if (!playing)
         {
@@ -348,7 +513,7 @@ void Deck::getNextAudioBlock(const AudioSourceChannelInfo& info)
             }
         }
 
-        if (bufferingSource->getNextReadPosition() > totalSamplesToPlay + 1 && !bufferingSource->isLooping())
+        if (stretcher->getNextReadPosition() > totalSamplesToPlay + 1 && !bufferingSource->isLooping())
         {
             playing = false;
             inputStreamEOF = true;
@@ -359,6 +524,8 @@ void Deck::getNextAudioBlock(const AudioSourceChannelInfo& info)
         for (int i = info.buffer->getNumChannels(); --i >= 0;) {
             info.buffer->applyGainRamp(i, info.startSample, info.numSamples, lastGain, gain);
         }
+
+        publishPosition();
     }
     else
     {
@@ -374,6 +541,66 @@ void Deck::getNextAudioBlock(const AudioSourceChannelInfo& info)
     }
 }
 
+void Deck::renderSource(const AudioSourceChannelInfo& info)
+{
+    const auto outputChannels = info.buffer->getNumChannels();
+
+    // Wider outputs take the source channels as they come
+    if (sourceChannels <= outputChannels || outputChannels > 2 || downmixBuffer.getNumChannels() < sourceChannels) {
+        resamplerSource->getNextAudioBlock(info);
+        fillUnusedChannels(info);
+        return;
+    }
+
+    // Rendered with every source channel, then folded down, in slices when the device sends a larger block than announced
+    for (int offset = 0; offset < info.numSamples;) {
+        const auto numSamples = jmin(info.numSamples - offset, downmixBuffer.getNumSamples());
+        const auto startSample = info.startSample + offset;
+
+        resamplerSource->getNextAudioBlock(AudioSourceChannelInfo(&downmixBuffer, 0, numSamples));
+
+        info.buffer->clear(startSample, numSamples);
+
+        for (int i = 0; i < sourceChannels; i++) {
+            auto gains = getStereoDownmixGains(sourceChannels, i);
+
+            if (outputChannels == 1) {
+                info.buffer->addFrom(0, startSample, downmixBuffer, i, 0, numSamples, (gains.first + gains.second) * 0.5f);
+                continue;
+            }
+
+            if (gains.first > 0.0f) {
+                info.buffer->addFrom(0, startSample, downmixBuffer, i, 0, numSamples, gains.first);
+            }
+
+            if (gains.second > 0.0f) {
+                info.buffer->addFrom(1, startSample, downmixBuffer, i, 0, numSamples, gains.second);
+            }
+        }
+
+        offset += numSamples;
+    }
+}
+
+void Deck::fillUnusedChannels(const AudioSourceChannelInfo& info)
+{
+    // The resampler only touches as many channels as the source has
+    const auto outputChannels = info.buffer->getNumChannels();
+
+    if (sourceChannels >= outputChannels) {
+        return;
+    }
+
+    for (int i = sourceChannels; i < outputChannels; i++) {
+        if (sourceChannels == 1) {
+            info.buffer->copyFrom(i, info.startSample, *info.buffer, 0, info.startSample, info.numSamples);
+        }
+        else {
+            info.buffer->clear(i, info.startSample, info.numSamples);
+        }
+    }
+}
+
 void Deck::setNextReadPosition(int64 newPosition)
 {
     if (bufferingSource != nullptr)
@@ -381,21 +608,26 @@ void Deck::setNextReadPosition(int64 newPosition)
         if (sampleRate > 0 && sourceSampleRate > 0)
             newPosition = (int64)((double)newPosition * sourceSampleRate / sampleRate);
 
-        bufferingSource->setNextReadPosition(newPosition);
+        // Seeking drops any tempo ramp
+        stretcher->setNextReadPosition(newPosition);
 
         if (resamplerSource != nullptr)
             resamplerSource->flushBuffers();
 
         inputStreamEOF = false;
+
+        publishPosition();
     }
 }
 
 int64 Deck::getNextReadPosition() const
 {
-    if (bufferingSource != nullptr)
+    auto current = getState();
+
+    if (current->track != nullptr)
     {
-        const double ratio = (sampleRate > 0 && sourceSampleRate > 0) ? sampleRate / sourceSampleRate : 1.0;
-        return (int64)((double)bufferingSource->getNextReadPosition() * ratio);
+        const double ratio = (sampleRate > 0 && current->sourceSampleRate > 0) ? sampleRate / current->sourceSampleRate : 1.0;
+        return (int64)((double)readPosition * ratio);
     }
 
     return 0;
@@ -403,20 +635,15 @@ int64 Deck::getNextReadPosition() const
 
 int64 Deck::getTotalLength() const
 {
-    const ScopedLock sl(sourceLock);
+    auto current = getState();
 
-    if (bufferingSource != nullptr)
-    {
-        const double ratio = (sampleRate > 0 && sourceSampleRate > 0) ? sampleRate / sourceSampleRate : 1.0;
-        return (int64)((double)bufferingSource->getTotalLength() * ratio);
-    }
-    return 0;
+    const double ratio = (sampleRate > 0 && current->sourceSampleRate > 0) ? sampleRate / current->sourceSampleRate : 1.0;
+    return (int64)((double)current->totalSourceLength * ratio);
 }
 
 bool Deck::isLooping() const
 {
-    const ScopedLock sl(sourceLock);
-    return bufferingSource != nullptr && bufferingSource->isLooping();
+    return getState()->looping;
 }
 
 bool Deck::start()
@@ -424,6 +651,13 @@ bool Deck::start()
     Logger::writeToLog("Try to start playing");
     if ((!playing) && resamplerSource != nullptr)
     {
+        // Never waits, this may run on the read-ahead thread itself. A ramp not primed yet holds its output and
+        // position on the audio thread until its first grains are ready, it only gets them sooner from here.
+        // Outside of sourceLock, the stretcher is only replaced by loading a track
+        if (stretcher != nullptr && !stretcher->prime()) {
+            Logger::writeToLog(String::formatted("[%s] Tempo ramp not primed yet, starting when it is", name.toWideCharPointer()));
+        }
+
         playing = true;
         stopped = false;
         fading = false;
@@ -441,6 +675,20 @@ bool Deck::start()
     return false;
 }
 
+bool Deck::startTempoRamp(double speed, double durationInSeconds)
+{
+    const ScopedLock sl(sourceLock);
+
+    if (stretcher == nullptr || playing || durationInSeconds <= 0.0) {
+        return false;
+    }
+
+    Logger::writeToLog(String::formatted("[%s] Tempo ramp: speed=%.3f, duration=%.2f", name.toWideCharPointer(), speed, durationInSeconds));
+
+    stretcher->startTempoRamp(speed, (int64)(durationInSeconds * sourceSampleRate));
+    return true;
+}
+
 void Deck::stop()
 {
     if (playing)
@@ -474,12 +722,14 @@ void Deck::setMaxTransitionTime(double duration)
 }
 
 double Deck::getFirstAudiblePosition() const {
-    return (double)firstAudibleSamplePosition / sourceSampleRate;
+    auto current = getState();
+    return (double)current->firstAudibleSamplePosition / current->sourceSampleRate;
 }
 
 double Deck::getEndPosition() const
 {
-    return totalSamplesToPlay / sourceSampleRate;
+    auto current = getState();
+    return current->totalSamplesToPlay / current->sourceSampleRate;
 }
 
 void Deck::fadeOut()
@@ -488,6 +738,8 @@ void Deck::fadeOut()
         transitionCuePosition = transitionStartPosition = getPositionInSeconds();
         transitionEndPosition = jmin(transitionStartPosition + maxTransitionTime, totalSamplesToPlay * sourceSampleRate);
         fading = true;
+
+        publishState();
     }
 }
 
@@ -496,6 +748,60 @@ void Deck::addListener(Callback* cb) {
     listeners.add(cb);
 }
 
+void Deck::setPlaybackSpeed(double speed, double rampDuration)
+{
+    const ScopedLock sl(speedLock);
+
+    const auto numRampSamples = rampDuration * sampleRate;
+
+    // Without a ramp the step is zero, the audio thread then jumps straight to the target
+    const auto step = numRampSamples > 0.0 ? (speed - playbackSpeed) / numRampSamples : 0.0;
+
+    speedSequence++;
+    targetSpeed = speed;
+    speedStep = step;
+    speedSequence++;
+}
+
+void Deck::updatePlaybackSpeed(int numSamples)
+{
+    // Never wait for the writer: a pair caught while being written is ignored, the last one is used again this block
+    const auto sequence = speedSequence.load();
+
+    if ((sequence & 1) == 0) {
+        const double target = targetSpeed;
+        const double step = speedStep;
+
+        if (speedSequence.load() == sequence) {
+            appliedTargetSpeed = target;
+            appliedSpeedStep = step;
+        }
+    }
+
+    const auto target = appliedTargetSpeed;
+    const auto step = appliedSpeedStep;
+    const double current = playbackSpeed;
+
+    if (current == target) {
+        return;
+    }
+
+    auto next = current + step * numSamples;
+
+    // Also covers a step left over from an earlier target
+    if (step == 0.0 || (step > 0.0) == (next >= target)) {
+        next = target;
+    }
+
+    playbackSpeed = next;
+    resamplerSource->setResamplingRatio(getResamplingRatio());
+}
+
+double Deck::getResamplingRatio() const
+{
+    return (sampleRate > 0 && sourceSampleRate > 0) ? sourceSampleRate / sampleRate * playbackSpeed : playbackSpeed.load();
+}
+
 void Deck::removeListener(Callback* cb)
 {
     listeners.remove(cb);
@@ -508,12 +814,16 @@ void Deck::prepareToPlay(int samplesPerBlockExpected, double newSampleRate)
     sampleRate = newSampleRate;
     blockSize = samplesPerBlockExpected;
 
+    if (sourceChannels > 2) {
+        downmixBuffer.setSize(sourceChannels, blockSize);
+    }
+
     if (resamplerSource != nullptr) {
         resamplerSource->prepareToPlay(samplesPerBlockExpected, sampleRate);
     }
 
     if (resamplerSource != nullptr && sourceSampleRate > 0) {
-        resamplerSource->setResamplingRatio(sourceSampleRate / sampleRate);
+        resamplerSource->setResamplingRatio(getResamplingRatio());
     }
 
     inputStreamEOF = false;
@@ -537,30 +847,73 @@ void Deck::setSource(AudioFormatReaderSource* newSource)
         setSource(nullptr);
     }
 
-    BufferingAudioSource* newBufferingSource = nullptr;
+    DecodeAheadSource* newBufferingSource = nullptr;
     ResamplingAudioSource* newResamplerSource = nullptr;
 
-    std::unique_ptr<BufferingAudioSource> oldBufferingSource(bufferingSource);
+    TimeStretcher* newStretcher = nullptr;
+
+    // Destroyed in reverse order, each before its input
+    std::unique_ptr<DecodeAheadSource> oldBufferingSource(bufferingSource);
+    std::unique_ptr<TimeStretcher> oldStretcher(stretcher);
     std::unique_ptr<ResamplingAudioSource> oldResamplerSource(resamplerSource);
 
+    memoryAccount.release(MemoryBudget::Component::ReadAhead, readAheadCharge);
+    readAheadCharge = 0;
+
     if (newSource != nullptr) {
-        sourceSampleRate = newSource->getAudioFormatReader()->sampleRate;
+        auto newReader = newSource->getAudioFormatReader();
+        sourceSampleRate = newReader->sampleRate;
 
-        newBufferingSource = new BufferingAudioSource(newSource, readAheadThread, false, (int)(sourceSampleRate * 2), 2);
+        // Buffer and resample only the channels the source actually has, mono is spread to every output channel later
+        auto numChannels = jmax(1, (int)newReader->numChannels);
+
+        // The read-ahead window shrinks when the memory budget is tight
+        const auto bytesPerSample = (int64)numChannels * DecodeAheadSource::getBytesPerSample(halfPrecisionBuffers);
+
+        readAheadCharge = memoryAccount.negotiate(
+            MemoryBudget::Component::ReadAhead,
+            (int64)(sourceSampleRate * kReadAheadDuration) * bytesPerSample,
+            (int64)(sourceSampleRate * kMinReadAheadDuration) * bytesPerSample
+        );
+
+        // Decoded by the shared pool, so a heavy decode here does not hold up the other deck
+        newBufferingSource = new DecodeAheadSource(newSource, decodePool, (int)(readAheadCharge / bytesPerSample), numChannels, halfPrecisionBuffers);
         newBufferingSource->setNextReadPosition(firstAudibleSamplePosition);
 
-        newResamplerSource = new ResamplingAudioSource(newBufferingSource, false, 2);
+        // The ring is rounded down to whole blocks
+        bufferingSize = newBufferingSource->getCapacity();
+
+        if (readAheadCharge > bufferingSize * bytesPerSample) {
+            memoryAccount.release(MemoryBudget::Component::ReadAhead, readAheadCharge - bufferingSize * bytesPerSample);
+            readAheadCharge = bufferingSize * bytesPerSample;
+        }
+
+        newStretcher = new TimeStretcher(newBufferingSource, newReader, newBufferingSource->getReaderLock(), numChannels, readAheadThread);
+        newResamplerSource = new ResamplingAudioSource(newStretcher, false, numChannels);
+        sourceChannels = numChannels;
+
+        // Surround sources are folded down to stereo, with a scratch buffer holding every channel
+        if (numChannels > 2) {
+            downmixBuffer.setSize(numChannels, blockSize);
+        }
 
         if (isPrepared)
         {
-            newResamplerSource->setResamplingRatio(sourceSampleRate / sampleRate);
+            newResamplerSource->setResamplingRatio(getResamplingRatio());
             newResamplerSource->prepareToPlay(blockSize, sampleRate);
         }
     }
 
     source = newSource;
     bufferingSource = newBufferingSource;
+    stretcher = newStretcher;
     resamplerSource = newResamplerSource;
+    sourceUnderruns = 0;
+
+    sourceLength = newSource != nullptr ? newSource->getTotalLength() : 0;
+    sourceLooping = newSource != nullptr && newSource->isLooping();
+    readPosition = newBufferingSource != nullptr ? newBufferingSource->getNextReadPosition() : 0;
+    bufferFill = 0.0;
 
     inputStreamEOF = false;
     playing = false;
@@ -595,32 +948,53 @@ int Deck::Loader::useTimeSlice()
     ScopedLock sl(lock);
 
     if (track != nullptr) {
-        deck.loadTrackInternal(track);
+        deck.loadTrackInternal(track, format);
         track = nullptr;
+        format = nullptr;
     }
 
     return 100;
 }
 
-void Deck::Loader::load(const ITrack::Ptr track)
+void Deck::Loader::load(const ITrack::Ptr track, AudioFormat* format)
 {
     ScopedLock sl(lock);
     this->track = track;
+    this->format = format;
 }
 
 int Deck::Scanner::useTimeSlice()
 {
-    if (track) {
-        deck.scanTrackInternal(track);
+    if (!track) {
+        return 100;
+    }
+
+    // Unloaded or replaced while waiting
+    if (deck.getState()->track != track) {
         track = nullptr;
+        return 100;
     }
 
+    // The tail is only needed once the play head gets near the cue, until then a load on another deck goes first
+    auto slack = deck.getScanningSlack();
+
+    if (slack > kUrgentScanningSlack && deck.scanCoordinator != nullptr && deck.scanCoordinator->isLoadingOtherThan(&deck)) {
+        // Look again sooner as the deadline gets closer
+        return jlimit(10, 250, roundToInt((slack - kUrgentScanningSlack) * 10.0));
+    }
+
+    deck.lastScanningDelay = Time::getMillisecondCounterHiRes() - requestedTime;
+
+    deck.scanTrackInternal(track);
+    track = nullptr;
+
     return 100;
 }
 
 void Deck::Scanner::scan(const ITrack::Ptr track)
 {
     this->track = track;
+    requestedTime = Time::getMillisecondCounterHiRes();
 }
 
 int Deck::PlayHead::useTimeSlice()
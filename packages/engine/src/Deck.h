@@ -2,6 +2,12 @@
 
 #include <JuceHeader.h>
 #include "ITrack.h"
+#include "MemoryBudget.h"
+#include "ScanCoordinator.h"
+#include "TrackAnalyzer.h"
+#include "TimeStretcher.h"
+#include "DecodeAheadSource.h"
+#include "FaultInjector.h"
 
 using namespace juce;
 
@@ -26,7 +32,37 @@ public:
         virtual void deckUnloaded(Deck& sender) = 0;
     };
 
-    Deck(const String& name, AudioFormatManager& formatMgr, TimeSliceThread& loadingThread, TimeSliceThread& readAheadThread);
+    /**
+     * Immutable view of the loaded track, republished whenever the track or its cue points change.
+     *
+     * Getters called from control threads read from the latest snapshot, so they never wait on the audio callback.
+     */
+    struct State {
+        ITrack::Ptr track;
+        int64 totalSourceLength = 0;
+        double sourceSampleRate = 0.0;
+        bool looping = false;
+
+        int64 firstAudibleSamplePosition = 0;
+        int64 totalSamplesToPlay = 0;
+
+        int64 leadingSamplePosition = 0;
+        double leadingDuration = 0.0;
+
+        int64 introEndPosition = -1;
+
+        int64 trailingPosition = 0;
+        double trailingDuration = 0.0;
+
+        double transitionPreCuePosition = 0.0;
+        double transitionCuePosition = 0.0;
+        double transitionStartPosition = 0.0;
+        double transitionEndPosition = 0.0;
+    };
+
+    using StatePtr = std::shared_ptr<const State>;
+
+    Deck(const String& name, AudioFormatManager& formatMgr, TimeSliceThread& loadingThread, TimeSliceThread& readAheadThread, DecodePool& decodePool, MemoryBudget::Account* parentAccount = nullptr, ScanCoordinator* scanCoordinator = nullptr);
 
     ~Deck() override;
 
@@ -68,8 +104,11 @@ public:
 
     bool isLooping() const override;
 
-    ITrack::Ptr getTrack() const { return track; }
+    ITrack::Ptr getTrack() const { return getState()->track; }
 
+    StatePtr getState() const { return std::atomic_load(&state); }
+
+    // Never waits, a tempo ramp still priming starts playing on the audio thread once its first grains are ready
     bool start();
 
     void stop();
@@ -87,15 +126,15 @@ public:
 
     double getSampleRate() const { return sampleRate; }
 
-    double getSourceSampleRate() const { return sourceSampleRate; }
+    double getSourceSampleRate() const { return getState()->sourceSampleRate; }
 
-    double getTransitionPreCuePosition() const { return transitionPreCuePosition; }
+    double getTransitionPreCuePosition() const { return getState()->transitionPreCuePosition; }
 
-    double getTransitionCuePosition() const { return transitionCuePosition; }
+    double getTransitionCuePosition() const { return getState()->transitionCuePosition; }
 
-    double getTransitionStartPosition() const { return transitionStartPosition; }
+    double getTransitionStartPosition() const { return getState()->transitionStartPosition; }
 
-    double getTransitionEndPosition() const { return transitionEndPosition; }
+    double getTransitionEndPosition() const { return getState()->transitionEndPosition; }
 
     double getMaxTransitionTime() const { return maxTransitionTime; }
 
@@ -105,13 +144,19 @@ public:
 
     double getEndPosition() const;
 
-    int64 getLeadingSamplePosition() const { return leadingSamplePosition; }
+    int64 getLeadingSamplePosition() const { return getState()->leadingSamplePosition; }
 
-    double getLeadingDuration() const { return leadingDuration; }
+    double getLeadingDuration() const { return getState()->leadingDuration; }
 
-    int64 getTrailingSamplePosition() const { return trailingPosition; }
+    // Where vocals most likely start in seconds, -1 when unknown
+    double getIntroEndPosition() const {
+        auto current = getState();
+        return (current->introEndPosition > -1 && current->sourceSampleRate > 0) ? current->introEndPosition / current->sourceSampleRate : -1.0;
+    }
 
-    double getTrailingDuration() const { return trailingDuration; }
+    int64 getTrailingSamplePosition() const { return getState()->trailingPosition; }
+
+    double getTrailingDuration() const { return getState()->trailingDuration; }
 
     bool shouldPlayAfterLoading() const { return playAfterLoading; }
 
@@ -119,8 +164,45 @@ public:
 
     inline bool isFading() const { return fading; }
 
+    // Fraction of the read-ahead buffer which is currently filled, 0.0 to 1.0
+    double getBufferFill() const { return bufferFill; }
+
+    /**
+     * Varispeed through the resampler, changing tempo and pitch together. The audio thread glides to the new speed
+     * over rampDuration seconds. Positions and durations stay in track time, only the time they take to play changes.
+     */
+    void setPlaybackSpeed(double speed, double rampDuration);
+
+    // Current speed, 1.0 is the normal speed
+    double getPlaybackSpeed() const { return playbackSpeed; }
+
+    // Read-ahead held as half-precision floats, for half the memory. Takes effect from the next track loaded
+    void setHalfPrecisionBuffers(bool enabled) { halfPrecisionBuffers = enabled; }
+
+    bool hasHalfPrecisionBuffers() const { return halfPrecisionBuffers; }
+
+    // Milliseconds taken by the last track loading, from loadTrack() to the track being ready
+    double getLastLoadingTime() const { return lastLoadingTime; }
+
+    // Milliseconds taken by the last tail scanning
+    double getLastScanningTime() const { return lastScanningTime; }
+
+    // Milliseconds the last tail scanning was held back to let other decks load
+    double getLastScanningDelay() const { return lastScanningDelay; }
+
+    void setWaitsForBuffering(bool shouldWait) { waitsForBuffering = shouldWait; }
+
+    // Files opened from now on are read through the injector, nullptr to stop. The injector must outlive the deck
+    void setFaultInjector(FaultInjector* injector) { faultInjector = injector; }
+
+    // Blocks rendered with the read-ahead or the stretcher running dry, over every track played so far
+    int64 getNumUnderruns() const { return numUnderruns; }
+
+    const MemoryBudget::Account& getMemoryAccount() const { return memoryAccount; }
+
 private:
     friend class Medley;
+    friend class ScanCoordinator;
 
     class Loader : public TimeSliceClient {
     public:
@@ -128,10 +210,12 @@ private:
         ~Loader() override;
         int useTimeSlice() override;
 
-        void load(const ITrack::Ptr track);
+        // format is the one sniffed from a mislabeled file, nullptr to sniff while loading
+        void load(const ITrack::Ptr track, AudioFormat* format = nullptr);
     private:
         Deck& deck;
         ITrack::Ptr track = nullptr;
+        AudioFormat* format = nullptr;
         CriticalSection lock;
     };
 
@@ -144,6 +228,7 @@ private:
     private:
         Deck& deck;
         ITrack::Ptr track = nullptr;
+        double requestedTime = 0.0;
     };
 
     class PlayHead : public TimeSliceClient {
@@ -155,6 +240,9 @@ private:
         double lastPosition = 0;
     };
 
+    // Plays at the given speed from the start, back to unity over the duration. Only before the deck starts playing
+    bool startTempoRamp(double speed, double durationInSeconds);
+
     void setVolume(float newVolume) {
         volume = newVolume;
         updateGain();
@@ -162,16 +250,41 @@ private:
 
     void setSource(AudioFormatReaderSource* newSource);
 
+    // Audio thread, moves the playback speed towards its target
+    void updatePlaybackSpeed(int numSamples);
+
+    double getResamplingRatio() const;
+
     void releaseChainedResources();
 
-    void loadTrackInternal(const ITrack::Ptr track);
+    // Resampler output into the block, surround sources are folded down to stereo or mono
+    void renderSource(const AudioSourceChannelInfo& info);
+
+    void fillUnusedChannels(const AudioSourceChannelInfo& info);
+
+    // Through the fault injector when there is one
+    std::unique_ptr<InputStream> openInputStream(const File& file);
+
+    void loadTrackInternal(const ITrack::Ptr track, AudioFormat* sniffedFormat);
 
     void unloadTrackInternal();
 
+    // Seconds of playback left before the tail scanning results may be needed
+    double getScanningSlack() const;
+
     void scanTrackInternal(ITrack::Ptr trackToScan);
 
     void calculateTransition();
 
+    TrackAnalysis getAnalysis() const;
+
+    // Takes the results of tail scanning and recalculates the transition
+    void applyTail(const TrackAnalysis& analysis);
+
+    void publishState();
+
+    void publishPosition();
+
     void firePositionChangeCalback(double position);
 
     void fireFinishedCallback();
@@ -195,7 +308,8 @@ private:
 
     void fadeOut();
 
-    bool isTrackLoading = false;
+    // Read by other decks' scan threads through ScanCoordinator
+    std::atomic<bool> isTrackLoading{ false };
     ITrack::Ptr track = nullptr;
 
     std::atomic<bool> playing{ false };
@@ -210,18 +324,38 @@ private:
     float gain = 1.0f;
     float lastGain = 1.0f;
 
+    MemoryBudget::Account memoryAccount;
+    int64 readAheadCharge = 0;
+    int64 decoderCharge = 0;
+
     AudioFormatManager& formatMgr;
     TimeSliceThread& loadingThread;
     TimeSliceThread& readAheadThread;
+    DecodePool& decodePool;
 
     AudioFormatReader* reader = nullptr;
+    // The format which made the reader, reused for the tail scanning
+    AudioFormat* readerFormat = nullptr;
     AudioFormatReaderSource* source = nullptr;
     ResamplingAudioSource* resamplerSource = nullptr;
-    BufferingAudioSource* bufferingSource = nullptr;
+    DecodeAheadSource* bufferingSource = nullptr;
+    TimeStretcher* stretcher = nullptr;
 
     int blockSize = 128;
+    int bufferingSize = 0;
+    int sourceChannels = 2;
+    AudioBuffer<float> downmixBuffer;
+    int64 sourceLength = 0;
+    bool sourceLooping = false;
     bool isPrepared = false;
     bool inputStreamEOF = false;
+    bool waitsForBuffering = false;
+    std::atomic<bool> halfPrecisionBuffers{ false };
+
+    std::atomic<FaultInjector*> faultInjector{ nullptr };
+    std::atomic<int64> numUnderruns{ 0 };
+    // As last seen from the current sources, which count from zero
+    int64 sourceUnderruns = 0;
 
     CriticalSection sourceLock;
     //
@@ -232,17 +366,22 @@ private:
     bool playAfterLoading = false;
 
     Scanner scanningScheduler;
+    ScanCoordinator* scanCoordinator;
     PlayHead playhead;
 
     int64 firstAudibleSamplePosition = 0;
     int64 lastAudibleSamplePosition = 0;
-    int64 totalSamplesToPlay = 0;
+    std::atomic<int64> totalSamplesToPlay{ 0 };
 
     int64 leadingSamplePosition = 0;
     double leadingDuration = 0.0;
+    float leadingDecibel = -100.0f;
+
+    int64 introEndPosition = -1;
 
     int64 trailingPosition = 0;
     double trailingDuration = 0.0;
+    bool tailAnalyzed = false;
 
     double transitionPreCuePosition = 0.0;
     double transitionCuePosition = 0.0;
@@ -254,6 +393,32 @@ private:
     bool main = false;
 
     bool fading = false;
+
+    double loadRequestedTime = 0.0;
+    std::atomic<double> lastLoadingTime{ 0.0 };
+    std::atomic<double> lastScanningTime{ 0.0 };
+    std::atomic<double> lastScanningDelay{ 0.0 };
+
+    // Written by the loading threads, read lock-free by anyone through getState()
+    StatePtr state = std::make_shared<const State>();
+
+    // Published by the audio thread at the end of each block, in source samples
+    std::atomic<int64> readPosition{ 0 };
+    std::atomic<double> bufferFill{ 0.0 };
+
+    // Audio thread only writes it
+    std::atomic<double> playbackSpeed{ 1.0 };
+
+    // Target and step are published as a pair, speedSequence is odd while they are being written. The audio thread
+    // never waits on it, a torn read is retried on the next block
+    CriticalSection speedLock;
+    std::atomic<uint32> speedSequence{ 0 };
+    std::atomic<double> targetSpeed{ 1.0 };
+    // Change per output sample while gliding
+    std::atomic<double> speedStep{ 0.0 };
+    // Audio thread only, the last pair read whole
+    double appliedTargetSpeed = 1.0;
+    double appliedSpeedStep = 0.0;
 };
 
 }
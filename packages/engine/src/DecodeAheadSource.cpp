@@ -0,0 +1,274 @@
+#include "DecodeAheadSource.h"
+
+namespace medley {
+
+DecodeAheadSource::DecodeAheadSource(PositionableAudioSource* source, DecodePool& pool, int numSamplesToBuffer, int numChannels, bool halfPrecision)
+    :
+    source(source),
+    pool(pool),
+    numChannels(jmax(1, numChannels)),
+    halfPrecision(halfPrecision)
+{
+    while ((int64)numBlocks * 2 * kBlockSize <= numSamplesToBuffer) {
+        numBlocks *= 2;
+    }
+
+    if (halfPrecision) {
+        halfRing.allocate((size_t)this->numChannels * numBlocks * kBlockSize, true);
+        decodeBuffer.setSize(this->numChannels, kBlockSize);
+    }
+    else {
+        ring.setSize(this->numChannels, (int)numBlocks * kBlockSize);
+    }
+
+    blocks.reset(new Block[numBlocks]);
+
+    pool.addJob(this);
+}
+
+DecodeAheadSource::~DecodeAheadSource()
+{
+    pool.removeJob(this);
+}
+
+void DecodeAheadSource::prepareToPlay(int samplesPerBlockExpected, double sampleRate)
+{
+    if (sampleRate > 0.0) {
+        playbackRate = sampleRate;
+    }
+
+    const ScopedLock sl(readerLock);
+    source->prepareToPlay(samplesPerBlockExpected, sampleRate);
+}
+
+void DecodeAheadSource::releaseResources()
+{
+    // The ring is kept, it is accounted for by the deck for as long as the track is loaded
+    const ScopedLock sl(readerLock);
+    source->releaseResources();
+}
+
+int DecodeAheadSource::dropStaleBlocks(uint32 currentGeneration, int64 position)
+{
+    for (;;) {
+        auto read = readIndex.load();
+
+        if (read == writeIndex.load()) {
+            return -1;
+        }
+
+        const auto slot = (int)(read & (numBlocks - 1));
+        auto& block = blocks[slot];
+
+        if (block.generation == currentGeneration && position < block.start + kBlockSize) {
+            return position >= block.start ? slot : -1;
+        }
+
+        // Fails when a seek has just dropped everything, there is nothing left to look at then
+        readIndex.compare_exchange_strong(read, read + 1);
+    }
+}
+
+void DecodeAheadSource::getNextAudioBlock(const AudioSourceChannelInfo& info)
+{
+    const auto currentGeneration = generation.load();
+    const auto channels = jmin(numChannels, info.buffer->getNumChannels());
+
+    auto position = nextPlayPosition.load();
+    int numDone = 0;
+
+    while (numDone < info.numSamples) {
+        const auto slot = dropStaleBlocks(currentGeneration, position);
+
+        if (slot < 0) {
+            break;
+        }
+
+        const auto offset = (int)(position - blocks[slot].start);
+        const auto numToCopy = jmin(kBlockSize - offset, info.numSamples - numDone);
+
+        const auto ringOffset = slot * kBlockSize + offset;
+
+        for (int ch = 0; ch < channels; ch++) {
+            if (halfPrecision) {
+                auto channelRing = halfRing + (size_t)ch * numBlocks * kBlockSize;
+                HalfFloat::toFloat(info.buffer->getWritePointer(ch, info.startSample + numDone), channelRing + ringOffset, numToCopy);
+            }
+            else {
+                info.buffer->copyFrom(ch, info.startSample + numDone, ring, ch, ringOffset, numToCopy);
+            }
+        }
+
+        numDone += numToCopy;
+        position += numToCopy;
+    }
+
+    const auto numMissing = info.numSamples - numDone;
+
+    if (numMissing > 0) {
+        info.buffer->clear(info.startSample + numDone, numMissing);
+
+        // Nothing is decoded past the end
+        if (isLooping() || position < getTotalLength()) {
+            numUnderruns++;
+        }
+    }
+
+    // Playback moves on regardless, the worker catches up from there
+    nextPlayPosition = position + numMissing;
+}
+
+bool DecodeAheadSource::waitForNextAudioBlockReady(const AudioSourceChannelInfo& info, int timeoutMs)
+{
+    const auto deadline = Time::getMillisecondCounter() + (uint32)timeoutMs;
+    const auto currentGeneration = generation.load();
+    const auto position = nextPlayPosition.load();
+
+    auto end = position + info.numSamples;
+
+    if (!isLooping()) {
+        end = jmin(end, getTotalLength());
+    }
+
+    if (end <= position) {
+        return true;
+    }
+
+    for (;;) {
+        if (dropStaleBlocks(currentGeneration, position) >= 0) {
+            // Blocks of a generation are contiguous
+            auto readyEnd = position;
+
+            for (auto i = readIndex.load(), w = writeIndex.load(); i != w && readyEnd < end; i++) {
+                auto& block = blocks[i & (numBlocks - 1)];
+
+                if (block.generation != currentGeneration || block.start > readyEnd) {
+                    break;
+                }
+
+                readyEnd = block.start + kBlockSize;
+            }
+
+            if (readyEnd >= end) {
+                return true;
+            }
+        }
+
+        if (Time::getMillisecondCounter() >= deadline) {
+            return false;
+        }
+
+        // Only offline rendering waits, it is blocking anyway so the workers may as well be woken
+        pool.schedule(this);
+        Thread::sleep(1);
+    }
+}
+
+void DecodeAheadSource::setNextReadPosition(int64 newPosition)
+{
+    nextPlayPosition = newPosition;
+    generation++;
+
+    // Playback is not reading, so this may act as the consumer and free the whole ring
+    const auto written = writeIndex.load();
+    auto read = readIndex.load();
+
+    while (read != written && !readIndex.compare_exchange_weak(read, written)) {
+
+    }
+
+    pool.schedule(this);
+}
+
+int64 DecodeAheadSource::getNextReadPosition() const
+{
+    const auto position = nextPlayPosition.load();
+    const auto length = getTotalLength();
+
+    return (isLooping() && length > 0) ? position % length : position;
+}
+
+bool DecodeAheadSource::needsDecoding() const
+{
+    if (writeIndex - readIndex >= numBlocks) {
+        return false;
+    }
+
+    // Starting over from a seek
+    if (decodeGeneration != generation) {
+        return true;
+    }
+
+    return isLooping() || decodePosition < getTotalLength();
+}
+
+int DecodeAheadSource::getMillisecondsUntilNeeded() const
+{
+    if (needsDecoding()) {
+        return 0;
+    }
+
+    const auto read = readIndex.load();
+
+    // Decoded up to the end, only a seek brings it back and that schedules it
+    if (writeIndex - read < numBlocks) {
+        return -1;
+    }
+
+    // Full, room comes back once playback is past the oldest block. Halved as resampling and tempo may speed it up
+    const auto& oldest = blocks[read & (numBlocks - 1)];
+    const auto remaining = jmax((int64)0, oldest.start + kBlockSize - nextPlayPosition.load());
+
+    return jmax(1, (int)(remaining * 500.0 / playbackRate));
+}
+
+void DecodeAheadSource::decodeNextBlock()
+{
+    const ScopedLock sl(readerLock);
+
+    const auto currentGeneration = generation.load();
+
+    // The position is set before the generation changes
+    if (currentGeneration != decodeGeneration) {
+        decodePosition = nextPlayPosition.load();
+        decodeGeneration = currentGeneration;
+    }
+
+    const auto write = writeIndex.load();
+
+    if (write - readIndex.load() >= numBlocks) {
+        return;
+    }
+
+    const auto position = decodePosition.load();
+
+    if (!isLooping() && position >= getTotalLength()) {
+        return;
+    }
+
+    const auto slot = (int)(write & (numBlocks - 1));
+
+    source->setNextReadPosition(position);
+
+    if (halfPrecision) {
+        source->getNextAudioBlock(AudioSourceChannelInfo(&decodeBuffer, 0, kBlockSize));
+
+        for (int ch = 0; ch < numChannels; ch++) {
+            auto channelRing = halfRing + (size_t)ch * numBlocks * kBlockSize;
+            HalfFloat::fromFloat(channelRing + slot * kBlockSize, decodeBuffer.getReadPointer(ch), kBlockSize);
+        }
+    }
+    else {
+        AudioBuffer<float> view(ring.getArrayOfWritePointers(), numChannels, slot * kBlockSize, kBlockSize);
+        source->getNextAudioBlock(AudioSourceChannelInfo(&view, 0, kBlockSize));
+    }
+
+    blocks[slot].start = position;
+    blocks[slot].generation = currentGeneration;
+
+    // Publishes the block
+    writeIndex = write + 1;
+    decodePosition = position + kBlockSize;
+}
+
+}
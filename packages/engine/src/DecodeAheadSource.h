@@ -0,0 +1,114 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "DecodePool.h"
+#include "HalfFloat.h"
+
+using namespace juce;
+
+namespace medley {
+
+/**
+ * Read-ahead buffer of a deck, filled by a job on a DecodePool instead of a single read-ahead thread.
+ *
+ * Decoded blocks are handed over through a single-producer single-consumer ring, the worker fills one block while
+ * playback reads another and neither side ever waits for the other. Seeking bumps a generation number, blocks decoded
+ * before that are dropped by playback while the worker starts over from the new position.
+ *
+ * The ring may hold half-precision samples instead, halving its memory for a conversion on either side.
+ */
+class DecodeAheadSource : public PositionableAudioSource, private DecodePool::Job {
+public:
+    static constexpr int kBlockSize = 2048;
+
+    // The source is not owned
+    DecodeAheadSource(PositionableAudioSource* source, DecodePool& pool, int numSamplesToBuffer, int numChannels, bool halfPrecision = false);
+
+    ~DecodeAheadSource() override;
+
+    // Held while decoding, anything else reading the source's reader must hold it too
+    const CriticalSection& getReaderLock() const { return readerLock; }
+
+    // Playback only, waits for the samples of the next block to be decoded. Wakes the workers, so offline rendering only
+    bool waitForNextAudioBlockReady(const AudioSourceChannelInfo& info, int timeoutMs);
+
+    // Ring size in samples, the requested size rounded down to a power of two number of blocks
+    int getCapacity() const { return (int)numBlocks * kBlockSize; }
+
+    bool isHalfPrecision() const { return halfPrecision; }
+
+    // Bytes used by one sample of one channel in the ring
+    static int getBytesPerSample(bool halfPrecision) { return halfPrecision ? (int)sizeof(uint16) : (int)sizeof(float); }
+
+    // Source position decoding has reached
+    int64 getDecodedPosition() const { return decodePosition; }
+
+    // Number of blocks played with samples missing
+    int64 getNumUnderruns() const { return numUnderruns; }
+
+    void prepareToPlay(int samplesPerBlockExpected, double sampleRate) override;
+
+    void releaseResources() override;
+
+    void getNextAudioBlock(const AudioSourceChannelInfo& info) override;
+
+    // Any thread, as long as playback is not reading at the same time
+    void setNextReadPosition(int64 newPosition) override;
+
+    int64 getNextReadPosition() const override;
+
+    int64 getTotalLength() const override { return source->getTotalLength(); }
+
+    bool isLooping() const override { return source->isLooping(); }
+
+private:
+    struct Block {
+        std::atomic<int64> start{ 0 };
+        std::atomic<uint32> generation{ 0 };
+    };
+
+    bool needsDecoding() const override;
+
+    int getMillisecondsUntilNeeded() const override;
+
+    void decodeNextBlock() override;
+
+    // Consumer side, drops blocks from another generation or already played. Returns the slot holding position, or -1
+    int dropStaleBlocks(uint32 currentGeneration, int64 position);
+
+    PositionableAudioSource* source;
+    DecodePool& pool;
+    int numChannels;
+    bool halfPrecision;
+
+    CriticalSection readerLock;
+
+    // Only one of them is used
+    AudioBuffer<float> ring;
+    HeapBlock<uint16> halfRing;
+    // Decoded into before the conversion
+    AudioBuffer<float> decodeBuffer;
+
+    std::unique_ptr<Block[]> blocks;
+    // A power of two, so the indices can wrap around
+    uint32 numBlocks = 4;
+
+    // Only ever moved forwards, writeIndex by the worker, readIndex by playback and seeks
+    std::atomic<uint32> writeIndex{ 0 };
+    std::atomic<uint32> readIndex{ 0 };
+
+    std::atomic<uint32> generation{ 0 };
+    std::atomic<int64> nextPlayPosition{ 0 };
+    // Output rate, close enough to how fast playback goes through the ring
+    std::atomic<double> playbackRate{ 44100.0 };
+
+    // Worker side
+    std::atomic<uint32> decodeGeneration{ 0 };
+    std::atomic<int64> decodePosition{ 0 };
+
+    std::atomic<int64> numUnderruns{ 0 };
+
+    JUCE_DECLARE_NON_COPYABLE(DecodeAheadSource)
+};
+
+}
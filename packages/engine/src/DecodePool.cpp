@@ -0,0 +1,222 @@
+#include "DecodePool.h"
+
+namespace {
+    // Longest an idle worker sleeps while there are jobs, in case one changes without being scheduled
+    constexpr int kMaxIdleTime = 100;
+}
+
+namespace medley {
+
+DecodePool& DecodePool::getShared()
+{
+    static DecodePool shared;
+    return shared;
+}
+
+DecodePool::DecodePool(int numWorkers)
+    : numWorkers(numWorkers < 0 ? jmax(1, SystemStats::getNumCpus() - 1) : jmax(1, numWorkers))
+{
+
+}
+
+DecodePool::~DecodePool()
+{
+    for (auto worker : workers) {
+        worker->signalThreadShouldExit();
+        worker->workAvailable.signal();
+    }
+
+    for (auto worker : workers) {
+        worker->stopThread(1000);
+    }
+
+    workers.clear();
+}
+
+void DecodePool::addJob(Job* job)
+{
+    {
+        const ScopedLock sl(jobsLock);
+
+        ensureWorkers();
+        jobs.addIfNotAlreadyThere(job);
+    }
+
+    schedule(job);
+}
+
+void DecodePool::removeJob(Job* job)
+{
+    job->removed = true;
+
+    {
+        const ScopedLock sl(jobsLock);
+        jobs.removeFirstMatchingValue(job);
+    }
+
+    for (auto worker : workers) {
+        const ScopedLock sl(worker->lock);
+        worker->queue.erase(std::remove(worker->queue.begin(), worker->queue.end(), job), worker->queue.end());
+    }
+
+    while (job->running) {
+        Thread::yield();
+    }
+}
+
+void DecodePool::schedule(Job* job)
+{
+    if (job->removed || workers.isEmpty() || job->scheduled.exchange(true)) {
+        return;
+    }
+
+    auto worker = workers[nextWorker++ % workers.size()];
+
+    {
+        const ScopedLock sl(worker->lock);
+        worker->queue.push_back(job);
+    }
+
+    worker->workAvailable.signal();
+}
+
+void DecodePool::setWorkerPolicy(const ThreadPolicy& policy)
+{
+    const ScopedLock sl(jobsLock);
+
+    workerPolicy = policy;
+
+    for (auto worker : workers) {
+        worker->policy.setPolicy(policy);
+        worker->workAvailable.signal();
+    }
+}
+
+void DecodePool::ensureWorkers()
+{
+    if (!workers.isEmpty()) {
+        return;
+    }
+
+    for (int i = 0; i < numWorkers; i++) {
+        auto worker = workers.add(new Worker(*this, i));
+        worker->policy.setPolicy(workerPolicy);
+        // Same as the read-ahead thread
+        worker->startThread(8);
+    }
+}
+
+DecodePool::Job* DecodePool::popLocal(Worker& worker)
+{
+    const ScopedLock sl(worker.lock);
+
+    if (worker.queue.empty()) {
+        return nullptr;
+    }
+
+    auto job = worker.queue.front();
+    worker.queue.pop_front();
+
+    // While still locked, so removeJob either finds it queued or sees it running
+    job->running = true;
+    return job;
+}
+
+DecodePool::Job* DecodePool::steal(Worker& thief)
+{
+    const auto numWorkers = workers.size();
+
+    for (int i = 1; i < numWorkers; i++) {
+        auto victim = workers[(thief.index + i) % numWorkers];
+
+        const ScopedLock sl(victim->lock);
+
+        if (victim->queue.empty()) {
+            continue;
+        }
+
+        // From the other end, the owner is least likely to get there soon
+        auto job = victim->queue.back();
+        victim->queue.pop_back();
+
+        job->running = true;
+        numSteals++;
+        return job;
+    }
+
+    return nullptr;
+}
+
+bool DecodePool::rescan(Worker& worker, int& idleTime)
+{
+    const ScopedLock sl(jobsLock);
+
+    bool queued = false;
+    idleTime = -1;
+
+    for (auto job : jobs) {
+        if (job->removed || job->scheduled) {
+            continue;
+        }
+
+        const auto wait = job->getMillisecondsUntilNeeded();
+
+        if (wait == 0 && !job->scheduled.exchange(true)) {
+            const ScopedLock wl(worker.lock);
+            worker.queue.push_back(job);
+            queued = true;
+        }
+        else if (wait > 0) {
+            idleTime = idleTime < 0 ? wait : jmin(idleTime, wait);
+        }
+    }
+
+    if (!jobs.isEmpty()) {
+        idleTime = idleTime < 0 ? kMaxIdleTime : jlimit(1, kMaxIdleTime, idleTime);
+    }
+
+    return queued;
+}
+
+void DecodePool::run(Worker& worker, Job* job)
+{
+    job->decodeNextBlock();
+
+    const ScopedLock sl(worker.lock);
+
+    // Back at the end of the queue, so other jobs get their turn in between
+    if (!job->removed && job->needsDecoding()) {
+        worker.queue.push_back(job);
+    }
+    else {
+        job->scheduled = false;
+    }
+
+    job->running = false;
+}
+
+void DecodePool::Worker::run()
+{
+    while (!threadShouldExit()) {
+        policy.applyPending();
+
+        auto job = pool.popLocal(*this);
+
+        if (job == nullptr) {
+            job = pool.steal(*this);
+        }
+
+        if (job != nullptr) {
+            pool.run(*this, job);
+            continue;
+        }
+
+        int idleTime;
+
+        if (!pool.rescan(*this, idleTime)) {
+            workAvailable.wait(idleTime);
+        }
+    }
+}
+
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <deque>
+#include "ThreadPolicy.h"
+
+using namespace juce;
+
+namespace medley {
+
+/**
+ * Worker threads decoding ahead of playback for every deck in the process, so a heavy decode on one deck no longer
+ * holds up the refills of the others.
+ *
+ * Each worker runs the jobs from its own queue first and steals from the other queues once it runs out. A job is
+ * requeued for as long as it has room to fill, and picked up again by an idle worker's rescan once it has room
+ * again. Nothing is ever signalled from the audio thread, instead idle workers sleep until the earliest time a job
+ * expects to have room, or until a job is scheduled.
+ */
+class DecodePool {
+public:
+    class Job {
+    public:
+        virtual ~Job() {}
+
+        // Whether there is room for more decoded samples, called from any worker
+        virtual bool needsDecoding() const = 0;
+
+        // How long until there is room again, 0 when there is now, -1 when only schedule() brings it back
+        virtual int getMillisecondsUntilNeeded() const = 0;
+
+        // Never run by two workers at once
+        virtual void decodeNextBlock() = 0;
+
+    private:
+        friend class DecodePool;
+
+        std::atomic<bool> scheduled{ false };
+        std::atomic<bool> running{ false };
+        std::atomic<bool> removed{ false };
+    };
+
+    // Shared by every engine in the process
+    static DecodePool& getShared();
+
+    // numWorkers < 0 means one per CPU, less the audio thread
+    DecodePool(int numWorkers = -1);
+
+    ~DecodePool();
+
+    void addJob(Job* job);
+
+    // Waits for a decode in progress, the job is never run once this returns
+    void removeJob(Job* job);
+
+    // Gets a job going right away instead of at the next rescan, not to be called from the audio thread
+    void schedule(Job* job);
+
+    int getNumWorkers() const { return numWorkers; }
+
+    // Workers stand in for the read-ahead thread and follow its policy, the last engine to set it wins
+    void setWorkerPolicy(const ThreadPolicy& policy);
+
+    // Number of jobs taken from another worker's queue
+    int64 getNumSteals() const { return numSteals; }
+
+private:
+    class Worker : public Thread {
+    public:
+        Worker(DecodePool& pool, int index) : Thread("Decode Worker " + String(index)), pool(pool), index(index) {}
+
+        void run() override;
+
+        CriticalSection lock;
+        std::deque<Job*> queue;
+        WaitableEvent workAvailable;
+        ThreadPolicyApplier policy;
+
+    private:
+        DecodePool& pool;
+        int index;
+
+        friend class DecodePool;
+    };
+
+    void ensureWorkers();
+
+    // Each returns the job marked as running
+    Job* popLocal(Worker& worker);
+
+    Job* steal(Worker& thief);
+
+    // Queues every job that has room on the given worker, returns whether any was.
+    // Otherwise idleTime is how long the worker may sleep, -1 for as long as nothing is scheduled
+    bool rescan(Worker& worker, int& idleTime);
+
+    void run(Worker& worker, Job* job);
+
+    int numWorkers;
+
+    CriticalSection jobsLock;
+    Array<Job*> jobs;
+
+    OwnedArray<Worker> workers;
+    ThreadPolicy workerPolicy;
+    std::atomic<int> nextWorker{ 0 };
+    std::atomic<int64> numSteals{ 0 };
+
+    JUCE_DECLARE_NON_COPYABLE(DecodePool)
+};
+
+}
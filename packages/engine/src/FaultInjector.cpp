@@ -0,0 +1,167 @@
+#include "FaultInjector.h"
+
+namespace medley {
+
+class FaultInjector::Stream : public InputStream {
+public:
+    Stream(FaultInjector& owner, const Rule& rule, InputStream* input, int64 seed)
+        :
+        owner(owner),
+        rule(rule),
+        input(input),
+        random(seed)
+    {
+
+    }
+
+    int64 getTotalLength() override { return input->getTotalLength(); }
+
+    bool isExhausted() override { return input->isExhausted(); }
+
+    int64 getPosition() override { return input->getPosition(); }
+
+    bool setPosition(int64 newPosition) override { return input->setPosition(newPosition); }
+
+    int read(void* destBuffer, int maxBytesToRead) override
+    {
+        owner.numReads++;
+
+        auto delay = drawLatency();
+
+        if (chance(rule.stallProbability)) {
+            delay += rule.stallDuration;
+            owner.numStalls++;
+        }
+
+        wait(delay);
+
+        const auto position = input->getPosition();
+
+        if (chance(rule.errorProbability) || (rule.failFromOffset >= 0 && position >= rule.failFromOffset)) {
+            owner.numErrors++;
+            return 0;
+        }
+
+        auto numToRead = maxBytesToRead;
+
+        if (numToRead > 1 && chance(rule.shortReadProbability)) {
+            numToRead = 1 + random.nextInt(numToRead - 1);
+            owner.numShortReads++;
+        }
+
+        // A read crossing the failing offset stops there
+        if (rule.failFromOffset >= 0 && position + numToRead > rule.failFromOffset) {
+            numToRead = (int)(rule.failFromOffset - position);
+        }
+
+        return input->read(destBuffer, numToRead);
+    }
+
+private:
+    bool chance(double probability) {
+        return probability > 0.0 && random.nextDouble() < probability;
+    }
+
+    double drawLatency() {
+        switch (rule.latency) {
+        case Distribution::Uniform:
+            return jmax(0.0, rule.latencyMean + rule.latencySpread * (random.nextDouble() * 2.0 - 1.0));
+
+        case Distribution::Normal: {
+            // Box-Muller
+            const auto u1 = jmax(1e-12, random.nextDouble());
+            const auto u2 = random.nextDouble();
+            const auto z = std::sqrt(-2.0 * std::log(u1)) * std::cos(MathConstants<double>::twoPi * u2);
+            return jmax(0.0, rule.latencyMean + rule.latencySpread * z);
+        }
+
+        case Distribution::Exponential:
+            return -rule.latencyMean * std::log(jmax(1e-12, 1.0 - random.nextDouble()));
+
+        default:
+            return rule.latencyMean;
+        }
+    }
+
+    void wait(double milliseconds) {
+        if (milliseconds <= 0.0) {
+            return;
+        }
+
+        owner.totalDelayMicroseconds += (int64)(milliseconds * 1000.0);
+
+        // Sub-millisecond delays add up instead of being lost to the sleep granularity
+        pendingDelay += milliseconds;
+
+        if (pendingDelay >= 1.0) {
+            const auto whole = (int)pendingDelay;
+            Thread::sleep(whole);
+            pendingDelay -= whole;
+        }
+    }
+
+    FaultInjector& owner;
+    Rule rule;
+    std::unique_ptr<InputStream> input;
+    Random random;
+    double pendingDelay = 0.0;
+};
+
+FaultInjector::FaultInjector(int64 seed)
+    : seed(seed)
+{
+
+}
+
+void FaultInjector::addRule(const Rule& rule)
+{
+    const ScopedLock sl(lock);
+    rules.push_back(rule);
+}
+
+void FaultInjector::clearRules()
+{
+    const ScopedLock sl(lock);
+    rules.clear();
+}
+
+bool FaultInjector::findRule(const File& file, Rule& result) const
+{
+    const ScopedLock sl(lock);
+
+    const auto path = file.getFullPathName();
+
+    for (auto& rule : rules) {
+        if (path.matchesWildcard(rule.pattern, true)) {
+            result = rule;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+InputStream* FaultInjector::wrap(const File& file, InputStream* stream)
+{
+    Rule rule;
+
+    if (stream == nullptr || !findRule(file, rule)) {
+        return stream;
+    }
+
+    // The same file gets the same faults, whatever else is read in between
+    return new Stream(*this, rule, stream, seed ^ file.getFullPathName().hashCode64());
+}
+
+FaultInjector::Stats FaultInjector::getStats() const
+{
+    Stats stats;
+    stats.numReads = numReads;
+    stats.numStalls = numStalls;
+    stats.numShortReads = numShortReads;
+    stats.numErrors = numErrors;
+    stats.totalDelay = totalDelayMicroseconds / 1000.0;
+    return stats;
+}
+
+}
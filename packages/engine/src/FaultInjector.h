@@ -0,0 +1,93 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+using namespace juce;
+
+namespace medley {
+
+/**
+ * Makes the files an engine reads behave like slow or flaky storage, to test how buffering copes.
+ *
+ * Streams are wrapped when their file matches a rule's wildcard pattern, the first matching rule applies. Each read
+ * may then be delayed, stalled, cut short or failed. Every stream draws from its own generator seeded from the
+ * injector's seed and the file path, so a run can be reproduced as long as files are read in the same way.
+ *
+ * Only meant for offline rendering, delays are real sleeps on whichever thread reads.
+ */
+class FaultInjector {
+public:
+    enum class Distribution {
+        Constant,
+        // Between mean - spread and mean + spread
+        Uniform,
+        // Spread is the standard deviation, negative draws are taken as zero
+        Normal,
+        // Mostly short with a long tail, spread is ignored
+        Exponential
+    };
+
+    struct Rule {
+        // Matched against the full path, case insensitive
+        String pattern = "*";
+
+        // Added to every read, in milliseconds
+        Distribution latency = Distribution::Constant;
+        double latencyMean = 0.0;
+        double latencySpread = 0.0;
+
+        // Chance per read of hanging for stallDuration milliseconds
+        double stallProbability = 0.0;
+        double stallDuration = 0.0;
+
+        // Chance per read of returning only part of what was asked for
+        double shortReadProbability = 0.0;
+
+        // Chance per read of failing, the read returns nothing. Readers cannot tell that from the end of the stream,
+        // so a failed read usually ends the track early rather than being retried
+        double errorProbability = 0.0;
+
+        // Every read from this byte offset on fails, -1 for never
+        int64 failFromOffset = -1;
+    };
+
+    struct Stats {
+        int64 numReads = 0;
+        int64 numStalls = 0;
+        int64 numShortReads = 0;
+        int64 numErrors = 0;
+        // In milliseconds
+        double totalDelay = 0.0;
+    };
+
+    FaultInjector(int64 seed = 0);
+
+    void addRule(const Rule& rule);
+
+    void clearRules();
+
+    // Takes ownership of the stream, returns it untouched when no rule matches
+    InputStream* wrap(const File& file, InputStream* stream);
+
+    Stats getStats() const;
+
+private:
+    class Stream;
+
+    bool findRule(const File& file, Rule& result) const;
+
+    int64 seed;
+
+    CriticalSection lock;
+    std::vector<Rule> rules;
+
+    std::atomic<int64> numReads{ 0 };
+    std::atomic<int64> numStalls{ 0 };
+    std::atomic<int64> numShortReads{ 0 };
+    std::atomic<int64> numErrors{ 0 };
+    std::atomic<int64> totalDelayMicroseconds{ 0 };
+
+    JUCE_DECLARE_NON_COPYABLE(FaultInjector)
+};
+
+}
@@ -0,0 +1,133 @@
+#include "FormatSniffer.h"
+
+namespace {
+    bool matches(const uint8* header, int offset, const char* magic) {
+        return memcmp(header + offset, magic, strlen(magic)) == 0;
+    }
+
+    const char* findExtension(const uint8* header, int numRead, bool tagged) {
+        if (numRead >= 12) {
+            if ((matches(header, 0, "RIFF") || matches(header, 0, "RF64") || matches(header, 0, "BW64")) && matches(header, 8, "WAVE")) {
+                return ".wav";
+            }
+
+            if (matches(header, 0, "FORM") && (matches(header, 8, "AIFF") || matches(header, 8, "AIFC"))) {
+                return ".aiff";
+            }
+
+            // MP4 and friends, only readable where the platform formats are registered
+            if (matches(header, 4, "ftyp")) {
+                return ".m4a";
+            }
+        }
+
+        if (numRead >= 4) {
+            if (matches(header, 0, "fLaC")) {
+                return ".flac";
+            }
+
+            if (matches(header, 0, "OggS")) {
+                return ".ogg";
+            }
+        }
+
+        // MPEG audio frame sync, layer bits of 00 would be ADTS AAC
+        if (numRead >= 2 && header[0] == 0xFF && (header[1] & 0xE0) == 0xE0 && (header[1] & 0x06) != 0) {
+            return ".mp3";
+        }
+
+        // Whatever follows an ID3v2 tag is most likely MP3, possibly after some padding
+        return tagged ? ".mp3" : nullptr;
+    }
+}
+
+namespace medley {
+
+AudioFormat* FormatSniffer::sniff(AudioFormatManager& formatMgr, InputStream& stream)
+{
+    const auto start = stream.getPosition();
+
+    uint8 header[kHeaderSize] = {};
+    auto numRead = stream.read(header, kHeaderSize);
+
+    const auto tagged = numRead >= 10 && matches(header, 0, "ID3");
+
+    if (tagged) {
+        // Synchsafe size, not counting the header nor the footer
+        const auto tagSize = ((header[6] & 0x7f) << 21) | ((header[7] & 0x7f) << 14) | ((header[8] & 0x7f) << 7) | (header[9] & 0x7f);
+        const auto hasFooter = (header[5] & 0x10) != 0;
+
+        stream.setPosition(start + 10 + tagSize + (hasFooter ? 10 : 0));
+
+        zerostruct(header);
+        numRead = stream.read(header, kHeaderSize);
+    }
+
+    stream.setPosition(start);
+
+    auto extension = findExtension(header, numRead, tagged);
+    return extension != nullptr ? formatMgr.findFormatForFileExtension(extension) : nullptr;
+}
+
+AudioFormatReader* FormatSniffer::createReaderFor(AudioFormatManager& formatMgr, const File& file, AudioFormat** usedFormat)
+{
+    return createReaderFor(formatMgr, std::unique_ptr<InputStream>(file.createInputStream()), usedFormat);
+}
+
+AudioFormatReader* FormatSniffer::createReaderFor(AudioFormatManager& formatMgr, std::unique_ptr<InputStream> stream, AudioFormat** usedFormat)
+{
+    if (stream == nullptr) {
+        return nullptr;
+    }
+
+    auto tryFormat = [&](AudioFormat* format) -> AudioFormatReader* {
+        // The stream is kept when opening fails, so the next try can have it
+        if (auto reader = format->createReaderFor(stream.get(), false)) {
+            stream.release();
+
+            if (usedFormat != nullptr) {
+                *usedFormat = format;
+            }
+
+            return reader;
+        }
+
+        stream->setPosition(0);
+        return nullptr;
+    };
+
+    auto sniffed = sniff(formatMgr, *stream);
+
+    if (sniffed != nullptr) {
+        if (auto reader = tryFormat(sniffed)) {
+            return reader;
+        }
+    }
+
+    // Nothing recognized, or a header that lied
+    for (int i = 0; i < formatMgr.getNumKnownFormats(); i++) {
+        auto format = formatMgr.getKnownFormat(i);
+
+        if (format == sniffed) {
+            continue;
+        }
+
+        if (auto reader = tryFormat(format)) {
+            return reader;
+        }
+    }
+
+    return nullptr;
+}
+
+AudioFormatReader* FormatSniffer::createReaderFor(AudioFormat* format, const File& file)
+{
+    return createReaderFor(format, std::unique_ptr<InputStream>(file.createInputStream()));
+}
+
+AudioFormatReader* FormatSniffer::createReaderFor(AudioFormat* format, std::unique_ptr<InputStream> stream)
+{
+    return stream != nullptr ? format->createReaderFor(stream.release(), true) : nullptr;
+}
+
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+using namespace juce;
+
+namespace medley {
+
+/**
+ * Tells the container of a file from its first bytes, so a reader is made by the right format on the first try,
+ * whatever the file extension says.
+ *
+ * Only one stream is opened, the header is sniffed from it and it is then handed to the format. Files nothing is
+ * recognized in fall back to trying every registered format on that same stream.
+ */
+class FormatSniffer {
+public:
+    // Bytes looked at, past any ID3v2 tag
+    static constexpr int kHeaderSize = 12;
+
+    // nullptr when nothing is recognized or the format is not registered. The stream is put back where it was
+    static AudioFormat* sniff(AudioFormatManager& formatMgr, InputStream& stream);
+
+    // usedFormat, when given, receives the format the reader was made by
+    static AudioFormatReader* createReaderFor(AudioFormatManager& formatMgr, const File& file, AudioFormat** usedFormat = nullptr);
+
+    // Same, from an already opened stream, which must be able to seek back to its start
+    static AudioFormatReader* createReaderFor(AudioFormatManager& formatMgr, std::unique_ptr<InputStream> stream, AudioFormat** usedFormat = nullptr);
+
+    // For a file sniffed before, such as the tail scanning of a loaded track
+    static AudioFormatReader* createReaderFor(AudioFormat* format, const File& file);
+
+    static AudioFormatReader* createReaderFor(AudioFormat* format, std::unique_ptr<InputStream> stream);
+};
+
+}
@@ -0,0 +1,313 @@
+#include "HalfFloat.h"
+
+#if JUCE_INTEL
+#include <immintrin.h>
+#if JUCE_MSVC
+#include <intrin.h>
+#endif
+#elif JUCE_ARM && (defined(__aarch64__) || defined(_M_ARM64))
+#include <arm_neon.h>
+#define MEDLEY_HALF_FLOAT_NEON 1
+#endif
+
+// F16C code is compiled for that target only and chosen at run time, the rest of the engine does not require it
+#if JUCE_INTEL && (JUCE_GCC || JUCE_CLANG)
+#define MEDLEY_F16C_TARGET __attribute__((target("avx,f16c")))
+#else
+#define MEDLEY_F16C_TARGET
+#endif
+
+namespace {
+    uint16 floatToHalf(float value) {
+        uint32 bits;
+        memcpy(&bits, &value, sizeof(bits));
+
+        const auto sign = (uint16)((bits >> 16) & 0x8000);
+        const auto magnitude = bits & 0x7fffffff;
+
+        // Infinity and NaN, quieted with the top of its payload kept as the instructions do
+        if (magnitude >= 0x7f800000) {
+            return sign | (magnitude > 0x7f800000 ? (uint16)(0x7e00 | ((magnitude >> 13) & 0x3ff)) : 0x7c00);
+        }
+
+        // Rounds up to infinity from 65520
+        if (magnitude >= 0x477ff000) {
+            return sign | 0x7c00;
+        }
+
+        // Subnormal halves, below 2^-14
+        if (magnitude < 0x38800000) {
+            if (magnitude <= 0x33000000) {
+                return sign;
+            }
+
+            const auto exponent = magnitude >> 23;
+            const auto mantissa = (magnitude & 0x7fffff) | 0x800000;
+            const auto shift = 126 - exponent;
+
+            auto result = mantissa >> shift;
+            const auto remainder = mantissa & ((1u << shift) - 1);
+            const auto halfway = 1u << (shift - 1);
+
+            if (remainder > halfway || (remainder == halfway && (result & 1))) {
+                result++;
+            }
+
+            return sign | (uint16)result;
+        }
+
+        // Rebias the exponent from 127 to 15 and round to nearest even
+        auto result = (magnitude - 0x38000000) >> 13;
+        const auto remainder = magnitude & 0x1fff;
+
+        if (remainder > 0x1000 || (remainder == 0x1000 && (result & 1))) {
+            result++;
+        }
+
+        return sign | (uint16)result;
+    }
+
+    float halfToFloat(uint16 half) {
+        const auto sign = (uint32)(half & 0x8000) << 16;
+        auto exponent = (uint32)(half >> 10) & 0x1f;
+        auto mantissa = (uint32)half & 0x3ff;
+
+        uint32 bits;
+
+        if (exponent == 0) {
+            if (mantissa == 0) {
+                bits = sign;
+            }
+            else {
+                // Subnormal, normalized for the float
+                exponent = 113;
+
+                while ((mantissa & 0x400) == 0) {
+                    mantissa <<= 1;
+                    exponent--;
+                }
+
+                bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+            }
+        }
+        else if (exponent == 31) {
+            // NaNs come out quiet
+            bits = sign | 0x7f800000 | (mantissa != 0 ? 0x400000 : 0) | (mantissa << 13);
+        }
+        else {
+            bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+        }
+
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+#if JUCE_INTEL
+    bool detectF16C() {
+#if JUCE_MSVC
+        int info[4];
+        __cpuid(info, 1);
+
+        // F16C and AVX, which the 256-bit forms need
+        if ((info[2] & (1 << 29)) == 0 || (info[2] & (1 << 28)) == 0) {
+            return false;
+        }
+
+        // AVX also needs the OS to save the YMM registers, XSAVE enabled and XMM and YMM state in XCR0
+        if ((info[2] & (1 << 27)) == 0) {
+            return false;
+        }
+
+        return (_xgetbv(0) & 0x6) == 0x6;
+#elif JUCE_GCC || JUCE_CLANG
+        return __builtin_cpu_supports("f16c") && __builtin_cpu_supports("avx");
+#else
+        return false;
+#endif
+    }
+
+    const bool hasF16C = detectF16C();
+
+    MEDLEY_F16C_TARGET int fromFloatF16C(uint16* dest, const float* src, int numSamples) {
+        int i = 0;
+
+        for (; i + 8 <= numSamples; i += 8) {
+            const auto converted = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+            _mm_storeu_si128((__m128i*)(dest + i), converted);
+        }
+
+        return i;
+    }
+
+    MEDLEY_F16C_TARGET int toFloatF16C(float* dest, const uint16* src, int numSamples) {
+        int i = 0;
+
+        for (; i + 8 <= numSamples; i += 8) {
+            const auto converted = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(src + i)));
+            _mm256_storeu_ps(dest + i, converted);
+        }
+
+        return i;
+    }
+#endif
+}
+
+namespace medley {
+
+void HalfFloat::fromFloat(uint16* dest, const float* src, int numSamples)
+{
+    int i = 0;
+
+#if JUCE_INTEL
+    if (hasF16C) {
+        i = fromFloatF16C(dest, src, numSamples);
+    }
+#elif MEDLEY_HALF_FLOAT_NEON
+    for (; i + 4 <= numSamples; i += 4) {
+        vst1_u16(dest + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(src + i))));
+    }
+#endif
+
+    for (; i < numSamples; i++) {
+        dest[i] = floatToHalf(src[i]);
+    }
+}
+
+void HalfFloat::toFloat(float* dest, const uint16* src, int numSamples)
+{
+    int i = 0;
+
+#if JUCE_INTEL
+    if (hasF16C) {
+        i = toFloatF16C(dest, src, numSamples);
+    }
+#elif MEDLEY_HALF_FLOAT_NEON
+    for (; i + 4 <= numSamples; i += 4) {
+        vst1q_f32(dest + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(src + i))));
+    }
+#endif
+
+    for (; i < numSamples; i++) {
+        dest[i] = halfToFloat(src[i]);
+    }
+}
+
+bool HalfFloat::isAccelerated()
+{
+#if JUCE_INTEL
+    return hasF16C;
+#elif MEDLEY_HALF_FLOAT_NEON
+    return true;
+#else
+    return false;
+#endif
+}
+
+}
+
+#if MEDLEY_SELF_TESTS
+
+// The accelerated conversions must give the exact bits of the portable ones
+class HalfFloatTest : public UnitTest
+{
+public:
+    HalfFloatTest()
+        : UnitTest("Half float conversion", "Medley")
+    {
+
+    }
+
+    void runTest() override
+    {
+        beginTest("Accelerated conversions are bit-exact");
+
+        if (!medley::HalfFloat::isAccelerated()) {
+            logMessage("No F16C nor NEON, skipped");
+            return;
+        }
+
+        uint16 halves[kBatchSize];
+        float floats[kBatchSize];
+
+        // Every half
+        for (uint32 start = 0; start < 0x10000; start += kBatchSize) {
+            for (int i = 0; i < kBatchSize; i++) {
+                halves[i] = (uint16)(start + i);
+            }
+
+            medley::HalfFloat::toFloat(floats, halves, kBatchSize);
+
+            for (int i = 0; i < kBatchSize; i++) {
+                if (!expectBits(floatBits(floats[i]), floatBits(halfToFloat(halves[i])), halves[i])) {
+                    return;
+                }
+            }
+        }
+
+        // Every float from below the smallest subnormal half up to where halves get normal, where rounding shifts most
+        if (!checkFromFloat(0x33000000, 0x38800000, 1)) {
+            return;
+        }
+
+        // Elsewhere every exponent and top of mantissa, with the low bits around the rounding point
+        const uint32 lowBits[] = { 0x0000, 0x0001, 0x0fff, 0x1000, 0x1001, 0x1fff };
+
+        for (auto low : lowBits) {
+            if (!checkFromFloat(low, 0x100000000ULL, 0x2000)) {
+                return;
+            }
+        }
+    }
+
+private:
+    static constexpr int kBatchSize = 4096;
+
+    static uint32 floatBits(float value)
+    {
+        uint32 bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    bool expectBits(uint32 actual, uint32 expected, uint32 input)
+    {
+        if (actual == expected) {
+            return true;
+        }
+
+        expect(false, "Input " + String::toHexString((int64)input) + " gave " + String::toHexString((int64)actual) + " instead of " + String::toHexString((int64)expected));
+        return false;
+    }
+
+    // Stops at the first mismatch, there would be millions of them
+    bool checkFromFloat(uint64 start, uint64 end, uint32 stride)
+    {
+        float floats[kBatchSize];
+        uint16 halves[kBatchSize];
+        uint32 inputs[kBatchSize];
+
+        for (auto bits = start; bits < end;) {
+            int n = 0;
+
+            for (; n < kBatchSize && bits < end; n++, bits += stride) {
+                inputs[n] = (uint32)bits;
+                memcpy(&floats[n], &inputs[n], sizeof(float));
+            }
+
+            medley::HalfFloat::fromFloat(halves, floats, n);
+
+            for (int i = 0; i < n; i++) {
+                if (!expectBits(halves[i], floatToHalf(floats[i]), inputs[i])) {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+};
+
+static HalfFloatTest halfFloatTest;
+
+#endif
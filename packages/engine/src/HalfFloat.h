@@ -0,0 +1,26 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+using namespace juce;
+
+namespace medley {
+
+/**
+ * Conversion between 32-bit floats and IEEE 754 half-precision floats stored as uint16.
+ *
+ * F16C is used on x86 when the CPU has it, NEON on ARM64, otherwise a portable conversion rounding the same way.
+ * Half precision keeps 11 significant bits, about 66dB below the signal itself at any level, which is enough for
+ * playing back lossy or 16-bit sources but not for processing.
+ */
+class HalfFloat {
+public:
+    static void fromFloat(uint16* dest, const float* src, int numSamples);
+
+    static void toFloat(float* dest, const uint16* src, int numSamples);
+
+    // Whether the conversion runs on SIMD instructions
+    static bool isAccelerated();
+};
+
+}
@@ -9,6 +9,8 @@ class ITrack : public ReferenceCountedObject {
 public:
     virtual File getFile() = 0;
     virtual float getPreGain() const { return 1.0f; }
+    // Beats per minute, 0 when unknown
+    virtual double getTempo() const { return 0.0; }
 
     using Ptr = ReferenceCountedObjectPtr<ITrack>;
 };
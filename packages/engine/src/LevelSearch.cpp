@@ -0,0 +1,275 @@
+#include "LevelSearch.h"
+#include "MiniMP3AudioFormatReader.h"
+
+namespace {
+    // searchForLevel() reads this many samples at a time, the last read may run past the end where it sees silence
+    constexpr int kReaderSearchChunkSize = 4096;
+
+    // Side information bounds this low are as good as decoded silence for any threshold in use
+    static const auto kNegligibleLevel = Decibels::decibelsToGain(-120.0f);
+}
+
+namespace medley {
+
+LevelSearch::LevelSearch(AudioFormatReader& reader, int64 startSample, int64 numSamples)
+    :
+    reader(reader),
+    mp3Reader(dynamic_cast<MiniMP3AudioFormatReader*>(&reader)),
+    rangeStart(jmax((int64)0, startSample)),
+    rangeEnd(jmax(rangeStart, startSample + numSamples)),
+    chunkData(kChunkSize * 2, true)
+{
+    chunkChannels[0] = chunkData.get();
+    chunkChannels[1] = chunkData.get() + kChunkSize;
+}
+
+int64 LevelSearch::search(int64 startSample, int64 numSamplesToSearch, double magnitudeRangeMinimum, double magnitudeRangeMaximum, int minimumConsecutiveSamples)
+{
+    const auto length = reader.lengthInSamples;
+
+    if (numSamplesToSearch <= 0 || startSample < rangeStart) {
+        return searchReader(reader, startSample, numSamplesToSearch, magnitudeRangeMinimum, magnitudeRangeMaximum, minimumConsecutiveSamples);
+    }
+
+    if (startSample >= length) {
+        return -1;
+    }
+
+    const auto lastChunkStart = startSample + ((length - 1 - startSample) / kReaderSearchChunkSize) * kReaderSearchChunkSize;
+    const auto endSample = jmin(startSample + numSamplesToSearch, lastChunkStart + kReaderSearchChunkSize);
+
+    // Silence past the end is known without reading, anything else must be within the range
+    if (endSample > rangeEnd && rangeEnd < length) {
+        return searchReader(reader, startSample, numSamplesToSearch, magnitudeRangeMinimum, magnitudeRangeMaximum, minimumConsecutiveSamples);
+    }
+
+    // Integer data is compared against rounded integer thresholds, exactly like searchForLevel() does
+    auto minimum = magnitudeRangeMinimum;
+    auto maximum = magnitudeRangeMaximum;
+
+    if (!reader.usesFloatingPointData) {
+        const auto intMax = (double)std::numeric_limits<int>::max();
+        const auto doubleMin = jlimit(0.0, intMax, magnitudeRangeMinimum * intMax);
+        const auto doubleMax = jlimit(doubleMin, intMax, magnitudeRangeMaximum * intMax);
+
+        minimum = roundToInt(doubleMin);
+        maximum = roundToInt(doubleMax);
+    }
+
+    // Any run longer than a block has to go through its boundaries, so blocks in the middle of a loud passage can be skipped
+    const auto runsSpanBlocks = minimum <= 0.0 && minimumConsecutiveSamples >= kBlockSize;
+
+    int consecutive = 0;
+    int64 firstMatchPos = -1;
+
+    auto position = startSample;
+
+    while (position < endSample) {
+        const auto block = (position - rangeStart) / kBlockSize;
+        const auto blockStart = rangeStart + block * kBlockSize;
+        const auto blockEnd = blockStart + kBlockSize;
+        const auto spanEnd = jmin(endSample, blockEnd);
+        const auto wholeBlock = position == blockStart && spanEnd == blockEnd;
+
+        const auto level = classify(block, minimum, maximum);
+
+        if (level == BlockLevel::AllMatch) {
+            if (firstMatchPos < 0) {
+                firstMatchPos = position;
+            }
+
+            consecutive += (int)(spanEnd - position);
+
+            if (consecutive >= minimumConsecutiveSamples) {
+                return firstMatchPos < length ? firstMatchPos : -1;
+            }
+        }
+        else if (level == BlockLevel::NoneMatch) {
+            consecutive = 0;
+            firstMatchPos = -1;
+        }
+        else if (runsSpanBlocks && wholeBlock && getSummary(block).exact
+            && consecutive + kBlockSize - 1 < minimumConsecutiveSamples
+            && getLongestPossibleRunAfter(block, endSample, minimum, maximum, minimumConsecutiveSamples) < minimumConsecutiveSamples)
+        {
+            // At least one sample in here does not match, and no run through this block can be long enough
+            consecutive = 0;
+            firstMatchPos = -1;
+        }
+        else {
+            const auto chunk = block / kBlocksPerChunk;
+            decodeChunk(chunk);
+
+            const auto chunkStart = rangeStart + chunk * kChunkSize;
+
+            for (auto i = position; i < spanEnd; i++) {
+                const auto index = (int)(i - chunkStart);
+                const auto sample1 = getMagnitude(0, index);
+                auto matches = sample1 >= minimum && sample1 <= maximum;
+
+                if (!matches && reader.numChannels > 1) {
+                    const auto sample2 = getMagnitude(1, index);
+                    matches = sample2 >= minimum && sample2 <= maximum;
+                }
+
+                if (matches) {
+                    if (firstMatchPos < 0) {
+                        firstMatchPos = i;
+                    }
+
+                    if (++consecutive >= minimumConsecutiveSamples) {
+                        return firstMatchPos < length ? firstMatchPos : -1;
+                    }
+                }
+                else {
+                    consecutive = 0;
+                    firstMatchPos = -1;
+                }
+            }
+        }
+
+        position = spanEnd;
+    }
+
+    return -1;
+}
+
+int64 LevelSearch::searchReader(AudioFormatReader& reader, int64 startSample, int64 numSamplesToSearch, double magnitudeRangeMinimum, double magnitudeRangeMaximum, int minimumConsecutiveSamples)
+{
+    // MP3 can skip silence without decoding it
+    if (auto mp3 = dynamic_cast<MiniMP3AudioFormatReader*>(&reader)) {
+        return mp3->searchForLevelCompressed(startSample, numSamplesToSearch, magnitudeRangeMinimum, magnitudeRangeMaximum, minimumConsecutiveSamples);
+    }
+
+    return reader.searchForLevel(startSample, numSamplesToSearch, magnitudeRangeMinimum, magnitudeRangeMaximum, minimumConsecutiveSamples);
+}
+
+double LevelSearch::getMagnitude(int channel, int index) const
+{
+    if (reader.usesFloatingPointData) {
+        return std::abs(((const float*)chunkChannels[channel])[index]);
+    }
+
+    return std::abs(chunkChannels[channel][index]);
+}
+
+const LevelSearch::Summary& LevelSearch::getSummary(int64 block)
+{
+    const auto chunk = block / kBlocksPerChunk;
+    const auto firstBlock = (int)(chunk * kBlocksPerChunk);
+
+    if (summaries.size() < firstBlock + kBlocksPerChunk) {
+        summaries.resize(firstBlock + kBlocksPerChunk);
+    }
+
+    if (!summaries.getReference((int)block).valid) {
+        const auto chunkStart = rangeStart + chunk * kChunkSize;
+
+        if (chunkStart >= reader.lengthInSamples) {
+            // Past the end, where searchForLevel() sees silence
+            for (int i = 0; i < kBlocksPerChunk; i++) {
+                summaries.set(firstBlock + i, { true, true, 0.0, 0.0 });
+            }
+        }
+        else {
+            const auto bound = mp3Reader != nullptr ? mp3Reader->getLevelBound(chunkStart, kChunkSize) : std::numeric_limits<float>::max();
+
+            if (bound <= kNegligibleLevel) {
+                // An upper bound is as good as the real peaks for settling most blocks, without decoding anything
+                for (int i = 0; i < kBlocksPerChunk; i++) {
+                    summaries.set(firstBlock + i, { true, false, bound, bound });
+                }
+            }
+            else {
+                decodeChunk(chunk);
+            }
+        }
+    }
+
+    return summaries.getReference((int)block);
+}
+
+void LevelSearch::decodeChunk(int64 chunk)
+{
+    if (chunk == cachedChunk) {
+        return;
+    }
+
+    const auto chunkStart = rangeStart + chunk * kChunkSize;
+
+    reader.read(chunkChannels, 2, chunkStart, kChunkSize, false);
+    numSamplesDecoded += kChunkSize;
+    cachedChunk = chunk;
+
+    const auto firstBlock = (int)(chunk * kBlocksPerChunk);
+
+    if (summaries.size() < firstBlock + kBlocksPerChunk) {
+        summaries.resize(firstBlock + kBlocksPerChunk);
+    }
+
+    for (int i = 0; i < kBlocksPerChunk; i++) {
+        Summary summary{ true, true, 0.0, 0.0 };
+
+        for (int j = i * kBlockSize; j < (i + 1) * kBlockSize; j++) {
+            const auto sample1 = getMagnitude(0, j);
+            const auto sample2 = reader.numChannels > 1 ? getMagnitude(1, j) : sample1;
+
+            summary.maxLevel = jmax(summary.maxLevel, sample1, sample2);
+            summary.quietLevel = jmax(summary.quietLevel, jmin(sample1, sample2));
+        }
+
+        summaries.set(firstBlock + i, summary);
+    }
+}
+
+LevelSearch::BlockLevel LevelSearch::classify(int64 block, double minimum, double maximum)
+{
+    const auto& summary = getSummary(block);
+
+    // Neither channel gets loud enough anywhere in the block
+    if (summary.maxLevel < minimum) {
+        return BlockLevel::NoneMatch;
+    }
+
+    // Every sample has at least one channel quiet enough
+    if (minimum <= 0.0 && summary.quietLevel <= maximum) {
+        return BlockLevel::AllMatch;
+    }
+
+    return BlockLevel::Undecided;
+}
+
+int64 LevelSearch::getLongestPossibleRunAfter(int64 block, int64 endSample, double minimum, double maximum, int64 target)
+{
+    // The block itself has at least one sample which does not match
+    int64 longest = kBlockSize - 1;
+
+    for (auto next = block + 1; longest < target; next++) {
+        const auto nextStart = rangeStart + next * kBlockSize;
+
+        if (nextStart >= endSample) {
+            break;
+        }
+
+        const auto available = jmin((int64)kBlockSize, endSample - nextStart);
+        const auto level = classify(next, minimum, maximum);
+
+        // Only an exact summary of a whole block proves a sample which breaks the run
+        const auto broken = level == BlockLevel::Undecided && getSummary(next).exact && available == kBlockSize;
+
+        if (level == BlockLevel::NoneMatch) {
+            break;
+        }
+
+        if (broken) {
+            longest += kBlockSize - 1;
+            break;
+        }
+
+        longest += available;
+    }
+
+    return longest;
+}
+
+}
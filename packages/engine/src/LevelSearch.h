@@ -0,0 +1,82 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+using namespace juce;
+
+class MiniMP3AudioFormatReader;
+
+namespace medley {
+
+/**
+ * Answers several AudioFormatReader::searchForLevel() queries over one range of a reader, with identical results.
+ *
+ * The range is summarised in blocks as it gets decoded, keeping the loudest and the quietest channel's peak of every
+ * block. A query then settles whole blocks from their summaries and only refines at sample resolution inside blocks
+ * where a match may start or end, so the decoded data is shared by every query instead of being read again each time.
+ */
+class LevelSearch {
+public:
+    static constexpr int kBlockSize = 1024;
+
+    LevelSearch(AudioFormatReader& reader, int64 startSample, int64 numSamples);
+
+    // Same contract as AudioFormatReader::searchForLevel(), queries outside of the range fall back to searchReader()
+    int64 search(int64 startSample, int64 numSamplesToSearch, double magnitudeRangeMinimum, double magnitudeRangeMaximum, int minimumConsecutiveSamples);
+
+    // Number of samples decoded so far, summaries and refinements included
+    int64 getNumSamplesDecoded() const { return numSamplesDecoded; }
+
+    // One-off search, which lets formats with a cheaper way than decoding use it
+    static int64 searchReader(AudioFormatReader& reader, int64 startSample, int64 numSamplesToSearch, double magnitudeRangeMinimum, double magnitudeRangeMaximum, int minimumConsecutiveSamples);
+
+private:
+    static constexpr int kBlocksPerChunk = 4;
+    static constexpr int kChunkSize = kBlockSize * kBlocksPerChunk;
+
+    enum class BlockLevel {
+        Undecided,
+        AllMatch,
+        NoneMatch
+    };
+
+    struct Summary {
+        bool valid = false;
+        // False when the levels are only upper bounds
+        bool exact = false;
+        // Peak of the louder of the first two channels
+        double maxLevel = 0.0;
+        // Peak of the quieter of the first two channels
+        double quietLevel = 0.0;
+    };
+
+    // Magnitude of a sample in the units searchForLevel() compares with
+    double getMagnitude(int channel, int index) const;
+
+    const Summary& getSummary(int64 block);
+
+    void decodeChunk(int64 chunk);
+
+    BlockLevel classify(int64 block, double minimum, double maximum);
+
+    // Longest run of matching samples which can start within the block and extend through the following ones
+    int64 getLongestPossibleRunAfter(int64 block, int64 endSample, double minimum, double maximum, int64 target);
+
+    AudioFormatReader& reader;
+    MiniMP3AudioFormatReader* mp3Reader;
+
+    int64 rangeStart;
+    int64 rangeEnd;
+
+    Array<Summary> summaries;
+
+    HeapBlock<int> chunkData;
+    int* chunkChannels[2];
+    int64 cachedChunk = -1;
+
+    int64 numSamplesDecoded = 0;
+
+    JUCE_DECLARE_NON_COPYABLE(LevelSearch)
+};
+
+}
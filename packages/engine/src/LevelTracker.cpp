@@ -6,18 +6,20 @@ void LevelTracker::process(AudioSampleBuffer& buffer)
     const auto numSamples = buffer.getNumSamples();
 
     const auto numBlocks = jmax(1, (int)(numSamples / samplesPerBlock));
+    const auto channelsToTrack = jmin(numChannels, (int)levels.size());
 
-    for (int channel = 0; channel < std::min(numChannels, int(levels.size())); channel++) {
-        for (int block = 0; block < numBlocks; block++) {
-            Time time = Time((int64)((double)samplesProcessed / sampleRate * 1000));
+    // Every channel shares the same timeline, time only advances once per block
+    for (int block = 0; block < numBlocks; block++) {
+        Time time = Time((int64)((double)samplesProcessed / sampleRate * 1000));
 
-            auto start = block * numBlocks;
-            auto numSamplesThisTime = jmin(numSamples - start, samplesPerBlock);
+        auto start = block * samplesPerBlock;
+        auto numSamplesThisTime = jmin(numSamples - start, samplesPerBlock);
 
+        for (int channel = 0; channel < channelsToTrack; channel++) {
             levels[channel].addLevel(time, buffer.getMagnitude(channel, start, numSamplesThisTime), holdDuration);
-
-            samplesProcessed += numSamplesThisTime;
         }
+
+        samplesProcessed += numSamplesThisTime;
     }
 }
 
@@ -26,29 +28,34 @@ void LevelTracker::prepare(const int channels, const int sampleRate, const int l
     this->sampleRate = sampleRate;
     samplesPerBlock = (int)(sampleRate * 0.1 / (double)backlogSize);
 
-    latency = RelativeTime((double)latencyInSamples / sampleRate);
+    latency = (double)latencyInSamples / sampleRate;
 
     levels.clear();
     levels.resize(channels, LevelSmoother(sampleRate, backlogSize));
 }
 
+void LevelTracker::setLatency(const int latencyInSamples)
+{
+    latency = (double)latencyInSamples / sampleRate;
+}
+
 double LevelTracker::getLevel(int channel) {
-    return channel < (int)levels.size() ? levels[channel].get().level : 0.0;
+    return channel >= 0 && channel < (int)levels.size() ? levels[channel].get().level : 0.0;
 }
 
 double LevelTracker::getPeak(int channel)
 {
-    return channel < (int)levels.size() ? levels[channel].get().peak : 0.0;
+    return channel >= 0 && channel < (int)levels.size() ? levels[channel].get().peak : 0.0;
 }
 
 bool LevelTracker::isClipping(int channel)
 {
-    return channel < (int)levels.size() ? levels[channel].get().clip : false;
+    return channel >= 0 && channel < (int)levels.size() ? levels[channel].get().clip : false;
 }
 
 void LevelTracker::update()
 {
-    auto time = Time((int64)((double)samplesProcessed / sampleRate * 1000)) - latency;
+    auto time = Time((int64)((double)samplesProcessed / sampleRate * 1000)) - RelativeTime(latency.load());
 
     for (auto& lv : levels) {
         lv.update(time);
@@ -12,6 +12,9 @@ public:
 
     void prepare(const int channels, const int sampleRate, const int latencyInSamples, const int backlogSize);
 
+    // From any thread
+    void setLatency(const int latencyInSamples);
+
     double getLevel(int channel);
 
     double getPeak(int channel);
@@ -28,6 +31,7 @@ private:
     std::vector<LevelSmoother> levels;    
 
     RelativeTime holdDuration{ 0.5 };
-    RelativeTime latency{ 0 };
+    // Seconds, changed from the message thread while meters are updated
+    std::atomic<double> latency{ 0.0 };
 };
 
@@ -27,8 +27,9 @@ void LookAheadLimiter::prepare(const ProcessSpec& spec)
     gainReductionCalculator.prepare(spec.sampleRate);
     lookAheadFadeIn.prepare(spec.sampleRate, spec.maximumBlockSize);
 
-    delay.prepare({ spec.sampleRate, static_cast<uint32> (spec.maximumBlockSize), 2 });
+    delay.prepare({ spec.sampleRate, static_cast<uint32> (spec.maximumBlockSize), spec.numChannels });
 
+    // Two rows of scratch space regardless of the channel count, the sidechain level and the gain reduction
     sideChainBuffer.setSize(2, spec.maximumBlockSize);
 }
 
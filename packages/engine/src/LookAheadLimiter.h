@@ -19,6 +19,12 @@ public:
 
     void reset();
 
+    // In decibels, -3 by default
+    void setThreshold(float thresholdInDecibels) { gainReductionCalculator.setThreshold(thresholdInDecibels); }
+
+    // In seconds, 0.15 by default
+    void setReleaseTime(float releaseTimeInSeconds) { gainReductionCalculator.setReleaseTime(releaseTimeInSeconds); }
+
 private:
     class Delay {
     private:
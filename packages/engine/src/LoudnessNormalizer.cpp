@@ -0,0 +1,179 @@
+#include "LoudnessNormalizer.h"
+
+namespace {
+    // BS.1770 K-weighting, as analog prototypes so the filters can be derived at any sample rate
+    constexpr double kShelfFrequency = 1681.974450955533;
+    constexpr double kShelfGain = 3.999843853973347;
+    constexpr double kShelfQ = 0.7071752369554196;
+    constexpr double kHighPassFrequency = 38.13547087602444;
+    constexpr double kHighPassQ = 0.5003270373238773;
+
+    constexpr int kBlocksPerWindow = 30;
+
+    // Below this the window is considered silence and the gain holds
+    constexpr float kAbsoluteGate = -70.0f;
+    constexpr float kRelativeGate = -20.0f;
+
+    // Decibels per second
+    constexpr float kMaxGainSlew = 3.0f;
+}
+
+void LoudnessNormalizer::Biquad::setCoefficients(double nb0, double nb1, double nb2, double a0, double na1, double na2)
+{
+    b0 = nb0 / a0;
+    b1 = nb1 / a0;
+    b2 = nb2 / a0;
+    a1 = na1 / a0;
+    a2 = na2 / a0;
+}
+
+float LoudnessNormalizer::Biquad::processSample(float sample, int channel)
+{
+    auto in = (double)sample;
+    auto out = b0 * in + z1[channel];
+
+    z1[channel] = b1 * in - a1 * out + z2[channel];
+    z2[channel] = b2 * in - a2 * out;
+
+    return (float)out;
+}
+
+LoudnessNormalizer::LoudnessNormalizer()
+{
+
+}
+
+void LoudnessNormalizer::prepare(const ProcessSpec& spec)
+{
+    sampleRate = spec.sampleRate;
+    numChannels = (int)spec.numChannels;
+
+    {
+        auto K = std::tan(MathConstants<double>::pi * kShelfFrequency / sampleRate);
+        auto Vh = std::pow(10.0, kShelfGain / 20.0);
+        auto Vb = std::pow(Vh, 0.4996667741545416);
+
+        shelf.setCoefficients(
+            Vh + Vb * K / kShelfQ + K * K,
+            2.0 * (K * K - Vh),
+            Vh - Vb * K / kShelfQ + K * K,
+            1.0 + K / kShelfQ + K * K,
+            2.0 * (K * K - 1.0),
+            1.0 - K / kShelfQ + K * K
+        );
+    }
+
+    {
+        auto K = std::tan(MathConstants<double>::pi * kHighPassFrequency / sampleRate);
+        auto a0 = 1.0 + K / kHighPassQ + K * K;
+
+        // The numerator is left unnormalized, as in the reference implementation
+        highPass.setCoefficients(
+            a0, -2.0 * a0, a0,
+            a0,
+            2.0 * (K * K - 1.0),
+            1.0 - K / kHighPassQ + K * K
+        );
+    }
+
+    for (auto biquad : { &shelf, &highPass }) {
+        biquad->z1.assign(numChannels, 0.0);
+        biquad->z2.assign(numChannels, 0.0);
+    }
+
+    samplesPerBlock = jmax(1, (int)(sampleRate / 10.0));
+    blockPowers.assign(kBlocksPerWindow, 0.0);
+
+    reset();
+}
+
+void LoudnessNormalizer::reset()
+{
+    for (auto biquad : { &shelf, &highPass }) {
+        std::fill(biquad->z1.begin(), biquad->z1.end(), 0.0);
+        std::fill(biquad->z2.begin(), biquad->z2.end(), 0.0);
+    }
+
+    std::fill(blockPowers.begin(), blockPowers.end(), 0.0);
+    samplesInBlock = 0;
+    blockSum = 0.0;
+    blockIndex = 0;
+    blocksFilled = 0;
+
+    loudness = -100.0f;
+    currentGain = 0.0f;
+    desiredGain = 0.0f;
+}
+
+void LoudnessNormalizer::process(const ProcessContextReplacing<float>& context)
+{
+    auto& block = context.getOutputBlock();
+
+    const auto channels = jmin((int)block.getNumChannels(), numChannels);
+    const auto numSamples = (int)block.getNumSamples();
+
+    // Measure the input first, the gain follows the loudness of what comes in
+    for (int i = 0; i < numSamples; i++) {
+        for (int ch = 0; ch < channels; ch++) {
+            auto weighted = highPass.processSample(shelf.processSample(block.getSample(ch, i), ch), ch);
+            blockSum += (double)weighted * weighted;
+        }
+
+        if (++samplesInBlock >= samplesPerBlock) {
+            finishBlock();
+        }
+    }
+
+    const auto startGain = currentGain.load();
+    const auto maxStep = kMaxGainSlew * numSamples / (float)sampleRate;
+    const auto endGain = startGain + jlimit(-maxStep, maxStep, desiredGain - startGain);
+
+    currentGain = endGain;
+
+    if (startGain == 0.0f && endGain == 0.0f) {
+        return;
+    }
+
+    auto gain = Decibels::decibelsToGain(startGain);
+    const auto gainStep = (Decibels::decibelsToGain(endGain) - gain) / (float)jmax(1, numSamples);
+
+    for (int i = 0; i < numSamples; i++) {
+        for (size_t ch = 0; ch < block.getNumChannels(); ch++) {
+            block.getChannelPointer(ch)[i] *= gain;
+        }
+
+        gain += gainStep;
+    }
+}
+
+void LoudnessNormalizer::finishBlock()
+{
+    blockPowers[blockIndex] = blockSum / samplesInBlock;
+    blockIndex = (blockIndex + 1) % kBlocksPerWindow;
+    blocksFilled = jmin(blocksFilled + 1, kBlocksPerWindow);
+
+    blockSum = 0.0;
+    samplesInBlock = 0;
+
+    if (blocksFilled < kBlocksPerWindow) {
+        return;
+    }
+
+    double sum = 0.0;
+    for (auto power : blockPowers) {
+        sum += power;
+    }
+
+    auto windowLoudness = (float)(-0.691 + 10.0 * std::log10(jmax(1e-12, sum / kBlocksPerWindow)));
+    loudness = windowLoudness;
+
+    const float target = targetLoudness;
+
+    // Breaks and fades would otherwise pull the gain all the way up
+    if (windowLoudness < kAbsoluteGate || windowLoudness < target + kRelativeGate) {
+        return;
+    }
+
+    const float limit = maxGain;
+    desiredGain = jlimit(-limit, limit, target - windowLoudness);
+}
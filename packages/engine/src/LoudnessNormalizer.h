@@ -0,0 +1,72 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+using namespace juce;
+using namespace juce::dsp;
+
+/**
+ * Rides the gain towards a target loudness, measured as BS.1770 short-term loudness (K-weighted, 3 second window).
+ *
+ * There is no look-ahead, gain only moves slowly and holds through silence, so it works as a slow AGC rather than
+ * a file normalizer. Every channel is weighted equally.
+ */
+class LoudnessNormalizer : public ProcessorBase
+{
+public:
+    LoudnessNormalizer();
+
+    // In LUFS
+    void setTargetLoudness(float lufs) { targetLoudness = lufs; }
+
+    float getTargetLoudness() const { return targetLoudness; }
+
+    // Most the gain may go up or down, in decibels
+    void setMaxGain(float decibels) { maxGain = decibels; }
+
+    void prepare(const ProcessSpec& spec) override;
+
+    void process(const ProcessContextReplacing<float>& context) override;
+
+    void reset() override;
+
+    // Short-term loudness of the input in LUFS, -100 until the first window is filled
+    float getLoudness() const { return loudness; }
+
+    // Gain currently applied, in decibels
+    float getGain() const { return currentGain; }
+
+private:
+    struct Biquad {
+        void setCoefficients(double b0, double b1, double b2, double a0, double a1, double a2);
+
+        // Transposed direct form II, one pair of state variables per channel
+        float processSample(float sample, int channel);
+
+        double b0 = 1.0, b1 = 0.0, b2 = 0.0, a1 = 0.0, a2 = 0.0;
+        std::vector<double> z1, z2;
+    };
+
+    void finishBlock();
+
+    Biquad shelf;
+    Biquad highPass;
+
+    double sampleRate = 48000.0;
+    int numChannels = 2;
+
+    // 100ms blocks, the window is the last 30 of them
+    int samplesPerBlock = 4800;
+    int samplesInBlock = 0;
+    double blockSum = 0.0;
+    std::vector<double> blockPowers;
+    int blockIndex = 0;
+    int blocksFilled = 0;
+
+    std::atomic<float> targetLoudness{ -23.0f };
+    std::atomic<float> maxGain{ 12.0f };
+
+    std::atomic<float> loudness{ -100.0f };
+    std::atomic<float> currentGain{ 0.0f };
+    float desiredGain = 0.0f;
+};
@@ -1,63 +1,174 @@
 #include "Medley.h"
 #include "MiniMP3AudioFormat.h"
+#include <mutex>
 
 #if JUCE_WINDOWS
 #include <Windows.h>
+#include <psapi.h>
+#elif JUCE_MAC
+#include <mach/mach.h>
+#elif JUCE_LINUX
+#include <unistd.h>
 #endif
 
+namespace {
+    std::atomic<double> formatRegistrationTime{ 0.0 };
+
+    // Beyond this the tracks are too far apart for a stretch to go unnoticed
+    constexpr double kMaxTempoNudge = 0.08;
+
+    // Back-timing speed changes glide over this many seconds, slow enough for the pitch change to go unnoticed
+    constexpr double kVarispeedRampDuration = 4.0;
+}
+
 namespace medley {
 
-Medley::Medley(IQueue& queue)
+Medley::Medley(IQueue& queue, bool useAudioDevice, bool deferInitialization)
     :
+    formatMgr(getSharedFormatManager()),
     mixer(*this),
     queue(queue),
     loadingThread("Loading Thread"),
     readAheadThread("Read-ahead-thread"),
-    visualizingThread("Visualizing Thread")
+    visualizingThread("Visualizing Thread"),
+    useAudioDevice(useAudioDevice)
 {
+    auto constructionStart = Time::getMillisecondCounterHiRes();
+
 #if JUCE_WINDOWS
     static_cast<void>(::CoInitialize(nullptr));
 #endif
 
+    // Only the first engine in the process pays for the registration
+    startupTimes.formats = formatRegistrationTime.exchange(0.0);
+
+    if (!isPluginHostingAvailable()) {
+        static std::once_flag noticed;
+        std::call_once(noticed, [] { Logger::writeToLog("Plugin hosting is not in this build, post-processing plugins need -Dmedley_plugins=1"); });
+    }
+
     updateFadingFactor();
 
-    auto error = deviceMgr.initialiseWithDefaultDevices(0, 2);
-    if (error.isNotEmpty()) {
-        throw std::runtime_error(error.toStdString());
+    auto decksStart = Time::getMillisecondCounterHiRes();
+
+    deck1 = new Deck("Deck A", formatMgr, loadingThread, readAheadThread, DecodePool::getShared(), &memoryAccount, &scanCoordinator);
+    deck2 = new Deck("Deck B", formatMgr, loadingThread, readAheadThread, DecodePool::getShared(), &memoryAccount, &scanCoordinator);
+
+    deck1->addListener(this);
+    deck2->addListener(this);
+
+    // The mixer only forwards preparation to the decks, mixing is up to the routing graph
+    mixer.addInputSource(deck1, false);
+    mixer.addInputSource(deck2, false);
+
+    routing.addSource("deck1", deck1);
+    routing.addSource("deck2", deck2);
+    routing.addBus("music");
+    routing.connect("deck1", "music");
+    routing.connect("deck2", "music");
+    routing.connect("music", RoutingGraph::kMainOutput);
+    routing.compileNow();
+
+    visualizingThread.addTimeSliceClient(&mixer);
+    visualizingThread.addTimeSliceClient(&routing);
+
+    readAheadThread.addTimeSliceClient(&threadPolicies[(int)EngineThread::ReadAhead]);
+    loadingThread.addTimeSliceClient(&threadPolicies[(int)EngineThread::Loading]);
+    visualizingThread.addTimeSliceClient(&threadPolicies[(int)EngineThread::Visualizing]);
+
+    startupTimes.decks = Time::getMillisecondCounterHiRes() - decksStart;
+
+    if (!deferInitialization) {
+        ensureAudioDevice();
+        ensureThreadsStarted();
     }
 
-    mixer.updateAudioConfig();
+    startupTimes.construction = startupTimes.formats + (Time::getMillisecondCounterHiRes() - constructionStart);
+    startupTimes.constructionMemory = getResidentMemory();
 
-    deviceMgr.addChangeListener(&mixer);
+    if (!deferInitialization) {
+        startupTimes.startedMemory = startupTimes.constructionMemory;
+    }
+}
+
+int64 Medley::getResidentMemory()
+{
+#if JUCE_WINDOWS
+    PROCESS_MEMORY_COUNTERS counters{};
 
-    formatMgr.registerFormat(new MiniMP3AudioFormat(), true);
-    formatMgr.registerFormat(new WavAudioFormat(), false);
-    formatMgr.registerFormat(new AiffAudioFormat(), false);
-    formatMgr.registerFormat(new FlacAudioFormat(), false);
-    formatMgr.registerFormat(new OggVorbisAudioFormat(), false);
+    if (K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return (int64)counters.WorkingSetSize;
+    }
+#elif JUCE_MAC
+    mach_task_basic_info info{};
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) == KERN_SUCCESS) {
+        return (int64)info.resident_size;
+    }
+#elif JUCE_LINUX
+    // Total and resident pages
+    auto fields = StringArray::fromTokens(File("/proc/self/statm").loadFileAsString(), true);
+
+    if (fields.size() >= 2) {
+        return fields[1].getLargeIntValue() * (int64)sysconf(_SC_PAGESIZE);
+    }
+#endif
+
+    return 0;
+}
+
+AudioFormatManager& Medley::getSharedFormatManager()
+{
+    static AudioFormatManager sharedFormatMgr;
+    static std::once_flag registered;
+
+    std::call_once(registered, [] {
+        auto start = Time::getMillisecondCounterHiRes();
+
+        sharedFormatMgr.registerFormat(new MiniMP3AudioFormat(), true);
+        sharedFormatMgr.registerFormat(new WavAudioFormat(), false);
+        sharedFormatMgr.registerFormat(new AiffAudioFormat(), false);
+        sharedFormatMgr.registerFormat(new FlacAudioFormat(), false);
+        sharedFormatMgr.registerFormat(new OggVorbisAudioFormat(), false);
 
 #if JUCE_MAC || JUCE_IOS
-    formatMgr.registerFormat(new CoreAudioFormat(), false);
+        sharedFormatMgr.registerFormat(new CoreAudioFormat(), false);
 #endif
 
 #if JUCE_USE_WINDOWS_MEDIA_FORMAT
-    formatMgr.registerFormat(new WindowsMediaAudioFormat(), false);
+        sharedFormatMgr.registerFormat(new WindowsMediaAudioFormat(), false);
 #endif
 
-    deck1 = new Deck("Deck A", formatMgr, loadingThread, readAheadThread);
-    deck2 = new Deck("Deck B", formatMgr, loadingThread, readAheadThread);
+        formatRegistrationTime = Time::getMillisecondCounterHiRes() - start;
+    });
 
-    deck1->addListener(this);
-    deck2->addListener(this);
+    return sharedFormatMgr;
+}
 
-    loadingThread.startThread();
-    readAheadThread.startThread(8);
-    visualizingThread.startThread();
+void Medley::ensureAudioDevice()
+{
+    if (!useAudioDevice || deviceInitialized) {
+        return;
+    }
 
-    mixer.addInputSource(deck1, false);
-    mixer.addInputSource(deck2, false);
+    ScopedLock sl(startupLock);
 
-    visualizingThread.addTimeSliceClient(&mixer);
+    // Another thread got here first
+    if (deviceInitialized) {
+        return;
+    }
+
+    auto start = Time::getMillisecondCounterHiRes();
+
+    auto error = deviceMgr.initialiseWithDefaultDevices(0, 2);
+    if (error.isNotEmpty()) {
+        throw std::runtime_error(error.toStdString());
+    }
+
+    mixer.updateAudioConfig();
+
+    deviceMgr.addChangeListener(&mixer);
 
     mainOut.setSource(&mixer);
     deviceMgr.addAudioCallback(&mainOut);
@@ -72,15 +183,48 @@ Medley::Medley(IQueue& queue)
             throw std::runtime_error("Audio device is not playing");
         }
     }
+
+    deviceInitialized = true;
+    startupTimes.device = Time::getMillisecondCounterHiRes() - start;
+    startupTimes.startedMemory = getResidentMemory();
+}
+
+void Medley::ensureThreadsStarted()
+{
+    if (threadsStarted) {
+        return;
+    }
+
+    ScopedLock sl(startupLock);
+
+    if (threadsStarted) {
+        return;
+    }
+
+    auto start = Time::getMillisecondCounterHiRes();
+
+    loadingThread.startThread();
+    readAheadThread.startThread(8);
+    visualizingThread.startThread();
+
+    threadsStarted = true;
+    startupTimes.threads = Time::getMillisecondCounterHiRes() - start;
+    startupTimes.startedMemory = getResidentMemory();
 }
 
 Medley::~Medley() {
     deck1->removeListener(this);
     deck2->removeListener(this);
     //
+    stopSegmentedOutput();
+
     mixer.removeAllInputs();
     mainOut.setSource(nullptr);
 
+    if (renderingOffline) {
+        mixer.releaseResources();
+    }
+
     loadingThread.stopThread(100);
     readAheadThread.stopThread(100);
     visualizingThread.stopThread(100);
@@ -92,6 +236,8 @@ Medley::~Medley() {
 }
 
 void Medley::setPositionInSeconds(double time) {
+    record(SessionEvent::Type::SeekSeconds, time);
+
     if (auto deck = getMainDeck()) {
         deck->setPosition(time);
     }
@@ -99,6 +245,8 @@ void Medley::setPositionInSeconds(double time) {
 
 void Medley::setPositionFractional(double fraction)
 {
+    record(SessionEvent::Type::SeekFraction, fraction);
+
     if (auto deck = getMainDeck()) {
         deck->setPositionFractional(fraction);
     }
@@ -123,19 +271,81 @@ double Medley::getPositionInSeconds() const
 }
 
 void Medley::setMaxTransitionTime(double value) {
+    record(SessionEvent::Type::SetMaxTransitionTime, value);
     maxTransitionTime = value;
     deck1->setMaxTransitionTime(value);
     deck2->setMaxTransitionTime(value);
 }
 
+double Medley::fitToPost(double secondsUntilPost, double upcomingDuration)
+{
+    record(SessionEvent::Type::FitToPost, secondsUntilPost, upcomingDuration);
+
+    if (secondsUntilPost <= 0.0) {
+        endPost();
+        return 1.0;
+    }
+
+    auto programmeDuration = jmax(0.0, upcomingDuration);
+
+    if (auto deck = getMainDeck()) {
+        auto until = deck->getTransitionStartPosition();
+
+        if (until <= 0.0) {
+            until = deck->getEndPosition();
+        }
+
+        programmeDuration += jmax(0.0, until - deck->getPositionInSeconds());
+    }
+
+    if (programmeDuration <= 0.0) {
+        endPost();
+        return 1.0;
+    }
+
+    // Whatever does not fit within the range is left for the post itself to cut or fill
+    const auto speed = jlimit(1.0 - kMaxVarispeed, 1.0 + kMaxVarispeed, programmeDuration / secondsUntilPost);
+
+    postSamplePosition = mixer.getSamplePosition() + (int64)(secondsUntilPost * mixer.getSampleRate());
+    programmeSpeed = speed;
+
+    for (auto deck : { deck1, deck2 }) {
+        // A deck waiting to play starts right at the speed
+        deck->setPlaybackSpeed(speed, deck->isPlaying() ? kVarispeedRampDuration : 0.0);
+    }
+
+    Logger::writeToLog(String::formatted("Fitting %.2fs of programme into %.2fs, speed=%.4f", programmeDuration, secondsUntilPost, speed));
+
+    return speed;
+}
+
+void Medley::clearPost()
+{
+    record(SessionEvent::Type::ClearPost);
+    endPost();
+}
+
+void Medley::endPost()
+{
+    postSamplePosition = -1;
+    programmeSpeed = 1.0;
+
+    for (auto deck : { deck1, deck2 }) {
+        deck->setPlaybackSpeed(1.0, deck->isPlaying() ? kVarispeedRampDuration : 0.0);
+    }
+}
+
 void Medley::fadeOutMainDeck()
 {
+    record(SessionEvent::Type::FadeOut);
+
     if (auto deck = getMainDeck()) {
         forceFadingOut++;
 
         if (transitionState == TransitionState::Transit) {
             deck->unloadTrack();
             transitionState = TransitionState::Idle;
+            introDeadline = -1.0;
 
             deck = getMainDeck();
         }
@@ -150,6 +360,12 @@ void Medley::fadeOutMainDeck()
 void Medley::changeListenerCallback(ChangeBroadcaster* source)
 {
     if (auto deviceMgr = dynamic_cast<AudioDeviceManager*>(source)) {
+        if (auto device = deviceMgr->getCurrentAudioDevice()) {
+            record(SessionEvent::Type::DeviceChanged, device->getCurrentSampleRate());
+        }
+
+        mixer.resetRecordedBlockSize();
+
         ScopedLock sl(callbackLock);
 
         listeners.call([](Callback& cb) {
@@ -173,6 +389,13 @@ bool Medley::loadNextTrack(Deck* currentDeck, bool play) {
 
     while (queue.count() > 0) {
         auto track = queue.fetchNextTrack();
+
+        if (track != nullptr && recorder.isRecording()) {
+            auto file = track->getFile();
+            // The size tells a replay whether it is given the same file
+            record(SessionEvent::Type::TrackFetched, track->getPreGain(), (double)file.getSize(), -1, file.getFullPathName());
+        }
+
         if (deck->loadTrack(track, play)) {
             return true;
         }
@@ -188,7 +411,7 @@ void Medley::deckTrackScanning(Deck& sender)
 
 void Medley::deckTrackScanned(Deck& sender)
 {
-
+    recordDeckEvent(SessionEvent::Type::TrackScanned, sender);
 }
 
 Deck* Medley::getAvailableDeck() {
@@ -210,6 +433,8 @@ inline String Medley::getDeckName(Deck& deck) {
 void Medley::deckStarted(Deck& sender) {
     Logger::writeToLog(String::formatted("[deckStarted] %s", sender.getName().toWideCharPointer()));
 
+    recordDeckEvent(SessionEvent::Type::DeckStarted, sender);
+
     ScopedLock sl(callbackLock);
     listeners.call([&sender](Callback& cb) {
         cb.deckStarted(sender);
@@ -217,6 +442,8 @@ void Medley::deckStarted(Deck& sender) {
 }
 
 void Medley::deckFinished(Deck& sender) {
+    recordDeckEvent(SessionEvent::Type::DeckFinished, sender);
+
     ScopedLock sl(callbackLock);
     listeners.call([&sender](Callback& cb) {
         cb.deckFinished(sender);
@@ -225,6 +452,8 @@ void Medley::deckFinished(Deck& sender) {
 
 void Medley::deckLoaded(Deck& sender)
 {
+    recordDeckEvent(SessionEvent::Type::DeckLoaded, sender, sender.getDuration());
+
     {
         ScopedLock sl(callbackLock);
 
@@ -238,6 +467,8 @@ void Medley::deckLoaded(Deck& sender)
 }
 
 void Medley::deckUnloaded(Deck& sender) {
+    recordDeckEvent(SessionEvent::Type::DeckUnloaded, sender);
+
     if (&sender == transitingDeck) {
         if (transitionState == TransitionState::Cued) {
             Logger::writeToLog(String::formatted("[%s] stopped before transition would happen, try starting next deck", sender.getName().toWideCharPointer()));
@@ -248,6 +479,7 @@ void Medley::deckUnloaded(Deck& sender) {
         }
 
         transitionState = TransitionState::Idle;
+        introDeadline = -1.0;
         transitingDeck = nullptr;
 
         if (forceFadingOut > 0) {
@@ -289,6 +521,12 @@ void Medley::deckPosition(Deck& sender, double position) {
         });
     }
 
+    const auto post = postSamplePosition.load();
+
+    if (post >= 0 && mixer.getSamplePosition() >= post) {
+        endPost();
+    }
+
     auto nextDeck = getAnotherDeck(&sender);
     if (nextDeck == nullptr) {
         return;
@@ -325,6 +563,7 @@ void Medley::deckPosition(Deck& sender, double position) {
 
                 Logger::writeToLog(String::formatted("[%s] cue", nextDeck->getName().toWideCharPointer()));
                 transitionState = TransitionState::Cued;
+                introDeadline = -1.0;
                 transitingDeck = &sender;
             }
 
@@ -346,6 +585,15 @@ void Medley::deckPosition(Deck& sender, double position) {
                         }
                     }
 
+                    // Presenters talk over the intro, the outgoing track should be gone when the vocals come in
+                    auto introEnd = nextDeck->getIntroEndPosition();
+                    auto introRemaining = introEnd - nextDeck->getPositionInSeconds();
+                    introDeadline = (introEnd >= 0.0 && introRemaining > 0.0) ? position + introRemaining : -1.0;
+
+                    if (tempoMatching) {
+                        matchTempo(sender, *nextDeck, transitionEndPos - position);
+                    }
+
                     nextDeck->start();
                 }
             }
@@ -361,6 +609,10 @@ void Medley::deckPosition(Deck& sender, double position) {
         }
     
         if (position >= transitionStartPos) {
+            if (introDeadline > transitionStartPos && introDeadline < transitionEndPos) {
+                transitionEndPos = introDeadline;
+            }
+
             auto transitionDuration = (transitionEndPos - transitionStartPos);
             auto transitionProgress = jlimit(0.0, 1.0, (position - transitionStartPos) / transitionDuration);
 
@@ -385,6 +637,8 @@ void Medley::deckPosition(Deck& sender, double position) {
 }
 
 void Medley::setAudioDeviceByIndex(int index) {
+    ensureAudioDevice();
+
     auto config = deviceMgr.getAudioDeviceSetup();
     config.outputDeviceName = getDeviceNames()[index];
     auto error = deviceMgr.setAudioDeviceSetup(config, true);
@@ -399,12 +653,18 @@ Deck* Medley::getMainDeck() const
 }
 
 void Medley::setFadingCurve(double curve) {
+    record(SessionEvent::Type::SetFadingCurve, curve);
     fadingCurve = jlimit(0.0, 100.0, curve);
     updateFadingFactor();
 }
 
 void Medley::play()
 {
+    record(SessionEvent::Type::Play);
+
+    ensureAudioDevice();
+    ensureThreadsStarted();
+
     if (!isDeckPlaying()) {
         loadNextTrack(nullptr, true);
     }
@@ -415,6 +675,8 @@ void Medley::play()
 
 void Medley::stop()
 {
+    record(SessionEvent::Type::Stop);
+
     keepPlaying = false;
 
     deck1->stop();
@@ -441,24 +703,215 @@ void Medley::removeListener(Callback* cb)
     listeners.remove(cb);
 }
 
+void Medley::matchTempo(Deck& from, Deck& to, double overlapDuration)
+{
+    auto fromTrack = from.getTrack();
+    auto toTrack = to.getTrack();
+
+    if (fromTrack == nullptr || toTrack == nullptr) {
+        return;
+    }
+
+    auto fromTempo = fromTrack->getTempo();
+    auto toTempo = toTrack->getTempo();
+
+    if (fromTempo <= 0.0 || toTempo <= 0.0) {
+        return;
+    }
+
+    auto speed = fromTempo / toTempo;
+    auto deviation = std::abs(speed - 1.0);
+
+    if (deviation < 0.001 || deviation > kMaxTempoNudge) {
+        return;
+    }
+
+    to.startTempoRamp(speed, overlapDuration);
+}
+
 void Medley::updateFadingFactor() {
     double outRange = 1000.0 - 1.0;
     double inRange = 100.0;
     fadingFactor = (float)(1000.0 / (((100.0 - fadingCurve) / inRange * outRange) + 1.0));
 }
 
+void Medley::prepareToRender(double sampleRate, int samplesPerBlock, int numChannels, bool waitForBuffering)
+{
+    if (useAudioDevice) {
+        throw std::runtime_error("Offline rendering requires an engine without audio device");
+    }
+
+    deck1->setWaitsForBuffering(waitForBuffering);
+    deck2->setWaitsForBuffering(waitForBuffering);
+
+    ensureThreadsStarted();
+
+    mixer.prepareToPlay(samplesPerBlock, sampleRate);
+    mixer.prepareProcessing(sampleRate, samplesPerBlock, numChannels, 0);
+
+    renderingOffline = true;
+}
+
+void Medley::setFaultInjector(FaultInjector* injector)
+{
+    if (useAudioDevice && injector != nullptr) {
+        throw std::runtime_error("Fault injection requires an engine without audio device");
+    }
+
+    deck1->setFaultInjector(injector);
+    deck2->setFaultInjector(injector);
+}
+
+void Medley::renderNextBlock(AudioBuffer<float>& buffer, int startSample, int numSamples)
+{
+    jassert(renderingOffline);
+
+    AudioSourceChannelInfo info(&buffer, startSample, numSamples);
+    mixer.getNextAudioBlock(info);
+
+    buffer.applyGain(startSample, numSamples, mainOut.getGain());
+}
+
+void Medley::startSegmentedOutput(const SegmentedOutputWriter::Options& options)
+{
+    // The rate and channels come from the device, a deferred one is opened now
+    ensureAudioDevice();
+
+    if (!mixer.isPrepared()) {
+        throw std::runtime_error("Segmented output needs an open audio device or prepareToRender() first");
+    }
+
+    auto writer = new SegmentedOutputWriter(formatMgr, options, mixer.getSampleRate(), mixer.getNumChannels());
+    stopSegmentedOutput();
+    segmentWriter = writer;
+}
+
+void Medley::stopSegmentedOutput()
+{
+    auto writer = segmentWriter.exchange(nullptr);
+
+    if (writer == nullptr) {
+        return;
+    }
+
+    // The audio thread may still be pushing to it
+    while (segmentWriterBusy) {
+        Thread::yield();
+    }
+
+    delete writer;
+}
+
+void Medley::startRecording(const File& file)
+{
+    // The header carries the device's rate and channels, a deferred one is opened now
+    ensureAudioDevice();
+
+    if (!mixer.isPrepared()) {
+        throw std::runtime_error("Recording needs an open audio device or prepareToRender() first");
+    }
+
+    SessionLog::Header header;
+    header.sampleRate = mixer.getSampleRate();
+    header.numChannels = mixer.getNumChannels();
+    header.startTime = Time::currentTimeMillis();
+
+    recorder.start(file, header);
+    mixer.resetRecordedBlockSize();
+
+    // Replays start from a fresh engine, which needs the settings this one runs with
+    record(SessionEvent::Type::SetGain, mainOut.getGain());
+    record(SessionEvent::Type::SetFadingCurve, fadingCurve);
+    record(SessionEvent::Type::SetMaxTransitionTime, maxTransitionTime);
+    record(SessionEvent::Type::SetMaxLeadingDuration, maxLeadingDuration);
+    record(SessionEvent::Type::SetTempoMatching, tempoMatching ? 1.0 : 0.0);
+    record(SessionEvent::Type::SetHalfPrecision, hasHalfPrecisionBuffers() ? 1.0 : 0.0);
+
+    Logger::writeToLog("Recording session to " + file.getFullPathName());
+}
+
+void Medley::stopRecording()
+{
+    recorder.stop();
+
+    if (auto dropped = recorder.getNumDroppedEvents()) {
+        Logger::writeToLog("Session recording dropped " + String(dropped) + " events");
+    }
+}
+
+void Medley::record(SessionEvent::Type type, double value, double value2, int deck, const String& text)
+{
+    if (!recorder.isRecording()) {
+        return;
+    }
+
+    SessionEvent event;
+    event.samplePosition = mixer.getSamplePosition();
+    event.type = type;
+    event.deck = deck;
+    event.values[0] = value;
+    event.values[1] = value2;
+    event.text = text;
+
+    recorder.record(event);
+}
+
+void Medley::recordDeckEvent(SessionEvent::Type type, Deck& deck, double value)
+{
+    record(type, value, 0.0, &deck == deck1 ? 0 : 1);
+}
+
+void Medley::setThreadPolicy(EngineThread thread, const ThreadPolicy& policy)
+{
+    jassert(thread != EngineThread::NumThreads);
+    threadPolicies[(int)thread].setPolicy(policy);
+
+    if (thread == EngineThread::Audio) {
+        outputTargets.setWorkerPolicy(policy);
+    }
+
+    if (thread == EngineThread::ReadAhead) {
+        DecodePool::getShared().setWorkerPolicy(policy);
+    }
+}
+
+ThreadPolicy::Status Medley::getThreadStatus(EngineThread thread) const
+{
+    jassert(thread != EngineThread::NumThreads);
+    return threadPolicies[(int)thread].getStatus();
+}
+
+Medley::Mixer::Mixer(Medley& medley)
+    : MixerAudioSource(), medley(medley)
+{
+#if JUCE_MODULE_AVAILABLE_juce_audio_processors
+    processor.getPluginChain().addListener(this);
+#endif
+}
+
+Medley::Mixer::~Mixer()
+{
+#if JUCE_MODULE_AVAILABLE_juce_audio_processors
+    processor.getPluginChain().removeListener(this);
+#endif
+}
+
 bool Medley::Mixer::togglePause() {
     return paused = !paused;
 }
 
 void Medley::Mixer::getNextAudioBlock(const AudioSourceChannelInfo& info) {
+    auto startTicks = Time::getHighResolutionTicks();
+
+    medley.threadPolicies[(int)EngineThread::Audio].applyPending();
+
     if (!outputStarted) {
         outputStarted = true;
         Logger::writeToLog("Output started");
     }
 
     if (!stalled) {
-        MixerAudioSource::getNextAudioBlock(info);
+        medley.routing.render(info);
 
         if (paused) {
             for (int i = info.buffer->getNumChannels(); --i >= 0;) {
@@ -470,7 +923,7 @@ void Medley::Mixer::getNextAudioBlock(const AudioSourceChannelInfo& info) {
     }
     else /* stalled */ {
         if (!paused) {
-            MixerAudioSource::getNextAudioBlock(info);
+            medley.routing.render(info);
 
             for (int i = info.buffer->getNumChannels(); --i >= 0;) {
                 info.buffer->applyGainRamp(i, info.startSample, jmin(256, info.numSamples), 0.0f, 1.0f);
@@ -481,15 +934,72 @@ void Medley::Mixer::getNextAudioBlock(const AudioSourceChannelInfo& info) {
     }
 
     if (prepared) {
+        // Every target shares this render, only its own chain is extra
+        medley.outputTargets.process(*info.buffer, info.startSample, info.numSamples);
+
         AudioBlock<float> block(*info.buffer, (size_t)info.startSample);
         processor.process(ProcessContextReplacing<float>(block));
 
         levelTracker.process(*info.buffer);
+
+        // Flagged before looking, so a writer being stopped is never deleted under us
+        medley.segmentWriterBusy = true;
+
+        if (auto writer = medley.segmentWriter.load()) {
+            writer->push(*info.buffer, info.startSample, info.numSamples, samplePosition);
+        }
+
+        medley.segmentWriterBusy = false;
+    }
+
+    // Only changes are recorded, a device keeps the same size for most of its life
+    if (info.numSamples != recordedBlockSize) {
+        recordedBlockSize = info.numSamples;
+        medley.record(SessionEvent::Type::BlockSize, info.numSamples);
+    }
+
+    samplePosition += info.numSamples;
+
+    auto ticks = Time::getHighResolutionTicks() - startTicks;
+
+    statCallbacks++;
+    statTicks += ticks;
+    statSamples += info.numSamples;
+
+    if (ticks > statMaxTicks) {
+        statMaxTicks = ticks;
     }
 }
 
+Medley::CallbackStats Medley::Mixer::getStatsAndReset()
+{
+    CallbackStats stats;
+
+    auto ticks = statTicks.exchange(0);
+    auto samples = statSamples.exchange(0);
+
+    stats.numCallbacks = statCallbacks.exchange(0);
+    stats.maxTime = Time::highResolutionTicksToSeconds(statMaxTicks.exchange(0)) * 1000.0;
+
+    if (stats.numCallbacks > 0) {
+        stats.averageTime = Time::highResolutionTicksToSeconds(ticks) * 1000.0 / stats.numCallbacks;
+    }
+
+    if (samples > 0) {
+        stats.load = Time::highResolutionTicksToSeconds(ticks) / (samples / sampleRate);
+    }
+
+    return stats;
+}
+
 void Medley::Mixer::changeListenerCallback(ChangeBroadcaster* source) {
+    // The device is live by now and nothing below may be prepared while it renders,
+    // removing the callback waits for a running one and adding it back prepares the sources again
+    auto& deviceMgr = medley.deviceMgr;
+
+    deviceMgr.removeAudioCallback(&medley.mainOut);
     updateAudioConfig();
+    deviceMgr.addAudioCallback(&medley.mainOut);
 }
 
 int Medley::Mixer::useTimeSlice()
@@ -512,20 +1022,52 @@ void Medley::Mixer::updateAudioConfig()
         }
 #endif
 
-        auto numSamples = device->getCurrentBufferSizeSamples();
-        numChannels = device->getOutputChannelNames().size();
+        prepareProcessing(
+            config.sampleRate,
+            device->getCurrentBufferSizeSamples(),
+            device->getActiveOutputChannels().countNumberOfSetBits(),
+            latencyInSamples
+        );
+    }
+}
+
+void Medley::Mixer::prepareProcessing(double newSampleRate, int samplesPerBlock, int channels, int latencyInSamples)
+{
+    sampleRate = newSampleRate;
+    numChannels = channels;
+    deviceLatency = latencyInSamples;
 
-        processor.prepare({ config.sampleRate, (uint32)numSamples, (uint32)numChannels });
+    processor.prepare({ sampleRate, (uint32)samplesPerBlock, (uint32)numChannels });
 
-        levelTracker.prepare(
-            numChannels,
-            (int)config.sampleRate,
-            latencyInSamples,
-            10
-        );
+    medley.routing.prepare(sampleRate, samplesPerBlock, numChannels, deviceLatency + processor.getLatencyInSamples());
+    medley.outputTargets.prepare(sampleRate, samplesPerBlock, numChannels);
 
-        prepared = true;
-    }
+    levelTracker.prepare(
+        numChannels,
+        (int)sampleRate,
+        deviceLatency + processor.getLatencyInSamples(),
+        10
+    );
+
+    prepared = true;
+}
+
+double Medley::Mixer::getOutputLatency() const
+{
+    return (deviceLatency + processor.getLatencyInSamples()) / sampleRate;
 }
 
+#if JUCE_MODULE_AVAILABLE_juce_audio_processors
+void Medley::Mixer::pluginScanningFinished(PluginChain& sender)
+{
+
+}
+
+void Medley::Mixer::pluginLatencyChanged(PluginChain& sender)
+{
+    // Keep meters in sync with what is actually heard
+    levelTracker.setLatency(deviceLatency + processor.getLatencyInSamples());
+}
+#endif
+
 }
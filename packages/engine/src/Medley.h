@@ -4,7 +4,12 @@
 
 #include "Deck.h"
 #include "PostProcessor.h"
+#include "RoutingGraph.h"
+#include "OutputTargets.h"
+#include "SegmentedOutputWriter.h"
+#include "SessionRecorder.h"
 #include "LevelTracker.h"
+#include "ThreadPolicy.h"
 #include <list>
 
 using namespace juce;
@@ -28,48 +33,129 @@ public:
         virtual void preCueNext() = 0;
     };
 
-    Medley(IQueue& queue);
+    enum class EngineThread {
+        Audio = 0,
+        ReadAhead,
+        Loading,
+        Visualizing,
+        NumThreads
+    };
+
+    struct CallbackStats {
+        int64 numCallbacks = 0;
+        double averageTime = 0.0;
+        double maxTime = 0.0;
+        // Ratio between time spent rendering and the duration of audio rendered
+        double load = 0.0;
+    };
+
+    // Milliseconds spent on each part of the initialization, deferred parts are filled in when they happen
+    struct StartupTimes {
+        double formats = 0.0;
+        double decks = 0.0;
+        double threads = 0.0;
+        double device = 0.0;
+        double construction = 0.0;
+
+        // Resident memory of the whole process in bytes, after construction and once the deferred parts are done
+        int64 constructionMemory = 0;
+        int64 startedMemory = 0;
+    };
+
+    /**
+     * With deferInitialization, the constructor only creates the decks; the audio device is opened
+     * and the threads are started on first play(), or when the device is first configured.
+     */
+    Medley(IQueue& queue, bool useAudioDevice = true, bool deferInitialization = false);
 
     virtual ~Medley();
 
     inline const auto& getAvailableDeviceTypes() {
+        ensureAudioDevice();
         return deviceMgr.getAvailableDeviceTypes();
     }
 
     inline void setCurrentAudioDeviceType(AudioIODeviceType& type) {
+        ensureAudioDevice();
         deviceMgr.setCurrentAudioDeviceType(type.getTypeName(), true);
     }
 
     inline void setCurrentAudioDeviceType(juce::String& type) {
+        ensureAudioDevice();
         deviceMgr.setCurrentAudioDeviceType(type, true);
     }
 
-    inline auto getCurrentAudioDeviceType() const {
+    // Opens the device first under deferInitialization, the device type is null when there is none
+    inline AudioIODeviceType* getCurrentAudioDeviceType() {
+        ensureAudioDevice();
         return deviceMgr.getCurrentDeviceTypeObject();
     }
 
-    inline auto getDeviceNames() const {
-        return getCurrentAudioDeviceType()->getDeviceNames();
+    inline StringArray getDeviceNames() {
+        auto type = getCurrentAudioDeviceType();
+        return type != nullptr ? type->getDeviceNames() : StringArray();
     }
 
-    inline auto getIndexOfCurrentDevice() const {
-        return getCurrentAudioDeviceType()->getIndexOfDevice(deviceMgr.getCurrentAudioDevice(), false);
+    inline int getIndexOfCurrentDevice() {
+        auto type = getCurrentAudioDeviceType();
+        return type != nullptr ? type->getIndexOfDevice(deviceMgr.getCurrentAudioDevice(), false) : -1;
     }
 
-    inline auto getDefaultDeviceIndex() const {
-        return getCurrentAudioDeviceType()->getDefaultDeviceIndex(false);
+    inline int getDefaultDeviceIndex() {
+        auto type = getCurrentAudioDeviceType();
+        return type != nullptr ? type->getDefaultDeviceIndex(false) : -1;
     }
 
     void setAudioDeviceByIndex(int index);
 
     inline const AudioFormatManager& getAudioFormatManager() const { return formatMgr; }
 
-    inline const AudioIODevice* getCurrentAudioDevice() const { return deviceMgr.getCurrentAudioDevice(); }
+    // Null until the device is opened under deferInitialization, and for engines without audio device
+    inline const AudioIODevice* getCurrentAudioDevice() const { return deviceInitialized ? deviceMgr.getCurrentAudioDevice() : nullptr; }
 
     inline Deck& getDeck1() const { return *deck1; }
 
     inline Deck& getDeck2() const { return *deck2; }
 
+    /**
+     * Decks are the sources "deck1" and "deck2", mixed into the "music" bus which feeds the main output.
+     * The main output then goes through the post-processing.
+     */
+    inline RoutingGraph& getRouting() { return routing; }
+
+    // Extra outputs with their own loudness processing, fed from the main output before the post-processing
+    inline OutputTargets& getOutputTargets() { return outputTargets; }
+
+    /**
+     * Start cutting the main output into segments with a rolling playlist, replacing any running writer.
+     * Audio is taken after the post-processing, before the main gain. Restart it after changing the audio device.
+     * Opens a deferred audio device. Throws if the options cannot be used, or if an engine without audio device has
+     * not been prepared to render.
+     */
+    void startSegmentedOutput(const SegmentedOutputWriter::Options& options);
+
+    // Finishes the current segment and ends the playlist
+    void stopSegmentedOutput();
+
+    bool isSegmentedOutputRunning() const { return segmentWriter.load() != nullptr; }
+
+    /**
+     * Record every control call, track handed out by the queue, audio callback block size and deck event to a
+     * compact binary log, each stamped with the engine sample clock, for SessionReplayer to re-drive an engine from.
+     *
+     * Start before play() for a complete replay, the current settings are recorded first but not what is already
+     * loaded. Opens a deferred audio device. Throws if the file cannot be created, or if an engine without audio device
+     * has not been prepared to render.
+     */
+    void startRecording(const File& file);
+
+    void stopRecording();
+
+    bool isRecording() const { return recorder.isRecording(); }
+
+    // Engine sample clock, samples rendered so far
+    int64 getSamplePosition() const { return mixer.getSamplePosition(); }
+
     Deck* getMainDeck() const;
 
     Deck* getAnotherDeck(Deck* from);
@@ -90,11 +176,17 @@ public:
 
     void removeListener(Callback* cb);
 
-    inline void setGain(float newGain) { mainOut.setGain(newGain); }
+    inline void setGain(float newGain) {
+        record(SessionEvent::Type::SetGain, newGain);
+        mainOut.setGain(newGain);
+    }
 
     inline float getGain() const { return mainOut.getGain(); }
 
-    inline bool togglePause() { return mixer.togglePause(); }
+    inline bool togglePause() {
+        record(SessionEvent::Type::TogglePause);
+        return mixer.togglePause();
+    }
 
     inline bool isPaused() const { return mixer.isPaused(); }
 
@@ -109,15 +201,57 @@ public:
     double getMaxLeadingDuration() const { return maxLeadingDuration; }
 
     void setMaxLeadingDuration(double value) {
+        record(SessionEvent::Type::SetMaxLeadingDuration, value);
         maxLeadingDuration = value;
     }
 
     double getMaxTransitionTime() const { return maxTransitionTime; }
 
+    /**
+     * Hold the decks' read-ahead as half-precision floats, halving its memory so more fits in a tight budget.
+     * Meant for playback of lossy and 16-bit sources, takes effect from the next track loaded.
+     */
+    void setHalfPrecisionBuffers(bool enabled) {
+        record(SessionEvent::Type::SetHalfPrecision, enabled ? 1.0 : 0.0);
+        deck1->setHalfPrecisionBuffers(enabled);
+        deck2->setHalfPrecisionBuffers(enabled);
+    }
+
+    bool hasHalfPrecisionBuffers() const { return deck1->hasHalfPrecisionBuffers(); }
+
+    // Time-stretch incoming tracks to the outgoing tempo during transitions, when both tempos are known
+    bool isTempoMatching() const { return tempoMatching; }
+
+    void setTempoMatching(bool enabled) {
+        record(SessionEvent::Type::SetTempoMatching, enabled ? 1.0 : 0.0);
+        tempoMatching = enabled;
+    }
+
     void setMaxTransitionTime(double value);
 
     void fadeOutMainDeck();
 
+    // Most back-timing may change the speed by, either way
+    static constexpr double kMaxVarispeed = 0.03;
+
+    /**
+     * Back-time to a hard post by playing everything slightly faster or slower, within kMaxVarispeed.
+     *
+     * upcomingDuration is the length of the items still to be played in full before the post, as played up to where
+     * the following one starts. The rest of the current track is added from its transition start. Both decks glide to
+     * the speed and keep it until the post is reached, calling again refines it. Returns the speed applied.
+     */
+    double fitToPost(double secondsUntilPost, double upcomingDuration);
+
+    // Back to normal speed
+    void clearPost();
+
+    // Speed applied for the current post, 1.0 when there is none
+    double getProgrammeSpeed() const { return programmeSpeed; }
+
+    // Channels of the audio device, or of the last prepareToRender()
+    inline int getNumOutputChannels() const { return mixer.getNumChannels(); }
+
     inline double getLevel(int channel) {
         return mixer.getLevel(channel);
     }
@@ -130,9 +264,84 @@ public:
         return mixer.isClipping(channel);
     }
 
+    // Statistics since the last call, times are in milliseconds
+    inline CallbackStats getCallbackStats() {
+        return mixer.getStatsAndReset();
+    }
+
+    /**
+     * Prepare for pulling audio through renderNextBlock() instead of an audio device.
+     *
+     * Without a real-time deadline decks can afford to wait for their read-ahead buffers,
+     * a host driving engines from a device callback should pass waitForBuffering = false.
+     */
+    void prepareToRender(double sampleRate, int samplesPerBlock, int numChannels = 2, bool waitForBuffering = true);
+
+    /**
+     * Read tracks through a fault injector, to see how buffering copes with slow or flaky storage. Offline rendering
+     * only, the injector sleeps on the reading threads. Applies to files opened from now on, nullptr to stop.
+     */
+    void setFaultInjector(FaultInjector* injector);
+
+    // Underruns of both decks so far
+    int64 getNumUnderruns() const { return deck1->getNumUnderruns() + deck2->getNumUnderruns(); }
+
+    // Output latency in seconds, including the audio device and post-processing delay
+    double getOutputLatency() const { return mixer.getOutputLatency(); }
+
+    // True only in builds made with -Dmedley_plugins=1 or -Dmedley_headless=0, which add juce_audio_processors
+    static constexpr bool isPluginHostingAvailable() {
+#if JUCE_MODULE_AVAILABLE_juce_audio_processors
+        return true;
+#else
+        return false;
+#endif
+    }
+
+#if JUCE_MODULE_AVAILABLE_juce_audio_processors
+    inline PluginChain& getPluginChain() { return mixer.getPluginChain(); }
+#endif
+
+    void renderNextBlock(AudioBuffer<float>& buffer, int startSample, int numSamples);
+
+    // Applied asynchronously by the thread itself, the audio thread picks it up on its next callback.
+    // Output target workers follow the audio thread's policy, decode workers, shared by every engine, the read-ahead one's
+    void setThreadPolicy(EngineThread thread, const ThreadPolicy& policy);
+
+    // Effective settings after the last policy was applied
+    ThreadPolicy::Status getThreadStatus(EngineThread thread) const;
+
+    // Memory held by this engine and its decks, counted against MemoryBudget::getGlobal()
+    const MemoryBudget::Account& getMemoryAccount() const { return memoryAccount; }
+
+    inline bool isRenderingOffline() const { return renderingOffline; }
+
+    // False for engines rendered by their host through renderNextBlock()
+    inline bool hasAudioDevice() const { return useAudioDevice; }
+
+    const StartupTimes& getStartupTimes() const { return startupTimes; }
+
+    // Resident set size of the process in bytes, 0 where it cannot be read
+    static int64 getResidentMemory();
+
+    // Formats are registered once and shared by every engine in the process
+    static AudioFormatManager& getSharedFormatManager();
+
     void changeListenerCallback(ChangeBroadcaster* source) override;
 
 private:
+    void ensureAudioDevice();
+
+    void ensureThreadsStarted();
+
+    // Stamped with the sample clock, nothing happens unless recording
+    void record(SessionEvent::Type type, double value = 0.0, double value2 = 0.0, int deck = -1, const String& text = String());
+
+    void recordDeckEvent(SessionEvent::Type type, Deck& deck, double value = 0.0);
+
+    // Back to normal speed, without recording it as a control call
+    void endPost();
+
     bool loadNextTrack(Deck* currentDeck, bool play);
 
     void deckTrackScanning(Deck& sender) override;
@@ -155,13 +364,18 @@ private:
 
     void updateFadingFactor();
 
-    class Mixer : public MixerAudioSource, public ChangeListener, public TimeSliceClient {
+    // Nudges the incoming deck to the outgoing tempo, gliding back to its own over the overlap
+    void matchTempo(Deck& from, Deck& to, double overlapDuration);
+
+    class Mixer : public MixerAudioSource, public ChangeListener, public TimeSliceClient
+#if JUCE_MODULE_AVAILABLE_juce_audio_processors
+        , public PluginChain::Callback
+#endif
+    {
     public:
-        Mixer(Medley& medley)
-            : MixerAudioSource(), medley(medley)
-        {
+        Mixer(Medley& medley);
 
-        }
+        ~Mixer() override;
 
         bool togglePause();
 
@@ -177,6 +391,32 @@ private:
 
         void updateAudioConfig();
 
+        void prepareProcessing(double sampleRate, int samplesPerBlock, int channels, int latencyInSamples);
+
+        CallbackStats getStatsAndReset();
+
+        inline double getSampleRate() const { return sampleRate; }
+
+        inline int getNumChannels() const { return numChannels; }
+
+        // Once the rate and channels are those of the output
+        inline bool isPrepared() const { return prepared; }
+
+        inline int64 getSamplePosition() const { return samplePosition; }
+
+        // The next callback records its block size
+        inline void resetRecordedBlockSize() { recordedBlockSize = 0; }
+
+        double getOutputLatency() const;
+
+#if JUCE_MODULE_AVAILABLE_juce_audio_processors
+        inline PluginChain& getPluginChain() { return processor.getPluginChain(); }
+
+        void pluginScanningFinished(PluginChain& sender) override;
+
+        void pluginLatencyChanged(PluginChain& sender) override;
+#endif
+
         inline double getLevel(int channel) {
             return levelTracker.getLevel(channel);
         }
@@ -202,12 +442,37 @@ private:
 
         PostProcessor processor;
         LevelTracker levelTracker;
+
+        double sampleRate = 44100.0;
+        // Also read from the message thread when plugin latency changes
+        std::atomic<int> deviceLatency{ 0 };
+        // Engine sample clock, samples rendered so far
+        std::atomic<int64> samplePosition{ 0 };
+        std::atomic<int> recordedBlockSize{ 0 };
+        std::atomic<int64> statCallbacks{ 0 };
+        std::atomic<int64> statTicks{ 0 };
+        std::atomic<int64> statMaxTicks{ 0 };
+        std::atomic<int64> statSamples{ 0 };
     };
 
     friend class Mixer;
 
     AudioDeviceManager deviceMgr;
-    AudioFormatManager formatMgr;
+    AudioFormatManager& formatMgr;
+
+    MemoryBudget::Account memoryAccount{ "Engine" };
+
+    // Lets a deck's tail scanning give way to the other deck's loading
+    ScanCoordinator scanCoordinator;
+
+    RoutingGraph routing;
+    OutputTargets outputTargets;
+
+    // Owned, swapped from the control thread while the audio thread may be pushing to it
+    std::atomic<SegmentedOutputWriter*> segmentWriter{ nullptr };
+    std::atomic<bool> segmentWriterBusy{ false };
+
+    SessionRecorder recorder;
 
     Deck* deck1 = nullptr;
     Deck* deck2 = nullptr;
@@ -220,8 +485,19 @@ private:
     TimeSliceThread readAheadThread;
     TimeSliceThread visualizingThread;
 
+    ThreadPolicyApplier threadPolicies[(int)EngineThread::NumThreads];
+
     bool keepPlaying = false;
 
+    bool useAudioDevice = true;
+    bool renderingOffline = false;
+
+    // Lazy startup can be triggered by the first getter call from any host thread
+    CriticalSection startupLock;
+    std::atomic<bool> deviceInitialized{ false };
+    std::atomic<bool> threadsStarted{ false };
+    StartupTimes startupTimes;
+
     enum class TransitionState {
         Idle,
         Cueing,
@@ -232,6 +508,9 @@ private:
     TransitionState transitionState = TransitionState::Idle;
     Deck* transitingDeck = nullptr;
 
+    // Position of the outgoing deck at which the incoming vocals start, the fade-out ends there at the latest
+    double introDeadline = -1.0;
+
     std::list<Deck*> deckQueue;
 
     double fadingCurve = 60;
@@ -242,6 +521,12 @@ private:
 
     int forceFadingOut = 0;
 
+    bool tempoMatching = true;
+
+    // Engine sample clock at the hard post, -1 when there is none
+    std::atomic<int64> postSamplePosition{ -1 };
+    std::atomic<double> programmeSpeed{ 1.0 };
+
     CriticalSection callbackLock;
     ListenerList<Callback> listeners;
 };
@@ -0,0 +1,130 @@
+#include "MemoryBudget.h"
+
+namespace {
+    void updatePeak(std::atomic<juce::int64>& peak, juce::int64 value) {
+        auto previous = peak.load();
+        while (value > previous && !peak.compare_exchange_weak(previous, value)) {}
+    }
+}
+
+namespace medley {
+
+MemoryBudget& MemoryBudget::getGlobal()
+{
+    static MemoryBudget instance;
+    return instance;
+}
+
+MemoryBudget::Usage MemoryBudget::getUsage() const
+{
+    return { current, peak };
+}
+
+int64 MemoryBudget::getAvailable() const
+{
+    int64 currentLimit = limit;
+
+    if (currentLimit <= 0) {
+        return -1;
+    }
+
+    return jmax((int64)0, currentLimit - current);
+}
+
+void MemoryBudget::add(Component component, int64 delta)
+{
+    components[(int)component] += delta;
+    updatePeak(peak, current += delta);
+}
+
+const char* MemoryBudget::getComponentName(Component component)
+{
+    switch (component) {
+    case Component::ReadAhead:
+        return "readAhead";
+    case Component::Decoder:
+        return "decoder";
+    case Component::Analysis:
+        return "analysis";
+    default:
+        return "unknown";
+    }
+}
+
+MemoryBudget::Account::Account(const String& name, Account* parent)
+    :
+    name(name),
+    parent(parent),
+    budget(parent != nullptr ? parent->budget : MemoryBudget::getGlobal())
+{
+
+}
+
+MemoryBudget::Account::Account(const String& name, MemoryBudget& budget)
+    :
+    name(name),
+    parent(nullptr),
+    budget(budget)
+{
+
+}
+
+MemoryBudget::Account::~Account()
+{
+    for (int i = 0; i < (int)Component::NumComponents; i++) {
+        release((Component)i, components[i]);
+    }
+}
+
+int64 MemoryBudget::Account::negotiate(Component component, int64 desired, int64 minimum)
+{
+    jassert(minimum <= desired);
+
+    auto granted = desired;
+    auto available = budget.getAvailable();
+
+    if (available >= 0 && available < desired) {
+        granted = jmax(minimum, available);
+
+        if (available < minimum) {
+            budget.overcommits++;
+        }
+    }
+
+    charge(component, granted);
+    return granted;
+}
+
+void MemoryBudget::Account::charge(Component component, int64 bytes)
+{
+    if (bytes != 0) {
+        add(component, bytes);
+    }
+}
+
+void MemoryBudget::Account::release(Component component, int64 bytes)
+{
+    if (bytes != 0) {
+        add(component, -bytes);
+    }
+}
+
+MemoryBudget::Usage MemoryBudget::Account::getUsage() const
+{
+    return { current, peak };
+}
+
+void MemoryBudget::Account::add(Component component, int64 delta)
+{
+    components[(int)component] += delta;
+    updatePeak(peak, current += delta);
+
+    if (parent != nullptr) {
+        parent->add(component, delta);
+    }
+    else {
+        budget.add(component, delta);
+    }
+}
+
+}
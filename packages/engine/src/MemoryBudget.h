@@ -0,0 +1,97 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+using namespace juce;
+
+namespace medley {
+
+/**
+ * Process-wide accounting of the memory held by the engines.
+ *
+ * Every engine and deck charges an Account, which propagates to its parent and finally to the budget.
+ * Components which can work with less memory, such as read-ahead buffers, negotiate the size against
+ * whatever is left; the budget is advisory and a component's minimum is always granted.
+ */
+class MemoryBudget {
+public:
+    enum class Component {
+        ReadAhead = 0,
+        Decoder,
+        Analysis,
+        NumComponents
+    };
+
+    struct Usage {
+        int64 current = 0;
+        int64 peak = 0;
+    };
+
+    class Account {
+    public:
+        Account(const String& name, Account* parent = nullptr);
+
+        Account(const String& name, MemoryBudget& budget);
+
+        // Whatever is still charged is released
+        ~Account();
+
+        // Charges and returns an amount between minimum and desired, depending on what is left in the budget
+        int64 negotiate(Component component, int64 desired, int64 minimum);
+
+        void charge(Component component, int64 bytes);
+
+        void release(Component component, int64 bytes);
+
+        const String& getName() const { return name; }
+
+        Usage getUsage() const;
+
+        int64 getUsage(Component component) const { return components[(int)component]; }
+
+        MemoryBudget& getBudget() const { return budget; }
+
+    private:
+        void add(Component component, int64 delta);
+
+        String name;
+        Account* parent;
+        MemoryBudget& budget;
+
+        std::atomic<int64> components[(int)Component::NumComponents]{};
+        std::atomic<int64> current{ 0 };
+        std::atomic<int64> peak{ 0 };
+
+        JUCE_DECLARE_NON_COPYABLE(Account)
+    };
+
+    static MemoryBudget& getGlobal();
+
+    // Zero means unlimited
+    void setLimit(int64 bytes) { limit = jmax((int64)0, bytes); }
+
+    int64 getLimit() const { return limit; }
+
+    Usage getUsage() const;
+
+    int64 getUsage(Component component) const { return components[(int)component]; }
+
+    // Bytes left before the limit is reached, or -1 when unlimited
+    int64 getAvailable() const;
+
+    // Number of times a component was granted its minimum in spite of the budget being exhausted
+    int64 getNumOvercommits() const { return overcommits; }
+
+    static const char* getComponentName(Component component);
+
+private:
+    void add(Component component, int64 delta);
+
+    std::atomic<int64> limit{ 0 };
+    std::atomic<int64> components[(int)Component::NumComponents]{};
+    std::atomic<int64> current{ 0 };
+    std::atomic<int64> peak{ 0 };
+    std::atomic<int64> overcommits{ 0 };
+};
+
+}
@@ -8,6 +8,103 @@
 
 #include <inttypes.h>
 
+namespace {
+    constexpr int kGranuleSamples = 576;
+
+    // LAME stores an encoder delay of up to 4095 samples, the decoder adds its own 529
+    constexpr int kMaxStartDelay = 4095 + 529;
+
+    // The Info/Xing frame is scanned like any other but skipped from the output, it holds 2 granules in MPEG-1
+    constexpr int kInfoFrameGranules = 2;
+
+    // Output lags the bitstream by at most the start delay and the info frame, plus one for blocks straddling granules
+    constexpr int kMaxDelayGranules = (kMaxStartDelay + kGranuleSamples - 1) / kGranuleSamples + kInfoFrameGranules + 1;
+
+    // Synthesis overlaps the previous granule and its filterbank remembers one more
+    constexpr int kCarriedGranules = 2;
+
+    constexpr int kSearchChunkSize = 4096;
+
+    // Granules scanned at once, about 13 seconds, each pass has to seek the stream shared with the decoder
+    constexpr int kScanBatchGranules = 1024;
+
+    /*
+     * Output level bound per unit of 2^((global_gain - 210) / 4), following ISO/IEC 11172-3 with everything at its worst:
+     *
+     * - A requantized line is |is|^(4/3) * 2^((global_gain - 210) / 4), scale factors and subblock gains only lower it.
+     *   |is| is at most 15 + 2^13 - 1 with the largest linbits.
+     * - An IMDCT output sums 18 lines, and the overlap-add the 18 of the previous granule, windows stay within 1.
+     * - Matrixing sums the 32 subbands with cosines within 1.
+     * - A PCM sample sums 16 synthesis window taps, the largest of table 3-B.3 being 1.144989014.
+     * - Mid/side stereo gives (M + S) / sqrt(2), intensity stereo only scales one channel down.
+     *
+     * Doubled for the rounding of a float decoder. Loose, it only has to prove silence or quiet passages.
+     */
+    const double kMaxLineMagnitude = std::pow(8191.0 + 15.0, 4.0 / 3.0);
+    constexpr double kImdctGain = 18 * 2;
+    constexpr double kMatrixingGain = 32;
+    constexpr double kWindowGain = 16 * 1.144989014;
+    constexpr double kStereoGain = 1.4142135624;
+    constexpr double kRoundingMargin = 2.0;
+
+    const double kLevelBoundScale = kMaxLineMagnitude * kImdctGain * kMatrixingGain * kWindowGain * kStereoGain * kRoundingMargin;
+
+    enum class SpanLevel {
+        Undecided,
+        AllMatch,
+        NoneMatch
+    };
+
+    struct FrameHeader {
+        bool lsf = false;
+        int sampleRate = 0;
+        int numChannels = 0;
+        int frameLength = 0;
+        int sideInfoOffset = 0;
+    };
+
+    bool parseFrameHeader(const uint8* h, FrameHeader& header) {
+        static const int bitrates[2][15] = {
+            { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },
+            { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 }
+        };
+
+        static const int sampleRates[3] = { 44100, 48000, 32000 };
+
+        if (h[0] != 0xFF || (h[1] & 0xE0) != 0xE0) {
+            return false;
+        }
+
+        const int version = (h[1] >> 3) & 3;
+        const int layer = (h[1] >> 1) & 3;
+        const int bitrateIndex = h[2] >> 4;
+        const int sampleRateIndex = (h[2] >> 2) & 3;
+
+        // Free format has no frame length in the header, it is not worth supporting here
+        if (version == 1 || layer != 1 || bitrateIndex == 0 || bitrateIndex == 15 || sampleRateIndex == 3) {
+            return false;
+        }
+
+        header.lsf = version != 3;
+        header.sampleRate = sampleRates[sampleRateIndex] >> (version == 3 ? 0 : (version == 2 ? 1 : 2));
+        header.numChannels = (h[3] >> 6) == 3 ? 1 : 2;
+        header.frameLength = (header.lsf ? 72000 : 144000) * bitrates[header.lsf][bitrateIndex] / header.sampleRate + ((h[2] >> 1) & 1);
+        header.sideInfoOffset = (h[1] & 1) ? 4 : 6;
+
+        return true;
+    }
+
+    int readBits(const uint8* data, int& bitPosition, int numBits) {
+        int value = 0;
+
+        for (int i = 0; i < numBits; i++, bitPosition++) {
+            value = (value << 1) | ((data[bitPosition >> 3] >> (7 - (bitPosition & 7))) & 1);
+        }
+
+        return value;
+    }
+}
+
 MiniMP3AudioFormatReader::MiniMP3AudioFormatReader(InputStream* const in)
     : AudioFormatReader(in, "MP3 Format")
 {
@@ -67,6 +164,295 @@ bool MiniMP3AudioFormatReader::readSamples(int** destSamples, int numDestChannel
     return true;
 }
 
+int64 MiniMP3AudioFormatReader::getMemoryUsage() const
+{
+    auto usage = (int64)sizeof(*this);
+
+    // With I/O callbacks, file.buffer is the read buffer allocated by minimp3
+    if (dec.io != nullptr) {
+        usage += (int64)dec.file.size;
+    }
+
+    usage += (int64)(dec.index.capacity * sizeof(mp3dec_frame_t));
+    usage += (int64)frameBufferSize * numChannels * sizeof(float);
+    usage += (int64)granuleLevels.size() * sizeof(float);
+
+    return usage;
+}
+
+int64 MiniMP3AudioFormatReader::searchForLevelCompressed(int64 startSample, int64 numSamplesToSearch, double magnitudeRangeMinimum, double magnitudeRangeMaximum, int minimumConsecutiveSamples)
+{
+    // Only locates the first frame, the rest is scanned as the search gets there
+    scanSideInformation(0);
+
+    if (numSamplesToSearch <= 0 || startSample < 0 || !sideInformationAvailable) {
+        return searchForLevel(startSample, numSamplesToSearch, magnitudeRangeMinimum, magnitudeRangeMaximum, minimumConsecutiveSamples);
+    }
+
+    if (startSample >= lengthInSamples) {
+        return -1;
+    }
+
+    // The generic search reads whole chunks, the last one may run past the end where it sees silence
+    const auto lastChunkStart = startSample + ((lengthInSamples - 1 - startSample) / kSearchChunkSize) * kSearchChunkSize;
+    const auto endSample = jmin(startSample + numSamplesToSearch, lastChunkStart + kSearchChunkSize);
+
+    const auto silenceMatches = 0.0 >= magnitudeRangeMinimum && 0.0 <= magnitudeRangeMaximum;
+
+    auto classify = [&](int64 position) {
+        if (position >= lengthInSamples) {
+            return silenceMatches ? SpanLevel::AllMatch : SpanLevel::NoneMatch;
+        }
+
+        auto bound = getBlockLevelBound(position / kGranuleSamples);
+
+        if (bound == 0.0f) {
+            return silenceMatches ? SpanLevel::AllMatch : SpanLevel::NoneMatch;
+        }
+
+        if (bound < magnitudeRangeMinimum) {
+            return SpanLevel::NoneMatch;
+        }
+
+        if (magnitudeRangeMinimum <= 0.0 && bound <= magnitudeRangeMaximum) {
+            return SpanLevel::AllMatch;
+        }
+
+        return SpanLevel::Undecided;
+    };
+
+    HeapBlock<float> tempSpace(kSearchChunkSize * 2);
+    float* tempBuffer[2] = { tempSpace.get(), tempSpace.get() + kSearchChunkSize };
+
+    int consecutive = 0;
+    int64 firstMatchPos = -1;
+
+    auto position = startSample;
+
+    while (position < endSample) {
+        const auto level = classify(position);
+        auto spanEnd = jmin(endSample, (position / kGranuleSamples + 1) * kGranuleSamples);
+
+        if (level == SpanLevel::Undecided) {
+            // Decode adjacent undecided blocks together
+            const auto decodeLimit = jmin(endSample, position + kSearchChunkSize);
+
+            while (spanEnd < decodeLimit && classify(spanEnd) == SpanLevel::Undecided) {
+                spanEnd += kGranuleSamples;
+            }
+
+            spanEnd = jmin(spanEnd, decodeLimit);
+
+            const auto numSamples = (int)(spanEnd - position);
+            read((int**)tempBuffer, 2, position, numSamples, false);
+
+            for (int i = 0; i < numSamples; i++) {
+                const auto sample1 = std::abs(tempBuffer[0][i]);
+                auto matches = sample1 >= magnitudeRangeMinimum && sample1 <= magnitudeRangeMaximum;
+
+                if (!matches && numChannels > 1) {
+                    const auto sample2 = std::abs(tempBuffer[1][i]);
+                    matches = sample2 >= magnitudeRangeMinimum && sample2 <= magnitudeRangeMaximum;
+                }
+
+                if (matches) {
+                    if (firstMatchPos < 0) {
+                        firstMatchPos = position + i;
+                    }
+
+                    if (++consecutive >= minimumConsecutiveSamples) {
+                        return firstMatchPos < lengthInSamples ? firstMatchPos : -1;
+                    }
+                }
+                else {
+                    consecutive = 0;
+                    firstMatchPos = -1;
+                }
+            }
+        }
+        else if (level == SpanLevel::AllMatch) {
+            if (firstMatchPos < 0) {
+                firstMatchPos = position;
+            }
+
+            consecutive += (int)(spanEnd - position);
+
+            if (consecutive >= minimumConsecutiveSamples) {
+                return firstMatchPos < lengthInSamples ? firstMatchPos : -1;
+            }
+        }
+        else {
+            consecutive = 0;
+            firstMatchPos = -1;
+        }
+
+        position = spanEnd;
+    }
+
+    return -1;
+}
+
+float MiniMP3AudioFormatReader::getLevelBound(int64 startSample, int numSamples)
+{
+    scanSideInformation(0);
+
+    if (!sideInformationAvailable || numSamples <= 0) {
+        return std::numeric_limits<float>::max();
+    }
+
+    auto bound = 0.0f;
+
+    for (auto block = jmax((int64)0, startSample) / kGranuleSamples; block <= (startSample + numSamples - 1) / kGranuleSamples; block++) {
+        bound = jmax(bound, getBlockLevelBound(block));
+    }
+
+    return bound;
+}
+
+void MiniMP3AudioFormatReader::scanSideInformation(int64 untilGranule)
+{
+    if (sideInformationComplete || untilGranule < granuleLevels.size()) {
+        return;
+    }
+
+    const auto targetGranule = jmax(untilGranule, (int64)granuleLevels.size() + kScanBatchGranules);
+
+    // The decoder expects the stream where it left it
+    const auto savedPosition = input->getPosition();
+
+    BufferedInputStream stream(*input, 65536);
+
+    uint8 data[64];
+
+    auto readHeaderAt = [&](int64 at, FrameHeader& header) {
+        stream.setPosition(at);
+        return stream.read(data, 4) == 4
+            && parseFrameHeader(data, header)
+            && header.sampleRate == (int)sampleRate
+            && header.numChannels == (int)numChannels;
+    };
+
+    FrameHeader header;
+
+    if (scanPosition < 0) {
+        int64 position = 0;
+
+        // ID3v2 tag, its size is syncsafe and excludes the header and footer
+        stream.setPosition(0);
+        if (stream.read(data, 10) == 10 && memcmp(data, "ID3", 3) == 0) {
+            position = 10 + (((int64)(data[6] & 0x7F) << 21) | ((data[7] & 0x7F) << 14) | ((data[8] & 0x7F) << 7) | (data[9] & 0x7F));
+
+            if (data[5] & 0x10) {
+                position += 10;
+            }
+        }
+
+        // Find the first frame, a false sync would shift every granule so the next frame must follow it
+        FrameHeader nextHeader;
+        const auto searchLimit = position + 65536;
+
+        while (position < searchLimit) {
+            if (readHeaderAt(position, header) && readHeaderAt(position + header.frameLength, nextHeader)) {
+                break;
+            }
+
+            position++;
+        }
+
+        if (position >= searchLimit) {
+            // Searches go through the decoder instead
+            sideInformationComplete = true;
+            input->setPosition(savedPosition);
+            return;
+        }
+
+        scanPosition = position;
+        sideInformationAvailable = true;
+    }
+
+    while (granuleLevels.size() <= targetGranule) {
+        stream.setPosition(scanPosition);
+
+        const auto numRead = stream.read(data, sizeof(data));
+
+        if (numRead < 4) {
+            sideInformationComplete = true;
+            break;
+        }
+
+        if (!parseFrameHeader(data, header) || header.sampleRate != (int)sampleRate || header.numChannels != (int)numChannels) {
+            // An ID3v1 tag is the only thing expected after the last frame, anything else leaves the rest unknown
+            sideInformationComplete = true;
+            sideInformationTruncated = memcmp(data, "TAG", 3) != 0;
+            break;
+        }
+
+        const auto mono = header.numChannels == 1;
+        const auto sideInfoSize = header.lsf ? (mono ? 9 : 17) : (mono ? 17 : 32);
+
+        if (numRead < header.sideInfoOffset + sideInfoSize) {
+            sideInformationComplete = true;
+            break;
+        }
+
+        const auto sideInfo = data + header.sideInfoOffset;
+
+        // Skip main_data_begin, private bits and, for MPEG-1, scfsi
+        int bit = header.lsf ? (8 + (mono ? 1 : 2)) : (9 + (mono ? 5 : 3) + 4 * header.numChannels);
+
+        const auto numGranules = header.lsf ? 1 : 2;
+        const auto granuleChannelBits = header.lsf ? 63 : 59;
+
+        for (int gr = 0; gr < numGranules; gr++) {
+            auto level = 0.0f;
+
+            for (int ch = 0; ch < header.numChannels; ch++) {
+                const auto start = bit;
+                const auto part2_3_length = readBits(sideInfo, bit, 12);
+                bit += 9; // big_values
+                const auto globalGain = readBits(sideInfo, bit, 8);
+
+                // Without any Huffman bits every spectral line is zero
+                if (part2_3_length > 0) {
+                    level = jmax(level, (float)(kLevelBoundScale * std::exp2((globalGain - 210) / 4.0)));
+                }
+
+                bit = start + granuleChannelBits;
+            }
+
+            granuleLevels.add(level);
+        }
+
+        scanPosition += header.frameLength;
+    }
+
+    input->setPosition(savedPosition);
+}
+
+float MiniMP3AudioFormatReader::getBlockLevelBound(int64 block)
+{
+    const auto lastGranule = block + kMaxDelayGranules;
+
+    scanSideInformation(lastGranule);
+
+    auto bound = 0.0f;
+
+    for (auto granule = jmax((int64)0, block - kCarriedGranules); granule <= lastGranule; granule++) {
+        if (granule >= granuleLevels.size()) {
+            // Past the last frame the output is silent, unless the frames could not be followed to the end
+            if (!sideInformationComplete || sideInformationTruncated) {
+                return std::numeric_limits<float>::max();
+            }
+
+            break;
+        }
+
+        bound = jmax(bound, granuleLevels.getUnchecked((int)granule));
+    }
+
+    return bound;
+}
+
 void MiniMP3AudioFormatReader::reallocBuffer()
 {
     buffer.realloc(frameBufferSize * numChannels, sizeof(float));
@@ -93,3 +479,85 @@ int MiniMP3AudioFormatReader::ioSeek(uint64_t position, void* user_data)
 
     return inst->input->setPosition(position) ? 0 : -1;
 }
+
+#if MEDLEY_SELF_TESTS
+
+#include "LevelSearch.h"
+
+// Compressed searches must find exactly what decoding finds, on the MP3 files of $MEDLEY_TEST_MEDIA
+class MiniMP3LevelSearchTest : public UnitTest
+{
+public:
+    MiniMP3LevelSearchTest()
+        : UnitTest("MP3 level search", "Medley")
+    {
+
+    }
+
+    void runTest() override
+    {
+        const auto mediaPath = SystemStats::getEnvironmentVariable("MEDLEY_TEST_MEDIA", {});
+
+        beginTest("Compressed searches match searchForLevel");
+
+        if (mediaPath.isEmpty()) {
+            logMessage("MEDLEY_TEST_MEDIA is not set, skipped");
+            return;
+        }
+
+        const auto files = File(mediaPath).findChildFiles(File::findFiles, true, "*.mp3");
+        expect(!files.isEmpty(), "No MP3 files in " + mediaPath);
+
+        for (auto& file : files) {
+            auto compressed = openReader(file);
+            auto decoded = openReader(file);
+
+            if (compressed == nullptr || decoded == nullptr || decoded->lengthInSamples <= 0) {
+                expect(false, "Cannot open " + file.getFileName());
+                continue;
+            }
+
+            const auto rate = (int64)decoded->sampleRate;
+            const auto length = decoded->lengthInSamples;
+            const auto tail = jmax((int64)0, length - rate * 30);
+
+            // First sound, loud passages, the leading window and the tail, as TrackAnalyzer asks for them
+            const Query queries[] = {
+                { 0, length / 2, Decibels::decibelsToGain(-60.0), 1.0, 1 },
+                { 0, length, 0.5, 1.0, 1 },
+                { rate * 5, rate * 20, 0.0, Decibels::decibelsToGain(-23.0), (int)(rate / 2) },
+                { tail, length - tail, 0.0, Decibels::decibelsToGain(-60.0), (int)(rate * 5 / 4) },
+                { tail, length - tail, 0.0, Decibels::decibelsToGain(-23.0), (int)(rate / 10) }
+            };
+
+            medley::LevelSearch levelSearch(*compressed, 0, length);
+
+            for (auto& q : queries) {
+                const auto expected = decoded->searchForLevel(q.start, q.numSamples, q.minimum, q.maximum, q.consecutive);
+                const auto description = file.getFileName() + " @" + String(q.start) + " [" + String(q.minimum) + ", " + String(q.maximum) + "]";
+
+                expectEquals(compressed->searchForLevelCompressed(q.start, q.numSamples, q.minimum, q.maximum, q.consecutive), expected, description);
+                expectEquals(levelSearch.search(q.start, q.numSamples, q.minimum, q.maximum, q.consecutive), expected, description + " LevelSearch");
+            }
+        }
+    }
+
+private:
+    struct Query {
+        int64 start;
+        int64 numSamples;
+        double minimum;
+        double maximum;
+        int consecutive;
+    };
+
+    static std::unique_ptr<MiniMP3AudioFormatReader> openReader(const File& file)
+    {
+        auto stream = file.createInputStream();
+        return stream != nullptr ? std::make_unique<MiniMP3AudioFormatReader>(stream.release()) : nullptr;
+    }
+};
+
+static MiniMP3LevelSearchTest miniMP3LevelSearchTest;
+
+#endif
@@ -14,9 +14,31 @@ public:
 
     bool readSamples(int** destSamples, int numDestChannels, int startOffsetInDestBuffer, int64 startSampleInFile, int numSamples) override;
 
+    // Bytes held by the decoder, its I/O buffer, seek index and the interleaving buffer
+    int64 getMemoryUsage() const;
+
+    /**
+     * Same contract and results as searchForLevel(), but spans which the side information alone proves to be
+     * silent, or too quiet to reach the range, are not decoded. Only forward searches benefit.
+     */
+    int64 searchForLevelCompressed(int64 startSample, int64 numSamplesToSearch, double magnitudeRangeMinimum, double magnitudeRangeMaximum, int minimumConsecutiveSamples);
+
+    // Upper bound of the absolute sample values within a range, from the side information only
+    float getLevelBound(int64 startSample, int numSamples);
+
 private:
     void reallocBuffer();
 
+    /**
+     * Walks the frame headers and side information, without decoding, to bound the level of every granule.
+     * Picks up where the last call stopped and goes at least as far as the given granule, so only what gets searched
+     * is ever scanned.
+     */
+    void scanSideInformation(int64 untilGranule);
+
+    // Upper bound of the absolute sample values within a granule-sized block of output
+    float getBlockLevelBound(int64 block);
+
     static size_t ioRead(void* buf, size_t size, void* user_data);
     static int ioSeek(uint64_t position, void* user_data);
 
@@ -28,6 +50,14 @@ private:
 
     int64 currentPosition = 0;
 
+    Array<float> granuleLevels;
+    // Offset of the next frame to scan, -1 until the first one is found
+    int64 scanPosition = -1;
+    bool sideInformationAvailable = false;
+    bool sideInformationComplete = false;
+    // Frames stopped before the end of the stream, what comes after is unknown
+    bool sideInformationTruncated = false;
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MiniMP3AudioFormatReader)
 };
 
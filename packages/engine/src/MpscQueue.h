@@ -0,0 +1,97 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+using namespace juce;
+
+namespace medley {
+
+/**
+ * Bounded lock-free queue for any number of producers and a single consumer.
+ *
+ * Producers never wait, neither on each other nor on the consumer: a push claims a slot or fails when the queue is
+ * full. A producer preempted between claiming and filling its slot only holds back the consumer, which sees the queue
+ * as empty from that slot until it is filled.
+ */
+template <typename T>
+class MpscQueue {
+public:
+    // Rounded up to a power of two
+    explicit MpscQueue(int capacity)
+        :
+        size((size_t)nextPowerOfTwo(jmax(2, capacity))),
+        cells(new Cell[size])
+    {
+        for (size_t i = 0; i < size; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // Any thread, false when the queue is full
+    bool push(const T& item)
+    {
+        auto position = pushPosition.load(std::memory_order_relaxed);
+
+        for (;;) {
+            auto& cell = cells[position & (size - 1)];
+            const auto sequence = cell.sequence.load(std::memory_order_acquire);
+            const auto diff = (int64)(sequence - position);
+
+            if (diff == 0) {
+                if (pushPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    cell.item = item;
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0) {
+                return false;
+            }
+            else {
+                // Another producer took it
+                position = pushPosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Consumer only, false when nothing is ready. The slot is moved from, so producers never free what it held
+    bool pop(T& item)
+    {
+        auto& cell = cells[popPosition & (size - 1)];
+
+        if (cell.sequence.load(std::memory_order_acquire) != popPosition + 1) {
+            return false;
+        }
+
+        item = std::move(cell.item);
+        cell.sequence.store(popPosition + size, std::memory_order_release);
+        popPosition++;
+        return true;
+    }
+
+    // Consumer only
+    void clear()
+    {
+        T item;
+
+        while (pop(item)) {
+
+        }
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence{ 0 };
+        T item;
+    };
+
+    const size_t size;
+    std::unique_ptr<Cell[]> cells;
+
+    std::atomic<size_t> pushPosition{ 0 };
+    size_t popPosition = 0;
+
+    JUCE_DECLARE_NON_COPYABLE(MpscQueue)
+};
+
+}
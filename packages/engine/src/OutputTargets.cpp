@@ -0,0 +1,381 @@
+#include "OutputTargets.h"
+
+namespace medley {
+
+void OutputTargets::Target::prepare(double sampleRate, int maxBlockSize, int numChannels)
+{
+    buffer.setSize(numChannels, maxBlockSize);
+
+    ProcessSpec spec{ sampleRate, (uint32)maxBlockSize, (uint32)numChannels };
+    normalizer.prepare(spec);
+    limiter.prepare(spec);
+}
+
+void OutputTargets::Target::load(const AudioBuffer<float>& mix, int startSample, int numSamples)
+{
+    for (int i = 0; i < buffer.getNumChannels(); i++) {
+        if (i < mix.getNumChannels()) {
+            buffer.copyFrom(i, 0, mix, i, startSample, numSamples);
+        }
+        else {
+            buffer.clear(i, 0, numSamples);
+        }
+    }
+}
+
+void OutputTargets::Target::process(int numSamples)
+{
+    AudioBlock<float> block(buffer.getArrayOfWritePointers(), (size_t)buffer.getNumChannels(), (size_t)numSamples);
+    ProcessContextReplacing<float> context(block);
+
+    normalizer.process(context);
+
+    if (limited) {
+        limiter.process(context);
+    }
+}
+
+OutputTargets::OutputTargets(int numWorkers)
+    : numWorkers(numWorkers < 0 ? jmax(0, SystemStats::getNumCpus() - 1) : numWorkers),
+    silence(numChannels, maxBlockSize)
+{
+    silence.clear();
+}
+
+OutputTargets::~OutputTargets()
+{
+    for (auto worker : workers) {
+        worker->signalThreadShouldExit();
+        worker->workAvailable.signal();
+    }
+
+    for (auto worker : workers) {
+        worker->stopThread(1000);
+    }
+
+    workers.clear();
+
+    for (auto& slot : slots) {
+        delete slot.target.exchange(nullptr);
+    }
+}
+
+void OutputTargets::addTarget(const String& name, const Settings& settings, Callback* callback)
+{
+    const ScopedLock sl(lock);
+
+    if (findTarget(name) != nullptr) {
+        throw std::runtime_error(("Output target already exists: " + name).toStdString());
+    }
+
+    for (auto& slot : slots) {
+        if (slot.target.load() != nullptr) {
+            continue;
+        }
+
+        // Fully set up before the audio thread can see it
+        auto target = new Target();
+        target->name = name;
+        target->callback = callback;
+        target->limited = settings.limiter;
+        target->normalizer.setTargetLoudness(settings.targetLoudness);
+        target->normalizer.setMaxGain(settings.maxGain);
+        target->limiter.setThreshold(settings.limiterThreshold);
+        target->limiter.setReleaseTime(settings.limiterRelease);
+        target->prepare(sampleRate, maxBlockSize, numChannels);
+
+        slot.target = target;
+
+        if (getNumTargets() > 1) {
+            ensureWorkers();
+        }
+
+        return;
+    }
+
+    throw std::runtime_error("No output target slot left");
+}
+
+void OutputTargets::removeTarget(const String& name)
+{
+    const ScopedLock sl(lock);
+
+    for (auto& slot : slots) {
+        auto target = slot.target.load();
+
+        if (target == nullptr || target->name != name) {
+            continue;
+        }
+
+        slot.target = nullptr;
+
+        // A block may still be in flight, the target must not be deleted under it
+        while (slot.state != Idle) {
+            Thread::sleep(1);
+        }
+
+        delete target;
+        return;
+    }
+}
+
+int OutputTargets::getNumTargets() const
+{
+    int count = 0;
+
+    for (auto& slot : slots) {
+        if (slot.target.load() != nullptr) {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+float OutputTargets::getLoudness(const String& name) const
+{
+    const ScopedLock sl(lock);
+
+    auto target = findTarget(name);
+    return target != nullptr ? target->normalizer.getLoudness() : -100.0f;
+}
+
+float OutputTargets::getGain(const String& name) const
+{
+    const ScopedLock sl(lock);
+
+    auto target = findTarget(name);
+    return target != nullptr ? target->normalizer.getGain() : 0.0f;
+}
+
+void OutputTargets::setWorkerPolicy(const ThreadPolicy& policy)
+{
+    const ScopedLock sl(lock);
+
+    workerPolicy = policy;
+
+    for (auto worker : workers) {
+        worker->policy.setPolicy(policy);
+        worker->workAvailable.signal();
+    }
+}
+
+void OutputTargets::prepare(double newSampleRate, int newMaxBlockSize, int newNumChannels)
+{
+    const ScopedLock sl(lock);
+
+    // Buffers are about to be reallocated
+    waitForWorkers();
+
+    sampleRate = newSampleRate;
+    maxBlockSize = jmax(1, newMaxBlockSize);
+    numChannels = jmax(1, newNumChannels);
+
+    silence.setSize(numChannels, maxBlockSize);
+    silence.clear();
+
+    for (auto& slot : slots) {
+        if (auto target = slot.target.load()) {
+            target->prepare(sampleRate, maxBlockSize, numChannels);
+        }
+    }
+}
+
+void OutputTargets::process(const AudioBuffer<float>& mix, int startSample, int numSamples)
+{
+    // Devices may call back with more than they announced, never more than the target buffers can hold per pass
+    if (numSamples > maxBlockSize) {
+        for (int start = 0; start < numSamples; start += maxBlockSize) {
+            process(mix, startSample + start, jmin(maxBlockSize, numSamples - start));
+        }
+
+        return;
+    }
+
+    const auto startTime = Time::getMillisecondCounterHiRes();
+    const auto deadlineTime = startTime + numSamples * 1000.0 / sampleRate * deadline;
+
+    currentNumSamples = numSamples;
+
+    uint32 dispatched = 0;
+    int numDispatched = 0;
+
+    for (int i = 0; i < kMaxTargets; i++) {
+        auto& slot = slots[i];
+
+        int expected = Idle;
+        if (!slot.state.compare_exchange_strong(expected, Claimed)) {
+            // Still busy with a block which missed its deadline, this one is dropped
+            if (expected == Abandoned) {
+                statLateBlocks++;
+            }
+
+            continue;
+        }
+
+        // Read after claiming, so a concurrent removeTarget() either sees the claim or is seen here
+        slot.current = slot.target.load();
+
+        if (slot.current == nullptr) {
+            slot.state = Idle;
+            continue;
+        }
+
+        slot.current->load(mix, startSample, numSamples);
+
+        slot.state = Pending;
+        dispatched |= (1u << i);
+        numDispatched++;
+    }
+
+    if (numDispatched == 0) {
+        return;
+    }
+
+    // A single chain is not worth waking anyone for
+    if (numDispatched > 1) {
+        for (auto worker : workers) {
+            worker->workAvailable.signal();
+        }
+    }
+
+    processPendingTargets();
+
+    auto allFinished = [&] {
+        for (int i = 0; i < kMaxTargets; i++) {
+            if ((dispatched & (1u << i)) && slots[i].state != Done) {
+                return false;
+            }
+        }
+
+        return true;
+    };
+
+    while (!allFinished()) {
+        auto remaining = deadlineTime - Time::getMillisecondCounterHiRes();
+
+        if (remaining <= 0.0) {
+            break;
+        }
+
+        if (remaining >= 1.0) {
+            targetFinished.wait((int)remaining);
+        }
+        else {
+            Thread::yield();
+        }
+    }
+
+    for (int i = 0; i < kMaxTargets; i++) {
+        if ((dispatched & (1u << i)) == 0) {
+            continue;
+        }
+
+        auto& slot = slots[i];
+        auto target = slot.current;
+
+        // Nobody got to it in time, withdraw it. Workers only take pending slots
+        int expected = Pending;
+        if (slot.state.compare_exchange_strong(expected, Claimed)) {
+            statLateBlocks++;
+
+            if (auto callback = target->callback) {
+                callback->outputTargetReady(target->name, silence, numSamples);
+            }
+
+            slot.current = nullptr;
+            slot.state = Idle;
+            continue;
+        }
+
+        if (slot.state != Done) {
+            statLateBlocks++;
+
+            // The slot is not idle until the worker lets go of it, so the target is still there
+            if (auto callback = target->callback) {
+                callback->outputTargetReady(target->name, silence, numSamples);
+            }
+
+            expected = Rendering;
+            if (slot.state.compare_exchange_strong(expected, Abandoned)) {
+                continue;
+            }
+
+            // Finished in the meantime, but silence has gone out already
+            slot.current = nullptr;
+            slot.state = Idle;
+            continue;
+        }
+
+        if (auto callback = target->callback) {
+            callback->outputTargetReady(target->name, target->buffer, numSamples);
+        }
+
+        slot.current = nullptr;
+        slot.state = Idle;
+    }
+}
+
+void OutputTargets::processPendingTargets()
+{
+    for (auto& slot : slots) {
+        int expected = Pending;
+        if (!slot.state.compare_exchange_strong(expected, Rendering)) {
+            continue;
+        }
+
+        slot.current->process(currentNumSamples);
+
+        expected = Rendering;
+        if (!slot.state.compare_exchange_strong(expected, Done)) {
+            // Abandoned by the audio thread, nobody is waiting for this result
+            slot.state = Idle;
+            continue;
+        }
+
+        targetFinished.signal();
+    }
+}
+
+void OutputTargets::waitForWorkers()
+{
+    // Only workers hold slots outside of process(), a late one finishes eventually
+    for (auto& slot : slots) {
+        while (slot.state != Idle) {
+            Thread::sleep(1);
+        }
+    }
+}
+
+void OutputTargets::ensureWorkers()
+{
+    while (workers.size() < jmin(numWorkers, kMaxTargets - 1)) {
+        auto worker = workers.add(new Worker(*this, workers.size()));
+        worker->policy.setPolicy(workerPolicy);
+        worker->startThread(Thread::realtimeAudioPriority);
+    }
+}
+
+OutputTargets::Target* OutputTargets::findTarget(const String& name) const
+{
+    for (auto& slot : slots) {
+        auto target = slot.target.load();
+
+        if (target != nullptr && target->name == name) {
+            return target;
+        }
+    }
+
+    return nullptr;
+}
+
+void OutputTargets::Worker::run()
+{
+    while (!threadShouldExit()) {
+        workAvailable.wait(100);
+        policy.applyPending();
+        owner.processPendingTargets();
+    }
+}
+
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "LoudnessNormalizer.h"
+#include "LookAheadLimiter.h"
+#include "ThreadPolicy.h"
+
+using namespace juce;
+
+namespace medley {
+
+/**
+ * Output-specific processing chains fed from the one mix, such as a broadcast feed and a web stream each
+ * normalized to its own loudness.
+ *
+ * The mix is rendered once, each target only adds its own normalizer and limiter. With more than one target the
+ * chains run in parallel on worker threads, the audio thread taking its share, and every result is delivered from
+ * the audio thread. Workers are only started once a second target is added.
+ *
+ * The audio thread waits for the workers until the deadline only, a target which has not finished by then delivers
+ * silence for that block, and for every block until it catches up, instead of delaying the device.
+ */
+class OutputTargets {
+public:
+    static constexpr int kMaxTargets = 16;
+
+    struct Settings {
+        // In LUFS
+        float targetLoudness = -23.0f;
+        // Most the normalizer may raise or lower the level, in decibels
+        float maxGain = 12.0f;
+
+        bool limiter = false;
+        float limiterThreshold = -1.0f;
+        float limiterRelease = 0.05f;
+    };
+
+    class Callback {
+    public:
+        virtual ~Callback() {}
+
+        // Called on the audio thread
+        virtual void outputTargetReady(const String& name, const AudioBuffer<float>& buffer, int numSamples) = 0;
+    };
+
+    // numWorkers < 0 means one per CPU, less the audio thread
+    OutputTargets(int numWorkers = -1);
+
+    ~OutputTargets();
+
+    // Throws if the name is taken or no slot is left
+    void addTarget(const String& name, const Settings& settings, Callback* callback);
+
+    // Waits for a block in flight to finish, the callback is not called once this returns
+    void removeTarget(const String& name);
+
+    int getNumTargets() const;
+
+    // Short-term loudness measured before normalization, in LUFS
+    float getLoudness(const String& name) const;
+
+    // Gain applied by the normalizer, in decibels
+    float getGain(const String& name) const;
+
+    // Fraction of the block duration the audio thread waits for the workers, 0.1 - 1.0
+    void setDeadline(double fraction) { deadline = jlimit(0.1, 1.0, fraction); }
+
+    // Blocks delivered as silence because their target missed the deadline, since the start
+    int64 getNumLateBlocks() const { return statLateBlocks; }
+
+    // Workers follow the audio thread's policy, they hold it up when they are late
+    void setWorkerPolicy(const ThreadPolicy& policy);
+
+    // Not to be called while processing, waits for a worker still busy with a late block
+    void prepare(double sampleRate, int maxBlockSize, int numChannels);
+
+    // Audio thread only, mix is left untouched
+    void process(const AudioBuffer<float>& mix, int startSample, int numSamples);
+
+private:
+    enum SlotState {
+        Idle = 0,
+        Claimed,
+        Pending,
+        Rendering,
+        Done,
+        // Missed the deadline while rendering, the worker drops the result and frees the slot
+        Abandoned
+    };
+
+    struct Target {
+        String name;
+        Callback* callback = nullptr;
+        bool limited = false;
+
+        AudioBuffer<float> buffer;
+        LoudnessNormalizer normalizer;
+        LookAheadLimiter limiter;
+
+        void prepare(double sampleRate, int maxBlockSize, int numChannels);
+
+        // Copies the mix in, on the audio thread, so a late worker never reads a device buffer being reused
+        void load(const AudioBuffer<float>& mix, int startSample, int numSamples);
+
+        void process(int numSamples);
+    };
+
+    struct Slot {
+        std::atomic<Target*> target{ nullptr };
+        std::atomic<int> state{ Idle };
+        // Set by the audio thread for the block being processed
+        Target* current = nullptr;
+    };
+
+    class Worker : public Thread {
+    public:
+        Worker(OutputTargets& owner, int index) : Thread("Output Target Worker " + String(index)), owner(owner) {}
+
+        void run() override;
+
+        WaitableEvent workAvailable;
+        ThreadPolicyApplier policy;
+    private:
+        OutputTargets& owner;
+    };
+
+    void ensureWorkers();
+
+    void processPendingTargets();
+
+    void waitForWorkers();
+
+    Target* findTarget(const String& name) const;
+
+    CriticalSection lock;
+    Slot slots[kMaxTargets];
+
+    int numWorkers;
+    OwnedArray<Worker> workers;
+    ThreadPolicy workerPolicy;
+
+    double sampleRate = 44100.0;
+    int maxBlockSize = 512;
+    int numChannels = 2;
+
+    // What late targets deliver
+    AudioBuffer<float> silence;
+
+    // Set before any slot becomes pending
+    std::atomic<int> currentNumSamples{ 0 };
+    WaitableEvent targetFinished;
+
+    std::atomic<double> deadline{ 0.5 };
+    std::atomic<int64> statLateBlocks{ 0 };
+
+    JUCE_DECLARE_NON_COPYABLE(OutputTargets)
+};
+
+}
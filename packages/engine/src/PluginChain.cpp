@@ -0,0 +1,447 @@
+#include "PluginChain.h"
+
+#if JUCE_MODULE_AVAILABLE_juce_audio_processors
+
+namespace {
+    constexpr int kRingBlocks = 4;
+
+    // How often chains let go of by the processing thread are deleted
+    constexpr int kCollectInterval = 200;
+}
+
+PluginChain::PluginChain()
+    :
+    scanner(*this),
+    aheadWorker(*this)
+{
+    formatMgr.addDefaultFormats();
+}
+
+PluginChain::~PluginChain()
+{
+    stopTimer();
+
+    scanner.stopThread(5000);
+    aheadWorker.stopThread(1000);
+
+    delete pendingChain.exchange(nullptr);
+    delete retiredChain.exchange(nullptr);
+    delete currentChain;
+
+    const ScopedLock sl(editLock);
+    plugins.clear();
+}
+
+void PluginChain::startScanning(const File& cacheFile)
+{
+    jassert(cacheFile != File());
+
+    if (scanner.isThreadRunning()) {
+        return;
+    }
+
+    scanner.cacheFile = cacheFile;
+    scanner.startThread(1);
+}
+
+bool PluginChain::isScanning() const
+{
+    return scanner.isThreadRunning();
+}
+
+void PluginChain::addPlugin(const String& identifier, std::function<void(bool, const String&)> callback)
+{
+    auto desc = knownPlugins.getTypeForIdentifierString(identifier);
+    if (desc == nullptr) {
+        callback(false, "Unknown plugin: " + identifier);
+        return;
+    }
+
+    formatMgr.createPluginInstanceAsync(*desc, spec.sampleRate, (int)spec.maximumBlockSize,
+        [this, callback](std::unique_ptr<AudioPluginInstance> instance, const String& error) {
+            if (instance == nullptr) {
+                callback(false, error);
+                return;
+            }
+
+            AudioProcessor::BusesLayout layout;
+            layout.inputBuses.add(AudioChannelSet::canonicalChannelSet((int)spec.numChannels));
+            layout.outputBuses.add(AudioChannelSet::canonicalChannelSet((int)spec.numChannels));
+
+            if (instance->checkBusesLayoutSupported(layout)) {
+                instance->setBusesLayout(layout);
+            }
+
+            instance->enableAllBuses();
+            instance->setNonRealtime(false);
+            instance->prepareToPlay(spec.sampleRate, (int)spec.maximumBlockSize);
+
+            {
+                const ScopedLock sl(editLock);
+
+                // Released wherever the last chain holding it is deleted, never on the processing thread
+                plugins.emplace_back(instance.release(), [](AudioPluginInstance* plugin) {
+                    plugin->releaseResources();
+                    delete plugin;
+                });
+            }
+
+            publish();
+            updateLatency();
+            callback(true, {});
+        }
+    );
+}
+
+void PluginChain::removePlugin(int index)
+{
+    {
+        const ScopedLock sl(editLock);
+
+        if (!isPositiveAndBelow(index, (int)plugins.size())) {
+            return;
+        }
+
+        plugins.erase(plugins.begin() + index);
+    }
+
+    publish();
+    updateLatency();
+}
+
+void PluginChain::clear()
+{
+    {
+        const ScopedLock sl(editLock);
+        plugins.clear();
+    }
+
+    publish();
+    updateLatency();
+}
+
+int PluginChain::getNumPlugins() const
+{
+    const ScopedLock sl(editLock);
+    return (int)plugins.size();
+}
+
+void PluginChain::prepare(const ProcessSpec& newSpec)
+{
+    aheadWorker.stopThread(1000);
+
+    spec = newSpec;
+    aheadActive = processAhead;
+
+    {
+        const ScopedLock sl(editLock);
+
+        for (auto& plugin : plugins) {
+            plugin->prepareToPlay(spec.sampleRate, (int)spec.maximumBlockSize);
+        }
+    }
+
+    // Buffers are sized for the new spec
+    publish();
+
+    if (aheadActive) {
+        auto ringSize = (int)spec.maximumBlockSize * kRingBlocks;
+
+        inputRing.setSize((int)spec.numChannels, ringSize);
+        outputRing.setSize((int)spec.numChannels, ringSize);
+        inputRing.clear();
+        outputRing.clear();
+
+        inputFifo.setTotalSize(ringSize);
+        outputFifo.setTotalSize(ringSize);
+        inputFifo.reset();
+        outputFifo.reset();
+
+        // One block of silence is the head start the worker thread gets
+        outputFifo.finishedWrite((int)spec.maximumBlockSize);
+        samplesToSkip = 0;
+
+        aheadWorker.startThread(8);
+    }
+
+    updateLatency();
+}
+
+void PluginChain::process(const ProcessContextReplacing<float>& context)
+{
+    if (aheadActive) {
+        processAheadBlock(context);
+        return;
+    }
+
+    auto chain = acquireChain();
+
+    if (chain == nullptr || chain->plugins.empty()) {
+        return;
+    }
+
+    auto& pluginBuffer = chain->buffer;
+    auto& block = context.getOutputBlock();
+    auto numSamples = jmin((int)block.getNumSamples(), pluginBuffer.getNumSamples());
+    auto numChannels = jmin((int)block.getNumChannels(), pluginBuffer.getNumChannels());
+
+    for (int ch = 0; ch < numChannels; ch++) {
+        pluginBuffer.copyFrom(ch, 0, block.getChannelPointer(ch), numSamples);
+    }
+
+    for (int ch = numChannels; ch < pluginBuffer.getNumChannels(); ch++) {
+        pluginBuffer.clear(ch, 0, numSamples);
+    }
+
+    processPlugins(*chain, numSamples);
+
+    for (int ch = 0; ch < numChannels; ch++) {
+        FloatVectorOperations::copy(block.getChannelPointer(ch), pluginBuffer.getReadPointer(ch), numSamples);
+    }
+}
+
+int PluginChain::getLatencyInSamples() const
+{
+    return latency;
+}
+
+PluginChain::Chain* PluginChain::acquireChain()
+{
+    // The previous chain must have been collected first, so a retired one is never overwritten
+    if (retiredChain.load() == nullptr) {
+        if (auto chain = pendingChain.exchange(nullptr)) {
+            retiredChain = currentChain;
+            currentChain = chain;
+        }
+    }
+
+    if (currentChain != nullptr && resetPending.exchange(false)) {
+        for (auto& plugin : currentChain->plugins) {
+            plugin->reset();
+        }
+    }
+
+    return currentChain;
+}
+
+void PluginChain::processPlugins(Chain& chain, int numSamples)
+{
+    auto& buffer = chain.buffer;
+
+    for (auto& plugin : chain.plugins) {
+        // Refers to the same channel data, no allocation for a reasonable number of channels
+        AudioBuffer<float> pluginView(buffer.getArrayOfWritePointers(), buffer.getNumChannels(), numSamples);
+
+        chain.midiBuffer.clear();
+        plugin->processBlock(pluginView, chain.midiBuffer);
+    }
+}
+
+void PluginChain::processAheadBlock(const ProcessContextReplacing<float>& context)
+{
+    auto& block = context.getOutputBlock();
+    auto numSamples = (int)block.getNumSamples();
+    auto numChannels = jmin((int)block.getNumChannels(), inputRing.getNumChannels());
+
+    // Hand this block over to the worker
+    {
+        int start1, size1, start2, size2;
+        inputFifo.prepareToWrite(numSamples, start1, size1, start2, size2);
+
+        for (int ch = 0; ch < numChannels; ch++) {
+            if (size1 > 0) inputRing.copyFrom(ch, start1, block.getChannelPointer(ch), size1);
+            if (size2 > 0) inputRing.copyFrom(ch, start2, block.getChannelPointer(ch) + size1, size2);
+        }
+
+        inputFifo.finishedWrite(size1 + size2);
+        aheadWorker.inputAvailable.signal();
+    }
+
+    // Blocks passed through earlier are dropped once processed, keeping the output one block behind
+    if (samplesToSkip > 0) {
+        auto numSkipped = jmin(samplesToSkip, outputFifo.getNumReady());
+
+        outputFifo.finishedRead(numSkipped);
+        samplesToSkip -= numSkipped;
+    }
+
+    // Never waits for the worker, a late block goes out as it is
+    if (samplesToSkip > 0 || outputFifo.getNumReady() < numSamples) {
+        samplesToSkip += numSamples;
+        underruns++;
+        return;
+    }
+
+    int start1, size1, start2, size2;
+    outputFifo.prepareToRead(numSamples, start1, size1, start2, size2);
+
+    for (int ch = 0; ch < numChannels; ch++) {
+        auto dest = block.getChannelPointer(ch);
+
+        if (size1 > 0) FloatVectorOperations::copy(dest, outputRing.getReadPointer(ch, start1), size1);
+        if (size2 > 0) FloatVectorOperations::copy(dest + size1, outputRing.getReadPointer(ch, start2), size2);
+    }
+
+    outputFifo.finishedRead(size1 + size2);
+}
+
+void PluginChain::processPendingInput()
+{
+    const auto numChannels = inputRing.getNumChannels();
+
+    while (!aheadWorker.threadShouldExit()) {
+        // Published by prepare() before the worker starts
+        auto chain = acquireChain();
+        if (chain == nullptr) {
+            break;
+        }
+
+        auto& pluginBuffer = chain->buffer;
+
+        auto numSamples = jmin(inputFifo.getNumReady(), outputFifo.getFreeSpace(), pluginBuffer.getNumSamples());
+        if (numSamples <= 0) {
+            break;
+        }
+
+        int start1, size1, start2, size2;
+        inputFifo.prepareToRead(numSamples, start1, size1, start2, size2);
+
+        for (int ch = 0; ch < pluginBuffer.getNumChannels(); ch++) {
+            if (ch >= numChannels) {
+                pluginBuffer.clear(ch, 0, numSamples);
+                continue;
+            }
+
+            if (size1 > 0) pluginBuffer.copyFrom(ch, 0, inputRing, ch, start1, size1);
+            if (size2 > 0) pluginBuffer.copyFrom(ch, size1, inputRing, ch, start2, size2);
+        }
+
+        inputFifo.finishedRead(size1 + size2);
+
+        processPlugins(*chain, numSamples);
+
+        outputFifo.prepareToWrite(numSamples, start1, size1, start2, size2);
+
+        for (int ch = 0; ch < numChannels; ch++) {
+            if (size1 > 0) outputRing.copyFrom(ch, start1, pluginBuffer, ch, 0, size1);
+            if (size2 > 0) outputRing.copyFrom(ch, start2, pluginBuffer, ch, size1, size2);
+        }
+
+        outputFifo.finishedWrite(size1 + size2);
+    }
+}
+
+void PluginChain::publish()
+{
+    auto chain = std::make_unique<Chain>();
+
+    {
+        const ScopedLock sl(editLock);
+        chain->plugins = plugins;
+    }
+
+    auto numChannels = (int)spec.numChannels;
+
+    for (auto& plugin : chain->plugins) {
+        numChannels = jmax(numChannels, plugin->getTotalNumInputChannels(), plugin->getTotalNumOutputChannels());
+    }
+
+    chain->buffer.setSize(numChannels, (int)spec.maximumBlockSize);
+    chain->midiBuffer.ensureSize(2048);
+
+    // Lets the processing thread take it on its next block
+    collectGarbage();
+    delete pendingChain.exchange(chain.release());
+
+    startTimer(kCollectInterval);
+}
+
+void PluginChain::collectGarbage()
+{
+    delete retiredChain.exchange(nullptr);
+}
+
+void PluginChain::timerCallback()
+{
+    collectGarbage();
+
+    if (pendingChain.load() == nullptr && retiredChain.load() == nullptr) {
+        stopTimer();
+    }
+}
+
+void PluginChain::updateLatency()
+{
+    int total = aheadActive ? (int)spec.maximumBlockSize : 0;
+
+    {
+        const ScopedLock sl(editLock);
+
+        for (auto& plugin : plugins) {
+            total += plugin->getLatencySamples();
+        }
+    }
+
+    if (latency.exchange(total) != total) {
+        listeners.call([this](Callback& cb) {
+            cb.pluginLatencyChanged(*this);
+        });
+    }
+}
+
+void PluginChain::saveCache(const File& file)
+{
+    if (file == File()) {
+        return;
+    }
+
+    if (auto xml = knownPlugins.createXml()) {
+        file.getParentDirectory().createDirectory();
+        xml->writeTo(file);
+    }
+}
+
+void PluginChain::Scanner::run()
+{
+    if (cacheFile.existsAsFile()) {
+        if (auto xml = parseXML(cacheFile)) {
+            chain.knownPlugins.recreateFromXml(*xml);
+        }
+    }
+
+    // A plugin crashing the scan is remembered here, and skipped next time
+    auto deadMansPedal = cacheFile.getSiblingFile(cacheFile.getFileNameWithoutExtension() + "-scanning");
+
+    for (auto format : chain.formatMgr.getFormats()) {
+        if (threadShouldExit()) {
+            break;
+        }
+
+        PluginDirectoryScanner directoryScanner(
+            chain.knownPlugins, *format,
+            format->getDefaultLocationsToSearch(),
+            true, deadMansPedal, true
+        );
+
+        String pluginName;
+        while (!threadShouldExit() && directoryScanner.scanNextFile(true, pluginName)) {
+            Logger::writeToLog("Scanned plugin: " + pluginName);
+        }
+    }
+
+    chain.saveCache(cacheFile);
+
+    chain.listeners.call([this](Callback& cb) {
+        cb.pluginScanningFinished(chain);
+    });
+}
+
+void PluginChain::AheadWorker::run()
+{
+    while (!threadShouldExit()) {
+        inputAvailable.wait(100);
+        chain.processPendingInput();
+    }
+}
+
+#endif
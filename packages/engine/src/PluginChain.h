@@ -0,0 +1,156 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+#if JUCE_MODULE_AVAILABLE_juce_audio_processors
+
+using namespace juce;
+using namespace juce::dsp;
+
+/**
+ * Third party plugins (VST3/AU) inserted after the mixer.
+ *
+ * Plugins are scanned on a background thread, the result is cached in a file so that only new or modified plugins are scanned again.
+ *
+ * Edits are made on the message thread, each one publishes a new list of plugins that the processing thread swaps in at
+ * its next block, the same way RoutingGraph hands over its plans. Processing never takes a lock and never deletes a plugin.
+ *
+ * When processing ahead is enabled, the chain runs on its own thread one block behind the audio callback,
+ * trading one block of latency for taking the plugins' DSP load off the device callback. The callback never waits for
+ * that thread: a block that is not processed in time is counted as an underrun and passes through unprocessed.
+ */
+class PluginChain : private Timer {
+public:
+    class Callback {
+    public:
+        virtual void pluginScanningFinished(PluginChain& sender) = 0;
+
+        virtual void pluginLatencyChanged(PluginChain& sender) = 0;
+    };
+
+    PluginChain();
+
+    ~PluginChain() override;
+
+    void startScanning(const File& cacheFile);
+
+    bool isScanning() const;
+
+    Array<PluginDescription> getKnownPlugins() const { return knownPlugins.getTypes(); }
+
+    // Plugin instantiation is asynchronous, the result is reported on the message thread
+    void addPlugin(const String& identifier, std::function<void(bool, const String&)> callback);
+
+    void removePlugin(int index);
+
+    void clear();
+
+    int getNumPlugins() const;
+
+    // Takes effect on the next prepare()
+    void setProcessAhead(bool shouldProcessAhead) { processAhead = shouldProcessAhead; }
+
+    bool isProcessingAhead() const { return processAhead; }
+
+    // Not while processing
+    void prepare(const ProcessSpec& spec);
+
+    // Audio thread only
+    void process(const ProcessContextReplacing<float>& context);
+
+    // Done by the processing thread before its next block
+    void reset() { resetPending = true; }
+
+    // Total delay introduced by the chain, including the extra block when processing ahead
+    int getLatencyInSamples() const;
+
+    int getNumUnderruns() const { return underruns; }
+
+    void addListener(Callback* cb) { listeners.add(cb); }
+
+    void removeListener(Callback* cb) { listeners.remove(cb); }
+
+private:
+    class Scanner : public Thread {
+    public:
+        Scanner(PluginChain& chain) : Thread("Plugin Scanner"), chain(chain) {}
+
+        void run() override;
+
+        File cacheFile;
+    private:
+        PluginChain& chain;
+    };
+
+    class AheadWorker : public Thread {
+    public:
+        AheadWorker(PluginChain& chain) : Thread("Plugin Processing Thread"), chain(chain) {}
+
+        void run() override;
+
+        WaitableEvent inputAvailable;
+    private:
+        PluginChain& chain;
+    };
+
+    using PluginPtr = std::shared_ptr<AudioPluginInstance>;
+
+    // What the processing thread works with, never changed once published
+    struct Chain {
+        std::vector<PluginPtr> plugins;
+        AudioBuffer<float> buffer;
+        MidiBuffer midiBuffer;
+    };
+
+    // Processing thread only, picks up the latest published chain
+    Chain* acquireChain();
+
+    void processPlugins(Chain& chain, int numSamples);
+
+    void processAheadBlock(const ProcessContextReplacing<float>& context);
+
+    void processPendingInput();
+
+    void publish();
+
+    void collectGarbage();
+
+    void timerCallback() override;
+
+    void updateLatency();
+
+    void saveCache(const File& file);
+
+    AudioPluginFormatManager formatMgr;
+    KnownPluginList knownPlugins;
+    Scanner scanner;
+
+    // Edited plugin list, never touched by the processing thread
+    CriticalSection editLock;
+    std::vector<PluginPtr> plugins;
+
+    ProcessSpec spec{ 44100.0, 512, 2 };
+
+    // Chains move from pending to current on the processing thread, then to retired once replaced
+    std::atomic<Chain*> pendingChain{ nullptr };
+    Chain* currentChain = nullptr;
+    std::atomic<Chain*> retiredChain{ nullptr };
+    std::atomic<bool> resetPending{ false };
+
+    std::atomic<bool> processAhead{ false };
+    AheadWorker aheadWorker;
+    AbstractFifo inputFifo{ 1 };
+    AbstractFifo outputFifo{ 1 };
+    bool aheadActive = false;
+    AudioBuffer<float> inputRing;
+    AudioBuffer<float> outputRing;
+    // Audio thread only, processed samples owed for blocks that were passed through
+    int samplesToSkip = 0;
+    std::atomic<int> underruns{ 0 };
+
+    std::atomic<int> latency{ 0 };
+
+    ListenerList<Callback> listeners;
+};
+
+#endif
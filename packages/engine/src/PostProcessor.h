@@ -3,6 +3,7 @@
 #include <JuceHeader.h>
 
 #include "LookAheadLimiter.h"
+#include "PluginChain.h"
 
 using namespace juce::dsp;
 
@@ -13,17 +14,42 @@ public:
     }
 
     inline void prepare(const ProcessSpec& spec) {
+#if JUCE_MODULE_AVAILABLE_juce_audio_processors
+         plugins.prepare(spec);
+#endif
          chain.prepare(spec);        
     }
 
     inline void process(const ProcessContextReplacing<float>& context) {
+#if JUCE_MODULE_AVAILABLE_juce_audio_processors
+         plugins.process(context);
+#endif
          chain.process(context);
     }
 
     inline void reset() {
+#if JUCE_MODULE_AVAILABLE_juce_audio_processors
+         plugins.reset();
+#endif
          chain.reset();
     }
 
+    // Delay introduced in front of the limiter
+    inline int getLatencyInSamples() const {
+#if JUCE_MODULE_AVAILABLE_juce_audio_processors
+        return plugins.getLatencyInSamples();
+#else
+        return 0;
+#endif
+    }
+
+#if JUCE_MODULE_AVAILABLE_juce_audio_processors
+    inline PluginChain& getPluginChain() { return plugins; }
+#endif
+
 private:
+#if JUCE_MODULE_AVAILABLE_juce_audio_processors
+     PluginChain plugins;
+#endif
      ProcessorChain<LookAheadLimiter> chain;
 };
@@ -0,0 +1,558 @@
+#include "RoutingGraph.h"
+
+namespace medley {
+
+const String RoutingGraph::kMainOutput = "main";
+
+struct RoutingGraph::Plan {
+    struct Input {
+        int buffer;
+        float gain;
+    };
+
+    struct Step {
+        std::shared_ptr<NodeState> node;
+        int buffer = -1;
+        std::vector<Input> inputs;
+    };
+
+    std::vector<Step> steps;
+    OwnedArray<AudioBuffer<float>> buffers;
+
+    int blockSize = 0;
+    int numChannels = 0;
+
+    uint64 generation = 0;
+    // Generation of the plan that replaced this one on the audio thread
+    uint64 replacedBy = 0;
+};
+
+RoutingGraph::RoutingGraph()
+{
+    addOutput(kMainOutput, nullptr);
+}
+
+RoutingGraph::~RoutingGraph()
+{
+    delete pendingPlan.exchange(nullptr);
+    delete retiredPlan.exchange(nullptr);
+    delete currentPlan;
+}
+
+void RoutingGraph::addSource(const String& name, AudioSource* source)
+{
+    jassert(source != nullptr);
+
+    ScopedLock sl(lock);
+
+    if (findNode(name) != nullptr) {
+        throw std::runtime_error(("Node already exists: " + name).toStdString());
+    }
+
+    auto node = std::make_shared<NodeState>();
+    node->name = name;
+    node->type = NodeType::Source;
+    node->source = source;
+
+    nodes.push_back(node);
+    markDirty();
+}
+
+void RoutingGraph::addBus(const String& name, std::shared_ptr<BusProcessor> processor)
+{
+    ScopedLock sl(lock);
+
+    if (findNode(name) != nullptr) {
+        throw std::runtime_error(("Node already exists: " + name).toStdString());
+    }
+
+    auto node = std::make_shared<NodeState>();
+    node->name = name;
+    node->type = NodeType::Bus;
+    node->processor = processor;
+    node->metered = true;
+
+    // Not part of any plan yet, so it can be prepared right away
+    node->meter.prepare(numChannels, (int)sampleRate, latency, 10);
+
+    if (processor != nullptr) {
+        processor->prepare({ sampleRate, (uint32)maxBlockSize, (uint32)numChannels });
+    }
+
+    nodes.push_back(node);
+    markDirty();
+}
+
+void RoutingGraph::addOutput(const String& name, OutputCallback* callback)
+{
+    ScopedLock sl(lock);
+
+    if (findNode(name) != nullptr) {
+        throw std::runtime_error(("Node already exists: " + name).toStdString());
+    }
+
+    auto node = std::make_shared<NodeState>();
+    node->name = name;
+    node->type = NodeType::Output;
+    node->callback = callback;
+    node->metered = true;
+    node->meter.prepare(numChannels, (int)sampleRate, latency, 10);
+
+    nodes.push_back(node);
+    markDirty();
+}
+
+uint64 RoutingGraph::removeNode(const String& name)
+{
+    if (name == kMainOutput) {
+        throw std::runtime_error("The main output cannot be removed");
+    }
+
+    ScopedLock sl(lock);
+
+    nodes.erase(std::remove_if(nodes.begin(), nodes.end(), [&](auto& node) { return node->name == name; }), nodes.end());
+    connections.erase(std::remove_if(connections.begin(), connections.end(), [&](auto& c) { return c.from == name || c.to == name; }), connections.end());
+
+    markDirty();
+    return generation;
+}
+
+bool RoutingGraph::waitUntilReleased(uint64 waitedGeneration, int timeoutMs) const
+{
+    const auto deadlineTime = Time::getMillisecondCounter() + (uint32)timeoutMs;
+
+    while (!isReleased(waitedGeneration)) {
+        if (Time::getMillisecondCounter() >= deadlineTime) {
+            return false;
+        }
+
+        Thread::sleep(1);
+    }
+
+    return true;
+}
+
+bool RoutingGraph::hasNode(const String& name) const
+{
+    ScopedLock sl(lock);
+    return findNode(name) != nullptr;
+}
+
+void RoutingGraph::connect(const String& from, const String& to, float gain)
+{
+    ScopedLock sl(lock);
+
+    auto source = findNode(from);
+    auto destination = findNode(to);
+
+    if (source == nullptr || destination == nullptr) {
+        throw std::runtime_error(("Unknown node: " + (source == nullptr ? from : to)).toStdString());
+    }
+
+    if (source->type == NodeType::Output) {
+        throw std::runtime_error("Outputs cannot feed other nodes");
+    }
+
+    if (destination->type == NodeType::Source) {
+        throw std::runtime_error("Sources cannot be fed");
+    }
+
+    for (auto& c : connections) {
+        if (c.from == from && c.to == to) {
+            c.gain = gain;
+            markDirty();
+            return;
+        }
+    }
+
+    if (from == to || isReachable(to, from)) {
+        throw std::runtime_error(("Connecting " + from + " to " + to + " would form a cycle").toStdString());
+    }
+
+    connections.push_back({ from, to, gain });
+    markDirty();
+}
+
+void RoutingGraph::disconnect(const String& from, const String& to)
+{
+    ScopedLock sl(lock);
+
+    connections.erase(std::remove_if(connections.begin(), connections.end(), [&](auto& c) { return c.from == from && c.to == to; }), connections.end());
+    markDirty();
+}
+
+void RoutingGraph::setGain(const String& name, float gain)
+{
+    ScopedLock sl(lock);
+
+    if (auto node = findNode(name)) {
+        node->gain = gain;
+    }
+}
+
+float RoutingGraph::getGain(const String& name) const
+{
+    ScopedLock sl(lock);
+
+    auto node = findNode(name);
+    return node != nullptr ? node->gain.load() : 0.0f;
+}
+
+double RoutingGraph::getLevel(const String& name, int channel) const
+{
+    ScopedLock sl(lock);
+
+    auto node = findNode(name);
+    return (node != nullptr && node->metered) ? node->meter.getLevel(channel) : 0.0;
+}
+
+double RoutingGraph::getPeak(const String& name, int channel) const
+{
+    ScopedLock sl(lock);
+
+    auto node = findNode(name);
+    return (node != nullptr && node->metered) ? node->meter.getPeak(channel) : 0.0;
+}
+
+bool RoutingGraph::isClipping(const String& name, int channel) const
+{
+    ScopedLock sl(lock);
+
+    auto node = findNode(name);
+    return (node != nullptr && node->metered) ? node->meter.isClipping(channel) : false;
+}
+
+void RoutingGraph::prepare(double newSampleRate, int newMaxBlockSize, int newNumChannels, int latencyInSamples)
+{
+    {
+        ScopedLock sl(lock);
+
+        sampleRate = newSampleRate;
+        maxBlockSize = jmax(1, newMaxBlockSize);
+        numChannels = jmax(1, newNumChannels);
+        latency = latencyInSamples;
+
+        for (auto& node : nodes) {
+            if (node->metered) {
+                node->meter.prepare(numChannels, (int)sampleRate, latency, 10);
+            }
+
+            if (node->processor != nullptr) {
+                node->processor->prepare({ sampleRate, (uint32)maxBlockSize, (uint32)numChannels });
+            }
+        }
+
+        markDirty();
+    }
+
+    compileNow();
+}
+
+void RoutingGraph::compileNow()
+{
+    if (dirty) {
+        publish(compile());
+    }
+
+    collectGarbage();
+}
+
+int RoutingGraph::useTimeSlice()
+{
+    compileNow();
+
+    {
+        ScopedLock sl(lock);
+
+        for (auto& node : nodes) {
+            if (node->metered) {
+                node->meter.update();
+            }
+        }
+    }
+
+    return 5;
+}
+
+void RoutingGraph::render(const AudioSourceChannelInfo& info)
+{
+    // Only pick up a new plan once the previous one has been collected, so nothing is ever freed here
+    if (retiredPlan.load() == nullptr) {
+        if (auto plan = pendingPlan.exchange(nullptr)) {
+            if (currentPlan != nullptr) {
+                currentPlan->replacedBy = plan->generation;
+                retiredPlan = currentPlan;
+            }
+            else {
+                // Nothing was rendered before
+                releasedGeneration = plan->generation;
+            }
+
+            currentPlan = plan;
+        }
+    }
+
+    if (currentPlan == nullptr || currentPlan->blockSize <= 0) {
+        info.clearActiveBufferRegion();
+        return;
+    }
+
+    auto& output = *info.buffer;
+    auto position = info.startSample;
+    auto remaining = info.numSamples;
+
+    while (remaining > 0) {
+        auto numSamples = jmin(remaining, currentPlan->blockSize);
+        renderPlan(*currentPlan, output, position, numSamples);
+
+        position += numSamples;
+        remaining -= numSamples;
+    }
+}
+
+void RoutingGraph::renderPlan(Plan& plan, AudioBuffer<float>& output, int startSample, int numSamples)
+{
+    for (auto& step : plan.steps) {
+        auto& node = *step.node;
+        auto& buffer = *plan.buffers[step.buffer];
+
+        // Refers to the preallocated buffer, trimmed to the block
+        AudioBuffer<float> block(buffer.getArrayOfWritePointers(), plan.numChannels, numSamples);
+
+        if (node.type == NodeType::Source) {
+            node.source->getNextAudioBlock(AudioSourceChannelInfo(&block, 0, numSamples));
+        }
+        else {
+            block.clear();
+
+            for (auto& input : step.inputs) {
+                auto& inputBuffer = *plan.buffers[input.buffer];
+
+                for (int i = 0; i < plan.numChannels; i++) {
+                    block.addFrom(i, 0, inputBuffer, i, 0, numSamples, input.gain);
+                }
+            }
+        }
+
+        if (node.processor != nullptr) {
+            AudioBlock<float> audioBlock(block);
+            node.processor->process(ProcessContextReplacing<float>(audioBlock));
+        }
+
+        auto gain = node.gain.load();
+        if (gain != node.lastGain) {
+            block.applyGainRamp(0, numSamples, node.lastGain, gain);
+            node.lastGain = gain;
+        }
+        else if (gain != 1.0f) {
+            block.applyGain(gain);
+        }
+
+        if (node.metered) {
+            node.meter.process(block);
+        }
+
+        if (node.type == NodeType::Output) {
+            if (node.name == kMainOutput) {
+                for (int i = output.getNumChannels(); --i >= 0;) {
+                    if (i < plan.numChannels) {
+                        output.copyFrom(i, startSample, block, i, 0, numSamples);
+                    }
+                    else {
+                        output.clear(i, startSample, numSamples);
+                    }
+                }
+            }
+            else if (node.callback != nullptr) {
+                node.callback->routedOutputReady(node.name, block, numSamples);
+            }
+        }
+    }
+}
+
+std::shared_ptr<RoutingGraph::NodeState> RoutingGraph::findNode(const String& name) const
+{
+    for (auto& node : nodes) {
+        if (node->name == name) {
+            return node;
+        }
+    }
+
+    return nullptr;
+}
+
+bool RoutingGraph::isReachable(const String& from, const String& to) const
+{
+    StringArray visited;
+    StringArray stack(from);
+
+    while (!stack.isEmpty()) {
+        auto name = stack[stack.size() - 1];
+        stack.remove(stack.size() - 1);
+
+        if (name == to) {
+            return true;
+        }
+
+        if (visited.contains(name)) {
+            continue;
+        }
+
+        visited.add(name);
+
+        for (auto& c : connections) {
+            if (c.from == name) {
+                stack.add(c.to);
+            }
+        }
+    }
+
+    return false;
+}
+
+void RoutingGraph::markDirty()
+{
+    generation++;
+    dirty = true;
+}
+
+RoutingGraph::Plan* RoutingGraph::compile()
+{
+    ScopedLock sl(lock);
+
+    dirty = false;
+
+    auto plan = new Plan();
+    plan->generation = generation;
+    plan->blockSize = maxBlockSize;
+    plan->numChannels = numChannels;
+
+    const auto numNodes = (int)nodes.size();
+
+    auto indexOf = [&](const String& name) {
+        for (int i = 0; i < numNodes; i++) {
+            if (nodes[i]->name == name) {
+                return i;
+            }
+        }
+
+        return -1;
+    };
+
+    std::vector<int> numIncoming(numNodes, 0);
+    std::vector<int> numConsumers(numNodes, 0);
+
+    for (auto& c : connections) {
+        auto from = indexOf(c.from);
+        auto to = indexOf(c.to);
+
+        if (from >= 0 && to >= 0) {
+            numIncoming[to]++;
+            numConsumers[from]++;
+        }
+    }
+
+    // Kahn's algorithm, nodes keep the order they were added in when nothing constrains them
+    std::vector<int> order;
+    std::vector<int> remaining(numIncoming);
+    std::vector<bool> scheduled(numNodes, false);
+
+    while ((int)order.size() < numNodes) {
+        auto next = -1;
+
+        for (int i = 0; i < numNodes; i++) {
+            if (!scheduled[i] && remaining[i] == 0) {
+                next = i;
+                break;
+            }
+        }
+
+        // Cycles are refused by connect(), this is only a safety net
+        if (next < 0) {
+            jassertfalse;
+            break;
+        }
+
+        scheduled[next] = true;
+        order.push_back(next);
+
+        for (auto& c : connections) {
+            if (c.from == nodes[next]->name) {
+                auto to = indexOf(c.to);
+
+                if (to >= 0) {
+                    remaining[to]--;
+                }
+            }
+        }
+    }
+
+    // A buffer goes back to the free list after the last step reading it, so the plan needs about as many buffers as
+    // the graph is wide instead of one per node
+    std::vector<int> bufferOf(numNodes, -1);
+    std::vector<int> consumersLeft(numConsumers);
+    Array<int> freeBuffers;
+
+    auto acquireBuffer = [&]() {
+        if (!freeBuffers.isEmpty()) {
+            return freeBuffers.removeAndReturn(freeBuffers.size() - 1);
+        }
+
+        plan->buffers.add(new AudioBuffer<float>(numChannels, maxBlockSize));
+        return plan->buffers.size() - 1;
+    };
+
+    for (auto index : order) {
+        Plan::Step step;
+        step.node = nodes[index];
+        step.buffer = acquireBuffer();
+        bufferOf[index] = step.buffer;
+
+        for (auto& c : connections) {
+            if (c.to == nodes[index]->name) {
+                auto from = indexOf(c.from);
+
+                if (from >= 0 && bufferOf[from] >= 0) {
+                    step.inputs.push_back({ bufferOf[from], c.gain });
+                }
+            }
+        }
+
+        // Inputs are released after this step has read them
+        for (auto& c : connections) {
+            if (c.to == nodes[index]->name) {
+                auto from = indexOf(c.from);
+
+                if (from >= 0 && --consumersLeft[from] == 0) {
+                    freeBuffers.add(bufferOf[from]);
+                }
+            }
+        }
+
+        // Nothing reads it, so it is free again right after
+        if (numConsumers[index] == 0) {
+            freeBuffers.add(step.buffer);
+        }
+
+        plan->steps.push_back(std::move(step));
+    }
+
+    return plan;
+}
+
+void RoutingGraph::publish(Plan* plan)
+{
+    // A plan the audio thread never picked up can go straight away
+    delete pendingPlan.exchange(plan);
+}
+
+void RoutingGraph::collectGarbage()
+{
+    if (auto plan = retiredPlan.exchange(nullptr)) {
+        // Older plans were collected before this one, or never picked up
+        releasedGeneration = plan->replacedBy;
+        delete plan;
+    }
+}
+
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "LevelTracker.h"
+
+using namespace juce;
+using namespace juce::dsp;
+
+namespace medley {
+
+/**
+ * Routes sources through buses into outputs.
+ *
+ * The graph is edited from control threads, each change is compiled on a background thread into a flat execution plan,
+ * nodes in topological order with every buffer allocated up front, which the audio thread picks up at the start of its
+ * next block. Rendering never allocates nor takes a lock, plans it has let go of are deleted by the compiling thread.
+ *
+ * A removed node is still rendered until the audio thread has moved on to a plan compiled after the removal, its source
+ * or output callback must be kept alive until then: removeNode() returns the graph generation of the removal, which
+ * isReleased() and waitUntilReleased() check. While the graph is not being rendered at all, nothing is ever released,
+ * but nothing renders the node either.
+ */
+class RoutingGraph : public TimeSliceClient {
+public:
+    enum class NodeType {
+        Source,
+        Bus,
+        Output
+    };
+
+    // Processing inserted on a bus, runs on the audio thread
+    class BusProcessor {
+    public:
+        virtual ~BusProcessor() {}
+
+        virtual void prepare(const ProcessSpec& spec) = 0;
+
+        virtual void process(const ProcessContextReplacing<float>& context) = 0;
+
+        virtual void reset() = 0;
+    };
+
+    // Receives outputs other than the main one, on the audio thread
+    class OutputCallback {
+    public:
+        virtual ~OutputCallback() {}
+
+        virtual void routedOutputReady(const String& name, const AudioBuffer<float>& buffer, int numSamples) = 0;
+    };
+
+    // Rendered into the buffer passed to render()
+    static const String kMainOutput;
+
+    RoutingGraph();
+
+    ~RoutingGraph() override;
+
+    // Node names are unique across types, these throw if the name is taken
+    void addSource(const String& name, AudioSource* source);
+
+    void addBus(const String& name, std::shared_ptr<BusProcessor> processor = nullptr);
+
+    void addOutput(const String& name, OutputCallback* callback);
+
+    // Returns the generation to wait for before the node's source or callback may be deleted
+    uint64 removeNode(const String& name);
+
+    // True once no plan compiled before the generation is left, so whatever was removed before it is no longer used
+    bool isReleased(uint64 generation) const { return releasedGeneration >= generation; }
+
+    // Returns false if the audio thread has not moved on after the timeout, the removed objects must then be kept
+    bool waitUntilReleased(uint64 generation, int timeoutMs = 2000) const;
+
+    bool hasNode(const String& name) const;
+
+    // Sources feed buses or outputs, buses feed buses or outputs; throws on unknown nodes or if it would form a cycle
+    void connect(const String& from, const String& to, float gain = 1.0f);
+
+    void disconnect(const String& from, const String& to);
+
+    // Gain applied to the node's own signal, ramped over one block, does not need compiling
+    void setGain(const String& name, float gain);
+
+    float getGain(const String& name) const;
+
+    // Meters of a bus or an output
+    double getLevel(const String& name, int channel) const;
+
+    double getPeak(const String& name, int channel) const;
+
+    bool isClipping(const String& name, int channel) const;
+
+    // Not to be called while rendering, compiles right away
+    void prepare(double sampleRate, int maxBlockSize, int numChannels, int latencyInSamples);
+
+    // Compile pending changes on the calling thread, for when the background thread is not running yet
+    void compileNow();
+
+    // Audio thread only
+    void render(const AudioSourceChannelInfo& info);
+
+    int useTimeSlice() override;
+
+private:
+    struct NodeState {
+        String name;
+        NodeType type = NodeType::Bus;
+        AudioSource* source = nullptr;
+        std::shared_ptr<BusProcessor> processor;
+        OutputCallback* callback = nullptr;
+
+        std::atomic<float> gain{ 1.0f };
+        // Audio thread only
+        float lastGain = 1.0f;
+
+        bool metered = false;
+        LevelTracker meter;
+    };
+
+    struct Connection {
+        String from;
+        String to;
+        float gain = 1.0f;
+    };
+
+    struct Plan;
+
+    std::shared_ptr<NodeState> findNode(const String& name) const;
+
+    bool isReachable(const String& from, const String& to) const;
+
+    void markDirty();
+
+    Plan* compile();
+
+    void publish(Plan* plan);
+
+    void collectGarbage();
+
+    void renderPlan(Plan& plan, AudioBuffer<float>& output, int startSample, int numSamples);
+
+    CriticalSection lock;
+    std::vector<std::shared_ptr<NodeState>> nodes;
+    std::vector<Connection> connections;
+
+    double sampleRate = 44100.0;
+    int maxBlockSize = 512;
+    int numChannels = 2;
+    int latency = 0;
+
+    std::atomic<bool> dirty{ true };
+
+    // Bumped by every edit, plans carry the one they were compiled at
+    std::atomic<uint64> generation{ 0 };
+    std::atomic<uint64> releasedGeneration{ 0 };
+
+    // Plans move from pending to current on the audio thread, then to retired once replaced
+    std::atomic<Plan*> pendingPlan{ nullptr };
+    Plan* currentPlan = nullptr;
+    std::atomic<Plan*> retiredPlan{ nullptr };
+
+    JUCE_DECLARE_NON_COPYABLE(RoutingGraph)
+};
+
+}
@@ -0,0 +1,29 @@
+#include "ScanCoordinator.h"
+#include "Deck.h"
+
+namespace medley {
+
+void ScanCoordinator::addDeck(Deck* deck)
+{
+    decks.addIfNotAlreadyThere(deck);
+}
+
+void ScanCoordinator::removeDeck(Deck* deck)
+{
+    decks.removeFirstMatchingValue(deck);
+}
+
+bool ScanCoordinator::isLoadingOtherThan(const Deck* deck) const
+{
+    const ScopedLock sl(decks.getLock());
+
+    for (auto other : decks) {
+        if (other != deck && other->isTrackLoading) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+}
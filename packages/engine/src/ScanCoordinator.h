@@ -0,0 +1,27 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+using namespace juce;
+
+namespace medley {
+
+class Deck;
+
+/**
+ * Shared by the decks of one loading thread, so that a deck's tail scan can tell whether another deck is waiting to load.
+ */
+class ScanCoordinator {
+public:
+    void addDeck(Deck* deck);
+
+    void removeDeck(Deck* deck);
+
+    // True while any deck other than the given one has a load requested or in progress
+    bool isLoadingOtherThan(const Deck* deck) const;
+
+private:
+    Array<Deck*, CriticalSection> decks;
+};
+
+}
@@ -0,0 +1,644 @@
+#include "SegmentedOutputWriter.h"
+
+namespace {
+    // Room for encoding falling behind for a while
+    constexpr double kRingDuration = 4.0;
+
+    constexpr int kPollInterval = 20;
+
+    // Owner of the PRIV frame HLS reads packed audio timestamps from
+    const char kTimestampOwner[] = "com.apple.streaming.transportStreamTimestamp";
+
+    // What LAME has used for years, until the first Info tag tells otherwise
+    constexpr int kDefaultEncoderDelay = 576;
+
+    // Added by every MP3 decoder's synthesis filterbank
+    constexpr int kDecoderDelay = 529;
+
+    constexpr int kEncodeTimeout = 30000;
+
+    bool isMp3(const String& format) {
+        return format.trimCharactersAtStart(".").equalsIgnoreCase("mp3");
+    }
+
+    bool isMpegSampleRate(double sampleRate) {
+        for (auto rate : { 8000, 11025, 12000, 16000, 22050, 24000, 32000, 44100, 48000 }) {
+            if (sampleRate == rate) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    int getMp3FrameSamples(double sampleRate) {
+        // MPEG-2 and 2.5 frames hold a single granule
+        return sampleRate >= 32000 ? 1152 : 576;
+    }
+
+    int64 getSegmentLength(const medley::SegmentedOutputWriter::Options& options, double sampleRate) {
+        const auto length = jmax((int64)1, (int64)std::round(options.segmentDuration * sampleRate));
+
+        if (!isMp3(options.format)) {
+            return length;
+        }
+
+        // Whole frames, for segments to be cut from the frame grid
+        const auto frameSamples = getMp3FrameSamples(sampleRate);
+        return jmax((int64)1, (length + frameSamples / 2) / frameSamples) * frameSamples;
+    }
+
+    // Named like LAMEEncoderAudioFormat::getQualityOptions(), "VBR quality N" or "N Kb/s CBR"
+    StringArray getLameQualityArguments(const String& option) {
+        if (option.startsWithIgnoreCase("VBR")) {
+            return { "-V", String(option.fromFirstOccurrenceOf("quality", false, true).getIntValue()) };
+        }
+
+        if (option.containsIgnoreCase("Kb/s")) {
+            return { "--cbr", "-b", String(option.getIntValue()) };
+        }
+
+        return {};
+    }
+
+    struct Mp3FrameHeader {
+        int sampleRate = 0;
+        int length = 0;
+        // Offset of what follows the side information, where an Info tag starts
+        int sideInfoEnd = 0;
+    };
+
+    bool parseMp3FrameHeader(const uint8* h, Mp3FrameHeader& header) {
+        static const int bitrates[2][15] = {
+            { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },
+            { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 }
+        };
+
+        static const int sampleRates[3] = { 44100, 48000, 32000 };
+
+        if (h[0] != 0xFF || (h[1] & 0xE0) != 0xE0) {
+            return false;
+        }
+
+        const int version = (h[1] >> 3) & 3;
+        const int layer = (h[1] >> 1) & 3;
+        const int bitrateIndex = h[2] >> 4;
+        const int sampleRateIndex = (h[2] >> 2) & 3;
+
+        if (version == 1 || layer != 1 || bitrateIndex == 0 || bitrateIndex == 15 || sampleRateIndex == 3) {
+            return false;
+        }
+
+        const bool lsf = version != 3;
+        const bool mono = (h[3] >> 6) == 3;
+
+        header.sampleRate = sampleRates[sampleRateIndex] >> (version == 3 ? 0 : (version == 2 ? 1 : 2));
+        header.length = (lsf ? 72000 : 144000) * bitrates[lsf][bitrateIndex] / header.sampleRate + ((h[2] >> 1) & 1);
+        header.sideInfoEnd = ((h[1] & 1) ? 4 : 6) + (lsf ? (mono ? 9 : 17) : (mono ? 17 : 32));
+
+        return true;
+    }
+
+    bool isInfoFrame(const uint8* frame, const Mp3FrameHeader& header) {
+        return header.sideInfoEnd + 8 <= header.length
+            && (memcmp(frame + header.sideInfoEnd, "Xing", 4) == 0 || memcmp(frame + header.sideInfoEnd, "Info", 4) == 0);
+    }
+
+    // From the LAME extension of an Info frame, -1 when there is none
+    int readEncoderDelay(const uint8* frame, const Mp3FrameHeader& header) {
+        const auto tag = frame + header.sideInfoEnd;
+        const auto flags = tag[7];
+
+        // Frame count, byte count, seek table and quality, each only when flagged
+        const auto lame = header.sideInfoEnd + 8 + ((flags & 1) ? 4 : 0) + ((flags & 2) ? 4 : 0) + ((flags & 4) ? 100 : 0) + ((flags & 8) ? 4 : 0);
+
+        // Version, revision, lowpass, replay gain, flags and bitrate, then delay and padding on 12 bits each
+        if (lame + 24 > header.length || memcmp(frame + lame, "LAME", 4) != 0) {
+            return -1;
+        }
+
+        const auto delay = frame + lame + 21;
+        return (delay[0] << 4) | (delay[1] >> 4);
+    }
+}
+
+namespace medley {
+
+SegmentedOutputWriter::SegmentedOutputWriter(AudioFormatManager& formatMgr, const Options& options, double sampleRate, int numChannels)
+    :
+    Thread("Segmented Output Writer"),
+    options(options),
+    encoderFormat(isMp3(options.format) ? new LAMEEncoderAudioFormat(options.encoder) : nullptr),
+    // The registered MP3 format only reads
+    format(encoderFormat != nullptr ? encoderFormat.get() : formatMgr.findFormatForFileExtension(options.format)),
+    hls(encoderFormat != nullptr),
+    sampleRate(sampleRate),
+    numChannels(jmax(1, numChannels)),
+    segmentLength(getSegmentLength(options, sampleRate)),
+    encoderDelay(kDefaultEncoderDelay)
+{
+    if (format == nullptr) {
+        throw std::runtime_error(("Unsupported segment format: " + options.format).toStdString());
+    }
+
+    if (hls && !options.encoder.existsAsFile()) {
+        throw std::runtime_error("MP3 segments need the LAME executable");
+    }
+
+    // LAME would resample anything else, and the frames would no longer fall on the engine clock
+    if (hls && !isMpegSampleRate(sampleRate)) {
+        throw std::runtime_error(("MP3 segments cannot be encoded at " + String(sampleRate) + "Hz").toStdString());
+    }
+
+    if (!options.directory.createDirectory()) {
+        throw std::runtime_error(("Could not create directory: " + options.directory.getFullPathName()).toStdString());
+    }
+
+    if (hls) {
+        qualityArguments = getLameQualityArguments(format->getQualityOptions()[options.quality]);
+
+        // Pre-roll is below two frames whatever the delay, post-roll covers what LAME looks ahead
+        frameSamples = getMp3FrameSamples(sampleRate);
+        historyLength = frameSamples * 2;
+        postRollLength = frameSamples * 2;
+
+        window.setSize(this->numChannels, historyLength + (int)segmentLength + postRollLength);
+    }
+
+    const auto capacity = nextPowerOfTwo((int)(sampleRate * kRingDuration));
+    fifo.setTotalSize(capacity);
+    ring.setSize(this->numChannels, capacity);
+
+    startThread();
+}
+
+SegmentedOutputWriter::~SegmentedOutputWriter()
+{
+    signalThreadShouldExit();
+    notify();
+    waitForThreadToExit(-1);
+}
+
+void SegmentedOutputWriter::push(const AudioBuffer<float>& buffer, int startSample, int numSamples, int64 clockPosition)
+{
+    if (!started) {
+        // Published by the first write to the ring
+        startClock = clockPosition;
+        started = true;
+    }
+
+    int start1, size1, start2, size2;
+
+    if (pendingSilence > 0) {
+        fifo.prepareToWrite((int)jmin(pendingSilence, (int64)fifo.getFreeSpace()), start1, size1, start2, size2);
+
+        for (int ch = 0; ch < numChannels; ch++) {
+            if (size1 > 0) ring.clear(ch, start1, size1);
+            if (size2 > 0) ring.clear(ch, start2, size2);
+        }
+
+        fifo.finishedWrite(size1 + size2);
+        pendingSilence -= size1 + size2;
+
+        if (pendingSilence > 0) {
+            pendingSilence += numSamples;
+            numDroppedSamples += numSamples;
+            return;
+        }
+    }
+
+    fifo.prepareToWrite(numSamples, start1, size1, start2, size2);
+
+    for (int ch = 0; ch < numChannels; ch++) {
+        // Mono output is repeated on every channel
+        const auto source = jmin(ch, buffer.getNumChannels() - 1);
+
+        if (size1 > 0) ring.copyFrom(ch, start1, buffer, source, startSample, size1);
+        if (size2 > 0) ring.copyFrom(ch, start2, buffer, source, startSample + size1, size2);
+    }
+
+    fifo.finishedWrite(size1 + size2);
+
+    const auto dropped = numSamples - (size1 + size2);
+
+    if (dropped > 0) {
+        pendingSilence += dropped;
+        numDroppedSamples += dropped;
+    }
+}
+
+void SegmentedOutputWriter::run()
+{
+    while (!threadShouldExit()) {
+        if (!drain()) {
+            wait(kPollInterval);
+        }
+    }
+
+    while (drain()) {
+
+    }
+
+    finishSegment();
+    flushWindow();
+    writePlaylist(true);
+}
+
+bool SegmentedOutputWriter::drain()
+{
+    auto ready = fifo.getNumReady();
+
+    if (ready <= 0) {
+        return false;
+    }
+
+    if (hls) {
+        int start1, size1, start2, size2;
+        fifo.prepareToRead(ready, start1, size1, start2, size2);
+
+        if (size1 > 0) appendToWindow(start1, size1);
+        if (size2 > 0) appendToWindow(start2, size2);
+
+        fifo.finishedRead(size1 + size2);
+        return true;
+    }
+
+    while (ready > 0) {
+        const auto position = startClock + numConsumed;
+        const auto index = position / segmentLength;
+        const auto boundary = (index + 1) * segmentLength;
+        const auto numToWrite = (int)jmin((int64)ready, boundary - position);
+
+        if (index != segmentIndex) {
+            finishSegment();
+            openSegment(index, position);
+        }
+
+        int start1, size1, start2, size2;
+        fifo.prepareToRead(numToWrite, start1, size1, start2, size2);
+
+        if (segmentWriter != nullptr) {
+            if (size1 > 0) segmentWriter->writeFromAudioSampleBuffer(ring, start1, size1);
+            if (size2 > 0) segmentWriter->writeFromAudioSampleBuffer(ring, start2, size2);
+        }
+
+        fifo.finishedRead(size1 + size2);
+
+        numConsumed += numToWrite;
+        samplesInSegment += numToWrite;
+        ready -= numToWrite;
+
+        if (position + numToWrite == boundary) {
+            finishSegment();
+        }
+    }
+
+    return true;
+}
+
+void SegmentedOutputWriter::openSegment(int64 index, int64 clockPosition)
+{
+    segmentIndex = index;
+    samplesInSegment = 0;
+
+    segmentTemp = std::make_unique<TemporaryFile>(getSegmentFile(index));
+
+    auto stream = new FileOutputStream(segmentTemp->getFile());
+
+    if (stream->openedOk()) {
+        segmentWriter.reset(format->createWriterFor(stream, sampleRate, (unsigned int)numChannels, options.bitsPerSample, {}, options.quality));
+    }
+
+    if (segmentWriter == nullptr) {
+        // The writer takes ownership only when it could be created
+        delete stream;
+        Logger::writeToLog("Could not write segment " + getSegmentFile(index).getFullPathName());
+    }
+}
+
+void SegmentedOutputWriter::appendToWindow(int ringStart, int numSamples)
+{
+    if (!windowStarted) {
+        // The first segment starts on the frame grid, with silence up to the first sample
+        const auto firstStart = startClock / frameSamples * frameSamples;
+
+        windowStart = firstStart - historyLength;
+        windowLength = (int)(startClock - windowStart);
+        window.clear();
+        windowStarted = true;
+    }
+
+    while (numSamples > 0) {
+        const auto numToCopy = jmin(numSamples, window.getNumSamples() - windowLength);
+
+        for (int ch = 0; ch < numChannels; ch++) {
+            window.copyFrom(ch, windowLength, ring, ch, ringStart, numToCopy);
+        }
+
+        windowLength += numToCopy;
+        ringStart += numToCopy;
+        numSamples -= numToCopy;
+        numConsumed += numToCopy;
+
+        // A segment is encoded once what LAME looks ahead at is there too
+        for (;;) {
+            const auto start = windowStart + historyLength;
+            const auto index = start / segmentLength;
+            const auto end = (index + 1) * segmentLength;
+
+            if (windowStart + windowLength < end + postRollLength) {
+                break;
+            }
+
+            writeMp3Segment(index, start, (int)(end - start));
+            shiftWindow((int)(end - start));
+        }
+    }
+}
+
+void SegmentedOutputWriter::flushWindow()
+{
+    if (!windowStarted) {
+        return;
+    }
+
+    const auto audioEnd = windowStart + windowLength;
+
+    // Padded with silence, the window always has room for a segment and what follows it
+    window.clear(windowLength, window.getNumSamples() - windowLength);
+    windowLength = window.getNumSamples();
+
+    while (windowStart + historyLength < audioEnd) {
+        const auto start = windowStart + historyLength;
+        const auto index = start / segmentLength;
+        const auto end = jmin((index + 1) * segmentLength, (audioEnd + frameSamples - 1) / frameSamples * frameSamples);
+
+        writeMp3Segment(index, start, (int)(end - start));
+        shiftWindow((int)(end - start));
+
+        window.clear(windowLength, window.getNumSamples() - windowLength);
+        windowLength = window.getNumSamples();
+    }
+
+    windowStarted = false;
+}
+
+void SegmentedOutputWriter::writeMp3Segment(int64 index, int64 clockPosition, int numSamples)
+{
+    const auto file = getSegmentFile(index);
+    MemoryBlock frames;
+
+    if (!encodeMp3(numSamples, frames)) {
+        // Left out of the playlist, which marks the gap as a discontinuity
+        Logger::writeToLog("Could not encode segment " + file.getFullPathName());
+        return;
+    }
+
+    TemporaryFile temp(file);
+
+    {
+        FileOutputStream stream(temp.getFile());
+
+        if (!stream.openedOk()) {
+            Logger::writeToLog("Could not write segment " + file.getFullPathName());
+            return;
+        }
+
+        writeTimestampTag(stream, clockPosition);
+        stream.write(frames.getData(), frames.getSize());
+    }
+
+    if (temp.overwriteTargetFileWithTemporary()) {
+        addToPlaylist(index, numSamples);
+    }
+}
+
+bool SegmentedOutputWriter::encodeMp3(int numSamples, MemoryBlock& frames)
+{
+    // Once more when the Info tag shows the delay was not the expected one
+    for (int attempt = 0; attempt < 2; attempt++) {
+        // The segment starts a whole number of frames into the decoded output, on its first kept frame
+        const auto delay = encoderDelay + kDecoderDelay;
+        const auto preRoll = (delay + frameSamples * 2 - 1) / frameSamples * frameSamples - delay;
+        const auto firstFrame = (delay + preRoll) / frameSamples;
+        const auto numFrames = numSamples / frameSamples;
+
+        MemoryBlock encoded;
+
+        if (!runEncoder(historyLength - preRoll, preRoll + numSamples + postRollLength, encoded)) {
+            return false;
+        }
+
+        auto data = (const uint8*)encoded.getData();
+        const auto size = (int)encoded.getSize();
+        auto position = 0;
+
+        // LAME writes no tag unless asked to, but skip one anyway
+        if (size >= 10 && memcmp(data, "ID3", 3) == 0) {
+            position = 10 + ((data[6] & 0x7f) << 21 | (data[7] & 0x7f) << 14 | (data[8] & 0x7f) << 7 | (data[9] & 0x7f)) + ((data[5] & 0x10) ? 10 : 0);
+        }
+
+        Array<Range<int>> audioFrames;
+        auto foundDelay = -1;
+        Mp3FrameHeader header;
+
+        while (position + 4 <= size && parseMp3FrameHeader(data + position, header) && position + header.length <= size) {
+            if (header.sampleRate != (int)sampleRate) {
+                return false;
+            }
+
+            // Not audio, gapless decoders skip it
+            if (audioFrames.isEmpty() && foundDelay < 0 && isInfoFrame(data + position, header)) {
+                foundDelay = readEncoderDelay(data + position, header);
+            }
+            else {
+                audioFrames.add({ position, position + header.length });
+            }
+
+            position += header.length;
+        }
+
+        if (foundDelay >= 0 && foundDelay != encoderDelay) {
+            Logger::writeToLog("LAME encoder delay is " + String(foundDelay) + " samples");
+            encoderDelay = foundDelay;
+            continue;
+        }
+
+        if (audioFrames.size() < firstFrame + numFrames) {
+            return false;
+        }
+
+        const auto start = audioFrames[firstFrame].getStart();
+        const auto end = audioFrames[firstFrame + numFrames - 1].getEnd();
+
+        frames.replaceWith(data + start, (size_t)(end - start));
+        return true;
+    }
+
+    return false;
+}
+
+bool SegmentedOutputWriter::runEncoder(int start, int numSamples, MemoryBlock& encoded)
+{
+    TemporaryFile input(".wav");
+    TemporaryFile output(".mp3");
+
+    {
+        auto stream = new FileOutputStream(input.getFile());
+        std::unique_ptr<AudioFormatWriter> writer(stream->openedOk() ? wavFormat.createWriterFor(stream, sampleRate, (unsigned int)numChannels, 16, {}, 0) : nullptr);
+
+        if (writer == nullptr) {
+            delete stream;
+            return false;
+        }
+
+        writer->writeFromAudioSampleBuffer(window, start, numSamples);
+    }
+
+    // Without bit reservoir, no frame refers to data of the one before, which may come from another run
+    // Low bitrates would otherwise be resampled, moving frames off the engine clock
+    StringArray args{ options.encoder.getFullPathName(), "--quiet", "--nores", "--resample", String(sampleRate / 1000.0) };
+    args.addArray(qualityArguments);
+    args.add(input.getFile().getFullPathName());
+    args.add(output.getFile().getFullPathName());
+
+    ChildProcess lame;
+
+    if (!lame.start(args)) {
+        return false;
+    }
+
+    lame.readAllProcessOutput();
+
+    if (!lame.waitForProcessToFinish(kEncodeTimeout) || lame.getExitCode() != 0) {
+        return false;
+    }
+
+    return output.getFile().loadFileAsData(encoded) && encoded.getSize() > 0;
+}
+
+void SegmentedOutputWriter::shiftWindow(int numSamples)
+{
+    const auto remaining = windowLength - numSamples;
+
+    for (int ch = 0; ch < numChannels; ch++) {
+        auto data = window.getWritePointer(ch);
+        memmove(data, data + numSamples, (size_t)remaining * sizeof(float));
+    }
+
+    windowStart += numSamples;
+    windowLength = remaining;
+}
+
+void SegmentedOutputWriter::writeTimestampTag(OutputStream& stream, int64 clockPosition) const
+{
+    // 33 bits, wrapping like MPEG timestamps do
+    const auto timestamp = (uint64)std::llround(clockPosition * 90000.0 / sampleRate) & 0x1FFFFFFFFULL;
+
+    const auto frameSize = (int)sizeof(kTimestampOwner) + 8;
+    const auto tagSize = 10 + frameSize;
+
+    // Sizes stay below 128, where syncsafe integers are plain bytes
+    const uint8 header[] = { 'I', 'D', '3', 4, 0, 0, 0, 0, 0, (uint8)tagSize };
+    const uint8 frameHeader[] = { 'P', 'R', 'I', 'V', 0, 0, 0, (uint8)frameSize, 0, 0 };
+
+    stream.write(header, sizeof(header));
+    stream.write(frameHeader, sizeof(frameHeader));
+    stream.write(kTimestampOwner, sizeof(kTimestampOwner));
+
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        stream.writeByte((char)((timestamp >> shift) & 0xFF));
+    }
+}
+
+void SegmentedOutputWriter::finishSegment()
+{
+    if (segmentIndex < 0) {
+        return;
+    }
+
+    const auto written = segmentWriter != nullptr;
+
+    // Flushes and closes the file
+    segmentWriter.reset();
+
+    if (written && samplesInSegment > 0 && segmentTemp->overwriteTargetFileWithTemporary()) {
+        addToPlaylist(segmentIndex, samplesInSegment);
+    }
+
+    segmentTemp.reset();
+    segmentIndex = -1;
+    samplesInSegment = 0;
+}
+
+void SegmentedOutputWriter::addToPlaylist(int64 index, int64 numSamples)
+{
+    listed.push_back({ index, numSamples / sampleRate, getSegmentFile(index).getFileName() });
+    lastSegmentIndex = index;
+
+    while ((int)listed.size() > jmax(1, options.playlistLength)) {
+        expired.push_back(listed.front());
+        listed.pop_front();
+    }
+
+    // Only deleted once no longer listed for a while
+    while ((int)expired.size() > jmax(0, options.numKeptSegments)) {
+        options.directory.getChildFile(expired.front().fileName).deleteFile();
+        expired.pop_front();
+    }
+
+    writePlaylist(false);
+}
+
+void SegmentedOutputWriter::writePlaylist(bool ended)
+{
+    if (listed.empty()) {
+        return;
+    }
+
+    String content;
+    content << "#EXTM3U\n";
+
+    if (hls) {
+        content << "#EXT-X-VERSION:3\n";
+        // Durations rounded to the nearest second must not exceed it, MP3 segments may be a little longer than asked
+        content << "#EXT-X-TARGETDURATION:" << jmax(1, roundToInt(segmentLength / sampleRate)) << "\n";
+        content << "#EXT-X-MEDIA-SEQUENCE:" << listed.front().index << "\n";
+    }
+
+    auto expectedIndex = listed.front().index;
+
+    for (auto& segment : listed) {
+        // A gap in the sequence means segments could not be written
+        if (hls && segment.index != expectedIndex) {
+            content << "#EXT-X-DISCONTINUITY\n";
+        }
+
+        content << "#EXTINF:" << String(segment.duration, 3) << ",\n";
+        content << segment.fileName << "\n";
+
+        expectedIndex = segment.index + 1;
+    }
+
+    if (hls && ended) {
+        content << "#EXT-X-ENDLIST\n";
+    }
+
+    replaceAtomically(options.directory.getChildFile(options.playlistName), content);
+}
+
+void SegmentedOutputWriter::replaceAtomically(const File& file, const String& content)
+{
+    TemporaryFile temp(file);
+
+    if (!temp.getFile().replaceWithText(content) || !temp.overwriteTargetFileWithTemporary()) {
+        Logger::writeToLog("Could not write " + file.getFullPathName());
+    }
+}
+
+File SegmentedOutputWriter::getSegmentFile(int64 index) const
+{
+    return options.directory.getChildFile(options.baseName + "-" + String(index) + "." + options.format.trimCharactersAtStart("."));
+}
+
+}
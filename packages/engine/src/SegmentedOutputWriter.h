@@ -0,0 +1,165 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <deque>
+
+using namespace juce;
+
+namespace medley {
+
+/**
+ * Cuts the output into fixed-duration encoded segments and keeps a rolling playlist of the latest ones, for
+ * on-demand catch-up.
+ *
+ * MP3 segments are HLS packed audio, encoded by an external LAME executable and each starting with the ID3 timestamp
+ * HLS requires, the playlist is then an HLS media playlist. HLS carries none of the other formats, segments of any
+ * other writable format are listed in a plain extended M3U instead.
+ *
+ * Each MP3 segment is its own LAME run, so it would carry the encoder delay and padding, and its first frames would
+ * refer to a bit reservoir the previous segment does not have. Instead the segment duration is rounded to whole MP3
+ * frames, segments are encoded without bit reservoir and with a little of the audio around them, and only the frames
+ * decoding to the segment's own samples are kept, found from the delay in LAME's Info tag. Played one after the other,
+ * segments then follow each other like a single stream, and the timestamp is exactly that of the first sample: the
+ * frames either side of a boundary come from two encodings of the same audio, which only differ by their
+ * quantization.
+ *
+ * The audio thread only copies into a ring, encoding and file writes happen on the writer's own thread. Segment
+ * boundaries fall on multiples of the segment length on the engine sample clock, and the media sequence number is
+ * the segment's index on that clock. Segments and the playlist are written to a temporary file then renamed, so a
+ * reader never sees them half written.
+ */
+class SegmentedOutputWriter : private Thread {
+public:
+    struct Options {
+        File directory;
+        String baseName = "segment";
+        String playlistName = "playlist.m3u8";
+
+        // mp3, or the file extension of a registered format that can write
+        String format = "mp3";
+        // LAME executable, needed for mp3
+        File encoder;
+        int bitsPerSample = 16;
+        // Index into the format's quality options, for lossy formats
+        int quality = 0;
+
+        // Rounded to whole frames for mp3
+        double segmentDuration = 6.0;
+        // Segments listed in the playlist
+        int playlistLength = 6;
+        // Segments kept on disk once dropped from the playlist, for clients still fetching them
+        int numKeptSegments = 2;
+    };
+
+    // Throws if the format is not available or the directory cannot be created
+    SegmentedOutputWriter(AudioFormatManager& formatMgr, const Options& options, double sampleRate, int numChannels);
+
+    // Writes out what is still buffered, then ends the playlist
+    ~SegmentedOutputWriter() override;
+
+    // Audio thread only. clockPosition is the engine sample clock at startSample
+    void push(const AudioBuffer<float>& buffer, int startSample, int numSamples, int64 clockPosition);
+
+    // Samples that did not fit in the ring, they are written as silence to keep the timeline
+    int64 getNumDroppedSamples() const { return numDroppedSamples; }
+
+    // Media sequence number of the last completed segment, -1 when there is none yet
+    int64 getLastSegmentIndex() const { return lastSegmentIndex; }
+
+    double getSampleRate() const { return sampleRate; }
+
+    int getNumChannels() const { return numChannels; }
+
+private:
+    struct Segment {
+        int64 index;
+        double duration;
+        String fileName;
+    };
+
+    void run() override;
+
+    // Encodes what is in the ring, returns false when there was nothing
+    bool drain();
+
+    void openSegment(int64 index, int64 clockPosition);
+
+    // MP3, adds what is read from the ring to the window and encodes the segments it completes
+    void appendToWindow(int ringStart, int numSamples);
+
+    // MP3, encodes what is left in the window, rounded up to whole frames
+    void flushWindow();
+
+    // MP3, encodes and writes the numSamples of the window after its history
+    void writeMp3Segment(int64 index, int64 clockPosition, int numSamples);
+
+    // MP3, the frames decoding to numSamples after the window's history
+    bool encodeMp3(int numSamples, MemoryBlock& frames);
+
+    // MP3, runs LAME on a range of the window
+    bool runEncoder(int start, int numSamples, MemoryBlock& encoded);
+
+    // Drops numSamples from the start of the window
+    void shiftWindow(int numSamples);
+
+    // ID3v2 tag with the PRIV frame carrying the timestamp of the first sample, on the 90 kHz MPEG clock
+    void writeTimestampTag(OutputStream& stream, int64 clockPosition) const;
+
+    void finishSegment();
+
+    void addToPlaylist(int64 index, int64 numSamples);
+
+    void writePlaylist(bool ended);
+
+    void replaceAtomically(const File& file, const String& content);
+
+    File getSegmentFile(int64 index) const;
+
+    Options options;
+    std::unique_ptr<AudioFormat> encoderFormat;
+    AudioFormat* format;
+    // Packed audio listed in an HLS playlist
+    bool hls;
+    double sampleRate;
+    int numChannels;
+    int64 segmentLength;
+
+    // Audio thread
+    bool started = false;
+    int64 pendingSilence = 0;
+
+    std::atomic<int64> startClock{ 0 };
+    std::atomic<int64> numDroppedSamples{ 0 };
+    std::atomic<int64> lastSegmentIndex{ -1 };
+
+    AbstractFifo fifo{ 1 };
+    AudioBuffer<float> ring;
+
+    // Writer thread
+    int64 numConsumed = 0;
+    int64 segmentIndex = -1;
+    int64 samplesInSegment = 0;
+    std::unique_ptr<TemporaryFile> segmentTemp;
+    std::unique_ptr<AudioFormatWriter> segmentWriter;
+    std::deque<Segment> listed;
+    std::deque<Segment> expired;
+
+    // MP3, writer thread. The window holds history before the segment being gathered, the segment, then what is
+    // encoded after it
+    WavAudioFormat wavFormat;
+    StringArray qualityArguments;
+    int frameSamples = 1152;
+    int historyLength = 0;
+    int postRollLength = 0;
+    // Learnt from the first Info tag, it is the same for every run
+    int encoderDelay;
+    AudioBuffer<float> window;
+    bool windowStarted = false;
+    // Clock position of the first sample in the window
+    int64 windowStart = 0;
+    int windowLength = 0;
+
+    JUCE_DECLARE_NON_COPYABLE(SegmentedOutputWriter)
+};
+
+}
@@ -0,0 +1,462 @@
+#include "SessionLog.h"
+
+namespace {
+    using Type = medley::SessionEvent::Type;
+
+    const char kMagic[8] = { 'M', 'D', 'L', 'Y', 'S', 'E', 'S', 'S' };
+
+    int getNumValues(Type type) {
+        switch (type) {
+        case Type::FitToPost:
+        case Type::TrackFetched:
+            return 2;
+
+        case Type::SeekSeconds:
+        case Type::SeekFraction:
+        case Type::SetGain:
+        case Type::SetFadingCurve:
+        case Type::SetMaxTransitionTime:
+        case Type::SetMaxLeadingDuration:
+        case Type::SetTempoMatching:
+        case Type::SetHalfPrecision:
+        case Type::BlockSize:
+        case Type::DeviceChanged:
+        case Type::DeckLoaded:
+            return 1;
+
+        default:
+            return 0;
+        }
+    }
+
+    bool isKnown(uint8 type) {
+        return (type >= (uint8)Type::Play && type <= (uint8)Type::SetHalfPrecision)
+            || (type >= (uint8)Type::TrackFetched && type <= (uint8)Type::DeviceChanged)
+            || (type >= (uint8)Type::DeckLoaded && type <= (uint8)Type::TrackScanned);
+    }
+
+    const char* getName(Type type) {
+        switch (type) {
+        case Type::Play: return "play";
+        case Type::Stop: return "stop";
+        case Type::TogglePause: return "togglePause";
+        case Type::FadeOut: return "fadeOut";
+        case Type::SeekSeconds: return "seek";
+        case Type::SeekFraction: return "seekFractional";
+        case Type::SetGain: return "setGain";
+        case Type::SetFadingCurve: return "setFadingCurve";
+        case Type::SetMaxTransitionTime: return "setMaxTransitionTime";
+        case Type::SetMaxLeadingDuration: return "setMaxLeadingDuration";
+        case Type::SetTempoMatching: return "setTempoMatching";
+        case Type::FitToPost: return "fitToPost";
+        case Type::ClearPost: return "clearPost";
+        case Type::SetHalfPrecision: return "setHalfPrecision";
+        case Type::TrackFetched: return "trackFetched";
+        case Type::BlockSize: return "blockSize";
+        case Type::DeviceChanged: return "deviceChanged";
+        case Type::DeckLoaded: return "loaded";
+        case Type::DeckStarted: return "started";
+        case Type::DeckFinished: return "finished";
+        case Type::DeckUnloaded: return "unloaded";
+        case Type::TrackScanned: return "scanned";
+        default: return "unknown";
+        }
+    }
+
+    void writeVarint(OutputStream& stream, uint64 value) {
+        while (value >= 0x80) {
+            stream.writeByte((char)((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+
+        stream.writeByte((char)value);
+    }
+
+    // False when the stream ends in the middle
+    bool readVarint(InputStream& stream, uint64& value) {
+        value = 0;
+
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8 byte;
+
+            if (stream.read(&byte, 1) != 1) {
+                return false;
+            }
+
+            value |= (uint64)(byte & 0x7f) << shift;
+
+            if ((byte & 0x80) == 0) {
+                return true;
+            }
+        }
+
+        throw std::runtime_error("Corrupted session log, varint too long");
+    }
+
+    uint64 zigzag(int64 value) {
+        return ((uint64)value << 1) ^ (uint64)(value >> 63);
+    }
+
+    int64 unzigzag(uint64 value) {
+        return (int64)(value >> 1) ^ -(int64)(value & 1);
+    }
+}
+
+namespace medley {
+
+String SessionEvent::describe() const
+{
+    String result;
+    result << "@" << samplePosition << " " << getName(type);
+
+    if (deck >= 0) {
+        result << " deck" << (deck + 1);
+    }
+
+    for (int i = 0; i < getNumValues(type); i++) {
+        result << " " << values[i];
+    }
+
+    if (text.isNotEmpty()) {
+        result << " " << text;
+    }
+
+    return result;
+}
+
+void SessionLog::writeHeader(OutputStream& stream, const Header& header)
+{
+    stream.write(kMagic, sizeof(kMagic));
+    stream.writeShort((short)kVersion);
+    stream.writeDouble(header.sampleRate);
+    stream.writeByte((char)header.numChannels);
+    stream.writeInt64(header.startTime);
+}
+
+void SessionLog::writeEvent(OutputStream& stream, const SessionEvent& event, int64& previousPosition)
+{
+    // Events from different threads may be a block out of order, hence signed
+    writeVarint(stream, zigzag(event.samplePosition - previousPosition));
+    previousPosition = event.samplePosition;
+
+    stream.writeByte((char)event.type);
+
+    if (event.isEngineEvent()) {
+        stream.writeByte((char)event.deck);
+    }
+
+    for (int i = 0; i < getNumValues(event.type); i++) {
+        stream.writeDouble(event.values[i]);
+    }
+
+    if (event.type == Type::TrackFetched) {
+        auto utf8 = event.text.toUTF8();
+        auto size = utf8.sizeInBytes() - 1;
+
+        writeVarint(stream, (uint64)size);
+        stream.write(utf8.getAddress(), size);
+    }
+}
+
+SessionLog::Header SessionLog::readHeader(InputStream& stream)
+{
+    char magic[sizeof(kMagic)];
+
+    if (stream.read(magic, sizeof(magic)) != (int)sizeof(magic) || memcmp(magic, kMagic, sizeof(kMagic)) != 0) {
+        throw std::runtime_error("Not a session log");
+    }
+
+    // Version, sample rate, channels and start time
+    if (stream.getNumBytesRemaining() < 19) {
+        throw std::runtime_error("Corrupted session log header");
+    }
+
+    auto version = stream.readShort();
+
+    if (version != kVersion) {
+        throw std::runtime_error("Unsupported session log version " + std::to_string(version));
+    }
+
+    Header header;
+    header.sampleRate = stream.readDouble();
+    header.numChannels = (uint8)stream.readByte();
+    header.startTime = stream.readInt64();
+
+    if (header.sampleRate <= 0.0 || header.numChannels <= 0) {
+        throw std::runtime_error("Corrupted session log header");
+    }
+
+    return header;
+}
+
+bool SessionLog::readEvent(InputStream& stream, SessionEvent& event, int64& previousPosition)
+{
+    uint64 delta;
+
+    if (!readVarint(stream, delta)) {
+        return false;
+    }
+
+    uint8 type;
+
+    if (stream.read(&type, 1) != 1) {
+        return false;
+    }
+
+    if (!isKnown(type)) {
+        throw std::runtime_error("Corrupted session log, unknown event type " + std::to_string(type));
+    }
+
+    event = SessionEvent();
+    event.samplePosition = previousPosition + unzigzag(delta);
+    event.type = (Type)type;
+
+    if (event.isEngineEvent()) {
+        uint8 deck;
+
+        if (stream.read(&deck, 1) != 1) {
+            return false;
+        }
+
+        event.deck = deck;
+    }
+
+    for (int i = 0; i < getNumValues(event.type); i++) {
+        if (stream.getNumBytesRemaining() < (int64)sizeof(double)) {
+            return false;
+        }
+
+        event.values[i] = stream.readDouble();
+    }
+
+    if (event.type == Type::TrackFetched) {
+        uint64 size;
+
+        if (!readVarint(stream, size) || (int64)size > stream.getNumBytesRemaining()) {
+            return false;
+        }
+
+        MemoryBlock utf8;
+        stream.readIntoMemoryBlock(utf8, (ssize_t)size);
+        event.text = String::fromUTF8((const char*)utf8.getData(), (int)utf8.getSize());
+    }
+
+    previousPosition = event.samplePosition;
+    return true;
+}
+
+std::vector<SessionEvent> SessionLog::readAll(const File& file, Header& header)
+{
+    FileInputStream stream(file);
+
+    if (stream.failedToOpen()) {
+        throw std::runtime_error(("Could not open " + file.getFullPathName()).toStdString());
+    }
+
+    BufferedInputStream buffered(stream, 65536);
+
+    header = readHeader(buffered);
+
+    std::vector<SessionEvent> events;
+    SessionEvent event;
+    int64 position = 0;
+
+    while (readEvent(buffered, event, position)) {
+        events.push_back(event);
+    }
+
+    return events;
+}
+
+}
+
+#if MEDLEY_SELF_TESTS
+
+// What is written must read back the same, and a log cut anywhere must give its complete events and nothing else
+class SessionLogTest : public UnitTest
+{
+public:
+    SessionLogTest()
+        : UnitTest("Session log format", "Medley")
+    {
+
+    }
+
+    void runTest() override
+    {
+        beginTest("Varints round-trip");
+
+        const uint64 unsignedValues[] = { 0, 1, 0x7f, 0x80, 0x3fff, 0x4000, 0xffffffffULL, 0x7fffffffffffffffULL, 0xffffffffffffffffULL };
+
+        for (auto value : unsignedValues) {
+            MemoryOutputStream out;
+            writeVarint(out, value);
+
+            MemoryInputStream in(out.getData(), out.getDataSize(), false);
+            uint64 read = 0;
+
+            expect(readVarint(in, read) && read == value, "Varint " + String((int64)value));
+            expect(in.isExhausted());
+        }
+
+        const int64 signedValues[] = { 0, 1, -1, 63, -64, 64, -65, std::numeric_limits<int64>::max(), std::numeric_limits<int64>::min() };
+
+        for (auto value : signedValues) {
+            expect(unzigzag(zigzag(value)) == value, "Zigzag " + String(value));
+        }
+
+        // Small magnitudes of either sign must stay in a single byte
+        expect(zigzag(-64) < 0x80 && zigzag(63) < 0x80);
+
+        beginTest("Garbage is rejected");
+        {
+            MemoryOutputStream out;
+
+            for (int i = 0; i < 10; i++) {
+                out.writeByte((char)0xff);
+            }
+
+            MemoryInputStream in(out.getData(), out.getDataSize(), false);
+            uint64 read;
+            expectThrows([&] { readVarint(in, read); });
+        }
+        {
+            MemoryOutputStream out;
+            writeVarint(out, 0);
+            out.writeByte((char)200);
+
+            MemoryInputStream in(out.getData(), out.getDataSize(), false);
+            medley::SessionEvent event;
+            int64 position = 0;
+            expectThrows([&] { medley::SessionLog::readEvent(in, event, position); });
+        }
+
+        beginTest("Events round-trip");
+
+        medley::SessionLog::Header header;
+        header.sampleRate = 48000.0;
+        header.numChannels = 2;
+        header.startTime = 1700000000123LL;
+
+        auto events = makeEvents();
+
+        MemoryOutputStream out;
+        medley::SessionLog::writeHeader(out, header);
+
+        const auto headerSize = out.getDataSize();
+        std::vector<size_t> eventEnds;
+        int64 position = 0;
+
+        for (auto& event : events) {
+            medley::SessionLog::writeEvent(out, event, position);
+            eventEnds.push_back(out.getDataSize());
+        }
+
+        {
+            MemoryInputStream in(out.getData(), out.getDataSize(), false);
+            auto readHeader = medley::SessionLog::readHeader(in);
+
+            expectEquals(readHeader.sampleRate, header.sampleRate);
+            expectEquals(readHeader.numChannels, header.numChannels);
+            expectEquals(readHeader.startTime, header.startTime);
+
+            auto readEvents = readAll(in);
+            expectEquals((int)readEvents.size(), (int)events.size());
+
+            for (size_t i = 0; i < jmin(events.size(), readEvents.size()); i++) {
+                expectEqualEvents(readEvents[i], events[i]);
+            }
+        }
+
+        beginTest("Truncated logs");
+
+        for (size_t length = 0; length < headerSize; length++) {
+            MemoryInputStream in(out.getData(), length, false);
+            expectThrows([&] { medley::SessionLog::readHeader(in); }, "Header cut at " + String((int64)length));
+        }
+
+        for (size_t length = headerSize; length <= out.getDataSize(); length++) {
+            MemoryInputStream in(out.getData(), length, false);
+            medley::SessionLog::readHeader(in);
+
+            const auto numComplete = (int)(std::upper_bound(eventEnds.begin(), eventEnds.end(), length) - eventEnds.begin());
+
+            std::vector<medley::SessionEvent> readEvents;
+
+            try {
+                readEvents = readAll(in);
+            }
+            catch (std::exception& e) {
+                expect(false, "Cut at " + String((int64)length) + " threw: " + e.what());
+                return;
+            }
+
+            if ((int)readEvents.size() != numComplete) {
+                expect(false, "Cut at " + String((int64)length) + " read " + String((int)readEvents.size()) + " events instead of " + String(numComplete));
+                return;
+            }
+
+            for (int i = 0; i < numComplete; i++) {
+                expectEqualEvents(readEvents[i], events[i]);
+            }
+        }
+    }
+
+private:
+    static std::vector<medley::SessionEvent> makeEvents()
+    {
+        std::vector<medley::SessionEvent> events;
+
+        auto add = [&](int64 position, Type type, int deck = -1, double value0 = 0.0, double value1 = 0.0, const String& text = {}) {
+            medley::SessionEvent event;
+            event.samplePosition = position;
+            event.type = type;
+            event.deck = deck;
+            event.values[0] = value0;
+            event.values[1] = value1;
+            event.text = text;
+            events.push_back(event);
+        };
+
+        add(0, Type::SetGain, -1, 0.75);
+        add(0, Type::BlockSize, -1, 512.0);
+        add(1024, Type::TrackFetched, -1, 1.0, -2.5, CharPointer_UTF8("/music/caf\xc3\xa9 \xe2\x99\xab.mp3"));
+        add(1024, Type::DeckLoaded, 0, 240.5);
+        add(2048, Type::Play);
+        // A block out of order, from another thread
+        add(1536, Type::DeckStarted, 1);
+        add(48000LL * 3600 * 24, Type::SeekFraction, -1, 0.5);
+        add(48000LL * 3600 * 24 + 1, Type::TrackFetched, -1, 0.0, 0.0, {});
+        add(48000LL * 3600 * 24 + 2, Type::TrackScanned, 1);
+
+        return events;
+    }
+
+    static std::vector<medley::SessionEvent> readAll(InputStream& in)
+    {
+        std::vector<medley::SessionEvent> events;
+        medley::SessionEvent event;
+        int64 position = 0;
+
+        while (medley::SessionLog::readEvent(in, event, position)) {
+            events.push_back(event);
+        }
+
+        return events;
+    }
+
+    void expectEqualEvents(const medley::SessionEvent& actual, const medley::SessionEvent& expected)
+    {
+        expect(actual.samplePosition == expected.samplePosition
+            && actual.type == expected.type
+            && actual.deck == expected.deck
+            && actual.values[0] == expected.values[0]
+            && actual.values[1] == expected.values[1]
+            && actual.text == expected.text,
+            "Read " + actual.describe() + ", wrote " + expected.describe());
+    }
+};
+
+static SessionLogTest sessionLogTest;
+
+#endif
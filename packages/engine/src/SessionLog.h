@@ -0,0 +1,91 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+using namespace juce;
+
+namespace medley {
+
+/**
+ * Something that happened to an engine, at a point of its sample clock.
+ *
+ * Inputs are what drives the engine from outside: control calls, the tracks the queue hands out and the audio
+ * callback's block size. Engine events are what the engine did in response, they are kept to check a replay against.
+ */
+struct SessionEvent {
+    enum class Type : uint8 {
+        // Control calls
+        Play = 1,
+        Stop,
+        TogglePause,
+        FadeOut,
+        SeekSeconds,
+        SeekFraction,
+        SetGain,
+        SetFadingCurve,
+        SetMaxTransitionTime,
+        SetMaxLeadingDuration,
+        SetTempoMatching,
+        FitToPost,
+        ClearPost,
+        SetHalfPrecision,
+
+        // Other inputs
+        TrackFetched = 32,
+        BlockSize,
+        DeviceChanged,
+
+        // Engine events, on a deck
+        DeckLoaded = 64,
+        DeckStarted,
+        DeckFinished,
+        DeckUnloaded,
+        TrackScanned
+    };
+
+    int64 samplePosition = 0;
+    Type type = Type::Play;
+    // 0 or 1, engine events only
+    int deck = -1;
+    double values[2] = {};
+    // Track path, TrackFetched only
+    String text;
+
+    bool isEngineEvent() const { return (uint8)type >= (uint8)Type::DeckLoaded; }
+
+    String describe() const;
+};
+
+/**
+ * The binary session log: a header, then events with their clock position as a delta from the previous one.
+ *
+ * Integers are LEB128 varints, signed ones zigzag encoded, values are little endian doubles and texts are UTF-8 with
+ * a varint length. Only the values an event type uses are stored, most events take a few bytes.
+ */
+class SessionLog {
+public:
+    static constexpr int kVersion = 1;
+
+    struct Header {
+        double sampleRate = 44100.0;
+        int numChannels = 2;
+        // Wall clock when the recording started, in milliseconds since the epoch
+        int64 startTime = 0;
+    };
+
+    static void writeHeader(OutputStream& stream, const Header& header);
+
+    // previousPosition is updated, start from 0 after the header
+    static void writeEvent(OutputStream& stream, const SessionEvent& event, int64& previousPosition);
+
+    // Throws when the stream is not a session log, or of a version this build cannot read
+    static Header readHeader(InputStream& stream);
+
+    // False at the end of the stream, or at an event cut short by the recording process dying. Throws on garbage
+    static bool readEvent(InputStream& stream, SessionEvent& event, int64& previousPosition);
+
+    // Reads a whole log into memory
+    static std::vector<SessionEvent> readAll(const File& file, Header& header);
+};
+
+}
@@ -0,0 +1,104 @@
+#include "SessionRecorder.h"
+
+namespace {
+    // A control burst or a busy transition stays well below this between two writer passes
+    constexpr int kQueueSize = 4096;
+
+    constexpr int kWriteInterval = 50;
+
+    constexpr size_t kBufferSize = 65536;
+}
+
+namespace medley {
+
+SessionRecorder::SessionRecorder()
+    :
+    Thread("Session Recorder"),
+    queue(kQueueSize)
+{
+
+}
+
+SessionRecorder::~SessionRecorder()
+{
+    stop();
+}
+
+void SessionRecorder::start(const File& file, const SessionLog::Header& header)
+{
+    stop();
+
+    file.deleteFile();
+
+    stream = file.createOutputStream(kBufferSize);
+
+    if (stream == nullptr || stream->failedToOpen()) {
+        stream = nullptr;
+        throw std::runtime_error(("Could not create session log " + file.getFullPathName()).toStdString());
+    }
+
+    SessionLog::writeHeader(*stream, header);
+    stream->flush();
+
+    // Anything recorded while stopping is stale, the writer is not running so this thread is the consumer
+    queue.clear();
+
+    lastPosition = 0;
+    numDroppedEvents = 0;
+    recording = true;
+
+    startThread();
+}
+
+void SessionRecorder::stop()
+{
+    if (!recording.exchange(false)) {
+        return;
+    }
+
+    stopThread(2000);
+
+    drain();
+    stream->flush();
+    stream = nullptr;
+}
+
+void SessionRecorder::record(const SessionEvent& event)
+{
+    if (!recording) {
+        return;
+    }
+
+    // Strings are shared, copying one only bumps a reference count
+    if (!queue.push(event)) {
+        numDroppedEvents++;
+    }
+}
+
+void SessionRecorder::run()
+{
+    while (!threadShouldExit()) {
+        if (drain()) {
+            // Flushed on every pass, so a crash loses at most the last few events
+            stream->flush();
+        }
+
+        wait(kWriteInterval);
+    }
+}
+
+bool SessionRecorder::drain()
+{
+    // Moved out, so the slots are left without text and the recording threads never free one
+    SessionEvent event;
+    bool wrote = false;
+
+    while (queue.pop(event)) {
+        SessionLog::writeEvent(*stream, event, lastPosition);
+        wrote = true;
+    }
+
+    return wrote;
+}
+
+}
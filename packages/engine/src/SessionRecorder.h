@@ -0,0 +1,54 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "SessionLog.h"
+#include "MpscQueue.h"
+
+using namespace juce;
+
+namespace medley {
+
+/**
+ * Writes a session log in the background.
+ *
+ * Events are recorded from any thread, the audio thread included: they are copied into a preallocated lock-free queue,
+ * then encoded and written by the recorder's own thread. Recording never waits, neither on other recording threads
+ * nor on the writer; events that do not fit are counted and dropped.
+ */
+class SessionRecorder : private Thread {
+public:
+    SessionRecorder();
+
+    ~SessionRecorder() override;
+
+    // Replaces any running recording. Throws if the file cannot be created
+    void start(const File& file, const SessionLog::Header& header);
+
+    // Writes out what is still pending and closes the file
+    void stop();
+
+    bool isRecording() const { return recording; }
+
+    void record(const SessionEvent& event);
+
+    int64 getNumDroppedEvents() const { return numDroppedEvents; }
+
+private:
+    void run() override;
+
+    // Writes pending events, returns false when there were none
+    bool drain();
+
+    MpscQueue<SessionEvent> queue;
+
+    // Writer thread only
+    std::unique_ptr<FileOutputStream> stream;
+    int64 lastPosition = 0;
+
+    std::atomic<bool> recording{ false };
+    std::atomic<int64> numDroppedEvents{ 0 };
+
+    JUCE_DECLARE_NON_COPYABLE(SessionRecorder)
+};
+
+}
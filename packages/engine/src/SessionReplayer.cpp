@@ -0,0 +1,394 @@
+#include "SessionReplayer.h"
+
+namespace {
+    using Type = medley::SessionEvent::Type;
+
+    constexpr int kDefaultBlockSize = 512;
+
+    // Events done on the engine's own threads, their timing depends on the play-head and the storage
+    bool isAwaited(Type type) {
+        return type == Type::DeckLoaded || type == Type::DeckStarted || type == Type::TrackScanned;
+    }
+
+    // Recorded on one operating system, replayed on another
+    String getFileName(const String& path) {
+        return path.fromLastOccurrenceOf("/", false, false).fromLastOccurrenceOf("\\", false, false);
+    }
+}
+
+namespace medley {
+
+class SessionReplayer::Track : public ITrack {
+public:
+    Track(const File& file, float preGain)
+        :
+        file(file),
+        preGain(preGain)
+    {
+
+    }
+
+    File getFile() override { return file; }
+
+    float getPreGain() const override { return preGain; }
+
+private:
+    File file;
+    float preGain;
+};
+
+size_t SessionReplayer::Queue::count() const
+{
+    const ScopedLock sl(lock);
+
+    const auto clock = engine != nullptr ? engine->getSamplePosition() : 0;
+
+    size_t available = 0;
+
+    while (next + available < tracks.size() && tracks[next + available].first <= clock) {
+        available++;
+    }
+
+    return available;
+}
+
+ITrack::Ptr SessionReplayer::Queue::fetchNextTrack()
+{
+    const ScopedLock sl(lock);
+
+    if (count() == 0) {
+        return nullptr;
+    }
+
+    return tracks[next++].second;
+}
+
+void SessionReplayer::Queue::add(int64 samplePosition, ITrack::Ptr track)
+{
+    const ScopedLock sl(lock);
+    tracks.emplace_back(samplePosition, track);
+}
+
+SessionReplayer::SessionReplayer(const File& logFile, const Options& options)
+    :
+    options(options)
+{
+    events = SessionLog::readAll(logFile, header);
+
+    for (auto& event : events) {
+        if (event.type == Type::TrackFetched) {
+            queue.add(event.samplePosition, resolveTrack(event));
+        }
+        else if (event.type == Type::BlockSize) {
+            maxBlockSize = jmax(maxBlockSize, (int)event.values[0]);
+        }
+    }
+
+    // The first callback size is recorded right after the settings, before any rendering
+    auto firstBlockSize = std::find_if(events.begin(), events.end(), [](const SessionEvent& event) {
+        return event.type == Type::BlockSize;
+    });
+
+    blockSize = options.blockSize > 0 ? options.blockSize : (firstBlockSize != events.end() ? (int)firstBlockSize->values[0] : kDefaultBlockSize);
+    maxBlockSize = jmax(maxBlockSize, blockSize);
+
+    engine = std::make_unique<Medley>(queue, false);
+    queue.engine = engine.get();
+
+    // Straight from the decks, the engine does not pass every event on
+    engine->getDeck1().addListener(this);
+    engine->getDeck2().addListener(this);
+}
+
+SessionReplayer::~SessionReplayer()
+{
+    engine->getDeck1().removeListener(this);
+    engine->getDeck2().removeListener(this);
+    engine->stop();
+}
+
+ITrack::Ptr SessionReplayer::resolveTrack(const SessionEvent& event)
+{
+    auto file = File::createFileWithoutCheckingPath(event.text);
+
+    if (!file.existsAsFile() && options.mediaDirectory.isDirectory()) {
+        file = options.mediaDirectory.getChildFile(getFileName(event.text));
+    }
+
+    if (!file.existsAsFile()) {
+        addDivergence(event.samplePosition, "track not found: " + event.text);
+    }
+    else if (event.values[1] >= 0.0 && file.getSize() != (int64)event.values[1]) {
+        addDivergence(event.samplePosition, "track differs from the recorded one: " + file.getFullPathName());
+    }
+
+    return new Track(file, (float)event.values[0]);
+}
+
+void SessionReplayer::addDivergence(int64 samplePosition, const String& description)
+{
+    divergences.emplace_back(samplePosition, "@" + String(samplePosition) + " " + description);
+}
+
+SessionReplayer::Result SessionReplayer::run(const BlockCallback& onBlock)
+{
+    if (hasRun) {
+        throw std::runtime_error("A session can only be replayed once per replayer");
+    }
+
+    hasRun = true;
+
+    // Waiting for the read-ahead keeps decoding speed out of the result
+    engine->prepareToRender(header.sampleRate, maxBlockSize, header.numChannels, true);
+
+    AudioBuffer<float> buffer(header.numChannels, maxBlockSize);
+    Result result;
+
+    auto renderUntil = [&](int64 position) {
+        while (!cancelled && engine->getSamplePosition() < position) {
+            const auto numSamples = (int)jmin((int64)blockSize, position - engine->getSamplePosition());
+
+            buffer.clear();
+            engine->renderNextBlock(buffer, 0, numSamples);
+            result.renderedSamples += numSamples;
+
+            if (onBlock) {
+                onBlock(buffer, numSamples);
+            }
+        }
+    };
+
+    for (auto& event : events) {
+        if (cancelled) {
+            break;
+        }
+
+        renderUntil(event.samplePosition);
+
+        if (event.isEngineEvent()) {
+            result.numEvents++;
+
+            if (options.waitForEvents && isAwaited(event.type)) {
+                waitFor(event);
+            }
+        }
+        else {
+            result.numInputs++;
+            apply(event);
+        }
+    }
+
+    result.numUnderruns = engine->getNumUnderruns();
+
+    compare(result);
+    return result;
+}
+
+void SessionReplayer::apply(const SessionEvent& event)
+{
+    const auto value = event.values[0];
+
+    switch (event.type) {
+    case Type::Play:
+        engine->play();
+        break;
+
+    case Type::Stop:
+        engine->stop();
+        break;
+
+    case Type::TogglePause:
+        engine->togglePause();
+        break;
+
+    case Type::FadeOut:
+        engine->fadeOutMainDeck();
+        break;
+
+    case Type::SeekSeconds:
+        engine->setPositionInSeconds(value);
+        break;
+
+    case Type::SeekFraction:
+        engine->setPositionFractional(value);
+        break;
+
+    case Type::SetGain:
+        engine->setGain((float)value);
+        break;
+
+    case Type::SetFadingCurve:
+        engine->setFadingCurve(value);
+        break;
+
+    case Type::SetMaxTransitionTime:
+        engine->setMaxTransitionTime(value);
+        break;
+
+    case Type::SetMaxLeadingDuration:
+        engine->setMaxLeadingDuration(value);
+        break;
+
+    case Type::SetTempoMatching:
+        engine->setTempoMatching(value != 0.0);
+        break;
+
+    case Type::FitToPost:
+        engine->fitToPost(value, event.values[1]);
+        break;
+
+    case Type::ClearPost:
+        engine->clearPost();
+        break;
+
+    case Type::SetHalfPrecision:
+        engine->setHalfPrecisionBuffers(value != 0.0);
+        break;
+
+    case Type::BlockSize:
+        if (options.blockSize <= 0) {
+            blockSize = jlimit(1, maxBlockSize, (int)value);
+        }
+        break;
+
+    case Type::DeviceChanged:
+        // The replay keeps the recorded rate, anything after a rate change plays at the wrong speed
+        if (value > 0.0 && value != header.sampleRate) {
+            addDivergence(event.samplePosition, "device changed to " + String(value) + "Hz, replayed at " + String(header.sampleRate) + "Hz");
+        }
+        break;
+
+    default:
+        // Fetched tracks are handed out by the queue
+        break;
+    }
+}
+
+void SessionReplayer::waitFor(const SessionEvent& event)
+{
+    const auto key = getKey(event);
+    const auto awaited = ++numAwaited[key];
+    const auto deadline = Time::getMillisecondCounter() + (uint32)options.eventTimeout;
+
+    while (!cancelled && Time::getMillisecondCounter() < deadline) {
+        {
+            const ScopedLock sl(observedLock);
+
+            if (numObserved[key] >= awaited) {
+                return;
+            }
+        }
+
+        observedSignal.wait(10);
+    }
+}
+
+void SessionReplayer::observe(SessionEvent::Type type, Deck& deck, double value)
+{
+    SessionEvent event;
+    event.samplePosition = engine->getSamplePosition();
+    event.type = type;
+    event.deck = &deck == &engine->getDeck1() ? 0 : 1;
+    event.values[0] = value;
+
+    {
+        const ScopedLock sl(observedLock);
+
+        observed.push_back(event);
+        numObserved[getKey(event)]++;
+    }
+
+    observedSignal.signal();
+}
+
+void SessionReplayer::compare(Result& result)
+{
+    const ScopedLock sl(observedLock);
+
+    std::vector<bool> matched(observed.size(), false);
+
+    for (auto& expected : events) {
+        if (!expected.isEngineEvent()) {
+            continue;
+        }
+
+        // The earliest of its kind not taken yet, events of one deck keep their order
+        auto found = false;
+
+        for (size_t i = 0; i < observed.size(); i++) {
+            auto& actual = observed[i];
+
+            if (matched[i] || actual.type != expected.type || actual.deck != expected.deck) {
+                continue;
+            }
+
+            matched[i] = true;
+            found = true;
+
+            result.numMatched++;
+            result.maxDrift = jmax(result.maxDrift, std::abs(actual.samplePosition - expected.samplePosition));
+
+            // Loaded carries the duration, a different one means different content
+            if (expected.type == Type::DeckLoaded && std::abs(actual.values[0] - expected.values[0]) > 0.01) {
+                addDivergence(expected.samplePosition, "loaded a track of " + String(actual.values[0], 2) + "s instead of " + String(expected.values[0], 2) + "s on deck" + String(expected.deck + 1));
+            }
+
+            break;
+        }
+
+        if (!found) {
+            addDivergence(expected.samplePosition, "missing: " + expected.describe());
+        }
+    }
+
+    for (size_t i = 0; i < observed.size(); i++) {
+        if (!matched[i]) {
+            addDivergence(observed[i].samplePosition, "unexpected: " + observed[i].describe());
+        }
+    }
+
+    std::stable_sort(divergences.begin(), divergences.end(), [](const auto& a, const auto& b) {
+        return a.first < b.first;
+    });
+
+    for (auto& divergence : divergences) {
+        result.divergences.add(divergence.second);
+    }
+}
+
+void SessionReplayer::deckTrackScanning(Deck& sender)
+{
+
+}
+
+void SessionReplayer::deckTrackScanned(Deck& sender)
+{
+    observe(Type::TrackScanned, sender);
+}
+
+void SessionReplayer::deckPosition(Deck& sender, double position)
+{
+
+}
+
+void SessionReplayer::deckStarted(Deck& sender)
+{
+    observe(Type::DeckStarted, sender);
+}
+
+void SessionReplayer::deckFinished(Deck& sender)
+{
+    observe(Type::DeckFinished, sender);
+}
+
+void SessionReplayer::deckLoaded(Deck& sender)
+{
+    observe(Type::DeckLoaded, sender, sender.getDuration());
+}
+
+void SessionReplayer::deckUnloaded(Deck& sender)
+{
+    observe(Type::DeckUnloaded, sender);
+}
+
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "Medley.h"
+#include "SessionLog.h"
+#include <functional>
+#include <map>
+
+using namespace juce;
+
+namespace medley {
+
+/**
+ * Re-drives an offline engine from a session log, to reproduce an on-air session on another machine.
+ *
+ * Control calls are applied at the sample clock they were recorded at, the queue hands out the recorded tracks no
+ * earlier than they were fetched, and blocks are rendered with the recorded callback sizes. What the engine does on
+ * its own threads, loading, scanning and starting decks, is timed by the play-head rather than the clock, so the
+ * clock is held at each recorded load, start and scan until the replay gets there too. Deck events of the replay are
+ * then checked against the recorded ones.
+ */
+class SessionReplayer : public Deck::Callback {
+public:
+    struct Options {
+        // Where to look for tracks missing at their recorded path, by file name
+        File mediaDirectory;
+
+        // Block size to render with, 0 for the sizes recorded from the audio callback
+        int blockSize = 0;
+
+        // Hold the clock at recorded engine events until they happen in the replay
+        bool waitForEvents = true;
+
+        // Milliseconds to hold for a single event before going on without it
+        int eventTimeout = 10000;
+    };
+
+    struct Result {
+        int64 numInputs = 0;
+        // Recorded engine events, and how many of those the replay did too
+        int64 numEvents = 0;
+        int64 numMatched = 0;
+
+        int64 renderedSamples = 0;
+        int64 numUnderruns = 0;
+
+        // Largest distance between a recorded engine event and the same one in the replay, in samples
+        int64 maxDrift = 0;
+
+        // Missing, unexpected or different events and tracks, in clock order
+        StringArray divergences;
+    };
+
+    // Receives every rendered block, before the next input is applied
+    using BlockCallback = std::function<void(const AudioBuffer<float>& buffer, int numSamples)>;
+
+    // Reads the whole log. Throws if it cannot be read
+    SessionReplayer(const File& logFile, const Options& options);
+
+    ~SessionReplayer() override;
+
+    const SessionLog::Header& getHeader() const { return header; }
+
+    // Clock position of the last recorded event
+    int64 getLength() const { return events.empty() ? 0 : events.back().samplePosition; }
+
+    // Not started yet until run(), for adding a fault injector, listeners or outputs beforehand
+    Medley& getEngine() { return *engine; }
+
+    // Renders the session from start to end, may only be called once
+    Result run(const BlockCallback& onBlock = nullptr);
+
+    // Stops run() after the current block, from any thread
+    void cancel() { cancelled = true; }
+
+    void deckTrackScanning(Deck& sender) override;
+
+    void deckTrackScanned(Deck& sender) override;
+
+    void deckPosition(Deck& sender, double position) override;
+
+    void deckStarted(Deck& sender) override;
+
+    void deckFinished(Deck& sender) override;
+
+    void deckLoaded(Deck& sender) override;
+
+    void deckUnloaded(Deck& sender) override;
+
+private:
+    class Track;
+
+    // Hands out the recorded tracks in order, each from the clock position it was fetched at
+    class Queue : public IQueue {
+    public:
+        size_t count() const override;
+
+        ITrack::Ptr fetchNextTrack() override;
+
+        void add(int64 samplePosition, ITrack::Ptr track);
+
+        Medley* engine = nullptr;
+
+    private:
+        mutable CriticalSection lock;
+        std::vector<std::pair<int64, ITrack::Ptr>> tracks;
+        size_t next = 0;
+    };
+
+    ITrack::Ptr resolveTrack(const SessionEvent& event);
+
+    void addDivergence(int64 samplePosition, const String& description);
+
+    void apply(const SessionEvent& event);
+
+    void observe(SessionEvent::Type type, Deck& deck, double value = 0.0);
+
+    void waitFor(const SessionEvent& event);
+
+    void compare(Result& result);
+
+    static int getKey(const SessionEvent& event) { return (int)event.type * 2 + event.deck; }
+
+    Options options;
+    SessionLog::Header header;
+    std::vector<SessionEvent> events;
+
+    Queue queue;
+    std::unique_ptr<Medley> engine;
+
+    int blockSize = 512;
+    int maxBlockSize = 512;
+
+    // With their clock position, for sorting
+    std::vector<std::pair<int64, String>> divergences;
+
+    CriticalSection observedLock;
+    std::vector<SessionEvent> observed;
+    std::map<int, int> numObserved;
+    WaitableEvent observedSignal;
+
+    // Run thread only
+    std::map<int, int> numAwaited;
+
+    std::atomic<bool> cancelled{ false };
+    bool hasRun = false;
+
+    JUCE_DECLARE_NON_COPYABLE(SessionReplayer)
+};
+
+}
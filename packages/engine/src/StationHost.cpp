@@ -0,0 +1,362 @@
+#include "StationHost.h"
+
+namespace medley {
+
+StationHost::StationHost(int numWorkers)
+{
+    if (numWorkers < 0) {
+        numWorkers = jmax(0, SystemStats::getNumCpus() - 1);
+    }
+
+    for (int i = 0; i < numWorkers; i++) {
+        auto worker = workers.add(new Worker(*this, i));
+        worker->startThread(9);
+    }
+}
+
+StationHost::~StationHost()
+{
+    closeDevice();
+
+    for (auto worker : workers) {
+        worker->signalThreadShouldExit();
+        worker->workAvailable.signal();
+    }
+
+    for (auto worker : workers) {
+        worker->stopThread(1000);
+    }
+}
+
+void StationHost::openDevice(int numOutputChannels, const String& deviceName)
+{
+    auto error = deviceMgr.initialise(0, numOutputChannels, nullptr, deviceName.isEmpty(), deviceName, nullptr);
+    if (error.isNotEmpty()) {
+        throw std::runtime_error(error.toStdString());
+    }
+
+    deviceMgr.addAudioCallback(this);
+}
+
+void StationHost::closeDevice()
+{
+    deviceMgr.removeAudioCallback(this);
+    deviceMgr.closeAudioDevice();
+}
+
+int StationHost::addStation(Medley& engine, int firstChannel, int numChannels)
+{
+    jassert(firstChannel >= 0 && numChannels > 0);
+
+    // Its own device would be started on top of ours, and preparing it for rendering would throw on the device thread
+    if (engine.hasAudioDevice()) {
+        throw std::runtime_error("Hosted engines must be created without audio device");
+    }
+
+    const ScopedLock sl(stationsLock);
+
+    int freeSlot = -1;
+
+    for (int i = 0; i < kMaxStations; i++) {
+        auto& station = stations[i];
+        auto stationEngine = station.engine.load();
+
+        if (stationEngine == nullptr) {
+            // A removed station may still be rendering into its buffer
+            if (freeSlot == -1 && !isBusy(station)) {
+                freeSlot = i;
+            }
+
+            continue;
+        }
+
+        if (stationEngine == &engine) {
+            throw std::runtime_error("Engine is already hosted");
+        }
+
+        auto overlapped = firstChannel < station.firstChannel + station.numChannels && station.firstChannel < firstChannel + numChannels;
+        if (overlapped) {
+            throw std::runtime_error("Output channels are already used by another station");
+        }
+    }
+
+    if (freeSlot == -1) {
+        throw std::runtime_error("Too many stations");
+    }
+
+    auto& station = stations[freeSlot];
+    station.firstChannel = firstChannel;
+    station.numChannels = numChannels;
+
+    if (prepared) {
+        prepareStation(station, engine);
+    }
+
+    // The device thread picks it up from here
+    station.engine = &engine;
+
+    return freeSlot;
+}
+
+bool StationHost::removeStation(Medley& engine, int timeoutMs)
+{
+    Station* removed = nullptr;
+
+    {
+        const ScopedLock sl(stationsLock);
+
+        for (auto& station : stations) {
+            if (station.engine.load() == &engine) {
+                station.engine = nullptr;
+                removed = &station;
+                break;
+            }
+        }
+    }
+
+    if (removed == nullptr) {
+        return true;
+    }
+
+    // A block may still be in flight, the engine must not be touched once we return. Waited for without the lock,
+    // other stations can be added and removed meanwhile
+    const auto deadlineTime = Time::getMillisecondCounter() + (uint32)timeoutMs;
+
+    while (removed->renderingEngine.load() == &engine) {
+        if (Time::getMillisecondCounter() >= deadlineTime) {
+            return false;
+        }
+
+        Thread::sleep(1);
+    }
+
+    return true;
+}
+
+int StationHost::getNumStations() const
+{
+    int count = 0;
+
+    for (auto& station : stations) {
+        if (station.engine.load() != nullptr) {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+StationHost::Stats StationHost::getStatsAndReset()
+{
+    Stats stats;
+    stats.numCallbacks = statCallbacks.exchange(0);
+    stats.numLateRenders = statLateRenders.exchange(0);
+    stats.maxJoinTime = statMaxJoinTime.exchange(0.0);
+    return stats;
+}
+
+void StationHost::audioDeviceIOCallback(const float** inputChannelData, int numInputChannels, float** outputChannelData, int numOutputChannels, int numSamples)
+{
+    for (int ch = 0; ch < numOutputChannels; ch++) {
+        if (outputChannelData[ch] != nullptr) {
+            FloatVectorOperations::clear(outputChannelData[ch], numSamples);
+        }
+    }
+
+    const auto preparedBlockSize = blockSize.load();
+
+    if (!prepared || preparedBlockSize <= 0) {
+        return;
+    }
+
+    // Devices may call back with more than they announced, never more than the station buffers can hold per pass
+    for (int start = 0; start < numSamples; start += preparedBlockSize) {
+        renderBlock(outputChannelData, numOutputChannels, start, jmin(preparedBlockSize, numSamples - start));
+    }
+
+    statCallbacks++;
+}
+
+void StationHost::audioDeviceAboutToStart(AudioIODevice* device)
+{
+    const ScopedLock sl(stationsLock);
+
+    prepared = false;
+    sampleRate = device->getCurrentSampleRate();
+    blockSize = device->getCurrentBufferSizeSamples();
+
+    for (auto& station : stations) {
+        if (auto engine = station.engine.load()) {
+            // A worker which missed the last deadline may still be rendering into the buffer and the engine
+            waitUntilIdle(station);
+            prepareStation(station, *engine);
+        }
+    }
+
+    prepared = true;
+}
+
+void StationHost::audioDeviceStopped()
+{
+    prepared = false;
+}
+
+bool StationHost::isBusy(const Station& station)
+{
+    return station.state == Pending || station.state == Rendering;
+}
+
+void StationHost::waitUntilIdle(Station& station)
+{
+    // Withdraw it if nobody picked it up yet
+    int expected = Pending;
+    station.state.compare_exchange_strong(expected, Idle);
+
+    while (station.state == Rendering) {
+        Thread::sleep(1);
+    }
+}
+
+void StationHost::prepareStation(Station& station, Medley& engine)
+{
+    station.buffer.setSize(station.numChannels, blockSize);
+    engine.prepareToRender(sampleRate, blockSize, station.numChannels, false);
+}
+
+void StationHost::renderBlock(float** outputChannelData, int numOutputChannels, int startSample, int numSamples)
+{
+    const auto startTime = Time::getMillisecondCounterHiRes();
+    const auto deadlineTime = startTime + numSamples * 1000.0 / sampleRate * deadline;
+
+    // Must be visible before any station becomes pending
+    currentNumSamples = numSamples;
+
+    uint64 dispatched = 0;
+
+    for (int i = 0; i < kMaxStations; i++) {
+        auto& station = stations[i];
+
+        if (station.engine.load() == nullptr) {
+            continue;
+        }
+
+        int state = station.state;
+
+        // Still busy with a block which missed its deadline
+        if (state == Pending || state == Rendering) {
+            statLateRenders++;
+            continue;
+        }
+
+        if (station.state.compare_exchange_strong(state, Pending)) {
+            dispatched |= (1ULL << i);
+        }
+    }
+
+    if (dispatched == 0) {
+        return;
+    }
+
+    for (auto worker : workers) {
+        worker->workAvailable.signal();
+    }
+
+    // The device thread takes its share as well
+    renderPendingStations();
+
+    auto allFinished = [&] {
+        for (int i = 0; i < kMaxStations; i++) {
+            if ((dispatched & (1ULL << i)) && stations[i].state != Done) {
+                return false;
+            }
+        }
+
+        return true;
+    };
+
+    while (!allFinished()) {
+        auto remaining = deadlineTime - Time::getMillisecondCounterHiRes();
+
+        if (remaining <= 0.0) {
+            break;
+        }
+
+        if (remaining >= 1.0) {
+            stationFinished.wait((int)remaining);
+        }
+        else {
+            Thread::yield();
+        }
+    }
+
+    auto joinTime = Time::getMillisecondCounterHiRes() - startTime;
+    if (joinTime > statMaxJoinTime) {
+        statMaxJoinTime = joinTime;
+    }
+
+    for (int i = 0; i < kMaxStations; i++) {
+        if ((dispatched & (1ULL << i)) == 0) {
+            continue;
+        }
+
+        auto& station = stations[i];
+
+        // Nobody got to it in time, withdraw it
+        int expected = Pending;
+        if (station.state.compare_exchange_strong(expected, Idle)) {
+            statLateRenders++;
+            continue;
+        }
+
+        // Still rendering, its result is dropped when it finishes
+        if (station.state != Done) {
+            statLateRenders++;
+            continue;
+        }
+
+        for (int ch = 0; ch < station.numChannels; ch++) {
+            auto outputChannel = station.firstChannel + ch;
+
+            if (outputChannel < numOutputChannels && outputChannelData[outputChannel] != nullptr) {
+                FloatVectorOperations::copy(outputChannelData[outputChannel] + startSample, station.buffer.getReadPointer(ch), numSamples);
+            }
+        }
+
+        station.state = Idle;
+    }
+}
+
+void StationHost::renderPendingStations()
+{
+    for (auto& station : stations) {
+        int expected = Pending;
+        if (!station.state.compare_exchange_strong(expected, Rendering)) {
+            continue;
+        }
+
+        // A station removed after being dispatched has its engine cleared, but its state is still honoured
+        if (auto engine = station.engine.load()) {
+            station.renderingEngine = engine;
+
+            // Checked again, removeStation clears the engine then waits on renderingEngine
+            if (station.engine.load() == engine) {
+                engine->renderNextBlock(station.buffer, 0, currentNumSamples);
+            }
+
+            station.renderingEngine = nullptr;
+        }
+
+        station.state = Done;
+        stationFinished.signal();
+    }
+}
+
+void StationHost::Worker::run()
+{
+    while (!threadShouldExit()) {
+        workAvailable.wait(100);
+        host.renderPendingStations();
+    }
+}
+
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "Medley.h"
+
+using namespace juce;
+
+namespace medley {
+
+/**
+ * Drives several engines from a single multichannel audio device, each station owning a range of output channels.
+ *
+ * Engines must be created without an audio device. On every device callback the stations are rendered in parallel
+ * by a pool of worker threads, with the device thread taking part; a station which has not finished before the
+ * deadline outputs silence for that block instead of delaying the others.
+ */
+class StationHost : public AudioIODeviceCallback {
+public:
+    static constexpr int kMaxStations = 64;
+
+    struct Stats {
+        int64 numCallbacks = 0;
+        // Number of station blocks replaced with silence because they missed the deadline
+        int64 numLateRenders = 0;
+        // Longest time in milliseconds the device thread spent waiting for the workers
+        double maxJoinTime = 0.0;
+    };
+
+    // numWorkers < 0 means one per CPU, less the device thread
+    StationHost(int numWorkers = -1);
+
+    ~StationHost() override;
+
+    // Open the named output device (or the default one) with at least numOutputChannels channels
+    void openDevice(int numOutputChannels, const String& deviceName = {});
+
+    void closeDevice();
+
+    AudioDeviceManager& getDeviceManager() { return deviceMgr; }
+
+    // Returns the station index, throws if the engine has its own audio device, the channel range is taken or no slot is left
+    int addStation(Medley& engine, int firstChannel, int numChannels = 2);
+
+    /**
+     * Stops rendering the engine, waiting for a block in flight to finish. Returns false if it is still rendering after
+     * the timeout: the engine is no longer hosted, but must be kept alive for as long as it is stuck.
+     */
+    bool removeStation(Medley& engine, int timeoutMs = 2000);
+
+    int getNumStations() const;
+
+    // Fraction of the block duration the device thread waits for stations to finish, 0.0 - 1.0
+    void setDeadline(double fraction) { deadline = jlimit(0.1, 1.0, fraction); }
+
+    // Statistics since the last call
+    Stats getStatsAndReset();
+
+    void audioDeviceIOCallback(const float** inputChannelData, int numInputChannels, float** outputChannelData, int numOutputChannels, int numSamples) override;
+
+    void audioDeviceAboutToStart(AudioIODevice* device) override;
+
+    void audioDeviceStopped() override;
+
+private:
+    enum StationState {
+        Idle = 0,
+        Pending,
+        Rendering,
+        Done
+    };
+
+    struct Station {
+        std::atomic<Medley*> engine{ nullptr };
+        std::atomic<int> state{ Idle };
+        // The engine a worker is rendering, what removeStation waits on
+        std::atomic<Medley*> renderingEngine{ nullptr };
+        int firstChannel = 0;
+        int numChannels = 0;
+        AudioBuffer<float> buffer;
+    };
+
+    class Worker : public Thread {
+    public:
+        Worker(StationHost& host, int index) : Thread("Station Worker " + String(index)), host(host) {}
+
+        void run() override;
+
+        WaitableEvent workAvailable;
+    private:
+        StationHost& host;
+    };
+
+    static bool isBusy(const Station& station);
+
+    // Device thread, while no block is being dispatched
+    static void waitUntilIdle(Station& station);
+
+    void prepareStation(Station& station, Medley& engine);
+
+    void renderBlock(float** outputChannelData, int numOutputChannels, int startSample, int numSamples);
+
+    void renderPendingStations();
+
+    AudioDeviceManager deviceMgr;
+    OwnedArray<Worker> workers;
+
+    CriticalSection stationsLock;
+    Station stations[kMaxStations];
+
+    // Written by the device thread under stationsLock, read by the callback without it
+    std::atomic<double> sampleRate{ 0.0 };
+    std::atomic<int> blockSize{ 0 };
+    std::atomic<bool> prepared{ false };
+
+    std::atomic<int> currentNumSamples{ 0 };
+    std::atomic<double> deadline{ 0.8 };
+    WaitableEvent stationFinished;
+
+    std::atomic<int64> statCallbacks{ 0 };
+    std::atomic<int64> statLateRenders{ 0 };
+    std::atomic<double> statMaxJoinTime{ 0.0 };
+};
+
+}
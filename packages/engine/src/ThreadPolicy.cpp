@@ -0,0 +1,344 @@
+#include "ThreadPolicy.h"
+
+#if JUCE_WINDOWS
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
+
+namespace {
+    constexpr int kMaxCpus = 64;
+    constexpr int kPendingCheckInterval = 250;
+
+    String describeCpus(juce::uint64 mask) {
+        if (mask == 0) {
+            return "any";
+        }
+
+        StringArray cpus;
+        for (int i = 0; i < kMaxCpus; i++) {
+            if (mask & (1ULL << i)) {
+                cpus.add(String(i));
+            }
+        }
+
+        return cpus.joinIntoString(",");
+    }
+
+#if !JUCE_WINDOWS
+    int toNativePolicy(medley::ThreadPolicy::Scheduling scheduling) {
+        switch (scheduling) {
+        case medley::ThreadPolicy::Scheduling::Fifo:
+            return SCHED_FIFO;
+        case medley::ThreadPolicy::Scheduling::RoundRobin:
+            return SCHED_RR;
+        default:
+            return SCHED_OTHER;
+        }
+    }
+#endif
+}
+
+namespace medley {
+
+ThreadPolicy::Resolved ThreadPolicy::resolve(StringArray& errors) const
+{
+    Resolved resolved;
+    resolved.scheduling = scheduling;
+    resolved.affinityMask = affinityMask;
+
+    if (isolatedCores) {
+        auto isolated = getIsolatedCpuMask();
+
+        if (isolated == 0) {
+            errors.add("No isolated CPUs, check the isolcpus= kernel parameter");
+        }
+        else {
+            resolved.affinityMask = (affinityMask != 0) ? (affinityMask & isolated) : isolated;
+
+            if (resolved.affinityMask == 0) {
+                errors.add("Affinity mask does not contain any isolated CPU");
+            }
+        }
+    }
+
+#if !JUCE_WINDOWS && !JUCE_LINUX
+    if (resolved.affinityMask != 0) {
+        errors.add("CPU affinity is not supported on this platform");
+        resolved.affinityMask = 0;
+    }
+#endif
+
+    if (scheduling != Scheduling::Default) {
+#if JUCE_WINDOWS
+        resolved.priority = priority;
+#else
+        auto nativePolicy = toNativePolicy(scheduling);
+        resolved.priority = jlimit(sched_get_priority_min(nativePolicy), sched_get_priority_max(nativePolicy), priority);
+
+        auto limit = getRealtimePriorityLimit();
+        if (limit == 0) {
+            errors.add("RLIMIT_RTPRIO is 0, real-time scheduling is not permitted for this user");
+        }
+        else if (limit > 0 && resolved.priority > limit) {
+            errors.add("Priority " + String(resolved.priority) + " exceeds RLIMIT_RTPRIO, lowered to " + String(limit));
+            resolved.priority = limit;
+        }
+#endif
+    }
+
+    return resolved;
+}
+
+void ThreadPolicy::apply(const Resolved& resolved, bool demote, int& schedulingResult, int& affinityResult)
+{
+    schedulingResult = 0;
+    affinityResult = 0;
+
+    const auto realtime = resolved.scheduling != Scheduling::Default;
+
+#if JUCE_WINDOWS
+    if (realtime || demote) {
+        auto nativePriority = !realtime ? THREAD_PRIORITY_NORMAL : (resolved.priority >= 90) ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_HIGHEST;
+
+        if (!SetThreadPriority(GetCurrentThread(), nativePriority)) {
+            schedulingResult = (int)GetLastError();
+        }
+    }
+
+    if (resolved.affinityMask != 0 && SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)resolved.affinityMask) == 0) {
+        affinityResult = (int)GetLastError();
+    }
+#else
+    if (realtime || demote) {
+        sched_param param{};
+        param.sched_priority = realtime ? resolved.priority : 0;
+
+        schedulingResult = pthread_setschedparam(pthread_self(), toNativePolicy(resolved.scheduling), &param);
+    }
+
+#if JUCE_LINUX
+    if (resolved.affinityMask != 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+
+        for (int i = 0; i < kMaxCpus; i++) {
+            if (resolved.affinityMask & (1ULL << i)) {
+                CPU_SET(i, &cpus);
+            }
+        }
+
+        affinityResult = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+#endif
+#endif
+}
+
+uint64 ThreadPolicy::getIsolatedCpuMask()
+{
+    uint64 mask = 0;
+
+#if JUCE_LINUX
+    // e.g. "2-3,6"
+    auto list = File("/sys/devices/system/cpu/isolated").loadFileAsString().trim();
+
+    for (auto& range : StringArray::fromTokens(list, ",", "")) {
+        auto first = range.upToFirstOccurrenceOf("-", false, false).getIntValue();
+        auto last = range.containsChar('-') ? range.fromFirstOccurrenceOf("-", false, false).getIntValue() : first;
+
+        for (int i = jmax(0, first); i <= jmin(last, kMaxCpus - 1); i++) {
+            mask |= (1ULL << i);
+        }
+    }
+#endif
+
+    return mask;
+}
+
+int ThreadPolicy::getRealtimePriorityLimit()
+{
+#if JUCE_LINUX
+    // Privileged processes are not bound by the limit
+    if (geteuid() == 0) {
+        return -1;
+    }
+
+    rlimit limit;
+    if (getrlimit(RLIMIT_RTPRIO, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY) {
+        return -1;
+    }
+
+    return (int)limit.rlim_cur;
+#else
+    return -1;
+#endif
+}
+
+String ThreadPolicy::describe(const Status& status)
+{
+    String text;
+
+    switch (status.scheduling) {
+    case Scheduling::Fifo:
+        text << "fifo/" << status.priority;
+        break;
+    case Scheduling::RoundRobin:
+        text << "rr/" << status.priority;
+        break;
+    default:
+        text << "default";
+        break;
+    }
+
+    text << " cpus=" << describeCpus(status.affinityMask);
+
+    if (status.error.isNotEmpty()) {
+        text << " (" << status.error << ")";
+    }
+
+    return text;
+}
+
+ThreadPolicyApplier::~ThreadPolicyApplier()
+{
+    stopTimer();
+}
+
+void ThreadPolicyApplier::setPolicy(const ThreadPolicy& newPolicy)
+{
+    StringArray errors;
+    auto resolved = newPolicy.resolve(errors);
+
+    {
+        const ScopedLock sl(lock);
+        policy = newPolicy;
+        resolveErrors = errors;
+
+        pendingScheduling = (int)resolved.scheduling;
+        pendingPriority = resolved.priority;
+        pendingMask = resolved.affinityMask;
+        requestedGeneration++;
+        pending = true;
+    }
+
+    // Outcome is logged once the target thread got to it
+    startTimer(kPendingCheckInterval);
+}
+
+ThreadPolicy ThreadPolicyApplier::getPolicy() const
+{
+    const ScopedLock sl(lock);
+    return policy;
+}
+
+void ThreadPolicyApplier::applyPending()
+{
+    if (!pending.exchange(false)) {
+        return;
+    }
+
+    const auto generation = requestedGeneration.load();
+
+    ThreadPolicy::Resolved resolved;
+    resolved.scheduling = (ThreadPolicy::Scheduling)pendingScheduling.load();
+    resolved.priority = pendingPriority;
+    resolved.affinityMask = pendingMask;
+
+    int newSchedulingResult, newAffinityResult;
+    ThreadPolicy::apply(resolved, promoted, newSchedulingResult, newAffinityResult);
+
+    const auto realtime = resolved.scheduling != ThreadPolicy::Scheduling::Default;
+
+    if (newSchedulingResult == 0 && (realtime || promoted)) {
+        promoted = realtime;
+        appliedScheduling = (int)resolved.scheduling;
+        appliedPriority = realtime ? resolved.priority : 0;
+    }
+
+    if (newAffinityResult == 0 && resolved.affinityMask != 0) {
+        appliedMask = resolved.affinityMask;
+    }
+
+    schedulingResult = newSchedulingResult;
+    affinityResult = newAffinityResult;
+    appliedGeneration = generation;
+}
+
+ThreadPolicy::Status ThreadPolicyApplier::getStatus() const
+{
+    ThreadPolicy::Status status;
+    status.scheduling = (ThreadPolicy::Scheduling)appliedScheduling.load();
+    status.priority = appliedPriority;
+    status.affinityMask = appliedMask;
+
+    StringArray errors;
+    int generation;
+
+    {
+        const ScopedLock sl(lock);
+        errors = resolveErrors;
+        generation = requestedGeneration;
+    }
+
+    if (generation == 0) {
+        return status;
+    }
+
+    if (appliedGeneration != generation) {
+        errors.add("Not picked up by the thread yet");
+    }
+
+#if JUCE_WINDOWS
+    if (schedulingResult != 0) {
+        errors.add("SetThreadPriority failed: " + String(schedulingResult.load()));
+    }
+
+    if (affinityResult != 0) {
+        errors.add("SetThreadAffinityMask failed: " + String(affinityResult.load()));
+    }
+#else
+    if (schedulingResult != 0) {
+        errors.add("pthread_setschedparam failed: " + String(strerror(schedulingResult)));
+    }
+
+    if (affinityResult != 0) {
+        errors.add("pthread_setaffinity_np failed: " + String(strerror(affinityResult)));
+    }
+#endif
+
+    status.applied = errors.isEmpty();
+    status.error = errors.joinIntoString("; ");
+    return status;
+}
+
+int ThreadPolicyApplier::useTimeSlice()
+{
+    applyPending();
+    return kPendingCheckInterval;
+}
+
+void ThreadPolicyApplier::timerCallback()
+{
+    const auto generation = appliedGeneration.load();
+
+    if (generation == loggedGeneration) {
+        return;
+    }
+
+    loggedGeneration = generation;
+
+    auto status = getStatus();
+
+    if (!status.applied) {
+        Logger::writeToLog("Could not apply thread policy: " + status.error);
+    }
+
+    if (generation == requestedGeneration) {
+        stopTimer();
+    }
+}
+
+}
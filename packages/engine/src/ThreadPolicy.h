@@ -0,0 +1,119 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+using namespace juce;
+
+namespace medley {
+
+/**
+ * Scheduling class, priority and CPU placement for one of the engine threads.
+ *
+ * Policies are always applied from the target thread itself, so the same code path works for
+ * threads owned by JUCE, by the audio driver, or by whoever calls Medley::renderNextBlock().
+ * Everything that reads files or builds strings is done beforehand by resolve(), the target thread only makes the
+ * system calls.
+ */
+struct ThreadPolicy {
+    enum class Scheduling {
+        Default,
+        Fifo,
+        RoundRobin
+    };
+
+    Scheduling scheduling = Scheduling::Default;
+
+    // 1 - 99 for Fifo/RoundRobin, ignored otherwise
+    int priority = 0;
+
+    // Bit n allows CPU n, zero leaves the affinity untouched
+    uint64 affinityMask = 0;
+
+    // Restrict to the CPUs isolated from the kernel scheduler (isolcpus=), combined with affinityMask if both are set
+    bool isolatedCores = false;
+
+    struct Status {
+        bool applied = false;
+        Scheduling scheduling = Scheduling::Default;
+        int priority = 0;
+        uint64 affinityMask = 0;
+        String error;
+    };
+
+    // What applying the policy comes down to, plain values the target thread can use as they are
+    struct Resolved {
+        Scheduling scheduling = Scheduling::Default;
+        int priority = 0;
+        uint64 affinityMask = 0;
+    };
+
+    // Works out the CPUs and the allowed priority, errors are what cannot be honoured. Not for the target thread
+    Resolved resolve(StringArray& errors) const;
+
+    /**
+     * Applies a resolved policy to the calling thread with system calls only, no allocation nor lock.
+     * Default scheduling is only set when demoting, otherwise the thread keeps what it has.
+     * Results are zero or the error code of each call.
+     */
+    static void apply(const Resolved& resolved, bool demote, int& schedulingResult, int& affinityResult);
+
+    // CPUs listed in /sys/devices/system/cpu/isolated, zero when there are none or on other platforms
+    static uint64 getIsolatedCpuMask();
+
+    // Highest real-time priority this process may request, -1 when unlimited or not applicable
+    static int getRealtimePriorityLimit();
+
+    static String describe(const Status& status);
+};
+
+/**
+ * Holds the policy requested for a thread until that thread picks it up.
+ *
+ * As a TimeSliceClient it applies itself on the TimeSliceThread it is registered to,
+ * other threads call applyPending() from their own loop.
+ *
+ * The policy is resolved when it is set, handed over and reported back through atomics, and failures are logged from
+ * the message thread.
+ */
+class ThreadPolicyApplier : public TimeSliceClient, private Timer {
+public:
+    ~ThreadPolicyApplier() override;
+
+    void setPolicy(const ThreadPolicy& newPolicy);
+
+    ThreadPolicy getPolicy() const;
+
+    // Wait-free, only the system calls when something is pending. Safe to call from the audio callback
+    void applyPending();
+
+    ThreadPolicy::Status getStatus() const;
+
+    int useTimeSlice() override;
+
+private:
+    void timerCallback() override;
+
+    // Setting side
+    CriticalSection lock;
+    ThreadPolicy policy;
+    StringArray resolveErrors;
+    int loggedGeneration = 0;
+
+    // Published before pending is raised
+    std::atomic<int> pendingScheduling{ 0 };
+    std::atomic<int> pendingPriority{ 0 };
+    std::atomic<uint64> pendingMask{ 0 };
+    std::atomic<int> requestedGeneration{ 0 };
+    std::atomic<bool> pending{ false };
+
+    // Written by the target thread
+    bool promoted = false;
+    std::atomic<int> appliedScheduling{ 0 };
+    std::atomic<int> appliedPriority{ 0 };
+    std::atomic<uint64> appliedMask{ 0 };
+    std::atomic<int> schedulingResult{ 0 };
+    std::atomic<int> affinityResult{ 0 };
+    std::atomic<int> appliedGeneration{ 0 };
+};
+
+}
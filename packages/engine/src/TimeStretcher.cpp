@@ -0,0 +1,422 @@
+#include "TimeStretcher.h"
+
+namespace {
+    // Grains of about 20ms, rounded to a power of two
+    constexpr double kFrameDuration = 0.02;
+
+    // How far ahead of playback grains are produced
+    constexpr double kLookAheadDuration = 0.25;
+
+    // Coarse search steps, refined around the best one afterwards
+    constexpr int kCoarseStep = 4;
+    constexpr int kCoarseDecimation = 2;
+}
+
+namespace medley {
+
+TimeStretcher::TimeStretcher(PositionableAudioSource* input, AudioFormatReader* reader, const CriticalSection& readerLock, int numChannels, TimeSliceThread& thread)
+    :
+    input(input),
+    reader(reader),
+    readerLock(readerLock),
+    thread(thread),
+    numChannels(jmax(1, numChannels))
+{
+    const auto sampleRate = reader->sampleRate > 0 ? reader->sampleRate : 44100.0;
+
+    frameSize = nextPowerOfTwo(jmax(256, (int)(sampleRate * kFrameDuration)));
+    hopSize = frameSize / 2;
+    tolerance = frameSize / 4;
+
+    // Periodic Hann, the halves of consecutive grains sum to exactly one
+    window.allocate(frameSize, false);
+    for (int i = 0; i < frameSize; i++) {
+        window[i] = (float)(0.5 - 0.5 * std::cos(MathConstants<double>::twoPi * i / frameSize));
+    }
+
+    inputCache.setSize(this->numChannels, frameSize * 4 + tolerance * 2);
+    overlapBuffer.setSize(this->numChannels, frameSize);
+    mixdown.allocate(tolerance * 2 + hopSize, true);
+    naturalMixdown.allocate(hopSize, true);
+
+    const auto capacity = nextPowerOfTwo(jmax(frameSize * 4, (int)(sampleRate * kLookAheadDuration)));
+    fifo.setTotalSize(capacity);
+    fifoBuffer.setSize(this->numChannels, capacity);
+
+    thread.addTimeSliceClient(this);
+}
+
+TimeStretcher::~TimeStretcher()
+{
+    thread.removeTimeSliceClient(this);
+}
+
+void TimeStretcher::startTempoRamp(double speed, int64 rampLengthInSamples)
+{
+    const ScopedLock sl(workerLock);
+
+    rampStart = input->getNextReadPosition();
+    rampStartSpeed = speed;
+    rampLength = jmax((int64)1, rampLengthInSamples);
+    numSamplesProduced = 0;
+    rampPending = true;
+
+    fifo.reset();
+
+    producedPosition = rampStart;
+    handoffPosition = rampStart;
+    currentSpeed = speed;
+
+    // Enough to ride through a few late time slices
+    primingThreshold = jmin(fifo.getTotalSize() / 2, hopSize * 8);
+
+    state = Priming;
+
+    thread.moveToFrontOfQueue(this);
+}
+
+void TimeStretcher::beginRamp()
+{
+    // Done from the worker, the reader must not be touched from the control thread
+    cacheLength = 0;
+    overlapBuffer.clear();
+
+    // Second half of a virtual grain ending right at the start, so the first hop comes out at unity gain
+    auto offset = ensureInput(rampStart - hopSize, frameSize);
+
+    for (int ch = 0; ch < numChannels; ch++) {
+        auto source = inputCache.getReadPointer(ch, offset + hopSize);
+        auto dest = overlapBuffer.getWritePointer(ch);
+
+        for (int i = 0; i < hopSize; i++) {
+            dest[i] = source[i] * window[hopSize + i];
+        }
+    }
+
+    previousGrainPosition = rampStart - hopSize;
+    nominalPosition = (double)rampStart;
+    rampPending = false;
+}
+
+void TimeStretcher::cancel()
+{
+    const ScopedLock sl(workerLock);
+    state = Bypass;
+}
+
+bool TimeStretcher::waitForNextAudioBlockReady(int numSamples, int timeoutMs)
+{
+    const auto deadline = Time::getMillisecondCounter() + (uint32)timeoutMs;
+
+    for (;;) {
+        const int current = state;
+
+        if (current != Priming && current != Stretching) {
+            return true;
+        }
+
+        auto needed = jmin(fifo.getTotalSize() - 1, current == Priming ? jmax(numSamples, primingThreshold) : numSamples);
+
+        if (fifo.getNumReady() >= needed) {
+            return true;
+        }
+
+        if (Time::getMillisecondCounter() >= deadline) {
+            return false;
+        }
+
+        thread.moveToFrontOfQueue(this);
+        Thread::sleep(1);
+    }
+}
+
+void TimeStretcher::prepareToPlay(int samplesPerBlockExpected, double sampleRate)
+{
+    input->prepareToPlay(samplesPerBlockExpected, sampleRate);
+}
+
+void TimeStretcher::releaseResources()
+{
+    input->releaseResources();
+}
+
+bool TimeStretcher::prime()
+{
+    if (state != Priming || fifo.getNumReady() >= jmin(fifo.getTotalSize() - 1, primingThreshold)) {
+        return true;
+    }
+
+    thread.moveToFrontOfQueue(this);
+    return false;
+}
+
+void TimeStretcher::getNextAudioBlock(const AudioSourceChannelInfo& info)
+{
+    int current = state;
+
+    if (current == Bypass) {
+        input->getNextAudioBlock(info);
+        return;
+    }
+
+    if (current == Priming) {
+        if (fifo.getNumReady() < primingThreshold) {
+            info.clearActiveBufferRegion();
+            return;
+        }
+
+        // The worker may have finished the whole ramp in the meantime
+        if (!state.compare_exchange_strong(current, Stretching)) {
+            current = state;
+        }
+    }
+
+    const auto channels = jmin(numChannels, info.buffer->getNumChannels());
+    const auto numToRead = jmin(info.numSamples, fifo.getNumReady());
+
+    int start1, size1, start2, size2;
+    fifo.prepareToRead(numToRead, start1, size1, start2, size2);
+
+    for (int ch = 0; ch < channels; ch++) {
+        if (size1 > 0) {
+            info.buffer->copyFrom(ch, info.startSample, fifoBuffer, ch, start1, size1);
+        }
+
+        if (size2 > 0) {
+            info.buffer->copyFrom(ch, info.startSample + size1, fifoBuffer, ch, start2, size2);
+        }
+    }
+
+    fifo.finishedRead(size1 + size2);
+
+    const auto numRead = size1 + size2;
+    const auto remaining = info.numSamples - numRead;
+
+    if (current == Finished && fifo.getNumReady() == 0) {
+        // The input was put at the handoff position when the last grain was made
+        state = Bypass;
+
+        if (remaining > 0) {
+            input->getNextAudioBlock(AudioSourceChannelInfo(info.buffer, info.startSample + numRead, remaining));
+        }
+
+        return;
+    }
+
+    if (remaining > 0) {
+        info.buffer->clear(info.startSample + numRead, remaining);
+        numUnderruns++;
+    }
+}
+
+void TimeStretcher::setNextReadPosition(int64 newPosition)
+{
+    cancel();
+    input->setNextReadPosition(newPosition);
+}
+
+int64 TimeStretcher::getNextReadPosition() const
+{
+    if (state == Bypass) {
+        return input->getNextReadPosition();
+    }
+
+    return producedPosition - (int64)(fifo.getNumReady() * currentSpeed);
+}
+
+int TimeStretcher::useTimeSlice()
+{
+    const int current = state;
+
+    if (current != Priming && current != Stretching) {
+        return 50;
+    }
+
+    const ScopedLock sl(workerLock);
+
+    if (rampPending) {
+        beginRamp();
+    }
+
+    int numGrains = 0;
+
+    while ((state == Priming || state == Stretching) && fifo.getFreeSpace() >= hopSize) {
+        produceGrain();
+        numGrains++;
+    }
+
+    return numGrains > 0 ? 2 : 5;
+}
+
+int TimeStretcher::ensureInput(int64 start, int length)
+{
+    jassert(length <= inputCache.getNumSamples());
+
+    if (start >= cacheStart && start + length <= cacheStart + cacheLength) {
+        return (int)(start - cacheStart);
+    }
+
+    // Grains only move forwards, but a search may start a little before the previous one
+    const auto keepFrom = jmax(cacheStart, start - frameSize);
+
+    if (start >= cacheStart && keepFrom < cacheStart + cacheLength) {
+        const auto shift = (int)(keepFrom - cacheStart);
+        const auto keep = cacheLength - shift;
+
+        for (int ch = 0; ch < numChannels; ch++) {
+            auto data = inputCache.getWritePointer(ch);
+            memmove(data, data + shift, sizeof(float) * (size_t)keep);
+        }
+
+        cacheStart = keepFrom;
+        cacheLength = keep;
+    }
+    else {
+        cacheStart = start;
+        cacheLength = 0;
+    }
+
+    // Fill the whole cache, the next few grains come from there as well. Out of range samples are read as silence
+    const auto numToRead = inputCache.getNumSamples() - cacheLength;
+
+    {
+        const ScopedLock sl(readerLock);
+        reader->read(&inputCache, cacheLength, numToRead, cacheStart + cacheLength, true, true);
+    }
+
+    cacheLength += numToRead;
+
+    return (int)(start - cacheStart);
+}
+
+int TimeStretcher::findBestOffset(int candidateOffset, int naturalOffset)
+{
+    const auto searchLength = tolerance * 2 + hopSize;
+
+    // Channels are summed for the search, it only needs to know where the waveforms line up
+    FloatVectorOperations::copy(mixdown, inputCache.getReadPointer(0, candidateOffset), searchLength);
+    FloatVectorOperations::copy(naturalMixdown, inputCache.getReadPointer(0, naturalOffset), hopSize);
+
+    for (int ch = 1; ch < numChannels; ch++) {
+        FloatVectorOperations::add(mixdown, inputCache.getReadPointer(ch, candidateOffset), searchLength);
+        FloatVectorOperations::add(naturalMixdown, inputCache.getReadPointer(ch, naturalOffset), hopSize);
+    }
+
+    auto score = [&](int offset, int step) {
+        double dot = 0.0;
+        double energy = 1e-9;
+
+        auto candidate = mixdown.get() + offset;
+
+        for (int i = 0; i < hopSize; i += step) {
+            dot += (double)candidate[i] * naturalMixdown[i];
+            energy += (double)candidate[i] * candidate[i];
+        }
+
+        return dot / std::sqrt(energy);
+    };
+
+    int best = tolerance;
+    double bestScore = -std::numeric_limits<double>::infinity();
+
+    for (int offset = 0; offset <= tolerance * 2; offset += kCoarseStep) {
+        auto s = score(offset, kCoarseDecimation);
+
+        if (s > bestScore) {
+            bestScore = s;
+            best = offset;
+        }
+    }
+
+    const auto coarseBest = best;
+    bestScore = -std::numeric_limits<double>::infinity();
+
+    for (int offset = jmax(0, coarseBest - kCoarseStep + 1); offset <= jmin(tolerance * 2, coarseBest + kCoarseStep - 1); offset++) {
+        auto s = score(offset, 1);
+
+        if (s > bestScore) {
+            bestScore = s;
+            best = offset;
+        }
+    }
+
+    return best;
+}
+
+void TimeStretcher::produceGrain()
+{
+    const auto progress = jmin(1.0, (double)numSamplesProduced / rampLength);
+    const auto speed = rampStartSpeed + (1.0 - rampStartSpeed) * progress;
+    const auto isLast = progress >= 1.0;
+
+    const auto naturalPosition = previousGrainPosition + hopSize;
+    int64 grainPosition;
+
+    // The first grain starts exactly where playback is, the last one continues its predecessor exactly
+    if (numSamplesProduced == 0 || isLast) {
+        grainPosition = naturalPosition;
+    }
+    else {
+        const auto searchStart = (int64)std::round(nominalPosition) - tolerance;
+        const auto low = jmin(searchStart, naturalPosition);
+        const auto high = jmax(searchStart + tolerance * 2 + hopSize, naturalPosition + hopSize);
+
+        auto offset = ensureInput(low, (int)(high - low));
+        grainPosition = searchStart + findBestOffset(offset + (int)(searchStart - low), offset + (int)(naturalPosition - low));
+    }
+
+    auto offset = ensureInput(grainPosition, frameSize);
+
+    for (int ch = 0; ch < numChannels; ch++) {
+        auto source = inputCache.getReadPointer(ch, offset);
+        auto dest = overlapBuffer.getWritePointer(ch);
+
+        for (int i = 0; i < frameSize; i++) {
+            dest[i] += source[i] * window[i];
+        }
+    }
+
+    previousGrainPosition = grainPosition;
+    nominalPosition += hopSize * speed;
+
+    pushCompletedHop();
+
+    numSamplesProduced += hopSize;
+    currentSpeed = speed;
+    producedPosition = grainPosition + hopSize;
+
+    if (isLast) {
+        handoffPosition = grainPosition + hopSize;
+
+        // Lets the read-ahead buffer fill from there while the FIFO drains
+        input->setNextReadPosition(handoffPosition);
+
+        state = Finished;
+    }
+}
+
+void TimeStretcher::pushCompletedHop()
+{
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite(hopSize, start1, size1, start2, size2);
+
+    for (int ch = 0; ch < numChannels; ch++) {
+        auto data = overlapBuffer.getWritePointer(ch);
+
+        if (size1 > 0) {
+            fifoBuffer.copyFrom(ch, start1, data, size1);
+        }
+
+        if (size2 > 0) {
+            fifoBuffer.copyFrom(ch, start2, data + size1, size2);
+        }
+
+        // The second half becomes the first, waiting for the next grain
+        FloatVectorOperations::copy(data, data + hopSize, hopSize);
+        FloatVectorOperations::clear(data + hopSize, hopSize);
+    }
+
+    fifo.finishedWrite(size1 + size2);
+}
+
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+using namespace juce;
+
+namespace medley {
+
+/**
+ * WSOLA time-stretching stage between a deck's read-ahead buffer and its resampler, changing tempo but not pitch.
+ *
+ * It passes its input through untouched until a tempo ramp is started, it then plays at the given speed, gliding back
+ * to unity over the ramp, and hands back to its input once there. Grains are searched and overlapped a little ahead
+ * of playback by a time slice on the read-ahead thread, reading the track's reader directly, so the audio thread only
+ * copies finished samples out of a FIFO.
+ *
+ * The last grain continues its predecessor exactly, so handing back to the input is seamless.
+ */
+class TimeStretcher : public PositionableAudioSource, public TimeSliceClient {
+public:
+    // Reader is shared with the decoding of the input, readerLock must be the lock held while that decodes
+    TimeStretcher(PositionableAudioSource* input, AudioFormatReader* reader, const CriticalSection& readerLock, int numChannels, TimeSliceThread& thread);
+
+    ~TimeStretcher() override;
+
+    // Control thread, while the input is not being played. speed is the source samples consumed per sample played
+    void startTempoRamp(double speed, int64 rampLengthInSamples);
+
+    // Drops the ramp and goes straight back to the input
+    void cancel();
+
+    // Including the time before the first grains are ready
+    bool isStretching() const { return state != Bypass; }
+
+    double getCurrentSpeed() const { return currentSpeed; }
+
+    // Number of times playback ran out of stretched samples
+    int64 getNumUnderruns() const { return numUnderruns; }
+
+    // Also waits for priming to finish, with numSamples = 0 only for that. Returns right away when not stretching
+    bool waitForNextAudioBlockReady(int numSamples, int timeoutMs);
+
+    // Any thread, never waits. True when primed or not stretching, otherwise moves the grain worker to the front of
+    // the queue; playback stays silent and does not advance until the first grains are ready
+    bool prime();
+
+    void prepareToPlay(int samplesPerBlockExpected, double sampleRate) override;
+
+    void releaseResources() override;
+
+    void getNextAudioBlock(const AudioSourceChannelInfo& info) override;
+
+    void setNextReadPosition(int64 newPosition) override;
+
+    int64 getNextReadPosition() const override;
+
+    int64 getTotalLength() const override { return input->getTotalLength(); }
+
+    bool isLooping() const override { return input->isLooping(); }
+
+    int useTimeSlice() override;
+
+private:
+    enum State {
+        Bypass = 0,
+        // Grains are being produced, playback waits for the first ones
+        Priming,
+        Stretching,
+        // No more grains, playback returns to the input at handoffPosition once the FIFO is drained
+        Finished
+    };
+
+    // Makes [start, start + length) of the input available in the cache, returns the offset of start in it
+    int ensureInput(int64 start, int length);
+
+    int findBestOffset(int cacheOffset, int naturalOffset);
+
+    void beginRamp();
+
+    void produceGrain();
+
+    void pushCompletedHop();
+
+    PositionableAudioSource* input;
+    AudioFormatReader* reader;
+    const CriticalSection& readerLock;
+    TimeSliceThread& thread;
+    int numChannels;
+
+    int frameSize = 1024;
+    int hopSize = 512;
+    int tolerance = 256;
+
+    HeapBlock<float> window;
+
+    // Worker state, guarded by workerLock
+    CriticalSection workerLock;
+
+    AudioBuffer<float> inputCache;
+    int64 cacheStart = 0;
+    int cacheLength = 0;
+
+    AudioBuffer<float> overlapBuffer;
+    HeapBlock<float> mixdown;
+    HeapBlock<float> naturalMixdown;
+
+    int64 rampStart = 0;
+    bool rampPending = false;
+    double nominalPosition = 0.0;
+    int64 previousGrainPosition = 0;
+    double rampStartSpeed = 1.0;
+    int64 rampLength = 0;
+    int64 numSamplesProduced = 0;
+
+    // Shared with the audio thread
+    std::atomic<int> state{ Bypass };
+    std::atomic<int64> handoffPosition{ 0 };
+    // Input position matching the end of what has been produced
+    std::atomic<int64> producedPosition{ 0 };
+    std::atomic<double> currentSpeed{ 1.0 };
+    std::atomic<int64> numUnderruns{ 0 };
+
+    AbstractFifo fifo{ 1 };
+    AudioBuffer<float> fifoBuffer;
+    int primingThreshold = 0;
+
+    JUCE_DECLARE_NON_COPYABLE(TimeStretcher)
+};
+
+}
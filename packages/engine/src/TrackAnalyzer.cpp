@@ -0,0 +1,299 @@
+#include "TrackAnalyzer.h"
+#include "AnalysisCache.h"
+#include "FormatSniffer.h"
+#include "LevelSearch.h"
+#include "VocalOnsetDetector.h"
+
+namespace {
+    static const auto kSilenceThreshold = Decibels::decibelsToGain(-60.0f);
+    static const auto kFadingSilenceThreshold = Decibels::decibelsToGain(-23.0f);
+
+    constexpr float kFirstSoundDuration = 0.001f;
+    constexpr float kLastSoundDuration = 1.25f;
+
+    constexpr int kHeadChunkSize = 4096;
+}
+
+namespace medley {
+
+void TrackAnalysis::calculateTransition()
+{
+    const auto leadTime = jmax(TrackAnalyzer::kLeadingScanningDuration, maxTransitionTime);
+
+    transitionStartPosition = lastAudibleSamplePosition / sampleRate;
+    transitionEndPosition = transitionStartPosition;
+
+    if (trailingDuration > 0.0 && maxTransitionTime > 0.0)
+    {
+
+        if (trailingDuration >= maxTransitionTime) {
+            transitionStartPosition = trailingPosition / sampleRate;
+            transitionEndPosition = transitionStartPosition + maxTransitionTime;
+        }
+        else {
+            transitionStartPosition = jmax(2.0, transitionEndPosition - trailingDuration);
+        }
+    }
+
+    transitionCuePosition = jmax(0.0, transitionStartPosition - leadTime);
+    if (transitionCuePosition == 0.0) {
+        transitionCuePosition = jmax(0.0, transitionStartPosition - leadTime / 2.0);
+    }
+
+    transitionPreCuePosition = jmax(0.0, transitionCuePosition - 1.0);
+
+    if (transitionPreCuePosition == transitionCuePosition) {
+        transitionCuePosition = jmin(transitionPreCuePosition + 1, transitionEndPosition);
+    }
+}
+
+class TrackAnalyzer::Job : public ThreadPoolJob {
+public:
+    Job(AudioFormatManager& formatMgr, int index, const File& file, double maxTransitionTime, ResultCallback onResult)
+        :
+        ThreadPoolJob("Analyze " + file.getFileName()),
+        formatMgr(formatMgr),
+        index(index),
+        file(file),
+        maxTransitionTime(maxTransitionTime),
+        onResult(onResult)
+    {
+
+    }
+
+    JobStatus runJob() override
+    {
+        TrackAnalysis analysis;
+        bool cached = false;
+        String error;
+
+        try {
+            analysis = TrackAnalyzer::analyzeFile(formatMgr, file, maxTransitionTime, &cached);
+        }
+        catch (std::exception& e) {
+            error = e.what();
+        }
+
+        if (!shouldExit()) {
+            onResult(index, file, analysis, cached, error);
+        }
+
+        return jobHasFinished;
+    }
+
+private:
+    AudioFormatManager& formatMgr;
+    int index;
+    File file;
+    double maxTransitionTime;
+    ResultCallback onResult;
+};
+
+TrackAnalyzer::TrackAnalyzer(AudioFormatManager& formatMgr, int numThreads)
+    :
+    formatMgr(formatMgr),
+    pool(numThreads > 0 ? numThreads : SystemStats::getNumCpus())
+{
+
+}
+
+TrackAnalyzer::~TrackAnalyzer()
+{
+    cancelAll();
+}
+
+void TrackAnalyzer::analyze(const Array<File>& files, double maxTransitionTime, ResultCallback onResult)
+{
+    for (int i = 0; i < files.size(); i++) {
+        pool.addJob(new Job(formatMgr, i, files[i], maxTransitionTime, onResult), true);
+    }
+}
+
+void TrackAnalyzer::cancelAll()
+{
+    pool.removeAllJobs(true, 5000);
+}
+
+void TrackAnalyzer::analyzeHead(AudioFormatReader& reader, double maxTransitionTime, TrackAnalysis& analysis)
+{
+    analysis.sampleRate = reader.sampleRate;
+    analysis.lengthInSamples = reader.lengthInSamples;
+    analysis.maxTransitionTime = maxTransitionTime;
+
+    auto mid = reader.lengthInSamples / 2;
+    analysis.firstAudibleSamplePosition = jmax(0LL, LevelSearch::searchReader(reader, 0, mid, kSilenceThreshold, 1.0, (int)(reader.sampleRate * kFirstSoundDuration)));
+    analysis.totalSamplesToPlay = reader.lengthInSamples;
+    analysis.lastAudibleSamplePosition = analysis.totalSamplesToPlay;
+    analysis.leadingSamplePosition = -1;
+    analysis.leadingDecibel = -100.0f;
+    analysis.introEndPosition = -1;
+    analysis.trailingPosition = -1;
+    analysis.trailingDuration = 0;
+    analysis.tailAnalyzed = false;
+
+    const auto firstAudibleSamplePosition = analysis.firstAudibleSamplePosition;
+    auto playDuration = analysis.totalSamplesToPlay / reader.sampleRate;
+
+    if (playDuration >= 3) {
+        const auto numChannels = (int)reader.numChannels;
+        const auto levelLength = (int64)(reader.sampleRate * jmax(maxTransitionTime, kLeadingScanningDuration));
+        // Loading waits for this, so vocals are only looked for within the leading section. An onset further in
+        // comes after any transition into the track and would not shorten it anyway
+        const auto introLength = jmin(levelLength, (int64)(reader.sampleRate * kIntroScanningDuration), reader.lengthInSamples - firstAudibleSamplePosition);
+
+        // The peak levels of the leading section and the vocal onset come out of the same decode
+        HeapBlock<Range<float>> maxLevels(numChannels, true);
+        VocalOnsetDetector vocalDetector(reader.sampleRate, firstAudibleSamplePosition, introLength);
+
+        AudioBuffer<float> chunk(numChannels, kHeadChunkSize);
+
+        for (int64 done = 0; done < levelLength; done += kHeadChunkSize) {
+            const auto numSamples = (int)jmin((int64)kHeadChunkSize, levelLength - done);
+            reader.read(&chunk, 0, numSamples, firstAudibleSamplePosition + done, true, true);
+
+            for (int i = 0; i < numChannels; i++) {
+                auto range = FloatVectorOperations::findMinAndMax(chunk.getReadPointer(i), numSamples);
+                maxLevels[i] = (done == 0) ? range : maxLevels[i].getUnionWith(range);
+            }
+
+            if (done < introLength) {
+                vocalDetector.process(chunk, (int)jmin((int64)numSamples, introLength - done));
+            }
+        }
+
+        analysis.introEndPosition = vocalDetector.findOnset();
+
+        float sumOfMaxLevels = 0.0f;
+        for (int i = 0; i < numChannels; i++) {
+            sumOfMaxLevels += maxLevels[i].getEnd();
+        }
+
+        auto leadingDecibel = Decibels::gainToDecibels(sumOfMaxLevels / jmax(1, numChannels));
+        auto leadingLevel = jlimit(0.0f, 0.9f, Decibels::decibelsToGain(leadingDecibel - 6.0f));
+
+        analysis.leadingDecibel = leadingDecibel;
+
+        // The leading section is searched twice
+        LevelSearch leadingSearch(reader, firstAudibleSamplePosition, (int64)(reader.sampleRate * kLeadingScanningDuration));
+
+        auto leadingSamplePosition = leadingSearch.search(
+            firstAudibleSamplePosition,
+            (int)(reader.sampleRate * kLeadingScanningDuration),
+            leadingLevel, 1.0,
+            (int)(reader.sampleRate * kFirstSoundDuration / 10)
+        );
+
+
+        if (leadingSamplePosition > -1) {
+            auto lead2 = leadingSearch.search(
+                jmax(0LL, leadingSamplePosition - (int)(reader.sampleRate * 2.0)),
+                (int)(reader.sampleRate * 2.0),
+                leadingLevel * 0.33, 1.0,
+                0
+            );
+
+            if ((lead2 > firstAudibleSamplePosition) && (lead2 < leadingSamplePosition)) {
+                leadingSamplePosition = lead2;
+            }
+        }
+
+        analysis.leadingSamplePosition = leadingSamplePosition;
+    }
+
+    analysis.leadingDuration = (analysis.leadingSamplePosition > -1) ? (analysis.leadingSamplePosition - firstAudibleSamplePosition) / reader.sampleRate : 0;
+}
+
+void TrackAnalyzer::analyzeTail(AudioFormatReader& reader, TrackAnalysis& analysis)
+{
+    auto middlePosition = reader.lengthInSamples / 2;
+    auto tailPosition = jmax(
+        analysis.firstAudibleSamplePosition,
+        middlePosition,
+        (int64)(reader.lengthInSamples - reader.sampleRate * kTailScanningDuration)
+    );
+
+    // All three searches go through the tail, which gets decoded once
+    LevelSearch tailSearch(reader, tailPosition, reader.lengthInSamples - tailPosition);
+
+    auto silencePosition = tailSearch.search(
+        tailPosition,
+        reader.lengthInSamples - tailPosition,
+        0, kSilenceThreshold,
+        (int)(reader.sampleRate * kLastSoundDuration)
+    );
+
+    if (silencePosition < 0) {
+        silencePosition = 0;
+    }
+
+    if (silencePosition > analysis.firstAudibleSamplePosition) {
+        analysis.lastAudibleSamplePosition = silencePosition;
+    }
+
+    auto endPosition = tailSearch.search(
+        silencePosition,
+        reader.lengthInSamples - silencePosition,
+        0, kSilenceThreshold,
+        (int)(reader.sampleRate * 0.004)
+    );
+
+    if (endPosition > analysis.lastAudibleSamplePosition) {
+        analysis.totalSamplesToPlay = endPosition;
+    }
+
+    analysis.trailingPosition = tailSearch.search(
+        tailPosition,
+        analysis.totalSamplesToPlay - tailPosition,
+        0, kFadingSilenceThreshold,
+        (int)(reader.sampleRate * 0.8)
+    );
+
+    analysis.trailingDuration = (analysis.trailingPosition > -1) ? (analysis.lastAudibleSamplePosition - analysis.trailingPosition) / reader.sampleRate : 0;
+    analysis.tailAnalyzed = true;
+}
+
+TrackAnalysis TrackAnalyzer::analyzeFile(AudioFormatManager& formatMgr, const File& file, double maxTransitionTime, bool* cached)
+{
+    TrackAnalysis analysis;
+
+    if (AnalysisCache::getShared().find(file, maxTransitionTime, analysis)) {
+        if (cached != nullptr) {
+            *cached = true;
+        }
+
+        return analysis;
+    }
+
+    if (!file.existsAsFile()) {
+        throw std::runtime_error("File does not exist");
+    }
+
+    std::unique_ptr<AudioFormatReader> reader(FormatSniffer::createReaderFor(formatMgr, file));
+
+    if (reader == nullptr) {
+        throw std::runtime_error("Could not create format reader");
+    }
+
+    // Same reader for both ends, the tail search picks up from the head results
+    analyzeHead(*reader, maxTransitionTime, analysis);
+
+    // Deck does not scan the tail of very short tracks either
+    if (analysis.lengthInSamples / analysis.sampleRate >= 3) {
+        analyzeTail(*reader, analysis);
+    }
+    else {
+        analysis.tailAnalyzed = true;
+    }
+
+    analysis.calculateTransition();
+
+    AnalysisCache::getShared().store(file, analysis);
+
+    if (cached != nullptr) {
+        *cached = false;
+    }
+
+    return analysis;
+}
+
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+using namespace juce;
+
+namespace medley {
+
+/**
+ * Cue points and levels of a track, as found by Deck when a track is loaded and scanned.
+ */
+struct TrackAnalysis {
+    double sampleRate = 0.0;
+    int64 lengthInSamples = 0;
+    // The leading section and the transition depend on it
+    double maxTransitionTime = 0.0;
+
+    int64 firstAudibleSamplePosition = 0;
+    int64 lastAudibleSamplePosition = 0;
+    int64 totalSamplesToPlay = 0;
+
+    int64 leadingSamplePosition = -1;
+    double leadingDuration = 0.0;
+    // Peak level of the leading section in decibels, averaged over channels
+    float leadingDecibel = -100.0f;
+
+    // Where vocals most likely start, from the head analysis, -1 when not found
+    int64 introEndPosition = -1;
+
+    int64 trailingPosition = -1;
+    double trailingDuration = 0.0;
+
+    // In seconds
+    double transitionPreCuePosition = 0.0;
+    double transitionCuePosition = 0.0;
+    double transitionStartPosition = 0.0;
+    double transitionEndPosition = 0.0;
+
+    // False until the tail has been scanned, the last audible position and trailing are estimates until then
+    bool tailAnalyzed = false;
+
+    void calculateTransition();
+};
+
+/**
+ * Runs track analysis on a pool of worker threads, results are delivered on the worker which produced them.
+ */
+class TrackAnalyzer {
+public:
+    static constexpr double kLeadingScanningDuration = 10.0;
+    static constexpr double kTailScanningDuration = 20.0;
+    // Most vocals are looked for from the first audible sample, within the leading section
+    static constexpr double kIntroScanningDuration = 30.0;
+
+    // Called once per file, error is empty on success
+    using ResultCallback = std::function<void(int index, const File& file, const TrackAnalysis& analysis, bool cached, const String& error)>;
+
+    // numThreads < 1 means one per CPU
+    TrackAnalyzer(AudioFormatManager& formatMgr, int numThreads = 0);
+
+    ~TrackAnalyzer();
+
+    void analyze(const Array<File>& files, double maxTransitionTime, ResultCallback onResult);
+
+    void cancelAll();
+
+    // First audible position and leading section, what is needed to start playing
+    static void analyzeHead(AudioFormatReader& reader, double maxTransitionTime, TrackAnalysis& analysis);
+
+    // Last audible position, end and trailing section, from the head results
+    static void analyzeTail(AudioFormatReader& reader, TrackAnalysis& analysis);
+
+    // Complete analysis of a file, from the shared cache when possible, throws when the file cannot be read
+    static TrackAnalysis analyzeFile(AudioFormatManager& formatMgr, const File& file, double maxTransitionTime, bool* cached = nullptr);
+
+private:
+    class Job;
+
+    AudioFormatManager& formatMgr;
+    ThreadPool pool;
+};
+
+}
@@ -0,0 +1,178 @@
+#include "VocalOnsetDetector.h"
+
+namespace {
+    // Where most of the energy of a voice is
+    constexpr double kVoiceBandLow = 300.0;
+    constexpr double kVoiceBandHigh = 3400.0;
+    constexpr double kCentroidLow = 400.0;
+    constexpr double kCentroidHigh = 3000.0;
+
+    // Rumble below this is left out of the total
+    constexpr double kFloorFrequency = 60.0;
+
+    // Frames quieter than this, summed over bins, are scored as nothing
+    constexpr float kSilentEnergy = 1e-6f;
+
+    constexpr double kBaselineDuration = 3.0;
+    constexpr double kSmoothingDuration = 0.5;
+    constexpr double kSustainDuration = 1.0;
+}
+
+namespace medley {
+
+VocalOnsetDetector::VocalOnsetDetector(double sampleRate, int64 startPosition, int64 maxSamples)
+    :
+    sampleRate(sampleRate),
+    startPosition(startPosition)
+{
+    window.allocate(kFftSize, false);
+    dsp::WindowingFunction<float>::fillWindowingTables(window, kFftSize, dsp::WindowingFunction<float>::hann, false);
+
+    frame.allocate(kFftSize, true);
+    fftData.allocate(kFftSize * 2, true);
+    previousMagnitudes.allocate(kFftSize / 2 + 1, true);
+
+    auto binOf = [&](double frequency) {
+        return jlimit(1, kFftSize / 2, (int)std::round(frequency * kFftSize / sampleRate));
+    };
+
+    lowBin = binOf(kVoiceBandLow);
+    highBin = binOf(kVoiceBandHigh);
+    floorBin = binOf(kFloorFrequency);
+
+    scores.reserve((size_t)(jmax((int64)0, maxSamples) / kHopSize) + 1);
+}
+
+void VocalOnsetDetector::process(const AudioBuffer<float>& buffer, int numSamples)
+{
+    const auto numChannels = buffer.getNumChannels();
+    int position = 0;
+
+    while (position < numSamples) {
+        const auto numToCopy = jmin(numSamples - position, kFftSize - frameFill);
+
+        FloatVectorOperations::copy(frame + frameFill, buffer.getReadPointer(0, position), numToCopy);
+
+        for (int ch = 1; ch < numChannels; ch++) {
+            FloatVectorOperations::add(frame + frameFill, buffer.getReadPointer(ch, position), numToCopy);
+        }
+
+        frameFill += numToCopy;
+        position += numToCopy;
+
+        if (frameFill == kFftSize) {
+            analyzeFrame();
+
+            // Half of the frame is kept for the next one
+            FloatVectorOperations::copy(frame, frame + kHopSize, kFftSize - kHopSize);
+            frameFill = kFftSize - kHopSize;
+        }
+    }
+}
+
+void VocalOnsetDetector::analyzeFrame()
+{
+    FloatVectorOperations::multiply(fftData, frame, window, kFftSize);
+    FloatVectorOperations::clear(fftData + kFftSize, kFftSize);
+
+    fft.performFrequencyOnlyForwardTransform(fftData);
+
+    double totalEnergy = 0.0;
+    double bandEnergy = 0.0;
+    double bandMagnitude = 0.0;
+    double weightedFrequency = 0.0;
+    double flux = 0.0;
+
+    for (int bin = floorBin; bin <= kFftSize / 2; bin++) {
+        const double magnitude = fftData[bin];
+        totalEnergy += magnitude * magnitude;
+
+        if (bin >= lowBin && bin <= highBin) {
+            bandEnergy += magnitude * magnitude;
+            bandMagnitude += magnitude;
+            weightedFrequency += magnitude * bin * sampleRate / kFftSize;
+
+            if (hasPrevious) {
+                flux += jmax(0.0, magnitude - (double)previousMagnitudes[bin]);
+            }
+        }
+    }
+
+    FloatVectorOperations::copy(previousMagnitudes, fftData, kFftSize / 2 + 1);
+    hasPrevious = true;
+
+    if (totalEnergy < kSilentEnergy || bandMagnitude <= 0.0) {
+        scores.push_back(0.0f);
+        return;
+    }
+
+    const auto bandRatio = bandEnergy / totalEnergy;
+    const auto relativeFlux = flux / bandMagnitude;
+    const auto centroid = weightedFrequency / bandMagnitude;
+
+    // Pads and bass lines change slowly and sit low, syllables keep the voice band moving
+    auto score = bandRatio + relativeFlux;
+
+    if (centroid < kCentroidLow || centroid > kCentroidHigh) {
+        score *= 0.5;
+    }
+
+    scores.push_back((float)score);
+}
+
+int64 VocalOnsetDetector::findOnset() const
+{
+    const auto framesPerSecond = sampleRate / kHopSize;
+    const auto baselineFrames = (int)(kBaselineDuration * framesPerSecond);
+    const auto smoothingFrames = jmax(1, (int)(kSmoothingDuration * framesPerSecond));
+    const auto sustainFrames = jmax(1, (int)(kSustainDuration * framesPerSecond));
+    const auto numFrames = (int)scores.size();
+
+    if (numFrames < baselineFrames + smoothingFrames + sustainFrames) {
+        return -1;
+    }
+
+    double mean = 0.0;
+    for (int i = 0; i < baselineFrames; i++) {
+        mean += scores[i];
+    }
+    mean /= baselineFrames;
+
+    double variance = 0.0;
+    for (int i = 0; i < baselineFrames; i++) {
+        variance += (scores[i] - mean) * (scores[i] - mean);
+    }
+
+    const auto deviation = std::sqrt(variance / baselineFrames);
+    const auto threshold = mean + jmax(2.0 * deviation, 0.15 * mean + 0.02);
+
+    // Moving average ending at each frame
+    std::vector<double> smoothed((size_t)numFrames, 0.0);
+    double sum = 0.0;
+
+    for (int i = 0; i < numFrames; i++) {
+        sum += scores[i];
+
+        if (i >= smoothingFrames) {
+            sum -= scores[i - smoothingFrames];
+        }
+
+        smoothed[i] = sum / jmin(i + 1, smoothingFrames);
+    }
+
+    int run = 0;
+
+    for (int i = baselineFrames; i < numFrames; i++) {
+        run = smoothed[i] > threshold ? run + 1 : 0;
+
+        if (run >= sustainFrames) {
+            // Back to where the run started, less the averaging delay
+            auto onsetFrame = jmax(baselineFrames, i - sustainFrames + 1 - smoothingFrames / 2);
+            return startPosition + (int64)onsetFrame * kHopSize;
+        }
+    }
+
+    return -1;
+}
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+using namespace juce;
+
+namespace medley {
+
+/**
+ * Finds where vocals most likely come in, from the audio fed to it during the head analysis.
+ *
+ * Every frame is scored from the share of energy in the voice band, how much that band keeps changing (spectral flux)
+ * and where its centroid sits. The first few seconds are taken as the instrumental baseline, the onset is the first
+ * point where the score rises well above it and stays there. It is a heuristic, tracks starting with vocals or with
+ * busy intros may give no result.
+ */
+class VocalOnsetDetector {
+public:
+    static constexpr int kFftOrder = 11;
+    static constexpr int kFftSize = 1 << kFftOrder;
+    static constexpr int kHopSize = kFftSize / 2;
+
+    // startPosition is the sample position of the first sample fed, at most maxSamples are
+    VocalOnsetDetector(double sampleRate, int64 startPosition, int64 maxSamples);
+
+    // Channels are summed
+    void process(const AudioBuffer<float>& buffer, int numSamples);
+
+    // Sample position of the onset, -1 when there is none
+    int64 findOnset() const;
+
+private:
+    void analyzeFrame();
+
+    double sampleRate;
+    int64 startPosition;
+
+    dsp::FFT fft{ kFftOrder };
+
+    HeapBlock<float> window;
+    HeapBlock<float> frame;
+    HeapBlock<float> fftData;
+    HeapBlock<float> previousMagnitudes;
+    int frameFill = 0;
+    bool hasPrevious = false;
+
+    int lowBin;
+    int highBin;
+    int floorBin;
+
+    std::vector<float> scores;
+};
+
+}
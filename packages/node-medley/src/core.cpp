@@ -57,11 +57,120 @@ void decWorkerRefCount() {
     }
 }
 
+bool parseEngineThread(const std::string& name, Engine::EngineThread& thread) {
+    static const std::map<std::string, Engine::EngineThread> threads = {
+        { "audio", Engine::EngineThread::Audio },
+        { "readAhead", Engine::EngineThread::ReadAhead },
+        { "loading", Engine::EngineThread::Loading },
+        { "visualizing", Engine::EngineThread::Visualizing }
+    };
+
+    auto it = threads.find(name);
+    if (it == threads.end()) {
+        return false;
+    }
+
+    thread = it->second;
+    return true;
+}
+
+Object createMemoryUsage(const Env& env, const medley::MemoryBudget::Usage& usage) {
+    auto result = Object::New(env);
+    result.Set("current", Number::New(env, (double)usage.current));
+    result.Set("peak", Number::New(env, (double)usage.peak));
+    return result;
+}
+
+Object createAccountUsage(const Env& env, const medley::MemoryBudget::Account& account) {
+    auto result = createMemoryUsage(env, account.getUsage());
+    auto components = Object::New(env);
+
+    for (int i = 0; i < (int)medley::MemoryBudget::Component::NumComponents; i++) {
+        auto component = (medley::MemoryBudget::Component)i;
+        components.Set(medley::MemoryBudget::getComponentName(component), Number::New(env, (double)account.getUsage(component)));
+    }
+
+    result.Set("components", components);
+    return result;
+}
+
+struct AnalysisResult {
+    int index;
+    File file;
+    medley::TrackAnalysis analysis;
+    bool cached;
+    juce::String error;
+};
+
+struct AnalysisContext {
+    AnalysisContext(const Env& env, int numTracks)
+        : deferred(Promise::Deferred::New(env)),
+        numRemaining(numTracks)
+    {
+        results = Persistent(Napi::Array::New(env, numTracks));
+    }
+
+    Promise::Deferred deferred;
+    ObjectReference results;
+    int numRemaining;
+
+    std::unique_ptr<medley::TrackAnalyzer> analyzer;
+    ThreadSafeFunction emitter;
+};
+
+Object createAnalysisObject(const Env& env, const AnalysisResult& result) {
+    auto& analysis = result.analysis;
+
+    auto toSeconds = [&](int64 samples) {
+        return analysis.sampleRate > 0.0 ? samples / analysis.sampleRate : 0.0;
+    };
+
+    auto obj = Object::New(env);
+    obj.Set("index", Number::New(env, result.index));
+    obj.Set("path", Napi::String::New(env, result.file.getFullPathName().toStdString()));
+    obj.Set("cached", Boolean::New(env, result.cached));
+
+    if (result.error.isNotEmpty()) {
+        obj.Set("error", Napi::String::New(env, result.error.toStdString()));
+        return obj;
+    }
+
+    obj.Set("duration", Number::New(env, toSeconds(analysis.lengthInSamples)));
+    obj.Set("firstAudiblePosition", Number::New(env, toSeconds(analysis.firstAudibleSamplePosition)));
+    obj.Set("lastAudiblePosition", Number::New(env, toSeconds(analysis.lastAudibleSamplePosition)));
+    obj.Set("endPosition", Number::New(env, toSeconds(analysis.totalSamplesToPlay)));
+    obj.Set("leadingPosition", Number::New(env, analysis.leadingSamplePosition > -1 ? toSeconds(analysis.leadingSamplePosition) : -1.0));
+    obj.Set("leadingDuration", Number::New(env, analysis.leadingDuration));
+    obj.Set("leadingLevel", Number::New(env, analysis.leadingDecibel));
+    obj.Set("introEndPosition", Number::New(env, analysis.introEndPosition > -1 ? toSeconds(analysis.introEndPosition) : -1.0));
+    obj.Set("trailingPosition", Number::New(env, analysis.trailingPosition > -1 ? toSeconds(analysis.trailingPosition) : -1.0));
+    obj.Set("trailingDuration", Number::New(env, analysis.trailingDuration));
+    obj.Set("transitionPreCuePosition", Number::New(env, analysis.transitionPreCuePosition));
+    obj.Set("transitionCuePosition", Number::New(env, analysis.transitionCuePosition));
+    obj.Set("transitionStartPosition", Number::New(env, analysis.transitionStartPosition));
+    obj.Set("transitionEndPosition", Number::New(env, analysis.transitionEndPosition));
+
+    return obj;
+}
+
+const char* schedulingName(medley::ThreadPolicy::Scheduling scheduling) {
+    switch (scheduling) {
+    case medley::ThreadPolicy::Scheduling::Fifo:
+        return "fifo";
+    case medley::ThreadPolicy::Scheduling::RoundRobin:
+        return "rr";
+    default:
+        return "default";
+    }
+}
+
 }
 
 void Medley::Initialize(Object& exports) {
     auto proto = {
         StaticMethod<&Medley::shutdown>("shutdown"),
+        StaticMethod<&Medley::setMemoryLimit>("setMemoryLimit"),
+        StaticMethod<&Medley::analyze>("analyze"),
         //
         InstanceMethod<&Medley::getAvailableDevices>("getAvailableDevices"),
         InstanceMethod<&Medley::setAudioDevice>("setAudioDevice"),
@@ -71,6 +180,17 @@ void Medley::Initialize(Object& exports) {
         InstanceMethod<&Medley::fadeOut>("fadeOut"),
         InstanceMethod<&Medley::seek>("seek"),
         InstanceMethod<&Medley::seekFractional>("seekFractional"),
+        InstanceMethod<&Medley::setThreadPolicy>("setThreadPolicy"),
+        InstanceMethod<&Medley::getThreadStatus>("getThreadStatus"),
+        InstanceMethod<&Medley::getMemoryUsage>("getMemoryUsage"),
+        InstanceMethod<&Medley::getStartupTimes>("getStartupTimes"),
+        InstanceMethod<&Medley::getDeckCues>("getDeckCues"),
+        InstanceMethod<&Medley::startSegmentedOutput>("startSegmentedOutput"),
+        InstanceMethod<&Medley::stopSegmentedOutput>("stopSegmentedOutput"),
+        InstanceMethod<&Medley::fitToPost>("fitToPost"),
+        InstanceMethod<&Medley::clearPost>("clearPost"),
+        InstanceMethod<&Medley::startRecording>("startRecording"),
+        InstanceMethod<&Medley::stopRecording>("stopRecording"),
         //
         InstanceAccessor<&Medley::level>("level"),
         InstanceAccessor<&Medley::playing>("playing"),
@@ -91,6 +211,90 @@ void Medley::shutdown(const CallbackInfo& info) {
     shutdownWorker();
 }
 
+void Medley::setMemoryLimit(const CallbackInfo& info) {
+    medley::MemoryBudget::getGlobal().setLimit((int64_t)info[0].ToNumber().DoubleValue());
+}
+
+Napi::Value Medley::analyze(const CallbackInfo& info) {
+    auto env = info.Env();
+
+    if (info.Length() < 1 || !info[0].IsArray()) {
+        TypeError::New(env, "Expected an array of tracks").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    auto tracks = info[0].As<Napi::Array>();
+    juce::Array<File> files;
+
+    for (uint32_t i = 0; i < tracks.Length(); i++) {
+        auto track = tracks.Get(i);
+        auto path = track.IsObject() ? track.ToObject().Get("path").ToString() : track.ToString();
+        files.add(File(juce::String::fromUTF8(path.Utf8Value().c_str())));
+    }
+
+    int concurrency = 0;
+    double maxTransitionTime = 3.0;
+    Function onResult;
+
+    if (info.Length() > 1 && info[1].IsObject()) {
+        auto options = info[1].ToObject();
+
+        if (options.Has("concurrency")) {
+            concurrency = options.Get("concurrency").ToNumber().Int32Value();
+        }
+
+        if (options.Has("maxTransitionTime")) {
+            maxTransitionTime = options.Get("maxTransitionTime").ToNumber().DoubleValue();
+        }
+
+        if (options.Has("onResult") && options.Get("onResult").IsFunction()) {
+            onResult = options.Get("onResult").As<Function>();
+        }
+    }
+
+    auto context = new AnalysisContext(env, files.size());
+    auto promise = context->deferred.Promise();
+
+    if (files.isEmpty()) {
+        context->deferred.Resolve(context->results.Value());
+        delete context;
+        return promise;
+    }
+
+    if (onResult.IsEmpty()) {
+        onResult = Function::New(env, [](const CallbackInfo&) {});
+    }
+
+    // Released once every result is in, the pool goes away with the context
+    context->emitter = ThreadSafeFunction::New(
+        env, onResult,
+        "Medley Analyzer",
+        0, 1,
+        [context](Napi::Env) { delete context; }
+    );
+
+    context->analyzer = std::make_unique<medley::TrackAnalyzer>(Engine::getSharedFormatManager(), concurrency);
+
+    context->analyzer->analyze(files, maxTransitionTime, [context](int index, const File& file, const medley::TrackAnalysis& analysis, bool cached, const juce::String& error) {
+        auto result = new AnalysisResult{ index, file, analysis, cached, error };
+
+        context->emitter.BlockingCall(result, [context](Napi::Env env, Function fn, AnalysisResult* result) {
+            auto obj = createAnalysisObject(env, *result);
+            delete result;
+
+            context->results.Value().Set((uint32_t)obj.Get("index").ToNumber().Uint32Value(), obj);
+            fn.Call({ obj });
+
+            if (--context->numRemaining == 0) {
+                context->deferred.Resolve(context->results.Value());
+                context->emitter.Release();
+            }
+        });
+    });
+
+    return promise;
+}
+
 void Medley::workerFinalizer(const CallbackInfo&) {
 
 }
@@ -179,6 +383,21 @@ Medley::Medley(const CallbackInfo& info)
         return;
     }
 
+    auto deferInitialization = false;
+    auto halfPrecisionBuffers = false;
+
+    if (info.Length() > 1 && info[1].IsObject()) {
+        auto options = info[1].ToObject();
+
+        if (options.Has("deferInitialization")) {
+            deferInitialization = options.Get("deferInitialization").ToBoolean();
+        }
+
+        if (options.Has("halfPrecisionBuffers")) {
+            halfPrecisionBuffers = options.Get("halfPrecisionBuffers").ToBoolean();
+        }
+    }
+
     self = Persistent(info.This());
     queueJS = Persistent(obj);
 
@@ -186,7 +405,8 @@ Medley::Medley(const CallbackInfo& info)
         ensureWorker(info.Env());
 
         queue = Queue::Unwrap(obj);
-        engine = new Engine(*queue);
+        engine = new Engine(*queue, true, deferInitialization);
+        engine->setHalfPrecisionBuffers(halfPrecisionBuffers);
         engine->addListener(this);
 
         threadSafeEmitter = ThreadSafeFunction::New(
@@ -354,4 +574,252 @@ Napi::Value Medley::getMaxLeadingDuration(const CallbackInfo& info) {
 
 void Medley::setMaxLeadingDuration(const CallbackInfo& info, const Napi::Value& value) {
     engine->setMaxLeadingDuration(value.ToNumber().DoubleValue());
-}
\ No newline at end of file
+}
+
+void Medley::setThreadPolicy(const CallbackInfo& info) {
+    auto env = info.Env();
+
+    if (info.Length() < 2 || !info[1].IsObject()) {
+        TypeError::New(env, "Insufficient parameter").ThrowAsJavaScriptException();
+        return;
+    }
+
+    Engine::EngineThread thread;
+    if (!parseEngineThread(info[0].ToString().Utf8Value(), thread)) {
+        TypeError::New(env, "Unknown thread").ThrowAsJavaScriptException();
+        return;
+    }
+
+    auto desc = info[1].ToObject();
+    medley::ThreadPolicy policy;
+
+    if (desc.Has("scheduling")) {
+        auto scheduling = desc.Get("scheduling").ToString().Utf8Value();
+
+        if (scheduling == "fifo") {
+            policy.scheduling = medley::ThreadPolicy::Scheduling::Fifo;
+        }
+        else if (scheduling == "rr") {
+            policy.scheduling = medley::ThreadPolicy::Scheduling::RoundRobin;
+        }
+    }
+
+    if (desc.Has("priority")) {
+        policy.priority = desc.Get("priority").ToNumber().Int32Value();
+    }
+
+    if (desc.Has("cpus")) {
+        auto cpus = desc.Get("cpus").As<Napi::Array>();
+
+        for (uint32_t i = 0; i < cpus.Length(); i++) {
+            auto cpu = cpus.Get(i).ToNumber().Int32Value();
+
+            if (cpu >= 0 && cpu < 64) {
+                policy.affinityMask |= (1ULL << cpu);
+            }
+        }
+    }
+
+    if (desc.Has("isolatedCores")) {
+        policy.isolatedCores = desc.Get("isolatedCores").ToBoolean();
+    }
+
+    engine->setThreadPolicy(thread, policy);
+}
+
+Napi::Value Medley::getThreadStatus(const CallbackInfo& info) {
+    auto env = info.Env();
+
+    Engine::EngineThread thread;
+    if (info.Length() < 1 || !parseEngineThread(info[0].ToString().Utf8Value(), thread)) {
+        TypeError::New(env, "Unknown thread").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    auto status = engine->getThreadStatus(thread);
+
+    auto cpus = Napi::Array::New(env);
+    for (int i = 0, n = 0; i < 64; i++) {
+        if (status.affinityMask & (1ULL << i)) {
+            cpus.Set(n++, Number::New(env, i));
+        }
+    }
+
+    auto result = Object::New(env);
+    result.Set("applied", status.applied);
+    result.Set("scheduling", schedulingName(status.scheduling));
+    result.Set("priority", status.priority);
+    result.Set("cpus", cpus);
+    result.Set("rtPriorityLimit", medley::ThreadPolicy::getRealtimePriorityLimit());
+
+    if (status.error.isNotEmpty()) {
+        result.Set("error", status.error.toStdString());
+    }
+
+    return result;
+}
+
+Napi::Value Medley::getMemoryUsage(const CallbackInfo& info) {
+    auto env = info.Env();
+    auto& budget = medley::MemoryBudget::getGlobal();
+
+    auto decks = Napi::Array::New(env);
+    decks.Set(0u, createAccountUsage(env, engine->getDeck1().getMemoryAccount()));
+    decks.Set(1u, createAccountUsage(env, engine->getDeck2().getMemoryAccount()));
+
+    auto global = createMemoryUsage(env, budget.getUsage());
+    global.Set("limit", Number::New(env, (double)budget.getLimit()));
+    global.Set("overcommits", Number::New(env, (double)budget.getNumOvercommits()));
+
+    auto result = createAccountUsage(env, engine->getMemoryAccount());
+    result.Set("decks", decks);
+    result.Set("global", global);
+
+    return result;
+}
+
+Napi::Value Medley::getDeckCues(const CallbackInfo& info) {
+    auto env = info.Env();
+
+    if (info.Length() < 1) {
+        TypeError::New(env, "Deck index expected").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    auto& deck = info[0].ToNumber().Int32Value() == 0 ? engine->getDeck1() : engine->getDeck2();
+
+    if (!deck.isTrackLoaded()) {
+        return env.Null();
+    }
+
+    auto result = Object::New(env);
+    result.Set("firstAudiblePosition", Number::New(env, deck.getFirstAudiblePosition()));
+    result.Set("leadingDuration", Number::New(env, deck.getLeadingDuration()));
+    result.Set("introEndPosition", Number::New(env, deck.getIntroEndPosition()));
+    result.Set("transitionCuePosition", Number::New(env, deck.getTransitionCuePosition()));
+    result.Set("transitionStartPosition", Number::New(env, deck.getTransitionStartPosition()));
+    result.Set("transitionEndPosition", Number::New(env, deck.getTransitionEndPosition()));
+    result.Set("endPosition", Number::New(env, deck.getEndPosition()));
+
+    return result;
+}
+
+void Medley::startSegmentedOutput(const CallbackInfo& info) {
+    auto env = info.Env();
+
+    if (info.Length() < 1 || !info[0].IsObject()) {
+        TypeError::New(env, "Insufficient parameter").ThrowAsJavaScriptException();
+        return;
+    }
+
+    auto desc = info[0].ToObject();
+
+    if (!desc.Has("directory")) {
+        TypeError::New(env, "Directory expected").ThrowAsJavaScriptException();
+        return;
+    }
+
+    medley::SegmentedOutputWriter::Options options;
+    options.directory = File(juce::String::fromUTF8(desc.Get("directory").ToString().Utf8Value().c_str()));
+
+    if (desc.Has("baseName")) {
+        options.baseName = juce::String::fromUTF8(desc.Get("baseName").ToString().Utf8Value().c_str());
+    }
+
+    if (desc.Has("playlistName")) {
+        options.playlistName = juce::String::fromUTF8(desc.Get("playlistName").ToString().Utf8Value().c_str());
+    }
+
+    if (desc.Has("format")) {
+        options.format = juce::String::fromUTF8(desc.Get("format").ToString().Utf8Value().c_str());
+    }
+
+    if (desc.Has("encoder")) {
+        options.encoder = File(juce::String::fromUTF8(desc.Get("encoder").ToString().Utf8Value().c_str()));
+    }
+
+    if (desc.Has("bitsPerSample")) {
+        options.bitsPerSample = desc.Get("bitsPerSample").ToNumber().Int32Value();
+    }
+
+    if (desc.Has("quality")) {
+        options.quality = desc.Get("quality").ToNumber().Int32Value();
+    }
+
+    if (desc.Has("segmentDuration")) {
+        options.segmentDuration = desc.Get("segmentDuration").ToNumber().DoubleValue();
+    }
+
+    if (desc.Has("playlistLength")) {
+        options.playlistLength = desc.Get("playlistLength").ToNumber().Int32Value();
+    }
+
+    if (desc.Has("keptSegments")) {
+        options.numKeptSegments = desc.Get("keptSegments").ToNumber().Int32Value();
+    }
+
+    try {
+        engine->startSegmentedOutput(options);
+    }
+    catch (std::exception& e) {
+        throw Napi::Error::New(env, e.what());
+    }
+}
+
+void Medley::stopSegmentedOutput(const CallbackInfo& info) {
+    engine->stopSegmentedOutput();
+}
+
+Napi::Value Medley::fitToPost(const CallbackInfo& info) {
+    auto env = info.Env();
+
+    if (info.Length() < 2) {
+        TypeError::New(env, "Insufficient parameter").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    auto speed = engine->fitToPost(info[0].ToNumber().DoubleValue(), info[1].ToNumber().DoubleValue());
+    return Number::New(env, speed);
+}
+
+void Medley::clearPost(const CallbackInfo& info) {
+    engine->clearPost();
+}
+
+void Medley::startRecording(const CallbackInfo& info) {
+    auto env = info.Env();
+
+    if (info.Length() < 1) {
+        TypeError::New(env, "Insufficient parameter").ThrowAsJavaScriptException();
+        return;
+    }
+
+    auto file = File(juce::String::fromUTF8(info[0].ToString().Utf8Value().c_str()));
+
+    try {
+        engine->startRecording(file);
+    }
+    catch (std::exception& e) {
+        throw Napi::Error::New(env, e.what());
+    }
+}
+
+void Medley::stopRecording(const CallbackInfo& info) {
+    engine->stopRecording();
+}
+
+Napi::Value Medley::getStartupTimes(const CallbackInfo& info) {
+    auto env = info.Env();
+    auto& times = engine->getStartupTimes();
+
+    auto result = Object::New(env);
+    result.Set("formats", Number::New(env, times.formats));
+    result.Set("decks", Number::New(env, times.decks));
+    result.Set("threads", Number::New(env, times.threads));
+    result.Set("device", Number::New(env, times.device));
+    result.Set("construction", Number::New(env, times.construction));
+    result.Set("constructionMemory", Number::New(env, (double)times.constructionMemory));
+    result.Set("startedMemory", Number::New(env, (double)times.startedMemory));
+
+    return result;
+}
@@ -2,6 +2,7 @@
 
 #include <napi.h>
 #include <Medley.h>
+#include <TrackAnalyzer.h>
 #include "track.h"
 #include "queue.h"
 
@@ -16,6 +17,10 @@ public:
 
     static void shutdown(const CallbackInfo& info);
 
+    static void setMemoryLimit(const CallbackInfo& info);
+
+    static Napi::Value analyze(const CallbackInfo& info);
+
     static void workerFinalizer(const CallbackInfo&);
 
     Medley(const CallbackInfo& info);
@@ -83,6 +88,28 @@ public:
     Napi::Value getAvailableDevices(const CallbackInfo& info);
 
     Napi::Value setAudioDevice(const CallbackInfo& info);
+
+    void setThreadPolicy(const CallbackInfo& info);
+
+    Napi::Value getThreadStatus(const CallbackInfo& info);
+
+    Napi::Value getMemoryUsage(const CallbackInfo& info);
+
+    Napi::Value getStartupTimes(const CallbackInfo& info);
+
+    Napi::Value getDeckCues(const CallbackInfo& info);
+
+    void startSegmentedOutput(const CallbackInfo& info);
+
+    void stopSegmentedOutput(const CallbackInfo& info);
+
+    Napi::Value fitToPost(const CallbackInfo& info);
+
+    void clearPost(const CallbackInfo& info);
+
+    void startRecording(const CallbackInfo& info);
+
+    void stopRecording(const CallbackInfo& info);
 private:
     void emitDeckEvent(const std::string& name,  medley::Deck& deck);
 
@@ -18,6 +18,11 @@ export interface TrackInfo {
    * @default 1.0
    */
   preGain: number;
+
+  /**
+   * Beats per minute, lets transitions nudge this track to the tempo of the previous one.
+   */
+  tempo?: number;
 }
 
 export type TrackDescriptor = string | TrackInfo;
@@ -92,8 +97,27 @@ export interface AudioLevels {
 type NormalEvent = 'audioDeviceChanged' | 'preCueNext';
 type DeckEvent = 'loaded' | 'unloaded' | 'started' | 'finished';
 
+export type MedleyOptions = {
+  /**
+   * Open the audio device and start the engine threads on first `play()` instead of in the constructor.
+   *
+   * @default false
+   */
+  deferInitialization?: boolean;
+
+  /**
+   * Hold the read-ahead of each deck as half-precision floats, halving its memory.
+   *
+   * @remarks
+   * Enough for playing lossy and 16-bit sources, the conversion runs on F16C or NEON where available.
+   *
+   * @default false
+   */
+  halfPrecisionBuffers?: boolean;
+}
+
 export declare class Medley extends EventEmitter {
-  constructor(queue: Queue);
+  constructor(queue: Queue, options?: MedleyOptions);
 
   on(event: DeckEvent, listener: (deckIndex: number) => void): this;
   once(event: DeckEvent, listener: (deckIndex: number) => void): this;
@@ -189,6 +213,296 @@ export declare class Medley extends EventEmitter {
   getAvailableDevices(): AudioDeviceTypeInfo[];
 
   setAudioDevice(descriptor: { type?: string, device: string }): boolean;
+
+  /**
+   * Request a scheduling class, priority and CPU placement for one of the engine threads.
+   *
+   * @remarks
+   * The policy is applied asynchronously by the thread itself, use `getThreadStatus()` to see the outcome.
+   * Real-time scheduling on Linux requires a sufficient `RLIMIT_RTPRIO` or `CAP_SYS_NICE`.
+   */
+  setThreadPolicy(thread: EngineThread, policy: ThreadPolicy): void;
+
+  getThreadStatus(thread: EngineThread): ThreadStatus;
+
+  /**
+   * Memory held by this engine, its decks, and all engines in the process, in bytes.
+   */
+  getMemoryUsage(): EngineMemoryUsage;
+
+  /**
+   * Milliseconds spent initializing each part of the engine, and the process memory, deferred parts are `0` until they happen.
+   */
+  getStartupTimes(): StartupTimes;
+
+  /**
+   * Cue points of the track loaded in a deck, in seconds, `null` when the deck is empty.
+   */
+  getDeckCues(deckIndex: number): DeckCues | null;
+
+  /**
+   * Start cutting the output into encoded segments listed in a rolling playlist, for on-demand catch-up.
+   *
+   * @remarks
+   * MP3 segments are encoded by LAME and listed in an HLS playlist, other formats in a plain M3U playlist.
+   * MP3 segments are cut from the MP3 frame grid so they play back without gaps, their duration is rounded to whole
+   * frames and the sample rate must be one MP3 supports.
+   * Encoding and file writes happen on a background thread, segment and playlist files are replaced atomically.
+   * Starting again replaces the running writer, restart it after changing the audio device.
+   */
+  startSegmentedOutput(options: SegmentedOutputOptions): void;
+
+  /**
+   * Finish the current segment and end the playlist
+   */
+  stopSegmentedOutput(): void;
+
+  /**
+   * Back-time to a hard post by playing slightly faster or slower, by 3% at most, instead of cutting content.
+   *
+   * @param secondsUntilPost Time left until the post
+   * @param upcomingDuration Total duration of the items to be played in full before the post, up to where each following one starts.
+   * The rest of the current track is added by the engine
+   *
+   * @returns The speed applied, call again as items start to refine it
+   */
+  fitToPost(secondsUntilPost: number, upcomingDuration: number): number;
+
+  /**
+   * Go back to normal speed, this also happens once the post is reached
+   */
+  clearPost(): void;
+
+  /**
+   * Record a session log to an absolute file path, replacing any recording in progress.
+   *
+   * @remarks
+   * Control calls, the tracks taken from the queue, the audio callback block size and deck events are logged
+   * against the engine sample clock, so the session can be replayed offline with `medley-cli --replay <file>`.
+   * Start before `play()` for a complete replay. Opens a deferred audio device, throws if the engine has no device and
+   * has not been prepared to render.
+   */
+  startRecording(file: string): void;
+
+  /**
+   * Write out what is pending and close the session log
+   */
+  stopRecording(): void;
+
+  /**
+   * Set the process-wide memory budget in bytes, `0` means unlimited.
+   *
+   * @remarks
+   * Read-ahead buffers of tracks loaded afterwards shrink to fit, down to a minimum of half a second.
+   */
+  static setMemoryLimit(bytes: number): void;
+
+  /**
+   * Analyze tracks in the background, without loading them into a deck.
+   *
+   * @remarks
+   * Results are kept in a process-wide cache which decks also use, loading an analyzed track skips its scan.
+   * The returned promise resolves with one result per track, in the same order, failures included.
+   */
+  static analyze(tracks: TrackDescriptor[], options?: AnalyzeOptions): Promise<TrackAnalysisResult[]>;
+}
+
+export type AnalyzeOptions = {
+  /**
+   * Number of tracks analyzed at once, defaults to the number of CPUs
+   */
+  concurrency?: number;
+  /**
+   * Should match `maxTransitionTime` of the engine which plays the tracks for cached results to be used, defaults to `3`
+   */
+  maxTransitionTime?: number;
+  /**
+   * Called as soon as each track is done, in completion order
+   */
+  onResult?: (result: TrackAnalysisResult) => void;
+}
+
+/**
+ * Positions are in seconds, `-1` when not found
+ */
+export type TrackAnalysisResult = {
+  index: number;
+  path: string;
+  /**
+   * Whether the result came from the cache
+   */
+  cached: boolean;
+  /**
+   * Set when the track could not be analyzed, other fields are then missing
+   */
+  error?: string;
+  duration: number;
+  firstAudiblePosition: number;
+  lastAudiblePosition: number;
+  endPosition: number;
+  leadingPosition: number;
+  leadingDuration: number;
+  /**
+   * Peak level of the leading section in decibels
+   */
+  leadingLevel: number;
+  /**
+   * Where vocals most likely start, the end of the intro
+   */
+  introEndPosition: number;
+  trailingPosition: number;
+  trailingDuration: number;
+  transitionPreCuePosition: number;
+  transitionCuePosition: number;
+  transitionStartPosition: number;
+  transitionEndPosition: number;
+}
+
+export type SegmentedOutputOptions = {
+  directory: string;
+  /**
+   * @default "segment"
+   */
+  baseName?: string;
+  /**
+   * @default "playlist.m3u8"
+   */
+  playlistName?: string;
+  /**
+   * `mp3` for HLS, or the file extension of another format that can be written, such as `flac`, `wav` or `ogg`
+   * @default "mp3"
+   */
+  format?: string;
+  /**
+   * Path to the LAME executable, required for `mp3`
+   */
+  encoder?: string;
+  /**
+   * @default 16
+   */
+  bitsPerSample?: number;
+  /**
+   * Index into the quality options of lossy formats
+   * @default 0
+   */
+  quality?: number;
+  /**
+   * In seconds, rounded to whole frames for `mp3`
+   * @default 6
+   */
+  segmentDuration?: number;
+  /**
+   * Number of segments listed in the playlist
+   * @default 6
+   */
+  playlistLength?: number;
+  /**
+   * Number of segments kept on disk after being dropped from the playlist
+   * @default 2
+   */
+  keptSegments?: number;
+}
+
+export type DeckCues = {
+  firstAudiblePosition: number;
+  leadingDuration: number;
+  /**
+   * Where vocals most likely start, for presenters talking over the intro, `-1` when not found
+   */
+  introEndPosition: number;
+  transitionCuePosition: number;
+  transitionStartPosition: number;
+  transitionEndPosition: number;
+  endPosition: number;
+}
+
+export type StartupTimes = {
+  /**
+   * Format registration, only paid by the first engine in the process
+   */
+  formats: number;
+  decks: number;
+  threads: number;
+  device: number;
+  /**
+   * Time spent in the constructor
+   */
+  construction: number;
+  /**
+   * Resident memory of the process in bytes right after construction
+   */
+  constructionMemory: number;
+  /**
+   * Resident memory of the process in bytes once the device is open and the threads are running, `0` until then
+   */
+  startedMemory: number;
+}
+
+export type MemoryUsage = {
+  current: number;
+  peak: number;
+}
+
+export type MemoryComponentUsage = {
+  readAhead: number;
+  decoder: number;
+  analysis: number;
+}
+
+export type AccountMemoryUsage = MemoryUsage & {
+  components: MemoryComponentUsage;
+}
+
+export type EngineMemoryUsage = AccountMemoryUsage & {
+  decks: AccountMemoryUsage[];
+  global: MemoryUsage & {
+    limit: number;
+    /**
+     * Number of times a buffer was given its minimum size although the budget was exhausted
+     */
+    overcommits: number;
+  };
+}
+
+export type EngineThread = 'audio' | 'readAhead' | 'loading' | 'visualizing';
+
+export type ThreadScheduling = 'default' | 'fifo' | 'rr';
+
+export type ThreadPolicy = {
+  /**
+   * @default 'default'
+   */
+  scheduling?: ThreadScheduling;
+
+  /**
+   * 1 - 99, only used with `fifo` and `rr`
+   */
+  priority?: number;
+
+  /**
+   * CPU indexes the thread is allowed to run on
+   */
+  cpus?: number[];
+
+  /**
+   * Restrict to CPUs isolated with the `isolcpus=` kernel parameter
+   */
+  isolatedCores?: boolean;
+}
+
+export type ThreadStatus = {
+  applied: boolean;
+  scheduling: ThreadScheduling;
+  priority: number;
+  /**
+   * CPUs the thread may run on, empty when it cannot be determined
+   */
+  cpus: number[];
+  /**
+   * `-1` when unlimited
+   */
+  rtPriorityLimit: number;
+  error?: string;
 }
 
 export type AudioDeviceTypeInfo = {
@@ -4,17 +4,22 @@ namespace {
 static Track createTrackFromJS(const Napi::Value p) {
     juce::String path;
     float preGain = 1.0f;
+    double tempo = 0.0;
 
     if (p.IsObject()) {
         auto obj = p.ToObject();
 
         path = obj.Get("path").ToString().Utf8Value();
         preGain = obj.Get("preGain").ToNumber();
+
+        if (obj.Has("tempo")) {
+            tempo = obj.Get("tempo").ToNumber().DoubleValue();
+        }
     } else {
         path = p.ToString().Utf8Value();
     }
 
-    return Track(juce::String(path), preGain);
+    return Track(juce::String(path), preGain, tempo);
 }
 }
 
@@ -175,8 +180,9 @@ void Queue::set(const CallbackInfo& info) {
             if (p.IsString()) {
                 auto obj = Arr::getUnchecked(index);
                 auto preGain = obj.getPreGain();
+                auto tempo = obj.getTempo();
 
-                Arr::setUnchecked(index, Track(File(p.ToString().Utf8Value()), preGain));
+                Arr::setUnchecked(index, Track(File(p.ToString().Utf8Value()), preGain, tempo));
             } else {
                 Arr::setUnchecked(index, createTrackFromJS(p));
             }
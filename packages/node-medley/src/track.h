@@ -10,26 +10,26 @@ public:
 
     }
 
-    Track(const File& file, float preGain = 1.0f)
-        : file(file), preGain(preGain)
+    Track(const File& file, float preGain = 1.0f, double tempo = 0.0)
+        : file(file), preGain(preGain), tempo(tempo)
     {
 
     }
 
-    Track(const juce::String& path, float preGain = 1.0f)
-        : Track(File(path), preGain)
+    Track(const juce::String& path, float preGain = 1.0f, double tempo = 0.0)
+        : Track(File(path), preGain, tempo)
     {
 
     }
 
     Track(const Track& other)
-        : file(other.file), preGain(other.preGain)
+        : file(other.file), preGain(other.preGain), tempo(other.tempo)
     {
 
     }
 
     Track(Track&& other)
-        : file(std::move(other.file)), preGain(other.preGain)
+        : file(std::move(other.file)), preGain(other.preGain), tempo(other.tempo)
     {
 
     }
@@ -37,6 +37,7 @@ public:
     Track operator=(const Track& other) {
         file = other.file;
         preGain = other.preGain;
+        tempo = other.tempo;
         return *this;
     }
 
@@ -54,14 +55,22 @@ public:
 
     float getPreGain() const { return preGain; }
 
+    double getTempo() const { return tempo; }
+
     Napi::Object toObject(Napi::Env env) {
         auto obj = Napi::Object::New(env);
         obj.Set("path", Napi::String::New(env, file.getFullPathName().toStdString()));
         obj.Set("preGain", Napi::Number::New(env, preGain));
+
+        if (tempo > 0.0) {
+            obj.Set("tempo", Napi::Number::New(env, tempo));
+        }
+
         return obj;
     }
 
 private:
     File file;
     float preGain = 1.0f;
+    double tempo = 0.0;
 };
@@ -0,0 +1,68 @@
+// Builds the addon in each build profile and compares startup time, memory and binary size,
+// `npm run bench:profiles -- [--runs N] [--defer]`. Leaves the default profile built.
+
+import { execFileSync } from 'child_process';
+import { statSync } from 'fs';
+import { join } from 'path';
+
+const profiles: [string, string[]][] = [
+  ['full', ['-Dmedley_headless=0']],
+  ['headless, plugins', ['-Dmedley_plugins=1']],
+  ['headless', []]
+];
+
+const runsIndex = process.argv.indexOf('--runs');
+const runs = runsIndex >= 0 ? +process.argv[runsIndex + 1] : 5;
+const defer = process.argv.includes('--defer');
+
+const root = join(__dirname, '..');
+const addon = join(root, 'build', 'Release', 'medley.node');
+const nodeGyp = process.platform === 'win32' ? 'node-gyp.cmd' : 'node-gyp';
+
+const median = (values: number[]) => {
+  const sorted = [...values].sort((a, b) => a - b);
+  return sorted[Math.floor(sorted.length / 2)];
+};
+
+const build = (flags: string[]) => {
+  execFileSync(nodeGyp, ['rebuild', '--', ...flags], { cwd: root, stdio: 'inherit', shell: process.platform === 'win32' });
+};
+
+const results: Record<string, number | string>[] = [];
+
+for (const [name, flags] of profiles) {
+  build(flags);
+
+  // Every run in a fresh process, the first require() is what is being measured
+  const samples: Record<string, number>[] = [];
+
+  for (let i = 0; i < runs; i++) {
+    const args = [require.resolve('ts-node/dist/bin'), join(__dirname, 'startup.ts'), '--json'];
+
+    if (defer) {
+      args.push('--defer');
+    }
+
+    const output = execFileSync(process.execPath, args, { cwd: root }).toString().trim().split('\n');
+    samples.push(JSON.parse(output[output.length - 1]));
+  }
+
+  const pick = (key: string) => median(samples.map(s => s[key]));
+  const mb = (bytes: number) => (bytes / 1024 / 1024).toFixed(2);
+
+  results.push({
+    profile: name,
+    'binary MB': mb(statSync(addon).size),
+    'require ms': pick('require').toFixed(2),
+    'new Medley ms': pick('construct').toFixed(2),
+    'RSS +MB': mb(pick('rssRequire') + pick('rssConstruct')),
+    'total RSS MB': mb(pick('rss'))
+  });
+}
+
+if (profiles[profiles.length - 1][1].length) {
+  build([]);
+}
+
+console.log(`\nmedians of ${runs} runs${defer ? ', deferred initialization' : ''}`);
+console.table(results);
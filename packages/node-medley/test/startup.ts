@@ -0,0 +1,58 @@
+// Measures the cost of loading the native addon and constructing an engine,
+// `npm run bench:profiles` runs it against every build profile,
+// pass --defer to postpone opening the device and starting threads until play()
+
+const rssBefore = process.memoryUsage().rss;
+const requireStart = process.hrtime.bigint();
+
+// `import` would be hoisted above the timer
+const { Medley, Queue } = require('../src');
+
+const requireTime = Number(process.hrtime.bigint() - requireStart) / 1e6;
+const rssAfterRequire = process.memoryUsage().rss;
+
+const deferInitialization = process.argv.includes('--defer');
+
+const constructStart = process.hrtime.bigint();
+const m = new Medley(new Queue(), { deferInitialization });
+const constructTime = Number(process.hrtime.bigint() - constructStart) / 1e6;
+const rssAfterConstruct = process.memoryUsage().rss;
+
+// A second engine shows the cost without the one-time format registration
+const secondStart = process.hrtime.bigint();
+const second = new Medley(new Queue(), { deferInitialization });
+const secondTime = Number(process.hrtime.bigint() - secondStart) / 1e6;
+
+const times = m.getStartupTimes();
+
+// Machine-readable, for test/compare-profiles.ts
+if (process.argv.includes('--json')) {
+  console.log(JSON.stringify({
+    require: requireTime,
+    construct: constructTime,
+    second: secondTime,
+    rssRequire: rssAfterRequire - rssBefore,
+    rssConstruct: rssAfterConstruct - rssAfterRequire,
+    rss: rssAfterConstruct,
+    ...times
+  }));
+
+  second.stop();
+  m.stop();
+  Medley.shutdown();
+  process.exit(0);
+}
+
+const mb = (bytes: number) => (bytes / 1024 / 1024).toFixed(2);
+
+console.log(`require():      ${requireTime.toFixed(2)}ms, RSS +${mb(rssAfterRequire - rssBefore)}MB`);
+console.log(`new Medley():   ${constructTime.toFixed(2)}ms, RSS +${mb(rssAfterConstruct - rssAfterRequire)}MB`);
+console.log(`second Medley:  ${secondTime.toFixed(2)}ms`);
+console.log(`total RSS:      ${mb(rssAfterConstruct)}MB`);
+
+console.log(`breakdown:      formats=${times.formats.toFixed(2)}ms decks=${times.decks.toFixed(2)}ms threads=${times.threads.toFixed(2)}ms device=${times.device.toFixed(2)}ms`);
+console.log(`engine RSS:     constructed=${mb(times.constructionMemory)}MB started=${mb(times.startedMemory)}MB`);
+
+second.stop();
+m.stop();
+Medley.shutdown();